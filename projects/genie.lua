@@ -19,6 +19,7 @@ end
 local ROOT_DIR = path.getabsolute("../")
 local BINARY_DIR = LOCATION .. "/bin/"
 build_app = false
+local build_unit_tests = false
 local use_basisu = false
 build_studio = true
 local working_dir = nil
@@ -127,6 +128,11 @@ newoption {
 	description = "Do build app."
 }
 
+newoption {
+	trigger = "with-unit-tests",
+	description = "Build unit tests."
+}
+
 newoption {
 	trigger = "with-basis-universal",
 	description = "Use basis universal compression."
@@ -221,6 +227,10 @@ if _OPTIONS["with-app"] then
 	build_app = true
 end
 
+if _OPTIONS["with-unit-tests"] then
+	build_unit_tests = true
+end
+
 if _OPTIONS["with-basis-universal"] then
 	use_basisu = true
 end
@@ -739,6 +749,27 @@ function dbgHelp()
 	configuration {}
 end
 
+if build_unit_tests then
+	project "unit_tests"
+		kind "ConsoleApp"
+
+		includedirs { "../src" }
+		files { "../src/unit_tests/**.h", "../src/unit_tests/**.cpp", "../src/renderer/occlusion_buffer.cpp" }
+		links { "engine" }
+		linkLib "luajit"
+
+		configuration { "vs*" }
+			links { "psapi", "winmm" }
+
+		configuration { "linux" }
+			links { "X11", "Xi", "dl", "rt", "gtk-3", "gobject-2.0" }
+
+		configuration {}
+
+		useLua()
+		defaultConfigurations()
+end
+
 if build_app then
 	project "app"
 		if working_dir then
@@ -2,6 +2,7 @@
 #include "engine/log.h"
 #include "engine/math.h"
 #include "engine/profiler.h"
+#include "engine/simd.h"
 #include "engine/stream.h"
 #include "engine/math.h"
 #include "renderer/model.h"
@@ -12,243 +13,296 @@ namespace Lumix
 {
 
 
-enum class Version
-{
-	FIRST = 0,
-
-	LAST
-};
-
-
 const ResourceType Animation::TYPE("animation");
 
 
 Animation::Animation(const Path& path, ResourceManager& resource_manager, IAllocator& allocator)
 	: Resource(path, resource_manager, allocator)
 	, m_mem(allocator)
-	, m_translations(allocator)
-	, m_rotations(allocator)
 {
 }
 
 
 struct AnimationSampler {
-	template <bool use_mask, bool use_weight>
-	static void getRelativePose(const Animation& anim, Time time, Pose& pose, const Model& model, float weight, const BoneMask* mask) {
-		ASSERT(!pose.is_absolute);
-		ASSERT(model.isReady());
-
-		Vec3* pos = pose.positions;
-		Quat* rot = pose.rotations;
-
+	// two neighbouring frames in a segment
+	struct Frames {
+		const Animation::TranslationRange* ranges;
+		const u16* translations[2];
+		const u16* rotations[2];
+		float t;
+	};
+
+	static u32 padded(u32 count) { return (count + 3) & ~3; }
+
+	static Frames getFrames(const Animation& anim, Time time) {
+		u32 frame_idx;
+		float frame_t;
 		if (time < anim.getLength()) {
 			const u64 anim_t_highres = ((u64)time.raw() << 16) / (anim.m_length.raw());
 			ASSERT(anim_t_highres <= 0xffFF);
-			const u16 anim_t = u16(anim_t_highres);
 			const u64 frame_48_16 = (anim.m_frame_count - 1) * anim_t_highres;
 			ASSERT((frame_48_16 & 0xffFF00000000) == 0);
-			const u32 frame_idx = u32(frame_48_16 >> 16);
-			const float frame_t = (frame_48_16 & 0xffFF) / float(0xffFF);
-		
-			for (const Animation::TranslationCurve& curve : anim.m_translations) {
-				Model::BoneMap::const_iterator iter = model.getBoneIndex(curve.name);
-				if (!iter.isValid()) continue;
-				if constexpr(use_mask) {
-					if (mask->bones.find(curve.name) == mask->bones.end()) continue;
-				}
-
-				Vec3 anim_pos;
-				if (curve.times) {
-					u32 idx = 1;
-					for (u32 c = curve.count; idx < c; ++idx) {
-						if (curve.times[idx] > anim_t) break;
-					}
-					const float t = float(anim_t - curve.times[idx - 1]) / (curve.times[idx] - curve.times[idx - 1]);
-					anim_pos = lerp(curve.pos[idx - 1], curve.pos[idx], t);
-				}
-				else {
-					anim_pos = lerp(curve.pos[frame_idx], curve.pos[frame_idx + 1], frame_t);
-				}
-
-				const int model_bone_index = iter.value();
-				if constexpr (use_weight) {
-					pos[model_bone_index] = lerp(pos[model_bone_index], anim_pos, weight);
-				}
-				else {
-					pos[model_bone_index] = anim_pos;
-				}
-			}
-
-			for (const Animation::RotationCurve& curve : anim.m_rotations) {
-				Model::BoneMap::const_iterator iter = model.getBoneIndex(curve.name);
-				if (!iter.isValid()) continue;
-				if constexpr(use_mask) {
-					if (mask->bones.find(curve.name) == mask->bones.end()) continue;
-				}
-
-				Quat anim_rot;
-				if(curve.times) {
-					u32 idx = 1;
-					for (u32 c = curve.count; idx < c; ++idx) {
-						if (curve.times[idx] > anim_t) break;
-					}
-					const float t = float(anim_t - curve.times[idx - 1]) / (curve.times[idx] - curve.times[idx - 1]);
-					anim_rot = nlerp(curve.rot[idx - 1], curve.rot[idx], t);
-				}
-				else {
-					anim_rot = nlerp(curve.rot[frame_idx], curve.rot[frame_idx + 1], frame_t);
-				}
-
-				const int model_bone_index = iter.value();
-				if constexpr (use_weight) {
-					rot[model_bone_index] = nlerp(rot[model_bone_index], anim_rot, weight);
-				}
-				else {
-					rot[model_bone_index] = anim_rot;
-				}
-			}
+			frame_idx = u32(frame_48_16 >> 16);
+			frame_t = (frame_48_16 & 0xffFF) / float(0xffFF);
 		}
 		else {
-			for (const Animation::TranslationCurve& curve : anim.m_translations) {
-				Model::BoneMap::const_iterator iter = model.getBoneIndex(curve.name);
-				if (!iter.isValid()) continue;
-				if constexpr(use_mask) {
-					if (mask->bones.find(curve.name) == mask->bones.end()) continue;
-				}
-
-				const int model_bone_index = iter.value();
-				if constexpr (use_weight) {
-					pos[model_bone_index] = lerp(pos[model_bone_index], curve.pos[curve.count - 1], weight);
-				}
-				else {
-					pos[model_bone_index] = curve.pos[curve.count - 1];
-				}
-			}
+			frame_idx = anim.m_frame_count - 2;
+			frame_t = 1;
+		}
+
+		const u32 segment_idx = minimum(frame_idx / Animation::SEGMENT_FRAMES, anim.m_segments_count - 1);
+		const u32 first_frame = segment_idx * Animation::SEGMENT_FRAMES;
+		const u32 segment_frames = minimum(Animation::SEGMENT_FRAMES, anim.m_frame_count - 1 - first_frame) + 1;
+		const u32 translation_stride = padded(anim.m_translations_count - anim.m_const_translations_count) * 3;
+		const u32 rotation_stride = padded(anim.m_rotations_count - anim.m_const_rotations_count) * 3;
+		const u32 local_frame = frame_idx - first_frame;
+		ASSERT(local_frame + 1 < segment_frames);
+
+		Frames res;
+		res.ranges = (const Animation::TranslationRange*)(anim.m_segments + segment_idx * anim.m_segment_size);
+		const u16* translations = (const u16*)(res.ranges + translation_stride / 12);
+		const u16* rotations = translations + segment_frames * translation_stride;
+		res.translations[0] = translations + local_frame * translation_stride;
+		res.translations[1] = res.translations[0] + translation_stride;
+		res.rotations[0] = rotations + local_frame * rotation_stride;
+		res.rotations[1] = res.rotations[0] + rotation_stride;
+		res.t = frame_t;
+		return res;
+	}
 
-			for (const Animation::RotationCurve& curve : anim.m_rotations) {
-				Model::BoneMap::const_iterator iter = model.getBoneIndex(curve.name);
-				if (!iter.isValid()) continue;
-				if constexpr(use_mask) {
-					if (mask->bones.find(curve.name) == mask->bones.end()) continue;
-				}
-
-				const int model_bone_index = iter.value();
-				if constexpr (use_weight) {
-					rot[model_bone_index] = nlerp(rot[model_bone_index], curve.rot[curve.count - 1], weight);
-				}
-				else {
-					rot[model_bone_index] = curve.rot[curve.count - 1];
-				}
+	// translations of tracks [group * 4, group * 4 + 3], [xyz][track]
+	static LUMIX_FORCE_INLINE void decodeTranslations(const Frames& frames, u32 group, float (&out)[3][4]) {
+		alignas(16) float q[2][3][4];
+		for (u32 f = 0; f < 2; ++f) {
+			const u16* packed = frames.translations[f] + group * 12;
+			for (u32 i = 0; i < 12; ++i) {
+				q[f][i >> 2][i & 3] = packed[i];
 			}
 		}
+
+		const Animation::TranslationRange& range = frames.ranges[group];
+		const float4 t = f4Splat(frames.t);
+		for (u32 i = 0; i < 3; ++i) {
+			const float4 q0 = f4Load(q[0][i]);
+			const float4 q1 = f4Load(q[1][i]);
+			const float4 v = q0 + (q1 - q0) * t;
+			f4Store(out[i], f4LoadUnaligned(range.min[i]) + v * f4LoadUnaligned(range.scale[i]));
+		}
 	}
-}; // AnimationSampler
 
-void Animation::getRelativePose(Time time, Pose& pose, const Model& model, float weight, const BoneMask* mask) const {
-	if (mask) {
-		if (weight < 0.9999f) {
-			AnimationSampler::getRelativePose<true, true>(*this, time, pose, model, weight, mask);
+	static LUMIX_FORCE_INLINE void unpackRotations(const u16* packed, float (&out)[4][4]) {
+		alignas(16) float c[4][4];
+		u32 dropped[4];
+		for (u32 track = 0; track < 4; ++track) {
+			c[0][track] = float(packed[track] >> 1);
+			c[1][track] = float(packed[4 + track] >> 1);
+			c[2][track] = float(packed[8 + track] >> 1);
+			c[3][track] = 1.f - 2.f * (packed[8 + track] & 1);
+			dropped[track] = (packed[track] & 1) | ((packed[4 + track] & 1) << 1);
+		}
+
+		const float4 scale = f4Splat(2 * Animation::ROTATION_RANGE / Animation::ROTATION_STEPS);
+		const float4 offset = f4Splat(-Animation::ROTATION_RANGE);
+		const float4 a = f4Load(c[0]) * scale + offset;
+		const float4 b = f4Load(c[1]) * scale + offset;
+		const float4 d = f4Load(c[2]) * scale + offset;
+		const float4 w2 = f4Max(f4Splat(0), f4Splat(1) - a * a - b * b - d * d);
+		f4Store(c[0], a);
+		f4Store(c[1], b);
+		f4Store(c[2], d);
+		f4Store(c[3], f4Sqrt(w2) * f4Load(c[3]));
+
+		// the dropped component is inserted at its index, the stored ones keep their order
+		for (u32 track = 0; track < 4; ++track) {
+			const u32 i = dropped[track];
+			out[0][track] = i == 0 ? c[3][track] : c[0][track];
+			out[1][track] = i == 0 ? c[0][track] : i == 1 ? c[3][track] : c[1][track];
+			out[2][track] = i <= 1 ? c[1][track] : i == 2 ? c[3][track] : c[2][track];
+			out[3][track] = i == 3 ? c[3][track] : c[2][track];
+		}
+	}
+
+	// rotations of tracks [group * 4, group * 4 + 3], [xyzw][track]
+	// the importer keeps neighbouring frames in the same hemisphere, so there's no need to check the sign
+	static LUMIX_FORCE_INLINE void decodeRotations(const Frames& frames, u32 group, float (&out)[4][4]) {
+		alignas(16) float q[2][4][4];
+		unpackRotations(frames.rotations[0] + group * 12, q[0]);
+		unpackRotations(frames.rotations[1] + group * 12, q[1]);
+
+		const float4 t = f4Splat(frames.t);
+		const float4 x0 = f4Load(q[0][0]);
+		const float4 y0 = f4Load(q[0][1]);
+		const float4 z0 = f4Load(q[0][2]);
+		const float4 w0 = f4Load(q[0][3]);
+		const float4 x = x0 + (f4Load(q[1][0]) - x0) * t;
+		const float4 y = y0 + (f4Load(q[1][1]) - y0) * t;
+		const float4 z = z0 + (f4Load(q[1][2]) - z0) * t;
+		const float4 w = w0 + (f4Load(q[1][3]) - w0) * t;
+		const float4 inv_len = f4Div(f4Splat(1), f4Sqrt(x * x + y * y + z * z + w * w));
+		f4Store(out[0], x * inv_len);
+		f4Store(out[1], y * inv_len);
+		f4Store(out[2], z * inv_len);
+		f4Store(out[3], w * inv_len);
+	}
+
+	// resolves curves to bones by name
+	template <bool use_mask>
+	struct BoneLookup {
+		LUMIX_FORCE_INLINE int translation(const Animation& anim, u32 curve_idx) const { return find(anim.m_translation_names[curve_idx]); }
+		LUMIX_FORCE_INLINE int rotation(const Animation& anim, u32 curve_idx) const { return find(anim.m_rotation_names[curve_idx]); }
+
+		LUMIX_FORCE_INLINE int find(u32 name) const {
+			Model::BoneMap::const_iterator iter = model.getBoneIndex(name);
+			if (!iter.isValid()) return -1;
+			if constexpr (use_mask) {
+				if (mask->bones.find(name) == mask->bones.end()) return -1;
+			}
+			return iter.value();
+		}
+
+		const Model& model;
+		const BoneMask* mask;
+	};
+
+	// curves are already resolved in the binding
+	struct BindingLookup {
+		LUMIX_FORCE_INLINE int translation(const Animation&, u32 curve_idx) const { return toIndex(binding.translations[curve_idx]); }
+		LUMIX_FORCE_INLINE int rotation(const Animation&, u32 curve_idx) const { return toIndex(binding.rotations[curve_idx]); }
+		static LUMIX_FORCE_INLINE int toIndex(u16 bone) { return bone == AnimationBinding::NO_BONE ? -1 : bone; }
+
+		const AnimationBinding& binding;
+	};
+
+	template <bool use_weight>
+	static LUMIX_FORCE_INLINE void setTranslation(int bone, const Vec3& value, Pose& pose, float weight) {
+		if (bone < 0) return;
+		if constexpr (use_weight) {
+			pose.positions[bone] = lerp(pose.positions[bone], value, weight);
 		}
 		else {
-			AnimationSampler::getRelativePose<true, false>(*this, time, pose, model, weight, mask);
+			pose.positions[bone] = value;
 		}
 	}
-	else {
-		if (weight < 0.9999f) {
-			AnimationSampler::getRelativePose<false, true>(*this, time, pose, model, weight, mask);
+
+	template <bool use_weight>
+	static LUMIX_FORCE_INLINE void setRotation(int bone, const Quat& value, Pose& pose, float weight) {
+		if (bone < 0) return;
+		if constexpr (use_weight) {
+			pose.rotations[bone] = nlerp(pose.rotations[bone], value, weight);
 		}
 		else {
-			AnimationSampler::getRelativePose<false, false>(*this, time, pose, model, weight, mask);
+			pose.rotations[bone] = value;
 		}
 	}
-}
 
-Vec3 Animation::getTranslation(Time time, u32 curve_idx) const
-{
-	const TranslationCurve& curve = m_translations[curve_idx];
-	if (time < m_length) {
-		const u64 anim_t_highres = ((u64)time.raw() << 16) / (m_length.raw());
-		ASSERT(anim_t_highres <= 0xffFF);
-		const u16 anim_t = u16(anim_t_highres);
-
-		if (curve.times) {
-			u32 idx = 1;
-			for (u32 c = curve.count; idx < c; ++idx) {
-				if (curve.times[idx] > anim_t) break;
+	template <bool use_weight, typename Bones>
+	static void getRelativePose(const Animation& anim, Time time, Pose& pose, const Bones& bones, float weight) {
+		ASSERT(!pose.is_absolute);
+
+		for (u32 i = 0; i < anim.m_const_translations_count; ++i) {
+			setTranslation<use_weight>(bones.translation(anim, i), anim.m_const_translations[i], pose, weight);
+		}
+		for (u32 i = 0; i < anim.m_const_rotations_count; ++i) {
+			setRotation<use_weight>(bones.rotation(anim, i), anim.m_const_rotations[i], pose, weight);
+		}
+		if (anim.m_segments_count == 0) return;
+
+		const Frames frames = getFrames(anim, time);
+
+		for (u32 i = anim.m_const_translations_count, c = anim.m_translations_count; i < c; i += 4) {
+			alignas(16) float v[3][4];
+			decodeTranslations(frames, (i - anim.m_const_translations_count) >> 2, v);
+			for (u32 track = 0, tc = minimum(4u, c - i); track < tc; ++track) {
+				const Vec3 pos(v[0][track], v[1][track], v[2][track]);
+				setTranslation<use_weight>(bones.translation(anim, i + track), pos, pose, weight);
+			}
+		}
+
+		for (u32 i = anim.m_const_rotations_count, c = anim.m_rotations_count; i < c; i += 4) {
+			alignas(16) float v[4][4];
+			decodeRotations(frames, (i - anim.m_const_rotations_count) >> 2, v);
+			for (u32 track = 0, tc = minimum(4u, c - i); track < tc; ++track) {
+				const Quat rot(v[0][track], v[1][track], v[2][track], v[3][track]);
+				setRotation<use_weight>(bones.rotation(anim, i + track), rot, pose, weight);
 			}
+		}
+	}
 
-			const float t = float(anim_t - curve.times[idx - 1]) / (curve.times[idx] - curve.times[idx - 1]);
-			return lerp(curve.pos[idx - 1], curve.pos[idx], t);
+	template <bool use_weight>
+	static void getRelativePose(const Animation& anim, Time time, Pose& pose, const Model& model, float weight, const BoneMask* mask) {
+		ASSERT(model.isReady());
+		if (mask) {
+			getRelativePose<use_weight>(anim, time, pose, BoneLookup<true>{model, mask}, weight);
 		}
+		else {
+			getRelativePose<use_weight>(anim, time, pose, BoneLookup<false>{model, mask}, weight);
+		}
+	}
+}; // AnimationSampler
 
-		const u64 frame_48_16 = (m_frame_count - 1) * anim_t_highres;
-		ASSERT((frame_48_16 & 0xffFF00000000) == 0);
-		const u32 frame_idx = u32(frame_48_16 >> 16);
-		const float frame_t = (frame_48_16 & 0xffFF) / float(0xffFF);
+void Animation::getRelativePose(Time time, Pose& pose, const Model& model, float weight, const BoneMask* mask) const {
+	if (weight < 0.9999f) {
+		AnimationSampler::getRelativePose<true>(*this, time, pose, model, weight, mask);
+	}
+	else {
+		AnimationSampler::getRelativePose<false>(*this, time, pose, model, weight, mask);
+	}
+}
 
-		return lerp(curve.pos[frame_idx], curve.pos[frame_idx + 1], frame_t);
+void Animation::getRelativePose(Time time, Pose& pose, const AnimationBinding& binding, float weight) const {
+	ASSERT(binding.translations.size() == (i32)m_translations_count);
+	ASSERT(binding.rotations.size() == (i32)m_rotations_count);
+	if (weight < 0.9999f) {
+		AnimationSampler::getRelativePose<true>(*this, time, pose, AnimationSampler::BindingLookup{binding}, weight);
+	}
+	else {
+		AnimationSampler::getRelativePose<false>(*this, time, pose, AnimationSampler::BindingLookup{binding}, weight);
 	}
+}
+
+Vec3 Animation::getTranslation(Time time, u32 curve_idx) const
+{
+	if (curve_idx < m_const_translations_count) return m_const_translations[curve_idx];
 
-	return curve.pos[curve.count - 1];
+	const u32 sampled_idx = curve_idx - m_const_translations_count;
+	alignas(16) float v[3][4];
+	AnimationSampler::decodeTranslations(AnimationSampler::getFrames(*this, time), sampled_idx >> 2, v);
+	const u32 track = sampled_idx & 3;
+	return Vec3(v[0][track], v[1][track], v[2][track]);
 }
 
 int Animation::getTranslationCurveIndex(u32 name_hash) const {
-	for (int i = 0, c = m_translations.size(); i < c; ++i) {
-		if (m_translations[i].name == name_hash) return i;
+	for (int i = 0, c = (int)m_translations_count; i < c; ++i) {
+		if (m_translation_names[i] == name_hash) return i;
 	}
 	return -1;
 }
 
 int Animation::getRotationCurveIndex(u32 name_hash) const {
-	for (int i = 0, c = m_rotations.size(); i < c; ++i) {
-		if (m_rotations[i].name == name_hash) return i;
+	for (int i = 0, c = (int)m_rotations_count; i < c; ++i) {
+		if (m_rotation_names[i] == name_hash) return i;
 	}
 	return -1;
 }
 
 Quat Animation::getRotation(Time time, u32 curve_idx) const
 {
-	const RotationCurve& curve = m_rotations[curve_idx];
-	if (time < m_length) {
-		const u64 anim_t_highres = ((u64)time.raw() << 16) / (m_length.raw());
-		ASSERT(anim_t_highres <= 0xffFF);
-		const u16 anim_t = u16(anim_t_highres);
-
-		if (curve.times) {
-			u32 idx = 1;
-			for (u32 c = curve.count; idx < c; ++idx) {
-				if (curve.times[idx] > anim_t) break;
-			}
+	if (curve_idx < m_const_rotations_count) return m_const_rotations[curve_idx];
 
-			const float t = float(anim_t - curve.times[idx - 1]) / (curve.times[idx] - curve.times[idx - 1]);
-			return nlerp(curve.rot[idx - 1], curve.rot[idx], t);
-		}
-
-		const u64 frame_48_16 = (m_frame_count - 1) * anim_t_highres;
-		ASSERT((frame_48_16 & 0xffFF00000000) == 0);
-		const u32 frame_idx = u32(frame_48_16 >> 16);
-		const float frame_t = (frame_48_16 & 0xffFF) / float(0xffFF);
-
-		return nlerp(curve.rot[frame_idx], curve.rot[frame_idx + 1], frame_t);
-	}
-
-	return curve.rot[curve.count - 1];
+	const u32 sampled_idx = curve_idx - m_const_rotations_count;
+	alignas(16) float v[4][4];
+	AnimationSampler::decodeRotations(AnimationSampler::getFrames(*this, time), sampled_idx >> 2, v);
+	const u32 track = sampled_idx & 3;
+	return Quat(v[0][track], v[1][track], v[2][track], v[3][track]);
 }
 
 void Animation::getRelativePose(Time time, Pose& pose, const Model& model, const BoneMask* mask) const {
-	if(mask) {
-		AnimationSampler::getRelativePose<true, false>(*this, time, pose, model, 1, mask);
-	}
-	else {
-		AnimationSampler::getRelativePose<false, false>(*this, time, pose, model, 1, mask);
-	}
+	AnimationSampler::getRelativePose<false>(*this, time, pose, model, 1, mask);
 }
 
 bool Animation::load(u64 mem_size, const u8* mem)
 {
-	m_translations.clear();
-	m_rotations.clear();
-	m_mem.clear();
+	unload();
 	Header header;
 	InputMemoryStream file(mem, mem_size);
 	file.read(&header, sizeof(header));
@@ -257,51 +311,119 @@ bool Animation::load(u64 mem_size, const u8* mem)
 		return false;
 	}
 
+	if (header.version < (u32)Version::COMPRESSED) {
+		logError("Animation ", getPath(), " uses old format, please reimport it");
+		return false;
+	}
+
+	if (header.version > (u32)Version::LAST) {
+		logError("Unsupported version of animation ", getPath());
+		return false;
+	}
+
+	if (header.frame_count < 2) {
+		logError("Invalid animation file ", getPath());
+		return false;
+	}
+
 	m_length = header.length;
 	m_frame_count = header.frame_count;
-	u32 translations_count;
-	file.read(&translations_count, sizeof(translations_count));
 	const u32 size = u32(file.size() - file.getPosition());
 	m_mem.resize(size);
-	file.read(&m_mem[0], size);
-
-	m_translations.resize(translations_count);
-
-	InputMemoryStream blob(&m_mem[0], size);
-	for (int i = 0; i < m_translations.size(); ++i) {
-		TranslationCurve& curve = m_translations[i];
-		curve.name = blob.read<u32>();
-		const Animation::CurveType type = blob.read<Animation::CurveType>();
-		curve.count = blob.read<u32>();
-		ASSERT(curve.count > 1 || type != Animation::CurveType::KEYFRAMED);
-		curve.times = type == Animation::CurveType::KEYFRAMED ? (const u16*)blob.skip(curve.count * sizeof(u16)) : nullptr;
-		curve.pos = (const Vec3*)blob.skip(curve.count * sizeof(Vec3));
+	file.read(m_mem.begin(), size);
+
+	InputMemoryStream blob(m_mem.begin(), size);
+	m_const_translations_count = blob.read<u32>();
+	m_translations_count = blob.read<u32>();
+	m_const_rotations_count = blob.read<u32>();
+	m_rotations_count = blob.read<u32>();
+	if (m_const_translations_count > m_translations_count || m_const_rotations_count > m_rotations_count) {
+		logError("Invalid animation file ", getPath());
+		unload();
+		return false;
 	}
-	
-	const u32 rotations_count = blob.read<u32>();
-	m_rotations.resize(rotations_count);
-
-	for (int i = 0; i < m_rotations.size(); ++i) {
-		RotationCurve& curve = m_rotations[i];
-		curve.name = blob.read<u32>();
-		const Animation::CurveType type = blob.read<Animation::CurveType>();
-		curve.count = blob.read<u32>();
-		ASSERT(curve.count > 1 || type != Animation::CurveType::KEYFRAMED);
-		curve.times = type == Animation::CurveType::KEYFRAMED ? (const u16*)blob.skip(curve.count * sizeof(u16)) : nullptr;
-		curve.rot = (const Quat*)blob.skip(curve.count * sizeof(Quat));
+
+	const u32 sampled_translations = AnimationSampler::padded(m_translations_count - m_const_translations_count);
+	const u32 sampled_rotations = AnimationSampler::padded(m_rotations_count - m_const_rotations_count);
+	const u32 frame_size = (sampled_translations + sampled_rotations) * 3 * sizeof(u16);
+	const u32 ranges_size = sampled_translations / 4 * sizeof(TranslationRange);
+	const u32 full_segments = (m_frame_count - 1) / SEGMENT_FRAMES;
+	const u32 last_segment_frames = (m_frame_count - 1) % SEGMENT_FRAMES;
+	m_segment_size = ranges_size + (SEGMENT_FRAMES + 1) * frame_size;
+	m_segments_count = 0;
+	u64 segments_size = 0;
+	if (sampled_translations + sampled_rotations > 0) {
+		m_segments_count = full_segments + (last_segment_frames ? 1 : 0);
+		segments_size = u64(full_segments) * m_segment_size;
+		if (last_segment_frames) segments_size += ranges_size + (last_segment_frames + 1) * frame_size;
 	}
 
+	const u64 expected_size = blob.getPosition()
+		+ (m_translations_count + m_rotations_count) * sizeof(u32)
+		+ m_const_translations_count * sizeof(Vec3)
+		+ m_const_rotations_count * sizeof(Quat)
+		+ segments_size;
+	if (expected_size != size) {
+		logError("Corrupted animation file ", getPath());
+		unload();
+		return false;
+	}
+
+	m_translation_names = (const u32*)blob.skip(m_translations_count * sizeof(u32));
+	m_rotation_names = (const u32*)blob.skip(m_rotations_count * sizeof(u32));
+	m_const_translations = (const Vec3*)blob.skip(m_const_translations_count * sizeof(Vec3));
+	m_const_rotations = (const Quat*)blob.skip(m_const_rotations_count * sizeof(Quat));
+	m_segments = (const u8*)blob.skip(segments_size);
+
 	return true;
 }
 
 
 void Animation::unload()
 {
-	m_translations.clear();
-	m_rotations.clear();
+	m_translations_count = 0;
+	m_const_translations_count = 0;
+	m_rotations_count = 0;
+	m_const_rotations_count = 0;
+	m_translation_names = nullptr;
+	m_rotation_names = nullptr;
+	m_const_translations = nullptr;
+	m_const_rotations = nullptr;
+	m_segments = nullptr;
+	m_segments_count = 0;
 	m_mem.clear();
 	m_length = Time::fromSeconds(0);
 }
 
 
+AnimationBinding::AnimationBinding(IAllocator& allocator)
+	: translations(allocator)
+	, rotations(allocator)
+{}
+
+
+void AnimationBinding::bind(const Animation& anim, const Model& model, const BoneMask* mask)
+{
+	ASSERT(model.isReady());
+	ASSERT(model.getBoneCount() < NO_BONE);
+
+	auto resolve = [&](u32 name) -> u16 {
+		Model::BoneMap::const_iterator iter = model.getBoneIndex(name);
+		if (!iter.isValid()) return NO_BONE;
+		if (mask && mask->bones.find(name) == mask->bones.end()) return NO_BONE;
+		return (u16)iter.value();
+	};
+
+	translations.resize(anim.m_translations_count);
+	for (u32 i = 0; i < anim.m_translations_count; ++i) {
+		translations[i] = resolve(anim.m_translation_names[i]);
+	}
+
+	rotations.resize(anim.m_rotations_count);
+	for (u32 i = 0; i < anim.m_rotations_count; ++i) {
+		rotations[i] = resolve(anim.m_rotation_names[i]);
+	}
+}
+
+
 } // namespace Lumix
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "engine/array.h"
 #include "engine/hash_map.h"
 #include "engine/resource.h"
 #include "engine/string.h"
@@ -7,6 +8,7 @@
 namespace Lumix
 {
 
+struct AnimationBinding;
 struct Model;
 struct Pose;
 struct Quat;
@@ -27,11 +29,18 @@ struct Animation final : Resource
 	public:
 		static const u32 HEADER_MAGIC = 0x5f4c4146; // '_LAF'
 		static const ResourceType TYPE;
+		// sampled frames are split into segments of this many frames, neighbouring segments share a frame
+		static constexpr u32 SEGMENT_FRAMES = 16;
+		// components of quaternions, except the largest one, are within this range
+		static constexpr float ROTATION_RANGE = 0.70710678f;
+		static constexpr u32 ROTATION_STEPS = 0x7fFF;
 
 	public:
-		enum class CurveType : u8 {
-			KEYFRAMED,
-			SAMPLED
+		enum class Version : u32 {
+			FIRST = 3,
+			COMPRESSED,
+
+			LAST
 		};
 
 		struct Header
@@ -42,6 +51,12 @@ struct Animation final : Resource
 			u32 frame_count;
 		};
 
+		// translations of 4 tracks in a segment are `min + u16 * scale`
+		struct TranslationRange {
+			float min[3][4];
+			float scale[3][4];
+		};
+
 	public:
 		Animation(const Path& path, ResourceManager& resource_manager, IAllocator& allocator);
 
@@ -53,6 +68,8 @@ struct Animation final : Resource
 		int getRotationCurveIndex(u32 name_hash) const;
 		void getRelativePose(Time time, Pose& pose, const Model& model, const BoneMask* mask) const;
 		void getRelativePose(Time time, Pose& pose, const Model& model, float weight, const BoneMask* mask) const;
+		// same as above, but bones are not looked up by name, `binding` must be bound to this animation
+		void getRelativePose(Time time, Pose& pose, const AnimationBinding& binding, float weight) const;
 		Time getLength() const { return m_length; }
 
 	private:
@@ -60,27 +77,55 @@ struct Animation final : Resource
 		bool load(u64 size, const u8* mem) override;
 
 	private:
+		// Layout of the file after the header:
+		//	u32 const_translations_count, translations_count, const_rotations_count, rotations_count
+		//	u32 translation_names[translations_count], rotation_names[rotations_count]
+		//	Vec3 const_translations[const_translations_count]
+		//	Quat const_rotations[const_rotations_count]
+		//	segments
+		// Tracks which do not change are first, the rest are sampled in all `frame_count` frames.
+		// Sampled tracks are padded to multiple of 4, so 4 tracks are decoded at once. Each segment has
+		//	TranslationRange ranges[padded translations / 4]
+		//	u16 translations[frames][padded translations / 4][3][4]
+		//	u16 rotations[frames][padded rotations / 4][3][4]
+		// i.e. components of 4 neighbouring tracks are next to each other.
+		// Rotations are smallest three, each u16 is `component << 1 | bit`, low bits of the first two
+		// are index of the dropped component, low bit of the third one is set if the dropped component is negative.
 		Time m_length;
-		struct TranslationCurve
-		{
-			u32 name;
-			u32 count;
-			const u16* times;
-			const Vec3* pos;
-		};
-		struct RotationCurve
-		{
-			u32 name;
-			u32 count;
-			const u16* times;
-			const Quat* rot;
-		};
-		Array<TranslationCurve> m_translations;
-		Array<RotationCurve> m_rotations;
-		Array<u8> m_mem;
 		u32 m_frame_count = 0;
+		u32 m_translations_count = 0;
+		u32 m_const_translations_count = 0;
+		u32 m_rotations_count = 0;
+		u32 m_const_rotations_count = 0;
+		const u32* m_translation_names = nullptr;
+		const u32* m_rotation_names = nullptr;
+		const Vec3* m_const_translations = nullptr;
+		const Quat* m_const_rotations = nullptr;
+		const u8* m_segments = nullptr;
+		u32 m_segments_count = 0;
+		u32 m_segment_size = 0;
+		Array<u8> m_mem;
 
 		friend struct AnimationSampler;
+		friend struct AnimationBinding;
+};
+
+
+// Curves of an animation resolved to bones of a model, so the animation can be sampled without bone lookups.
+// It must be bound again if the animation, the model or the mask changes, see Resource::getGeneration.
+struct AnimationBinding
+{
+	// the curve has no bone in the model or the bone is not in the mask
+	static constexpr u16 NO_BONE = 0xffFF;
+
+	explicit AnimationBinding(IAllocator& allocator);
+	AnimationBinding(AnimationBinding&& rhs) = default;
+
+	void bind(const Animation& anim, const Model& model, const BoneMask* mask);
+
+	// curve index -> bone index
+	Array<u16> translations;
+	Array<u16> rotations;
 };
 
 
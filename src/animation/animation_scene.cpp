@@ -46,11 +46,28 @@ struct AnimationSceneImpl final : AnimationScene
 	
 	struct Animator
 	{
+		// see anim::Controller::LOD
+		enum class LOD : u32 {
+			FULL,
+			// without IK and layers except the first one
+			REDUCED,
+			// reduced and the pose is evaluated only every few frames
+			THROTTLED,
+			// the controller is updated, but the pose is not evaluated
+			CULLED,
+
+			COUNT
+		};
+
 		EntityRef entity;
 		anim::Controller* resource = nullptr;
 		u32 default_set = 0;
 		anim::RuntimeContext* ctx = nullptr;
 		LocalRigidTransform root_motion = {{0, 0, 0}, {0, 0, 0, 1}};
+		// frames since the pose was evaluated at throttled LOD
+		u32 throttled_frame = 0;
+		// computed at the beginning of update
+		LOD lod = LOD::FULL;
 
 		struct IK {
 			float weight = 0;
@@ -514,7 +531,7 @@ struct AnimationSceneImpl final : AnimationScene
 
 	void updateAnimator(EntityRef entity, float time_delta) override {
 		Animator& animator = m_animators[m_animator_map[entity]];
-		updateAnimator(animator, time_delta);
+		updateAnimator(animator, time_delta, Animator::LOD::FULL);
 	}
 
 	void setAnimatorInput(EntityRef entity, u32 input_idx, float value) override {
@@ -616,7 +633,76 @@ struct AnimationSceneImpl final : AnimationScene
 		return animator.default_set;
 	}
 
-	void updateAnimator(Animator& animator, float time_delta)
+	Animator::LOD getLOD(const Animator& animator, const DVec3* camera_pos)
+	{
+		const anim::Controller& controller = *animator.resource;
+		if (controller.m_flags.isSet(anim::Controller::Flags::CULL_INVISIBLE)) {
+			ModelInstance* model_instance = m_render_scene->getModelInstance(animator.entity);
+			const bool visible = compareAndExchange(&model_instance->visible, 0, 1);
+			if (!visible) return Animator::LOD::CULLED;
+		}
+		if (!camera_pos) return Animator::LOD::FULL;
+
+		const anim::Controller::LOD& lod = controller.m_lod;
+		const double squared_dist = squaredLength(m_universe.getPosition(animator.entity) - *camera_pos);
+		if (lod.throttled_distance > 0 && squared_dist > lod.throttled_distance * lod.throttled_distance) return Animator::LOD::THROTTLED;
+		if (lod.reduced_distance > 0 && squared_dist > lod.reduced_distance * lod.reduced_distance) return Animator::LOD::REDUCED;
+		return Animator::LOD::FULL;
+	}
+
+	// relative pose of the current state of the controller
+	void evaluatePose(Animator& animator, Pose& pose, Model& model, Animator::LOD lod)
+	{
+		model.getRelativePose(pose);
+		animator.ctx->base_layer_only = lod != Animator::LOD::FULL;
+		animator.resource->getPose(*animator.ctx, pose);
+		if (lod != Animator::LOD::FULL) return;
+
+		for (Animator::IK& ik : animator.inverse_kinematics) {
+			if (ik.weight == 0) break;
+			const u32 idx = u32(&ik - animator.inverse_kinematics);
+			updateIK(animator.resource->m_ik[idx], ik, pose, model);
+		}
+	}
+
+	// the pose is evaluated every few frames and interpolated between the last two evaluations, 
+	// so it lags behind the controller by up to `throttled_frames` frames
+	void evaluateThrottledPose(Animator& animator, Pose& pose, Model& model)
+	{
+		anim::RuntimeContext& ctx = *animator.ctx;
+		const u32 frames = maximum(animator.resource->m_lod.throttled_frames, 1u);
+		if (ctx.next_pose.size() != (i32)pose.count) {
+			evaluatePose(animator, pose, model, Animator::LOD::THROTTLED);
+			ctx.next_pose.resize(pose.count);
+			ctx.prev_pose.resize(pose.count);
+			for (u32 i = 0; i < pose.count; ++i) {
+				ctx.next_pose[i] = {pose.positions[i], pose.rotations[i]};
+			}
+			memcpy(ctx.prev_pose.begin(), ctx.next_pose.begin(), ctx.next_pose.byte_size());
+			// spread evaluations of animators over frames
+			animator.throttled_frame = animator.entity.index % frames;
+			return;
+		}
+
+		++animator.throttled_frame;
+		if (animator.throttled_frame >= frames) {
+			animator.throttled_frame = 0;
+			evaluatePose(animator, pose, model, Animator::LOD::THROTTLED);
+			memcpy(ctx.prev_pose.begin(), ctx.next_pose.begin(), ctx.next_pose.byte_size());
+			for (u32 i = 0; i < pose.count; ++i) {
+				ctx.next_pose[i] = {pose.positions[i], pose.rotations[i]};
+			}
+		}
+
+		const float t = (animator.throttled_frame + 1) / float(frames);
+		for (u32 i = 0; i < pose.count; ++i) {
+			pose.positions[i] = lerp(ctx.prev_pose[i].pos, ctx.next_pose[i].pos, t);
+			pose.rotations[i] = nlerp(ctx.prev_pose[i].rot, ctx.next_pose[i].rot, t);
+		}
+		pose.is_absolute = false;
+	}
+
+	void updateAnimator(Animator& animator, float time_delta, Animator::LOD lod)
 	{
 		if (!animator.resource || !animator.resource->isReady()) return;
 		if (!animator.ctx) {
@@ -635,15 +721,20 @@ struct AnimationSceneImpl final : AnimationScene
 		animator.ctx->model = model;
 		animator.ctx->time_delta = Time::fromSeconds(time_delta);
 		animator.ctx->root_bone_hash = crc32(animator.resource->m_root_motion_bone);
+		// state of the controller, events and root motion do not depend on LOD
 		animator.resource->update(*animator.ctx, animator.root_motion);
 
-		model->getRelativePose(*pose);
-		animator.resource->getPose(*animator.ctx, *pose);
-		
-		for (Animator::IK& ik : animator.inverse_kinematics) {
-			if (ik.weight == 0) break;
-			const u32 idx = u32(&ik - animator.inverse_kinematics);
-			updateIK(animator.resource->m_ik[idx], ik, *pose, *model);
+		if (lod == Animator::LOD::CULLED) {
+			m_render_scene->unlockPose(entity, false);
+			return;
+		}
+
+		if (lod == Animator::LOD::THROTTLED) {
+			evaluateThrottledPose(animator, *pose, *model);
+		}
+		else {
+			animator.ctx->next_pose.clear();
+			evaluatePose(animator, *pose, *model, lod);
 		}
 
 		pose->computeAbsolute(*model);
@@ -825,9 +916,28 @@ struct AnimationSceneImpl final : AnimationScene
 		updateAnimables(time_delta);
 		updatePropertyAnimators(time_delta);
 
-		jobs::forEach(m_animators.size(), 1, [&](i32 idx, i32){
-			updateAnimator(m_animators[idx], time_delta);
+		// LODs are computed here, because getPosition and clearing visibility are not safe on workers
+		const EntityPtr camera = m_render_scene->getActiveCamera();
+		const DVec3 camera_pos = camera.isValid() ? m_universe.getPosition((EntityRef)camera) : DVec3(0);
+		i32 lod_counts[(u32)Animator::LOD::COUNT] = {};
+		for (Animator& animator : m_animators) {
+			animator.lod = Animator::LOD::FULL;
+			if (!animator.resource || !animator.resource->isReady()) continue;
+			if (!m_universe.hasComponent(animator.entity, MODEL_INSTANCE_TYPE)) continue;
+
+			animator.lod = getLOD(animator, camera.isValid() ? &camera_pos : nullptr);
+			++lod_counts[(u32)animator.lod];
+		}
+
+		jobs::parallelFor(m_animators.size(), 1, [&](i32 from, i32 to){
+			for (i32 i = from; i < to; ++i) {
+				updateAnimator(m_animators[i], time_delta, m_animators[i].lod);
+			}
 		});
+		profiler::pushInt("full LOD", lod_counts[(u32)Animator::LOD::FULL]);
+		profiler::pushInt("reduced LOD", lod_counts[(u32)Animator::LOD::REDUCED]);
+		profiler::pushInt("throttled LOD", lod_counts[(u32)Animator::LOD::THROTTLED]);
+		profiler::pushInt("culled", lod_counts[(u32)Animator::LOD::CULLED]);
 	}
 
 
@@ -37,6 +37,7 @@ void Controller::unload() {
 	m_animation_slots.clear();
 	m_bone_masks.clear();
 	m_inputs = InputDecl();
+	m_lod = {};
 	LUMIX_DELETE(m_allocator, m_root);
 	m_root = nullptr;
 }
@@ -201,6 +202,7 @@ void Controller::serialize(OutputMemoryStream& stream) {
 	}
 	stream.write(m_ik);
 	stream.write(m_ik_count);
+	stream.write(m_lod);
 	m_root->serialize(stream);
 }
 
@@ -247,6 +249,9 @@ bool Controller::deserialize(InputMemoryStream& stream) {
 
 	stream.read(m_ik);
 	stream.read(m_ik_count);
+	if (header.version > ControllerVersion::TRANSITIONS) {
+		stream.read(m_lod);
+	}
 	m_root->deserialize(stream, *this, (u32)header.version);
 	return true;
 }
@@ -19,6 +19,7 @@ struct RuntimeContext;
 enum class ControllerVersion : u32 {
 	EVENTS,
 	TRANSITIONS,
+	LOD,
 	LATEST
 };
 
@@ -53,9 +54,19 @@ public:
 	Array<BoneMask> m_bone_masks;
 	InputDecl m_inputs;
 	enum class Flags : u32 {
-		XZ_ROOT_MOTION = 1 << 0
+		XZ_ROOT_MOTION = 1 << 0,
+		// animators are not evaluated if their model instance was not rendered in the last frame
+		CULL_INVISIBLE = 1 << 1
 	};
 	FlagSet<Flags, u32> m_flags;
+	// animators far from the camera are evaluated in less detail, distance 0 disables the level
+	struct LOD {
+		// IK and all layers except the first one are skipped farther than this
+		float reduced_distance = 0;
+		// pose is evaluated every `throttled_frames` frames farther than this and interpolated in between
+		float throttled_distance = 0;
+		u32 throttled_frames = 4;
+	} m_lod;
 	struct IK {
 		enum { MAX_BONES_COUNT = 8 };
 		u16 max_iterations = 5;
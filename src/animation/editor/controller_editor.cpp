@@ -992,6 +992,19 @@ struct ControllerEditorImpl : ControllerEditor {
 					m_controller->m_flags.set(Controller::Flags::XZ_ROOT_MOTION, xz_root_motion);
 					pushUndo();
 				}
+				bool cull_invisible = m_controller->m_flags.isSet(Controller::Flags::CULL_INVISIBLE);
+				ImGuiEx::Label("Cull invisible");
+				if (ImGui::Checkbox("##cull", &cull_invisible)) {
+					m_controller->m_flags.set(Controller::Flags::CULL_INVISIBLE, cull_invisible);
+					pushUndo();
+				}
+				Controller::LOD& lod = m_controller->m_lod;
+				ImGuiEx::Label("Reduced LOD distance");
+				if (ImGui::DragFloat("##rld", &lod.reduced_distance, 1, 0, FLT_MAX, "%.1f")) pushUndo((uintptr)&lod.reduced_distance);
+				ImGuiEx::Label("Throttled LOD distance");
+				if (ImGui::DragFloat("##tld", &lod.throttled_distance, 1, 0, FLT_MAX, "%.1f")) pushUndo((uintptr)&lod.throttled_distance);
+				ImGuiEx::Label("Throttled LOD frames");
+				if (ImGui::DragInt("##tlf", (int*)&lod.throttled_frames, 1, 1, 16)) pushUndo((uintptr)&lod.throttled_frames);
 			}
 
 			if (ImGui::CollapsingHeader("Inputs")) {
@@ -76,15 +76,44 @@ static LUMIX_FORCE_INLINE LocalRigidTransform getRootMotion(const RuntimeContext
 }
 
 RuntimeContext::RuntimeContext(Controller& controller, IAllocator& allocator)
-	: data(allocator)
+	: allocator(allocator)
+	, data(allocator)
 	, inputs(allocator)
 	, controller(controller)
 	, animations(allocator)
 	, events(allocator)
 	, input_runtime(nullptr, 0)
+	, bindings(allocator)
+	, prev_pose(allocator)
+	, next_pose(allocator)
 {
 }
 
+const AnimationBinding& RuntimeContext::getBinding(const Animation& anim, u32 mask_idx) {
+	ASSERT(model && model->isReady() && anim.isReady());
+	if (mask_idx >= (u32)controller.m_bone_masks.size()) mask_idx = 0xffFFffFF;
+
+	auto rebind = [&](Binding& b){
+		b.animation_generation = anim.getGeneration();
+		b.model_generation = model->getGeneration();
+		b.binding.bind(anim, *model, mask_idx == 0xffFFffFF ? nullptr : &controller.m_bone_masks[mask_idx]);
+	};
+
+	// there are just a few animations per context, linear search is fine
+	for (Binding& b : bindings) {
+		if (b.animation != &anim || b.model != model || b.mask_idx != mask_idx) continue;
+		if (b.animation_generation != anim.getGeneration() || b.model_generation != model->getGeneration()) rebind(b);
+		return b.binding;
+	}
+
+	Binding& b = bindings.emplace(allocator);
+	b.animation = &anim;
+	b.model = model;
+	b.mask_idx = mask_idx;
+	rebind(b);
+	return b.binding;
+}
+
 static u32 getInputByteOffset(Controller& controller, u32 input_idx) {
 	u32 offset = 0;
 	for (u32 i = 0; i < input_idx; ++i) {
@@ -204,7 +233,7 @@ void Blend1DNode::skip(RuntimeContext& ctx) const {
 	ctx.input_runtime.skip(sizeof(float));
 }
 
-static void getPose(const RuntimeContext& ctx, float rel_time, float weight, u32 slot, Pose& pose, u32 mask_idx, bool looped) {
+static void getPose(RuntimeContext& ctx, float rel_time, float weight, u32 slot, Pose& pose, u32 mask_idx, bool looped) {
 	Animation* anim = ctx.animations[slot];
 	if (!anim) return;
 	if (!ctx.model->isReady()) return;
@@ -213,11 +242,10 @@ static void getPose(const RuntimeContext& ctx, float rel_time, float weight, u32
 	Time time = anim->getLength() * rel_time;
 	const Time anim_time = looped ? time % anim->getLength() : minimum(time, anim->getLength());
 
-	const BoneMask* mask = mask_idx < (u32)ctx.controller.m_bone_masks.size() ? &ctx.controller.m_bone_masks[mask_idx] : nullptr;
-	anim->getRelativePose(anim_time, pose, *ctx.model, weight, mask);
+	anim->getRelativePose(anim_time, pose, ctx.getBinding(*anim, mask_idx), weight);
 }
 
-static void getPose(const RuntimeContext& ctx, Time time, float weight, u32 slot, Pose& pose, u32 mask_idx, bool looped) {
+static void getPose(RuntimeContext& ctx, Time time, float weight, u32 slot, Pose& pose, u32 mask_idx, bool looped) {
 	Animation* anim = ctx.animations[slot];
 	if (!anim) return;
 	if (!ctx.model->isReady()) return;
@@ -225,8 +253,7 @@ static void getPose(const RuntimeContext& ctx, Time time, float weight, u32 slot
 
 	const Time anim_time = looped ? time % anim->getLength() : minimum(time, anim->getLength());
 
-	const BoneMask* mask = mask_idx < (u32)ctx.controller.m_bone_masks.size() ? &ctx.controller.m_bone_masks[mask_idx] : nullptr;
-	anim->getRelativePose(anim_time, pose, *ctx.model, weight, mask);
+	anim->getRelativePose(anim_time, pose, ctx.getBinding(*anim, mask_idx), weight);
 }
 
 void Blend1DNode::getPose(RuntimeContext& ctx, float weight, Pose& pose, u32 mask) const {
@@ -406,6 +433,10 @@ void LayersNode::skip(RuntimeContext& ctx) const {
 
 void LayersNode::getPose(RuntimeContext& ctx, float weight, Pose& pose, u32 mask) const {
 	for (const Layer& layer : m_layers) {
+		if (ctx.base_layer_only && &layer != m_layers.begin()) {
+			layer.node.skip(ctx);
+			continue;
+		}
 		layer.node.getPose(ctx, weight, pose, layer.mask);
 	}
 }
@@ -637,4 +668,4 @@ Node* Node::create(GroupNode* parent, Type type, IAllocator& allocator) {
 }
 
 
-} // namespace Lumix::anim
\ No newline at end of file
+} // namespace Lumix::anim
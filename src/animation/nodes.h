@@ -1,5 +1,6 @@
 #pragma once
 
+#include "animation/animation.h"
 #include "engine/array.h"
 #include "engine/stream.h"
 
@@ -21,7 +22,23 @@ struct RuntimeContext {
 
 	void setInput(u32 input_idx, float value);
 	void setInput(u32 input_idx, bool value);
+	// `anim` resolved to bones of `model`, masked by controller's bone mask `mask_idx` if there's such mask
+	// bindings are cached and rebuilt when the animation or the model is reloaded
+	const AnimationBinding& getBinding(const Animation& anim, u32 mask_idx);
+
+	struct Binding {
+		Binding(IAllocator& allocator) : binding(allocator) {}
+		Binding(Binding&& rhs) = default;
+
+		const Animation* animation;
+		const Model* model;
+		u32 animation_generation;
+		u32 model_generation;
+		u32 mask_idx;
+		AnimationBinding binding;
+	};
 
+	IAllocator& allocator;
 	Controller& controller;
 	Array<u8> inputs;
 	Array<Animation*> animations;
@@ -32,6 +49,12 @@ struct RuntimeContext {
 	Time time_delta;
 	Model* model = nullptr;
 	InputMemoryStream input_runtime;
+	Array<Binding> bindings;
+	// layers except the first one are skipped in getPose
+	bool base_layer_only = false;
+	// the last two evaluated relative poses of an animator with throttled update rate, the pose is interpolated between them
+	Array<LocalRigidTransform> prev_pose;
+	Array<LocalRigidTransform> next_pose;
 };
 
 struct Node {
@@ -145,6 +145,67 @@ struct Runner final
 		return false;
 	}
 
+	// -memory_report <path> writes allocation tags to a file on exit
+	static bool getMemoryReportPath(Span<char> path) {
+		char cmd_line[2048];
+		os::getCommandLine(Span(cmd_line));
+
+		CommandLineParser parser(cmd_line);
+		while (parser.next()) {
+			if (!parser.currentEquals("-memory_report")) continue;
+			if (!parser.next()) break;
+			parser.getCurrent(path.begin(), path.length());
+			return true;
+		}
+		return false;
+	}
+
+	// -profiler_trace <path> [-profiler_trace_limit <MB>] streams profiler events to a chrome trace file
+	static bool getProfilerTracePath(Span<char> path, u64& max_file_size) {
+		char cmd_line[2048];
+		os::getCommandLine(Span(cmd_line));
+
+		bool found = false;
+		max_file_size = 0;
+		CommandLineParser parser(cmd_line);
+		while (parser.next()) {
+			if (parser.currentEquals("-profiler_trace")) {
+				if (!parser.next()) break;
+				parser.getCurrent(path.begin(), path.length());
+				found = true;
+			}
+			else if (parser.currentEquals("-profiler_trace_limit")) {
+				if (!parser.next()) break;
+				char tmp[32];
+				parser.getCurrent(tmp, lengthOf(tmp));
+				u64 mb = 0;
+				fromCString(Span(tmp, stringLength(tmp)), mb);
+				max_file_size = mb * 1024 * 1024;
+			}
+		}
+		return found;
+	}
+
+	// -resource_budget <type> <MB> keeps unreferenced resources of the type loaded up to the budget, can be repeated
+	void setResourceBudgets() {
+		char cmd_line[2048];
+		os::getCommandLine(Span(cmd_line));
+
+		CommandLineParser parser(cmd_line);
+		while (parser.next()) {
+			if (!parser.currentEquals("-resource_budget")) continue;
+			char type[32];
+			char tmp[32];
+			if (!parser.next()) break;
+			parser.getCurrent(type, lengthOf(type));
+			if (!parser.next()) break;
+			parser.getCurrent(tmp, lengthOf(tmp));
+			u64 mb = 0;
+			fromCString(Span(tmp, stringLength(tmp)), mb);
+			m_engine->getResourceManager().setMemoryBudget(type, mb * 1024 * 1024);
+		}
+	}
+
 	void loadProject() {
 		FileSystem& fs = m_engine->getFileSystem();
 		OutputMemoryStream data(m_allocator);
@@ -162,7 +223,14 @@ struct Runner final
 			init_data.file_system = FileSystem::createPacked("main.pak", m_allocator);
 		}
 
+		char trace_path[LUMIX_MAX_PATH];
+		u64 trace_limit;
+		if (getProfilerTracePath(Span(trace_path), trace_limit)) {
+			if (!profiler::startCapture(trace_path, trace_limit)) logError("Could not start profiler capture to ", trace_path);
+		}
+
 		m_engine = Engine::create(static_cast<Engine::InitArgs&&>(init_data), m_allocator);
+		setResourceBudgets();
 		
 		if (!isWindowCommandLineOption()) {
 			os::setFullscreen(m_engine->getWindowHandle());
@@ -199,8 +267,15 @@ struct Runner final
 		auto* gui = static_cast<GUISystem*>(m_engine->getPluginManager().getPlugin("gui"));
 		gui->setInterface(nullptr);
 		m_pipeline.reset();
+
+		char memory_report_path[LUMIX_MAX_PATH];
+		if (getMemoryReportPath(Span(memory_report_path))) {
+			if (!TagAllocator::saveReport(memory_report_path)) logError("Could not save memory report to ", memory_report_path);
+		}
+
 		m_engine.reset();
 		m_universe = nullptr;
+		profiler::stopCapture();
 	}
 
 	void captureMouse(bool capture) {
@@ -10,8 +10,9 @@
 #include "engine/engine.h"
 #include "engine/log.h"
 #include "engine/lua_wrapper.h"
-#include "engine/lz4.h"
+#include "engine/compression.h"
 #include "engine/atomic.h"
+#include "engine/command_line_parser.h"
 #include "engine/sync.h"
 #include "engine/thread.h"
 #include "engine/os.h"
@@ -109,6 +110,14 @@ struct AssetCompilerImpl : AssetCompiler {
 		if (!os::makePath(path)) logError("Could not create ", path);
 		ResourceManagerHub& rm = engine.getResourceManager();
 		rm.setLoadHook(&m_load_hook);
+		rm.enableDependencyRecording(true);
+
+		char cmd_line[2048];
+		os::getCommandLine(Span(cmd_line));
+		CommandLineParser parser(cmd_line);
+		while (parser.next()) {
+			if (parser.currentEquals("-lz4hc")) m_compression_level = chunked_lz4::Level::HIGH;
+		}
 	}
 
 	~AssetCompilerImpl()
@@ -139,12 +148,15 @@ struct AssetCompilerImpl : AssetCompiler {
 			logError("Could not save .lumix/assets/_list.txt");
 		}
 
+		ResourceManagerHub& rm = m_app.getEngine().getResourceManager();
+		rm.saveDependencyManifest();
+		rm.enableDependencyRecording(false);
+
 		ASSERT(m_plugins.empty());
 		m_task.m_finished = true;
 		m_to_compile.emplace();
 		m_semaphore.signal();
 		m_task.destroy();
-		ResourceManagerHub& rm = m_app.getEngine().getResourceManager();
 		rm.setLoadHook(nullptr);
 	}
 	
@@ -156,6 +168,7 @@ struct AssetCompilerImpl : AssetCompiler {
 		m_watcher->getCallback().bind<&AssetCompilerImpl::onFileChanged>(this);
 		m_dependencies.clear();
 		m_resources.clear();
+		engine.getResourceManager().loadDependencyManifest();
 		fillDB();
 	}
 
@@ -178,16 +191,11 @@ struct AssetCompilerImpl : AssetCompiler {
 	bool writeCompiledResource(const char* locator, Span<const u8> data) override {
 		constexpr u32 COMPRESSION_SIZE_LIMIT = 4096;
 		OutputMemoryStream compressed(m_app.getAllocator());
-		i32 compressed_size = 0;
 		if (data.length() > COMPRESSION_SIZE_LIMIT) {
-			const i32 cap = LZ4_compressBound((i32)data.length());
-			compressed.resize(cap);
-			compressed_size = LZ4_compress_default((const char*)data.begin(), (char*)compressed.getMutableData(), (i32)data.length(), cap); 
-			if (compressed_size == 0) {
+			if (!chunked_lz4::compress(data, compressed, m_compression_level, m_app.getAllocator())) {
 				logError("Could not compress ", locator);
 				return false;
 			}
-			compressed.resize(compressed_size);
 		}
 
 		char normalized[LUMIX_MAX_PATH];
@@ -203,10 +211,10 @@ struct AssetCompilerImpl : AssetCompiler {
 		}
 		CompiledResourceHeader header;
 		header.decompressed_size = data.length();
-		if (data.length() > COMPRESSION_SIZE_LIMIT && compressed_size < i32(data.length() / 4 * 3)) {
+		if (data.length() > COMPRESSION_SIZE_LIMIT && compressed.size() < data.length() / 4 * 3) {
 			header.flags |= CompiledResourceHeader::COMPRESSED;
 			(void)file.write(&header, sizeof(header));
-			(void)file.write(compressed.data(), compressed_size);
+			(void)file.write(compressed.data(), compressed.size());
 		}
 		else {
 			(void)file.write(&header, sizeof(header));
@@ -784,6 +792,7 @@ struct AssetCompilerImpl : AssetCompiler {
 	bool m_init_finished = false;
 	Array<Resource*> m_on_init_load;
 
+	chunked_lz4::Level m_compression_level = chunked_lz4::Level::FAST;
 	u32 m_compile_batch_count = 0;
 	u32 m_batch_remaining_count = 0;
 	StaticString<LUMIX_MAX_PATH> m_res_in_progress;
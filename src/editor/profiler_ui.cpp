@@ -121,7 +121,7 @@ static const char* getContexSwitchReasonString(i8 reason)
 		"WrRundown"		   ,
 		"MaximumWaitReason",
 	};
-	if (reason >= (i8)lengthOf(reasons)) return "Unknown";
+	if (reason < 0 || reason >= (i8)lengthOf(reasons)) return "Unknown";
 	return reasons[reason];
 }
 
@@ -387,6 +387,7 @@ struct ProfilerUIImpl final : ProfilerUI
 
 	void onGUICPUProfiler();
 	void onGUIMemoryProfiler();
+	void onGUIMemoryTags();
 	void onGUIResources();
 	void onFrame();
 	void addToTree(debug::Allocator::AllocationInfo* info);
@@ -424,6 +425,7 @@ struct ProfilerUIImpl final : ProfilerUI
 	i64 hovered_link = 0;
 	profiler::GPUMemStatsBlock m_gpu_mem_stats;
 	bool m_is_gpu_mem_stats_valid = false;
+	u32 m_selected_memory_tag = 0;
 };
 
 
@@ -475,6 +477,18 @@ void ProfilerUIImpl::onGUIResources()
 		auto* resource_manager = m_resource_manager.get(RESOURCE_TYPES[i]);
 		auto& resources = resource_manager->getResourceTable();
 
+		if (resource_manager->getMemoryBudget() > 0) {
+			const ResourceManager::CacheStats& stats = resource_manager->getCacheStats();
+			const u64 requests = stats.hits + stats.misses;
+			ImGui::Text("Cache: %.3fMB resident / %.3fMB budget, %u cached (%.3fMB), hit rate %.1f%%, %" PRIu64 " evictions"
+				, stats.resident_size / (1024.f * 1024.f)
+				, resource_manager->getMemoryBudget() / (1024.f * 1024.f)
+				, stats.cached_count
+				, stats.cached_size / (1024.f * 1024.f)
+				, requests ? stats.hits * 100.f / requests : 0.f
+				, stats.evictions);
+		}
+
 		if (ImGui::BeginTable("resc", 4)) {
             ImGui::TableSetupColumn("Path");
             ImGui::TableSetupColumn("Size");
@@ -499,7 +513,7 @@ void ProfilerUIImpl::onGUIResources()
 				ImGui::Text("%.3fKB", iter.value()->size() / 1024.0f);
 				sum += iter.value()->size();
 				ImGui::TableNextColumn();
-				ImGui::Text("%s", getResourceStateString(iter.value()->getState()));
+				ImGui::Text("%s%s", getResourceStateString(iter.value()->getState()), iter.value()->isCached() ? " (cached)" : "");
 				ImGui::TableNextColumn();
 				ImGui::Text("%u", iter.value()->getRefCount());
 			}
@@ -660,6 +674,8 @@ void ProfilerUIImpl::onGUIMemoryProfiler()
 		ImGui::Text("GPU: %.02fMB/%.02f (%.02fMB dedicated)", current, total, dedicated);
 	}
 
+	onGUIMemoryTags();
+
 	ImGui::Columns(2, "memc");
 	for (auto* child : m_allocation_root->m_children)
 	{
@@ -673,6 +689,71 @@ void ProfilerUIImpl::onGUIMemoryProfiler()
 	ImGui::Columns(1);
 }
 
+void ProfilerUIImpl::onGUIMemoryTags()
+{
+	if (!ImGui::TreeNode("Tags")) return;
+
+	if (ImGui::Button("Save report")) {
+		char path[LUMIX_MAX_PATH];
+		if (os::getSaveFilename(Span(path), "Text file\0*.txt\0", "txt")) {
+			if (!TagAllocator::saveReport(path)) logError("Could not save ", path);
+		}
+	}
+
+	if (ImGui::BeginTable("tags", 4)) {
+		ImGui::TableSetupColumn("Tag");
+		ImGui::TableSetupColumn("Live");
+		ImGui::TableSetupColumn("Peak");
+		ImGui::TableSetupColumn("Allocations");
+		ImGui::TableHeadersRow();
+
+		TagAllocator::forEachTag([&](TagAllocator& tag){
+			const TagAllocator::Stats stats = tag.getStats();
+			ImGui::TableNextColumn();
+			for (TagAllocator* parent = tag.getParent(); parent; parent = parent->getParent()) ImGui::Indent();
+			ImGui::PushID(&tag);
+			if (ImGui::Selectable(tag.getName(), m_selected_memory_tag == tag.getID(), ImGuiSelectableFlags_SpanAllColumns)) {
+				m_selected_memory_tag = tag.getID();
+			}
+			ImGui::PopID();
+			for (TagAllocator* parent = tag.getParent(); parent; parent = parent->getParent()) ImGui::Unindent();
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3fMB", stats.live_bytes / (1024.f * 1024.f));
+			ImGui::TableNextColumn();
+			ImGui::Text("%.3fMB", stats.peak_bytes / (1024.f * 1024.f));
+			ImGui::TableNextColumn();
+			ImGui::Text("%" PRIu64, stats.live_count);
+		});
+		ImGui::EndTable();
+	}
+
+	// timeline of the selected tag from the captured profiler data
+	Array<float> values(m_allocator);
+	forEachThread([&](ThreadContextProxy& ctx){
+		u32 p = ctx.begin;
+		const u32 end = ctx.end;
+		while (p != end) {
+			profiler::EventHeader header;
+			read(ctx, p, header);
+			if (header.type == profiler::EventType::MEMORY_TAG) {
+				profiler::MemoryTagRecord r;
+				read(ctx, p + sizeof(profiler::EventHeader), r);
+				if (r.id == m_selected_memory_tag) values.push(r.live_bytes / (1024.f * 1024.f));
+			}
+			p += header.size;
+		}
+	});
+
+	if (values.empty()) {
+		ImGui::TextUnformatted(m_is_paused ? "No data for selected tag" : "Pause the profiler to see the timeline");
+	}
+	else {
+		ImGui::PlotLines("##memory_timeline", values.begin(), values.size(), 0, "Live (MB)", 0, FLT_MAX, ImVec2(-1, 100));
+	}
+	ImGui::TreePop();
+}
+
+
 static void renderArrow(ImVec2 p_min, ImGuiDir dir, float scale, ImDrawList* dl)
 {
 	const float h = ImGui::GetFontSize() * 1.00f;
@@ -751,7 +832,11 @@ void ProfilerUIImpl::onGUICPUProfiler()
 		else {
 			ImGui::Separator();
 			ImGui::Text("Context switch tracing not available.");
-			ImGui::Text("Run the app as an administrator.");
+			#ifdef _WIN32
+				ImGui::Text("Run the app as an administrator.");
+			#else
+				ImGui::Text("Perf events are not available, see /proc/sys/kernel/perf_event_paranoid.");
+			#endif
 		}
 		ImGui::EndMenu();
 	}
@@ -1121,6 +1206,8 @@ void ProfilerUIImpl::onGUICPUProfiler()
 					read(ctx, p + sizeof(profiler::EventHeader), m_gpu_mem_stats);
 					m_is_gpu_mem_stats_valid = true;
 					break;
+				case profiler::EventType::MEMORY_TAG:
+					break;
 				case profiler::EventType::FRAME:
 					if (header.time >= view_start && header.time <= m_end && m_show_frames) {
 						const float t = float((header.time - view_start) / double(m_range));
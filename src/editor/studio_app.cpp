@@ -2267,6 +2267,7 @@ struct StudioAppImpl final : StudioApp
 		m_export.dest_dir = "";
 		m_settings.getValue(Settings::LOCAL, "export_dir", Span(m_export.dest_dir.data));
 		m_settings.getValue(Settings::LOCAL, "export_pack", m_export.pack);
+		m_settings.getValue(Settings::LOCAL, "export_high_compression", m_export.high_compression);
 	}
 
 
@@ -3040,11 +3041,14 @@ struct StudioAppImpl final : StudioApp
 
 			Span<const char> basename = Path::getBasename(info.filename);
 			ExportFileInfo rec;
-			fromCString(Span(basename), rec.hash);
 			rec.offset = 0;
 			rec.size = os::getFileSize(StaticString<LUMIX_MAX_PATH>(base_path, ".lumix/assets/", info.filename));
 			copyString(rec.path, ".lumix/assets/");
 			catString(rec.path, info.filename);
+			// compiled resources are named by hash, other files (e.g. dependency manifest) are found by path hash
+			if (basename.length() == 0 || basename[0] < '0' || basename[0] > '9' || !fromCString(Span(basename), rec.hash)) {
+				rec.hash = Path(rec.path).getHash();
+			}
 			infos.insert(rec.hash, rec);
 		}
 		
@@ -3115,6 +3119,16 @@ struct StudioAppImpl final : StudioApp
 				out_info.offset = ~0UL;
 			}
 		}
+
+		const char* manifest_path = ".lumix/assets/_deps.bin";
+		if (os::fileExists(manifest_path)) {
+			const u32 hash = Path(manifest_path).getHash();
+			auto& out_info = infos.emplace(hash);
+			copyString(Span(out_info.path), manifest_path);
+			out_info.hash = hash;
+			out_info.size = os::getFileSize(manifest_path);
+			out_info.offset = ~0UL;
+		}
 		exportDataScan("pipelines/", infos);
 		exportDataScan("universes/", infos);
 	}
@@ -3139,6 +3153,12 @@ struct StudioAppImpl final : StudioApp
 			if (ImGui::Checkbox("##pack", &m_export.pack)) {
 				m_settings.setValue(Settings::LOCAL, "export_pack", m_export.pack);
 			}
+			if (m_export.pack) {
+				ImGuiEx::Label("High compression");
+				if (ImGui::Checkbox("##high_compression", &m_export.high_compression)) {
+					m_settings.setValue(Settings::LOCAL, "export_high_compression", m_export.high_compression);
+				}
+			}
 			ImGuiEx::Label("Mode");
 			if (ImGui::Combo("##mode", (int*)&m_export.mode, "All files\0Loaded universe\0")) {
 				m_settings.setValue(Settings::LOCAL, "export_pack", (i32)m_export.mode);
@@ -3201,28 +3221,21 @@ struct StudioAppImpl final : StudioApp
 				logError("No files found while trying to create ", dest);
 				return;
 			}
-			u64 total_size = 0;
-			for (ExportFileInfo& info : infos) {
-				info.offset = total_size;
-				total_size += info.size;
-			}
-			
 			os::OutputFile file;
 			if (!file.open(dest)) {
 				logError("Could not create ", dest);
 				return;
 			}
 
-			const u32 count = (u32)infos.size();
-			bool success = file.write(&count, sizeof(count));
-
-			for (auto& info : infos) {
-				success = file.write(&info.hash, sizeof(info.hash)) && success;
-				success = file.write(&info.offset, sizeof(info.offset)) && success;
-				success = file.write(&info.size, sizeof(info.size)) && success;
-			}
-
+			// infos are sorted by hash, so the table of entries is too
+			Array<pak::Entry> entries(m_allocator);
+			entries.reserve(infos.size());
 			OutputMemoryStream src(m_allocator);
+			OutputMemoryStream compressed(m_allocator);
+			const chunked_lz4::Level level = m_export.high_compression ? chunked_lz4::Level::HIGH : chunked_lz4::Level::FAST;
+			const u8 padding[pak::ALIGNMENT] = {};
+			u64 offset = 0;
+			bool success = true;
 			for (const ExportFileInfo& info : infos) {
 				src.clear();
 				if (!fs.getContentSync(Path(info.path), src)) {
@@ -3230,8 +3243,33 @@ struct StudioAppImpl final : StudioApp
 					file.close();
 					return;
 				}
-				success = file.write(src.data(), src.size()) && success;
+
+				pak::Entry& entry = entries.emplace();
+				entry.hash = info.hash;
+				entry.offset = offset;
+				entry.decompressed_size = src.size();
+				compressed.clear();
+				if (pak::compress(src, compressed, level, m_allocator)) {
+					entry.flags = pak::Entry::COMPRESSED;
+					entry.size = compressed.size();
+					success = file.write(compressed.data(), compressed.size()) && success;
+				}
+				else {
+					entry.flags = 0;
+					entry.size = src.size();
+					success = file.write(src.data(), src.size()) && success;
+				}
+
+				const u64 padding_size = (pak::ALIGNMENT - entry.size % pak::ALIGNMENT) % pak::ALIGNMENT;
+				success = file.write(padding, padding_size) && success;
+				offset += entry.size + padding_size;
 			}
+
+			pak::Footer footer;
+			footer.toc_offset = offset;
+			footer.count = entries.size();
+			success = file.write(entries.begin(), entries.byte_size()) && success;
+			success = file.write(&footer, sizeof(footer)) && success;
 			file.close();
 
 			if (!success) {
@@ -3474,6 +3512,7 @@ struct StudioAppImpl final : StudioApp
 		Mode mode = Mode::ALL_FILES;
 
 		bool pack = false;
+		bool high_compression = false;
 		StaticString<96> startup_universe;
 		StaticString<LUMIX_MAX_PATH> dest_dir;
 	};
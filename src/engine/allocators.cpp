@@ -1,8 +1,11 @@
 #include "engine/allocators.h"
 #include "engine/atomic.h"
 #include "engine/crt.h"
+#include "engine/debug.h"
 #include "engine/math.h"
 #include "engine/os.h"
+#include "engine/stream.h"
+#include "engine/string.h"
 #if !defined _WIN32 || defined __clang__
 	#include <string.h>
 	#include <malloc.h>
@@ -12,8 +15,14 @@
 namespace Lumix
 {
 	static constexpr u32 PAGE_SIZE = 4096;
-	static constexpr size_t MAX_PAGE_COUNT = 16384;
-	static constexpr u32 SMALL_ALLOC_MAX_SIZE = 64;
+	static constexpr size_t MAX_PAGE_COUNT = 65536;
+	static constexpr u32 SMALL_ALLOC_MAX_SIZE = 512;
+	static constexpr u32 BIN_SIZES[] = { 8, 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+	static_assert(lengthOf(BIN_SIZES) == DefaultAllocator::BIN_COUNT);
+	// number of blocks moved between a thread cache and shared pages at once
+	static constexpr u32 CACHE_BATCH_SIZE = 32;
+	// allocators created after this many do not use thread caches
+	static constexpr u32 MAX_CACHED_ALLOCATORS = 32;
 
 	struct DefaultAllocator::Page {
 		struct Header {
@@ -28,15 +37,74 @@ namespace Lumix
 
 	static_assert(sizeof(DefaultAllocator::Page) == PAGE_SIZE);
 
+	// free blocks are linked through their first bytes
+	struct ThreadCacheBin {
+		void* first;
+		u32 count;
+	};
+
+	struct ThreadCache {
+		ThreadCacheBin bins[DefaultAllocator::BIN_COUNT];
+	};
+
+	// plain globals without constructors, so they work even for static allocators constructed before them
+	static DefaultAllocator* volatile g_cached_allocators[MAX_CACHED_ALLOCATORS];
+	static volatile i32 g_cached_allocators_count = 0;
+	static volatile i32 g_cached_allocators_lock = 0;
+
+	static void lockCachedAllocators() {
+		while (!compareAndExchange(&g_cached_allocators_lock, 1, 0)) {}
+	}
+
+	static void unlockCachedAllocators() {
+		memoryBarrier();
+		g_cached_allocators_lock = 0;
+	}
+
+	static void flush(DefaultAllocator& allocator, ThreadCacheBin& bin, u32 count);
+
+	// set once the thread's caches are destroyed, allocators used later, e.g. static ones on the main thread,
+	// do not use caches anymore; trivially destructible, so it's valid until the thread is gone
+	static thread_local bool t_thread_caches_destroyed = false;
+
+	// returns cached blocks to their allocators when thread exits
+	struct ThreadCaches {
+		~ThreadCaches() {
+			t_thread_caches_destroyed = true;
+			for (u32 i = 0; i < lengthOf(caches); ++i) {
+				ThreadCache* cache = caches[i];
+				if (!cache) continue;
+
+				lockCachedAllocators();
+				DefaultAllocator* allocator = g_cached_allocators[i];
+				if (allocator) {
+					for (ThreadCacheBin& bin : cache->bins) flush(*allocator, bin, bin.count);
+				}
+				unlockCachedAllocators();
+				free(cache);
+				caches[i] = nullptr;
+			}
+		}
+
+		ThreadCache* caches[MAX_CACHED_ALLOCATORS] = {};
+	};
+
+	static thread_local ThreadCaches t_thread_caches;
+
 	static u32 sizeToBin(size_t n) {
 		ASSERT(n > 0);
 		ASSERT(n <= SMALL_ALLOC_MAX_SIZE);
+		if (n <= 32) return n <= 8 ? 0 : (n <= 16 ? 1 : 2);
+		// 48, 64, 96, 128, ... two bins per power of two
+		const u32 v = u32(n - 1);
 		#ifdef _WIN32
-			unsigned long res;
-			return _BitScanReverse(&res, ((unsigned long)n - 1) >> 2) ? res : 0;
+			unsigned long msb;
+			_BitScanReverse(&msb, v);
 		#else
-			return 31 - __builtin_clz((n - 1) >> 2);
+			const u32 msb = 31 - __builtin_clz(v);
 		#endif
+		const u32 upper_half = (v >> (msb - 1)) & 1;
+		return 3 + (msb - 5) * 2 + upper_half;
 	}
 
 	void initPage(u32 item_size, DefaultAllocator::Page* page) {
@@ -56,16 +124,17 @@ namespace Lumix
 		return (DefaultAllocator::Page*)((uintptr)ptr & ~u64(PAGE_SIZE - 1));
 	}
 
-	static void freeSmall(DefaultAllocator& allocator, void* mem) {
+	// call with allocator.m_mutex locked
+	static void freeToPage(DefaultAllocator& allocator, void* mem) {
 		u8* ptr = (u8*)mem;
 		DefaultAllocator::Page* page = getPage(ptr);
 		
-		MutexGuard guard(allocator.m_mutex);
 		if (page->header.first_free + page->header.item_size > sizeof(page->data)) {
 			ASSERT(!page->header.next);
 			ASSERT(!page->header.prev);
 			const u32 bin = sizeToBin(page->header.item_size);
 			page->header.next = allocator.m_free_lists[bin];
+			if (page->header.next) page->header.next->header.prev = page;
 			allocator.m_free_lists[bin] = page;
 		}
 
@@ -73,6 +142,95 @@ namespace Lumix
 		page->header.first_free = u32(ptr - page->data);
 	}
 
+	// call with allocator.m_mutex locked
+	static void* allocFromPage(DefaultAllocator& allocator, u32 bin) {
+		if (!allocator.m_small_allocations) {
+			allocator.m_small_allocations = (u8*)os::memReserve(PAGE_SIZE * MAX_PAGE_COUNT);
+		}
+		DefaultAllocator::Page* p = allocator.m_free_lists[bin];
+		if (!p) {
+			if (allocator.m_page_count == MAX_PAGE_COUNT) return nullptr;
+
+			p = (DefaultAllocator::Page*)(allocator.m_small_allocations + PAGE_SIZE * allocator.m_page_count);
+			initPage(BIN_SIZES[bin], p);
+			allocator.m_free_lists[bin] = p;
+			++allocator.m_page_count;
+		}
+
+		ASSERT(p->header.item_size > 0);
+		ASSERT(p->header.first_free + p->header.item_size <= sizeof(p->data));
+		void* res = &p->data[p->header.first_free];
+		p->header.first_free = *(u32*)res;
+
+		const bool is_page_full = p->header.first_free + p->header.item_size > sizeof(p->data);
+		if (is_page_full) {
+			if (allocator.m_free_lists[bin] == p) {
+				allocator.m_free_lists[bin] = p->header.next;
+			}
+			if (p->header.next) {
+				p->header.next->header.prev = p->header.prev;
+			}
+			if (p->header.prev) {
+				p->header.prev->header.next = p->header.next;
+			}
+			p->header.next = p->header.prev = nullptr;
+		}
+
+		return res;
+	}
+
+	// returns `count` blocks from thread cache to pages
+	static void flush(DefaultAllocator& allocator, ThreadCacheBin& bin, u32 count) {
+		MutexGuard guard(allocator.m_mutex);
+		for (u32 i = 0; i < count; ++i) {
+			void* mem = bin.first;
+			bin.first = *(void**)mem;
+			freeToPage(allocator, mem);
+		}
+		bin.count -= count;
+	}
+
+	static void refill(DefaultAllocator& allocator, ThreadCacheBin& bin, u32 bin_idx) {
+		MutexGuard guard(allocator.m_mutex);
+		for (u32 i = 0; i < CACHE_BATCH_SIZE; ++i) {
+			void* mem = allocFromPage(allocator, bin_idx);
+			if (!mem) return;
+			*(void**)mem = bin.first;
+			bin.first = mem;
+			++bin.count;
+		}
+	}
+
+	static ThreadCache* getThreadCache(DefaultAllocator& allocator) {
+		if (allocator.m_id >= MAX_CACHED_ALLOCATORS) return nullptr;
+		if (t_thread_caches_destroyed) return nullptr;
+
+		ThreadCache*& cache = t_thread_caches.caches[allocator.m_id];
+		if (!cache) {
+			cache = (ThreadCache*)malloc(sizeof(ThreadCache));
+			memset(cache, 0, sizeof(*cache));
+		}
+		return cache;
+	}
+
+	static void freeSmall(DefaultAllocator& allocator, void* mem) {
+		ThreadCache* cache = getThreadCache(allocator);
+		if (!cache) {
+			MutexGuard guard(allocator.m_mutex);
+			freeToPage(allocator, mem);
+			return;
+		}
+
+		// blocks freed by other threads than the one which allocated them end up here too,
+		// they return to the shared pages once this thread has too many of them
+		const u32 bin_idx = sizeToBin(getPage(mem)->header.item_size);
+		ThreadCacheBin& bin = cache->bins[bin_idx];
+		*(void**)mem = bin.first;
+		bin.first = mem;
+		++bin.count;
+		if (bin.count >= 2 * CACHE_BATCH_SIZE) flush(allocator, bin, CACHE_BATCH_SIZE);
+	}
+
 	static void* reallocSmall(DefaultAllocator& allocator, void* mem, size_t n) {
 		DefaultAllocator::Page* p = getPage(mem);
 		if (n <= SMALL_ALLOC_MAX_SIZE) {
@@ -90,7 +248,7 @@ namespace Lumix
 		DefaultAllocator::Page* p = getPage(mem);
 		if (n <= SMALL_ALLOC_MAX_SIZE) {
 			const u32 bin = sizeToBin(n);
-			if (sizeToBin(p->header.item_size) == bin) return mem;
+			if (sizeToBin(p->header.item_size) == bin && p->header.item_size % align == 0) return mem;
 		}
 		
 		void* new_mem = allocator.allocate_aligned(n, align);
@@ -100,45 +258,31 @@ namespace Lumix
 	}
 
 	static void* allocSmall(DefaultAllocator& allocator, size_t n) {
-		const u32 bin = sizeToBin(n);
-
-		MutexGuard guard(allocator.m_mutex);
+		const u32 bin_idx = sizeToBin(n);
 
-		if (!allocator.m_small_allocations) {
-			allocator.m_small_allocations = (u8*)os::memReserve(PAGE_SIZE * MAX_PAGE_COUNT);
+		ThreadCache* cache = getThreadCache(allocator);
+		if (!cache) {
+			MutexGuard guard(allocator.m_mutex);
+			return allocFromPage(allocator, bin_idx);
 		}
-		DefaultAllocator::Page* p = allocator.m_free_lists[bin];
-		if (!p) {
-			if (allocator.m_page_count == MAX_PAGE_COUNT) return nullptr;
 
-			p = (DefaultAllocator::Page*)(allocator.m_small_allocations + PAGE_SIZE * allocator.m_page_count);
-			initPage(8 << bin, p);
-			allocator.m_free_lists[bin] = p;
-			++allocator.m_page_count;
-		}
-
-		ASSERT(p->header.item_size > 0);
-		ASSERT(p->header.first_free + n < sizeof(p->data));
-		void* res = &p->data[p->header.first_free];
-		p->header.first_free = *(u32*)res;
-
-		const bool is_page_full = p->header.first_free + p->header.item_size > sizeof(p->data);
-		if (is_page_full) {
-			if (allocator.m_free_lists[bin] == p) {
-				allocator.m_free_lists[bin] = p->header.next;
-			}
-			if (p->header.next) {
-				p->header.next->header.prev = p->header.prev;
-			}
-			if (p->header.prev) {
-				p->header.prev->header.next = p->header.next;
-			}
-			p->header.next = p->header.prev = nullptr;
+		ThreadCacheBin& bin = cache->bins[bin_idx];
+		if (!bin.first) {
+			refill(allocator, bin, bin_idx);
+			if (!bin.first) return nullptr;
 		}
 
+		void* res = bin.first;
+		bin.first = *(void**)res;
+		--bin.count;
 		return res;
 	}
 
+	// items are placed at multiples of their size from page start
+	static bool canAllocSmallAligned(size_t size, size_t align) {
+		return size <= SMALL_ALLOC_MAX_SIZE && BIN_SIZES[sizeToBin(size)] % align == 0;
+	}
+
 	static bool isSmallAlloc(DefaultAllocator& allocator, void* p) {
 		return allocator.m_small_allocations && p >= allocator.m_small_allocations && p < allocator.m_small_allocations + (PAGE_SIZE * MAX_PAGE_COUNT);
 	}
@@ -146,16 +290,34 @@ namespace Lumix
 	DefaultAllocator::DefaultAllocator() {
 		m_page_count = 0;
 		memset(m_free_lists, 0, sizeof(m_free_lists));
+		m_id = atomicIncrement(&g_cached_allocators_count) - 1;
+		if (m_id < MAX_CACHED_ALLOCATORS) {
+			lockCachedAllocators();
+			g_cached_allocators[m_id] = this;
+			unlockCachedAllocators();
+		}
 	}
 
 	DefaultAllocator::~DefaultAllocator() {
+		if (m_id < MAX_CACHED_ALLOCATORS) {
+			// caches of other threads are freed when those threads exit
+			lockCachedAllocators();
+			g_cached_allocators[m_id] = nullptr;
+			unlockCachedAllocators();
+			if (!t_thread_caches_destroyed) {
+				ThreadCache*& cache = t_thread_caches.caches[m_id];
+				free(cache);
+				cache = nullptr;
+			}
+		}
 		os::memRelease(m_small_allocations, PAGE_SIZE * MAX_PAGE_COUNT);
 	}
 
 	void* DefaultAllocator::allocate(size_t n)
 	{
 		if (n <= SMALL_ALLOC_MAX_SIZE) {
-			return allocSmall(*this, n);
+			void* res = allocSmall(*this, n);
+			if (res) return res;
 		}
 		return malloc(n);
 	}
@@ -182,8 +344,9 @@ namespace Lumix
 #ifdef _WIN32
 	void* DefaultAllocator::allocate_aligned(size_t size, size_t align)
 	{
-		if (size <= SMALL_ALLOC_MAX_SIZE && align <= size) {
-			return allocSmall(*this, size);
+		if (canAllocSmallAligned(size, align)) {
+			void* res = allocSmall(*this, size);
+			if (res) return res;
 		}
 		return _aligned_malloc(size, align);
 	}
@@ -294,4 +457,427 @@ void* BaseProxyAllocator::reallocate(void* ptr, size_t size)
 }
 
 
+	// stored right in front of each user pointer returned by a tag allocator
+	struct TagAllocationHeader {
+		u64 size;
+		u32 offset;
+		u32 padding;
+	};
+
+	static constexpr u32 TAG_MIN_ALIGN = sizeof(TagAllocationHeader);
+
+	// tags are kept in a list in creation order, so parents come before children
+	static TagAllocator* g_first_tag = nullptr;
+	static TagAllocator* g_last_tag = nullptr;
+	static u32 g_last_tag_id = 0;
+
+	static Mutex& getTagsMutex() {
+		static Mutex mutex;
+		return mutex;
+	}
+
+	// shared by all tags, guarded by sampling mutex
+	static debug::StackTree& getSamplingStackTree() {
+		static debug::StackTree tree;
+		return tree;
+	}
+
+	static Mutex& getSamplingMutex() {
+		static Mutex mutex;
+		return mutex;
+	}
+
+	static TagAllocationHeader* getTagHeader(void* user_ptr) {
+		return (TagAllocationHeader*)user_ptr - 1;
+	}
+
+
+TagAllocator::TagAllocator(IAllocator& source, const char* tag_name)
+	: m_source(source)
+	, m_root(&source)
+	, m_name(tag_name)
+{
+	MutexGuard lock(getTagsMutex());
+	for (TagAllocator* tag = g_first_tag; tag; tag = tag->m_next) {
+		if (tag == &source) {
+			m_parent = tag;
+			m_root = tag->m_root;
+			break;
+		}
+	}
+	m_id = ++g_last_tag_id;
+	m_prev = g_last_tag;
+	if (g_last_tag) g_last_tag->m_next = this;
+	else g_first_tag = this;
+	g_last_tag = this;
+}
+
+
+TagAllocator::~TagAllocator() {
+	if (m_live_count != 0) {
+		const StaticString<256> msg("Tag allocator ", m_name, " destroyed with ", (u64)m_live_count, " live allocations (", (u64)m_live_bytes, " bytes)\n");
+		debug::debugOutput(msg);
+	}
+	MutexGuard lock(getTagsMutex());
+	if (m_prev) m_prev->m_next = m_next;
+	else g_first_tag = m_next;
+	if (m_next) m_next->m_prev = m_prev;
+	else g_last_tag = m_prev;
+}
+
+
+void TagAllocator::lockTags() { getTagsMutex().enter(); }
+void TagAllocator::unlockTags() { getTagsMutex().exit(); }
+TagAllocator* TagAllocator::getFirstTag() { return g_first_tag; }
+
+
+TagAllocator::Stats TagAllocator::getStats() const {
+	Stats stats;
+	stats.live_bytes = m_live_bytes;
+	stats.peak_bytes = m_peak_bytes;
+	stats.live_count = m_live_count;
+	stats.total_count = m_total_count;
+	return stats;
+}
+
+
+u32 TagAllocator::getSamples(Span<Sample> samples) {
+	MutexGuard lock(getSamplingMutex());
+	const u32 count = minimum(m_samples_count, MAX_SAMPLES, samples.length());
+	memcpy(samples.begin(), m_samples, count * sizeof(Sample));
+	return count;
+}
+
+
+void TagAllocator::onAllocate(u64 size) {
+	for (TagAllocator* tag = this; tag; tag = tag->m_parent) {
+		const i64 live = atomicAdd(&tag->m_live_bytes, (i64)size) + (i64)size;
+		atomicIncrement(&tag->m_live_count);
+		atomicIncrement(&tag->m_total_count);
+		i64 peak = tag->m_peak_bytes;
+		while (live > peak && !compareAndExchange64(&tag->m_peak_bytes, live, peak)) {
+			peak = tag->m_peak_bytes;
+		}
+	}
+
+	const u32 period = m_sampling_period;
+	if (period != 0 && m_total_count % period == 0) {
+		MutexGuard lock(getSamplingMutex());
+		Sample& sample = m_samples[m_samples_count % MAX_SAMPLES];
+		sample.callstack = getSamplingStackTree().record();
+		sample.size = size;
+		++m_samples_count;
+	}
+}
+
+
+void TagAllocator::onDeallocate(u64 size) {
+	for (TagAllocator* tag = this; tag; tag = tag->m_parent) {
+		atomicAdd(&tag->m_live_bytes, -(i64)size);
+		atomicAdd(&tag->m_live_count, -1);
+	}
+}
+
+
+void* TagAllocator::allocate_aligned(size_t size, size_t align) {
+	align = maximum(align, (size_t)TAG_MIN_ALIGN);
+	u8* mem = (u8*)m_root->allocate_aligned(size + align, align);
+	if (!mem) return nullptr;
+
+	u8* ptr = mem + align;
+	TagAllocationHeader* header = getTagHeader(ptr);
+	header->size = size;
+	header->offset = (u32)align;
+	onAllocate(size);
+	return ptr;
+}
+
+
+void TagAllocator::deallocate_aligned(void* ptr) {
+	if (!ptr) return;
+
+	TagAllocationHeader* header = getTagHeader(ptr);
+	onDeallocate(header->size);
+	m_root->deallocate_aligned((u8*)ptr - header->offset);
+}
+
+
+void* TagAllocator::reallocate_aligned(void* ptr, size_t size, size_t align) {
+	if (!ptr) return allocate_aligned(size, align);
+	if (size == 0) {
+		deallocate_aligned(ptr);
+		return nullptr;
+	}
+
+	align = maximum(align, (size_t)TAG_MIN_ALIGN);
+	const TagAllocationHeader old_header = *getTagHeader(ptr);
+	if (old_header.offset != align) {
+		void* new_ptr = allocate_aligned(size, align);
+		memcpy(new_ptr, ptr, minimum(size, (size_t)old_header.size));
+		deallocate_aligned(ptr);
+		return new_ptr;
+	}
+
+	u8* mem = (u8*)m_root->reallocate_aligned((u8*)ptr - align, size + align, align);
+	if (!mem) return nullptr;
+
+	onDeallocate(old_header.size);
+	u8* new_ptr = mem + align;
+	getTagHeader(new_ptr)->size = size;
+	onAllocate(size);
+	return new_ptr;
+}
+
+
+// default alignment goes through the root's unaligned functions, so it can use its small bins and thread caches
+void* TagAllocator::allocate(size_t size) {
+	u8* mem = (u8*)m_root->allocate(size + TAG_MIN_ALIGN);
+	if (!mem) return nullptr;
+
+	u8* ptr = mem + TAG_MIN_ALIGN;
+	TagAllocationHeader* header = getTagHeader(ptr);
+	header->size = size;
+	header->offset = TAG_MIN_ALIGN;
+	onAllocate(size);
+	return ptr;
+}
+
+
+void TagAllocator::deallocate(void* ptr) {
+	if (!ptr) return;
+
+	TagAllocationHeader* header = getTagHeader(ptr);
+	onDeallocate(header->size);
+	m_root->deallocate((u8*)ptr - TAG_MIN_ALIGN);
+}
+
+
+void* TagAllocator::reallocate(void* ptr, size_t size) {
+	if (!ptr) return allocate(size);
+	if (size == 0) {
+		deallocate(ptr);
+		return nullptr;
+	}
+
+	const u64 old_size = getTagHeader(ptr)->size;
+	u8* mem = (u8*)m_root->reallocate((u8*)ptr - TAG_MIN_ALIGN, size + TAG_MIN_ALIGN);
+	if (!mem) return nullptr;
+
+	onDeallocate(old_size);
+	u8* new_ptr = mem + TAG_MIN_ALIGN;
+	getTagHeader(new_ptr)->size = size;
+	onAllocate(size);
+	return new_ptr;
+}
+
+
+bool TagAllocator::saveReport(const char* path) {
+	os::OutputFile file;
+	if (!file.open(path)) return false;
+
+	file << "tag; live bytes; peak bytes; live allocations; total allocations\n";
+	forEachTag([&](TagAllocator& tag){
+		for (TagAllocator* parent = tag.m_parent; parent; parent = parent->m_parent) file << "\t";
+		const Stats stats = tag.getStats();
+		file << tag.m_name << "; " << stats.live_bytes << "; " << stats.peak_bytes << "; " << stats.live_count << "; " << stats.total_count << "\n";
+	});
+
+	file << "\nsampled callstacks\n";
+	forEachTag([&](TagAllocator& tag){
+		Sample samples[MAX_SAMPLES];
+		const u32 count = tag.getSamples(Span(samples));
+		for (u32 i = 0; i < count; ++i) {
+			file << tag.m_name << ", " << samples[i].size << " bytes\n";
+			debug::StackNode* node = samples[i].callstack;
+			while (node) {
+				char fn_name[256];
+				int line;
+				if (debug::StackTree::getFunction(node, Span(fn_name), line)) {
+					file << "\t" << fn_name;
+					if (line >= 0) file << ":" << line;
+					file << "\n";
+				}
+				node = debug::StackTree::getParent(node);
+			}
+		}
+	});
+
+	const bool success = !file.isError();
+	file.close();
+	return success;
+}
+
+
+	static constexpr u32 FRAME_SUB_ARENA_SIZE = 64 * 1024;
+	static constexpr u32 FRAME_MIN_ALIGN = 16;
+	static constexpr u32 FRAME_ARENA_SLOTS = 4;
+
+	// part of a frame allocator's active buffer owned by a single thread
+	struct FrameArena {
+		u32 epoch = 0;
+		u8* pos = nullptr;
+		u8* end = nullptr;
+	};
+
+	struct FrameArenas {
+		FrameArena slots[FRAME_ARENA_SLOTS];
+		u32 next = 0;
+	};
+
+	static thread_local FrameArenas t_frame_arenas;
+	// each reset of any frame allocator gets new epoch, so stale thread arenas never match
+	static volatile i32 g_frame_epoch = 0;
+
+	static FrameArena& getFrameArena(u32 epoch) {
+		FrameArenas& arenas = t_frame_arenas;
+		for (FrameArena& arena : arenas.slots) {
+			if (arena.epoch == epoch) return arena;
+		}
+		FrameArena& arena = arenas.slots[arenas.next];
+		arenas.next = (arenas.next + 1) % FRAME_ARENA_SLOTS;
+		arena.epoch = epoch;
+		arena.pos = nullptr;
+		arena.end = nullptr;
+		return arena;
+	}
+
+	static u8* alignFrameAlloc(u8* mem, size_t align) {
+		return (u8*)(((uintptr)mem + sizeof(u64) + align - 1) & ~(uintptr)(align - 1));
+	}
+
+
+FrameAllocator::FrameAllocator(IAllocator& source, u32 buffer_size)
+	: m_source(source)
+	, m_buffer_size(buffer_size)
+{
+	ASSERT(buffer_size <= (1 << 30));
+	m_buffers[0] = (u8*)source.allocate_aligned(buffer_size, 64);
+	m_buffers[1] = (u8*)source.allocate_aligned(buffer_size, 64);
+	m_epoch = atomicIncrement(&g_frame_epoch);
+}
+
+
+FrameAllocator::~FrameAllocator() {
+	m_source.deallocate_aligned(m_buffers[0]);
+	m_source.deallocate_aligned(m_buffers[1]);
+}
+
+
+void FrameAllocator::reset() {
+	const u32 used = minimum((u32)m_used, m_buffer_size);
+	m_buffer_used[m_active] = used;
+	m_high_water_mark = maximum(m_high_water_mark, used);
+	m_last_overflow_count = m_overflow_count;
+
+	m_active ^= 1;
+	#ifdef LUMIX_DEBUG
+		// catch anything still using memory from two frames ago
+		memset(m_buffers[m_active], 0xcd, m_buffer_used[m_active]);
+	#endif
+	m_used = 0;
+	m_overflow_count = 0;
+	m_epoch = atomicIncrement(&g_frame_epoch);
+}
+
+
+FrameAllocator::Stats FrameAllocator::getStats() const {
+	Stats stats;
+	stats.used = m_buffer_used[m_active ^ 1];
+	stats.high_water_mark = m_high_water_mark;
+	stats.capacity = m_buffer_size;
+	stats.overflow_count = m_last_overflow_count;
+	return stats;
+}
+
+
+bool FrameAllocator::isOwned(const void* ptr) const {
+	for (const u8* buffer : m_buffers) {
+		if (ptr >= buffer && ptr < buffer + m_buffer_size) return true;
+	}
+	return false;
+}
+
+
+u8* FrameAllocator::reserve(u32 size) {
+	// checked first so failing requests can not overflow m_used
+	if (size > m_buffer_size || (u32)m_used >= m_buffer_size) return nullptr;
+	const u32 offset = atomicAdd(&m_used, size);
+	if (offset + size > m_buffer_size) return nullptr;
+	return m_buffers[m_active] + offset;
+}
+
+
+void* FrameAllocator::allocate_aligned(size_t size, size_t align) {
+	align = maximum(align, (size_t)FRAME_MIN_ALIGN);
+	const size_t reserved_size = size + align + sizeof(u64);
+
+	u8* ptr = nullptr;
+	if (reserved_size <= FRAME_SUB_ARENA_SIZE / 4) {
+		FrameArena& arena = getFrameArena(m_epoch);
+		ptr = arena.pos ? alignFrameAlloc(arena.pos, align) : nullptr;
+		if (!ptr || ptr + size > arena.end) {
+			u8* chunk = reserve(FRAME_SUB_ARENA_SIZE);
+			if (chunk) {
+				arena.end = chunk + FRAME_SUB_ARENA_SIZE;
+				ptr = alignFrameAlloc(chunk, align);
+			}
+			else {
+				ptr = nullptr;
+			}
+		}
+		if (ptr) arena.pos = ptr + size;
+	}
+	else if (reserved_size <= m_buffer_size) {
+		u8* mem = reserve((u32)reserved_size);
+		if (mem) ptr = alignFrameAlloc(mem, align);
+	}
+
+	if (!ptr) {
+		atomicIncrement(&m_overflow_count);
+		return m_source.allocate_aligned(size, align);
+	}
+
+	// size is kept in front of each allocation for reallocate
+	((u64*)ptr)[-1] = size;
+	return ptr;
+}
+
+
+void FrameAllocator::deallocate_aligned(void* ptr) {
+	if (!ptr || isOwned(ptr)) return;
+	m_source.deallocate_aligned(ptr);
+}
+
+
+void* FrameAllocator::reallocate_aligned(void* ptr, size_t size, size_t align) {
+	if (!ptr) return allocate_aligned(size, align);
+	if (size == 0) {
+		deallocate_aligned(ptr);
+		return nullptr;
+	}
+	if (!isOwned(ptr)) return m_source.reallocate_aligned(ptr, size, align);
+
+	u8* mem = (u8*)ptr;
+	const u64 old_size = ((u64*)ptr)[-1];
+	if (size <= old_size) return ptr;
+
+	// grow in place if it's the last allocation in this thread's arena
+	FrameArena& arena = getFrameArena(m_epoch);
+	if (arena.pos == mem + old_size && mem + size <= arena.end) {
+		arena.pos = mem + size;
+		((u64*)ptr)[-1] = size;
+		return ptr;
+	}
+
+	void* new_ptr = allocate_aligned(size, align);
+	memcpy(new_ptr, ptr, old_size);
+	return new_ptr;
+}
+
+
+void* FrameAllocator::allocate(size_t size) { return allocate_aligned(size, FRAME_MIN_ALIGN); }
+void FrameAllocator::deallocate(void* ptr) { deallocate_aligned(ptr); }
+void* FrameAllocator::reallocate(void* ptr, size_t size) { return reallocate_aligned(ptr, size, FRAME_MIN_ALIGN); }
+
+
 } // namespace Lumix
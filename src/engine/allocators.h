@@ -5,8 +5,12 @@
 
 namespace Lumix {
 
+namespace debug { struct StackNode; }
+
+// Small allocations are served from pages shared by all threads, through per-thread caches of free blocks.
 struct LUMIX_ENGINE_API DefaultAllocator final : IAllocator {
 	struct Page;
+	static constexpr u32 BIN_COUNT = 11;
 
 	DefaultAllocator();
 	~DefaultAllocator();
@@ -19,8 +23,9 @@ struct LUMIX_ENGINE_API DefaultAllocator final : IAllocator {
 	void* reallocate_aligned(void* ptr, size_t size, size_t align) override;
 
 	u8* m_small_allocations = nullptr;
-	Page* m_free_lists[4];
+	Page* m_free_lists[BIN_COUNT];
 	u32 m_page_count = 0;
+	u32 m_id;
 	Mutex m_mutex;
 };
 
@@ -43,4 +48,119 @@ private:
 };
 
 
-} // namespace Lumix
\ No newline at end of file
+// Tracks memory allocated through it under a named tag. If the source is also a tag allocator,
+// the tags form a hierarchy and a parent's stats include its children.
+// Stats are updated with atomics only, so tracking can stay enabled in release builds.
+struct LUMIX_ENGINE_API TagAllocator final : IAllocator {
+	static constexpr u32 MAX_SAMPLES = 64;
+
+	struct Stats {
+		u64 live_bytes;
+		u64 peak_bytes;
+		u64 live_count;
+		u64 total_count;
+	};
+
+	struct Sample {
+		debug::StackNode* callstack;
+		u64 size;
+	};
+
+	TagAllocator(IAllocator& source, const char* tag_name);
+	~TagAllocator();
+
+	void* allocate(size_t size) override;
+	void deallocate(void* ptr) override;
+	void* reallocate(void* ptr, size_t size) override;
+	void* allocate_aligned(size_t size, size_t align) override;
+	void deallocate_aligned(void* ptr) override;
+	void* reallocate_aligned(void* ptr, size_t size, size_t align) override;
+
+	const char* getName() const { return m_name; }
+	u32 getID() const { return m_id; }
+	TagAllocator* getParent() const { return m_parent; }
+	IAllocator& getSourceAllocator() { return m_source; }
+	Stats getStats() const;
+	// callstack of every nth allocation is recorded, 0 disables sampling
+	void setSamplingPeriod(u32 period) { m_sampling_period = period; }
+	u32 getSamples(Span<Sample> samples);
+
+	// calls f for each existing tag, parents are visited before their children
+	template <typename F> static void forEachTag(const F& f) {
+		lockTags();
+		for (TagAllocator* tag = getFirstTag(); tag; tag = tag->m_next) f(*tag);
+		unlockTags();
+	}
+	// writes human readable report of all tags to a file
+	static bool saveReport(const char* path);
+
+private:
+	static void lockTags();
+	static void unlockTags();
+	static TagAllocator* getFirstTag();
+	void onAllocate(u64 size);
+	void onDeallocate(u64 size);
+
+	IAllocator& m_source;
+	// allocations are forwarded to the first non-tag allocator in the hierarchy
+	IAllocator* m_root;
+	TagAllocator* m_parent = nullptr;
+	TagAllocator* m_next = nullptr;
+	TagAllocator* m_prev = nullptr;
+	const char* m_name;
+	u32 m_id;
+	u32 m_sampling_period = 0;
+	volatile i64 m_live_bytes = 0;
+	volatile i64 m_peak_bytes = 0;
+	volatile i64 m_live_count = 0;
+	volatile i64 m_total_count = 0;
+	Sample m_samples[MAX_SAMPLES];
+	u32 m_samples_count = 0;
+};
+
+
+// Bump allocator for memory which does not outlive the next frame; deallocate is a no-op.
+// There are two buffers, reset() switches to the other one, so memory allocated in frame N
+// is valid until reset() at the start of frame N + 2. Each thread bumps in its own sub-arena,
+// requests which do not fit in the active buffer are forwarded to the source allocator.
+// reset() must not run concurrently with any allocation.
+struct LUMIX_ENGINE_API FrameAllocator final : IAllocator {
+	struct Stats {
+		u32 used;
+		u32 high_water_mark;
+		u32 capacity;
+		u32 overflow_count;
+	};
+
+	FrameAllocator(IAllocator& source, u32 buffer_size);
+	~FrameAllocator();
+
+	void reset();
+	Stats getStats() const;
+	IAllocator& getSourceAllocator() { return m_source; }
+
+	void* allocate(size_t size) override;
+	void deallocate(void* ptr) override;
+	void* reallocate(void* ptr, size_t size) override;
+	void* allocate_aligned(size_t size, size_t align) override;
+	void deallocate_aligned(void* ptr) override;
+	void* reallocate_aligned(void* ptr, size_t size, size_t align) override;
+
+private:
+	u8* reserve(u32 size);
+	bool isOwned(const void* ptr) const;
+
+	IAllocator& m_source;
+	u8* m_buffers[2];
+	u32 m_buffer_size;
+	u32 m_active = 0;
+	u32 m_epoch;
+	volatile i32 m_used = 0;
+	volatile i32 m_overflow_count = 0;
+	u32 m_buffer_used[2] = {};
+	u32 m_last_overflow_count = 0;
+	u32 m_high_water_mark = 0;
+};
+
+
+} // namespace Lumix
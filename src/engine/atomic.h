@@ -11,9 +11,24 @@ LUMIX_ENGINE_API i32 atomicIncrement(i32 volatile* value);
 LUMIX_ENGINE_API i32 atomicDecrement(i32 volatile* value);
 // returns the initial value
 LUMIX_ENGINE_API i32 atomicAdd(i32 volatile* addend, i32 value);
+LUMIX_ENGINE_API i64 atomicAdd(i64 volatile* addend, i64 value);
 LUMIX_ENGINE_API i32 atomicSubtract(i32 volatile* addend, i32 value);
 LUMIX_ENGINE_API bool compareAndExchange(i32 volatile* dest, i32 exchange, i32 comperand);
 LUMIX_ENGINE_API bool compareAndExchange64(i64 volatile* dest, i64 exchange, i64 comperand);
 LUMIX_ENGINE_API void memoryBarrier();
 
+// fences for publishing data to another thread without a lock
+// release - memory operations before the fence are visible before stores after it
+// acquire - loads before the fence are done before memory operations after it
+// x64 does not reorder these, so msvc needs only a compiler barrier
+#ifdef _MSC_VER
+	extern "C" void _ReadWriteBarrier();
+	#pragma intrinsic(_ReadWriteBarrier)
+	LUMIX_FORCE_INLINE void releaseFence() { _ReadWriteBarrier(); }
+	LUMIX_FORCE_INLINE void acquireFence() { _ReadWriteBarrier(); }
+#else
+	LUMIX_FORCE_INLINE void releaseFence() { __atomic_thread_fence(__ATOMIC_RELEASE); }
+	LUMIX_FORCE_INLINE void acquireFence() { __atomic_thread_fence(__ATOMIC_ACQUIRE); }
+#endif
+
 } // namespace Lumix
@@ -0,0 +1,261 @@
+#include "engine/allocator.h"
+#include "engine/atomic.h"
+#include "engine/compression.h"
+#include "engine/crt.h"
+#include "engine/job_system.h"
+#include "engine/lz4.h"
+#include "engine/math.h"
+#include "engine/stream.h"
+
+
+namespace Lumix
+{
+
+
+namespace chunked_lz4
+{
+
+
+// LZ4 block format limits
+static constexpr u32 MIN_MATCH = 4;
+static constexpr u32 LAST_LITERALS = 5;
+static constexpr u32 MF_LIMIT = 12;
+static constexpr u32 MAX_DISTANCE = 0xffFF;
+
+
+// Hash chain match finder with lazy matching, similar to LZ4-HC, which we do not bundle.
+// Output is a regular LZ4 block.
+struct HighCompressor
+{
+	static constexpr u32 HASH_LOG = 15;
+	static constexpr u32 MAX_ATTEMPTS = 256;
+
+	explicit HighCompressor(IAllocator& allocator)
+		: allocator(allocator)
+	{
+		head = (i32*)allocator.allocate(sizeof(i32) << HASH_LOG);
+		chain = (u16*)allocator.allocate(sizeof(u16) * (MAX_DISTANCE + 1));
+	}
+
+	~HighCompressor()
+	{
+		allocator.deallocate(head);
+		allocator.deallocate(chain);
+	}
+
+	static u32 hash(const u8* p)
+	{
+		u32 v;
+		memcpy(&v, p, sizeof(v));
+		return (v * 2654435761u) >> (32 - HASH_LOG);
+	}
+
+	void insert(const u8* src, u32 pos)
+	{
+		const u32 h = hash(src + pos);
+		const u32 distance = head[h] < 0 ? 0 : pos - head[h];
+		chain[pos & MAX_DISTANCE] = distance > MAX_DISTANCE ? 0 : (u16)distance;
+		head[h] = pos;
+	}
+
+	// finds the longest match for `pos` among inserted positions, match can not go past `limit`
+	u32 findMatch(const u8* src, u32 pos, u32 limit, u32& offset) const
+	{
+		u32 best = 0;
+		i32 candidate = head[hash(src + pos)];
+		for (u32 attempt = 0; attempt < MAX_ATTEMPTS && candidate >= 0; ++attempt) {
+			const u32 distance = pos - candidate;
+			if (distance == 0 || distance > MAX_DISTANCE) break;
+
+			if (src[candidate + best] == src[pos + best]) {
+				u32 len = 0;
+				while (pos + len < limit && src[candidate + len] == src[pos + len]) ++len;
+				if (len > best) {
+					best = len;
+					offset = distance;
+					if (pos + len == limit) break;
+				}
+			}
+
+			const u16 delta = chain[candidate & MAX_DISTANCE];
+			if (delta == 0) break;
+			candidate -= delta;
+		}
+		return best;
+	}
+
+	static bool writeLength(u8*& op, const u8* oend, u32 len)
+	{
+		while (len >= 255) {
+			if (op >= oend) return false;
+			*op++ = 255;
+			len -= 255;
+		}
+		if (op >= oend) return false;
+		*op++ = (u8)len;
+		return true;
+	}
+
+	static bool writeSequence(u8*& op, const u8* oend, const u8* literals, u32 literals_count, u32 offset, u32 match_len)
+	{
+		if (op >= oend) return false;
+		u8* token = op++;
+		const u32 ml = match_len - MIN_MATCH;
+		*token = u8((minimum(literals_count, 15u) << 4) | minimum(ml, 15u));
+		if (literals_count >= 15 && !writeLength(op, oend, literals_count - 15)) return false;
+
+		if (op + literals_count + 2 > oend) return false;
+		memcpy(op, literals, literals_count);
+		op += literals_count;
+		*op++ = u8(offset & 0xff);
+		*op++ = u8(offset >> 8);
+
+		if (ml >= 15 && !writeLength(op, oend, ml - 15)) return false;
+		return true;
+	}
+
+	// returns compressed size or 0 if it does not fit in `capacity`
+	u32 compress(const u8* src, u32 size, u8* dst, u32 capacity)
+	{
+		memset(head, 0xff, sizeof(i32) << HASH_LOG);
+
+		u8* op = dst;
+		const u8* oend = dst + capacity;
+		u32 anchor = 0;
+		if (size > MF_LIMIT) {
+			const u32 search_limit = size - MF_LIMIT;
+			const u32 match_limit = size - LAST_LITERALS;
+			u32 pos = 0;
+			u32 next_insert = 0;
+			while (pos < search_limit) {
+				while (next_insert < pos) insert(src, next_insert++);
+
+				u32 offset;
+				u32 len = findMatch(src, pos, match_limit, offset);
+				if (len < MIN_MATCH) {
+					++pos;
+					continue;
+				}
+
+				// take a longer match at the next position if there is one
+				while (pos + 1 < search_limit) {
+					insert(src, next_insert++);
+					u32 next_offset;
+					const u32 next_len = findMatch(src, pos + 1, match_limit, next_offset);
+					if (next_len <= len) break;
+					++pos;
+					len = next_len;
+					offset = next_offset;
+				}
+
+				if (!writeSequence(op, oend, src + anchor, pos - anchor, offset, len)) return 0;
+				pos += len;
+				anchor = pos;
+			}
+		}
+
+		const u32 literals_count = size - anchor;
+		if (op >= oend) return 0;
+		*op++ = u8(minimum(literals_count, 15u) << 4);
+		if (literals_count >= 15 && !writeLength(op, oend, literals_count - 15)) return 0;
+		if (op + literals_count > oend) return 0;
+		memcpy(op, src + anchor, literals_count);
+		op += literals_count;
+		return u32(op - dst);
+	}
+
+	IAllocator& allocator;
+	i32* head;
+	u16* chain;
+};
+
+
+u32 getChunksCount(u64 decompressed_size, u32 chunk_size)
+{
+	return u32((decompressed_size + chunk_size - 1) / chunk_size);
+}
+
+
+bool compress(Span<const u8> src, OutputMemoryStream& dst, Level level, IAllocator& allocator, u32 chunk_size)
+{
+	Local<HighCompressor> high;
+	// HighCompressor is our own encoder, so we check that its chunks decompress back to the source
+	OutputMemoryStream verify(allocator);
+	if (level == Level::HIGH) {
+		high.create(allocator);
+		verify.resize(chunk_size);
+	}
+
+	const u32 chunks_count = getChunksCount(src.length(), chunk_size);
+	const u64 table_offset = dst.size();
+	dst.resize(table_offset + chunks_count * sizeof(u32));
+
+	for (u32 i = 0; i < chunks_count; ++i) {
+		const u8* chunk = src.begin() + i * chunk_size;
+		const u32 size = minimum(chunk_size, src.length() - i * chunk_size);
+		const i32 capacity = LZ4_compressBound(size);
+		const u64 offset = dst.size();
+		dst.resize(offset + capacity);
+		u8* out = dst.getMutableData() + offset;
+		const u32 compressed_size = high.get()
+			? high->compress(chunk, size, out, capacity)
+			: (u32)LZ4_compress_default((const char*)chunk, (char*)out, size, capacity);
+		if (compressed_size == 0) return false;
+
+		if (high.get()) {
+			const i32 res = LZ4_decompress_safe((const char*)out, (char*)verify.getMutableData(), compressed_size, size);
+			if (res != (i32)size || memcmp(verify.data(), chunk, size) != 0) {
+				ASSERT(false);
+				return false;
+			}
+		}
+
+		dst.resize(offset + compressed_size);
+		memcpy(dst.getMutableData() + table_offset + i * sizeof(u32), &compressed_size, sizeof(compressed_size));
+	}
+	return true;
+}
+
+
+bool decompress(Span<const u8> src, Span<u8> dst, u32 from, u32 to, u32 chunk_size)
+{
+	const u32 chunks_count = getChunksCount(dst.length(), chunk_size);
+	if (to > chunks_count || src.length() < chunks_count * sizeof(u32)) return false;
+
+	const u8* table = src.begin();
+	u64 offset = chunks_count * sizeof(u32);
+	for (u32 i = 0; i < from; ++i) {
+		u32 compressed_size;
+		memcpy(&compressed_size, table + i * sizeof(u32), sizeof(compressed_size));
+		offset += compressed_size;
+	}
+
+	for (u32 i = from; i < to; ++i) {
+		u32 compressed_size;
+		memcpy(&compressed_size, table + i * sizeof(u32), sizeof(compressed_size));
+		if (offset + compressed_size > src.length()) return false;
+
+		const u32 size = minimum(chunk_size, dst.length() - i * chunk_size);
+		const i32 res = LZ4_decompress_safe((const char*)src.begin() + offset, (char*)dst.begin() + i * chunk_size, compressed_size, size);
+		if (res != (i32)size) return false;
+		offset += compressed_size;
+	}
+	return true;
+}
+
+
+bool decompressParallel(Span<const u8> src, Span<u8> dst, u32 chunk_size)
+{
+	const u32 chunks_count = getChunksCount(dst.length(), chunk_size);
+	volatile i32 failed = 0;
+	jobs::parallelFor(chunks_count, 1, [&](i32 from, i32 to){
+		if (!decompress(src, dst, from, to, chunk_size)) failed = 1;
+	});
+	return !failed;
+}
+
+
+} // namespace chunked_lz4
+
+
+} // namespace Lumix
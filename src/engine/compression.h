@@ -0,0 +1,33 @@
+#pragma once
+
+#include "engine/lumix.h"
+
+namespace Lumix {
+
+struct IAllocator;
+struct OutputMemoryStream;
+
+// Data compressed as independent LZ4 blocks (chunks), so the chunks can be decompressed in parallel.
+// Layout is u32 compressed size of each chunk followed by the chunks. Each chunk decompresses
+// to chunk_size bytes, except the last one.
+namespace chunked_lz4 {
+
+static constexpr u32 DEFAULT_CHUNK_SIZE = 256 * 1024;
+
+enum class Level : u8 {
+	FAST,
+	// slower compression with better ratio, decompression is as fast as FAST
+	HIGH
+};
+
+LUMIX_ENGINE_API u32 getChunksCount(u64 decompressed_size, u32 chunk_size = DEFAULT_CHUNK_SIZE);
+// appends compressed src to dst
+LUMIX_ENGINE_API bool compress(Span<const u8> src, OutputMemoryStream& dst, Level level, IAllocator& allocator, u32 chunk_size = DEFAULT_CHUNK_SIZE);
+// decompresses chunks [from, to), dst is the whole decompressed data
+LUMIX_ENGINE_API bool decompress(Span<const u8> src, Span<u8> dst, u32 from, u32 to, u32 chunk_size = DEFAULT_CHUNK_SIZE);
+// decompresses all chunks on job system workers, waits until they are done
+LUMIX_ENGINE_API bool decompressParallel(Span<const u8> src, Span<u8> dst, u32 chunk_size = DEFAULT_CHUNK_SIZE);
+
+} // namespace chunked_lz4
+
+} // namespace Lumix
@@ -1,3 +1,4 @@
+#include "engine/allocators.h"
 #include "engine/atomic.h"
 #include "engine/core.h"
 #include "engine/crc32.h"
@@ -26,6 +27,15 @@ void registerEngineAPI(lua_State* L, Engine* engine);
 
 static const u32 SERIALIZED_ENGINE_MAGIC = 0x5f4c454e; // == '_LEN'
 static const u32 SERIALIZED_PROJECT_MAGIC = 0x5f50524c; // == '_PRL'
+static const u32 FRAME_ALLOCATOR_BUFFER_SIZE = 8 * 1024 * 1024;
+
+
+enum class SerializedEngineVersion : u32 {
+	BASE,
+	CHUNKED, // universe version before universe, scenes prefixed with their size
+
+	LATEST
+};
 
 
 #pragma pack(1)
@@ -66,6 +76,7 @@ public:
 
 	EngineImpl(InitArgs&& init_data, IAllocator& allocator)
 		: m_allocator(allocator)
+		, m_frame_allocator(m_allocator, FRAME_ALLOCATOR_BUFFER_SIZE)
 		, m_prefab_resource_manager(m_allocator)
 		, m_resource_manager(m_allocator)
 		, m_lua_resources(m_allocator)
@@ -105,12 +116,12 @@ public:
 			m_file_system = static_cast<UniquePtr<FileSystem>&&>(init_data.file_system);
 		}
 		else if (init_data.working_dir) {
-			m_file_system = FileSystem::create(init_data.working_dir, m_allocator);
+			m_file_system = FileSystem::create(init_data.working_dir, m_allocator, init_data.io_threads_count);
 		}
 		else {
 			char current_dir[LUMIX_MAX_PATH];
 			os::getCurrentDirectory(Span(current_dir)); 
-			m_file_system = FileSystem::create(current_dir, m_allocator);
+			m_file_system = FileSystem::create(current_dir, m_allocator, init_data.io_threads_count);
 		}
 
 		m_resource_manager.init(*m_file_system);
@@ -145,6 +156,11 @@ public:
 
 	~EngineImpl()
 	{
+		m_resource_manager.cancelPrefetch();
+		// cached resources hold references to resources of other managers, so unload them all before any manager is destroyed
+		for (ResourceManager* manager : m_resource_manager.getAll()) {
+			manager->setMemoryBudget(0);
+		}
 		m_prefab_resource_manager.destroy();
 		for (Resource* res : m_lua_resources) {
 			res->decRefCount();
@@ -156,6 +172,9 @@ public:
 
 		lua_close(m_state);
 
+		const FrameAllocator::Stats frame_stats = m_frame_allocator.getStats();
+		logInfo("Frame allocator high-water mark: ", frame_stats.high_water_mark / 1024, " of ", frame_stats.capacity / 1024, " KB");
+
 		unregisterLogCallback<&EngineImpl::logToFile>(this);
 		m_log_file.close();
 		m_is_log_file_open = false;
@@ -187,6 +206,7 @@ public:
 	os::WindowHandle getWindowHandle() override { return m_window_handle; }
 	IAllocator& getAllocator() override { return m_allocator; }
 	PageAllocator& getPageAllocator() override { return m_page_allocator; }
+	FrameAllocator& getFrameAllocator() override { return m_frame_allocator; }
 
 	bool instantiatePrefab(Universe& universe,
 		const struct PrefabResource& prefab,
@@ -305,6 +325,12 @@ public:
 	void update(Universe& context) override
 	{
 		PROFILE_FUNCTION();
+		m_frame_allocator.reset();
+		const FrameAllocator::Stats frame_stats = m_frame_allocator.getStats();
+		profiler::pushInt("frame allocator used", frame_stats.used);
+		profiler::pushInt("frame allocator high-water", frame_stats.high_water_mark);
+		if (frame_stats.overflow_count > 0) profiler::pushInt("frame allocator overflows", frame_stats.overflow_count);
+
 		float dt = m_timer.tick() * m_time_multiplier;
 		if (m_next_frame)
 		{
@@ -312,6 +338,8 @@ public:
 			dt = 1 / 30.0f;
 		}
 		m_last_time_delta = dt;
+		// scenes move a lot of entities, so their hierarchies are updated once at the end
+		context.setTransformsDeferred(true);
 		{
 			PROFILE_BLOCK("update scenes");
 			for (UniquePtr<IScene>& scene : context.getScenes())
@@ -327,8 +355,10 @@ public:
 			}
 		}
 		m_plugin_manager->update(dt, m_paused);
+		context.setTransformsDeferred(false);
 		m_input_system->update(dt);
 		m_file_system->processCallbacks();
+		m_resource_manager.update();
 
 		if (m_next_frame)
 		{
@@ -418,16 +448,21 @@ public:
 	{
 		SerializedEngineHeader header;
 		header.magic = SERIALIZED_ENGINE_MAGIC; // == '_LEN'
-		header.version = 0;
+		header.version = (u32)SerializedEngineVersion::LATEST;
 		serializer.write(header);
 		serializePluginList(serializer);
 		i32 pos = (i32)serializer.size();
+		serializer.write(UniverseVersion::LATEST);
 		ctx.serialize(serializer);
 		serializer.write((i32)ctx.getScenes().size());
 		for (UniquePtr<IScene>& scene : ctx.getScenes()) {
 			serializer.writeString(scene->getPlugin().getName());
 			serializer.write(scene->getVersion());
+			const u64 size_pos = serializer.size();
+			serializer.write((u32)0);
 			scene->serialize(serializer);
+			const u32 size = u32(serializer.size() - size_pos - sizeof(u32));
+			memcpy(serializer.getMutableData() + size_pos, &size, sizeof(size));
 		}
 		u32 crc = crc32((const u8*)serializer.data() + pos, (i32)serializer.size() - pos);
 		return crc;
@@ -443,18 +478,102 @@ public:
 			logError("Wrong or corrupted file");
 			return false;
 		}
+		if (header.version > (u32)SerializedEngineVersion::LATEST) {
+			logError("Unsupported version");
+			return false;
+		}
 		if (!hasSerializedPlugins(serializer)) return false;
 
-		ctx.deserialize(serializer, entity_map);
+		if (header.version <= (u32)SerializedEngineVersion::BASE) {
+			ctx.deserialize(serializer, entity_map, UniverseVersion::BASE);
+			i32 scene_count;
+			serializer.read(scene_count);
+			for (int i = 0; i < scene_count; ++i)
+			{
+				const char* tmp = serializer.readString();
+				IScene* scene = ctx.getScene(tmp);
+				const i32 version = serializer.read<i32>();
+				scene->deserialize(serializer, entity_map, version);
+			}
+			return true;
+		}
+
+		PROFILE_FUNCTION();
+		const UniverseVersion universe_version = serializer.read<UniverseVersion>();
+		if (universe_version > UniverseVersion::LATEST) {
+			logError("Unsupported universe version");
+			return false;
+		}
+		ctx.deserialize(serializer, entity_map, universe_version);
+		return deserializeScenes(ctx, serializer, entity_map);
+	}
+
+
+	struct SceneBlock {
+		IScene* scene;
+		i32 version;
+		const u8* data;
+		u32 size;
+		const EntityMap* entity_map;
+
+		void deserialize() const {
+			PROFILE_BLOCK("deserialize scene");
+			InputMemoryStream blob(data, size);
+			scene->deserialize(blob, *entity_map, version);
+			if (blob.getPosition() != size) {
+				logError("Scene ", scene->getPlugin().getName(), " read ", blob.getPosition(), " bytes, expected ", size);
+			}
+		}
+	};
+
+
+	// each scene has its own block, so scenes which can deserialize on any thread run on workers,
+	// while the rest run here
+	bool deserializeScenes(Universe& ctx, InputMemoryStream& serializer, const EntityMap& entity_map)
+	{
 		i32 scene_count;
 		serializer.read(scene_count);
-		for (int i = 0; i < scene_count; ++i)
-		{
-			const char* tmp = serializer.readString();
-			IScene* scene = ctx.getScene(tmp);
-			const i32 version = serializer.read<i32>();
-			scene->deserialize(serializer, entity_map, version);
+		Array<SceneBlock> blocks(m_allocator);
+		blocks.reserve(scene_count);
+		bool any_parallel = false;
+		for (i32 i = 0; i < scene_count; ++i) {
+			const char* name = serializer.readString();
+			SceneBlock& block = blocks.emplace();
+			block.scene = ctx.getScene(name);
+			block.version = serializer.read<i32>();
+			block.size = serializer.read<u32>();
+			if (serializer.getPosition() + block.size > serializer.size()) {
+				logError("Unexpected end of file");
+				return false;
+			}
+			block.data = (const u8*)serializer.skip(block.size);
+			block.entity_map = &entity_map;
+			if (!block.scene) {
+				logWarning("Scene ", name, " not found, its data are ignored");
+				blocks.pop();
+				continue;
+			}
+			any_parallel = any_parallel || block.scene->isDeserializeThreadSafe();
+		}
+
+		if (!any_parallel) {
+			for (const SceneBlock& block : blocks) block.deserialize();
+			return true;
+		}
+
+		ctx.setComponentsAddedDeferred(true);
+		jobs::SignalHandle signal = jobs::INVALID_HANDLE;
+		for (SceneBlock& block : blocks) {
+			if (!block.scene->isDeserializeThreadSafe()) continue;
+			jobs::run(&block, [](void* data){
+				((const SceneBlock*)data)->deserialize();
+			}, &signal);
+		}
+		for (const SceneBlock& block : blocks) {
+			if (!block.scene->isDeserializeThreadSafe()) block.deserialize();
 		}
+		jobs::wait(signal);
+		ctx.setComponentsAddedDeferred(false);
 		return true;
 	}
 
@@ -497,6 +616,7 @@ public:
 private:
 	IAllocator& m_allocator;
 	PageAllocator m_page_allocator;
+	FrameAllocator m_frame_allocator;
 	UniquePtr<FileSystem> m_file_system;
 	ResourceManagerHub m_resource_manager;
 	UniquePtr<PluginManager> m_plugin_manager;
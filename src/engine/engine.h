@@ -16,6 +16,8 @@ struct LUMIX_ENGINE_API Engine {
 		bool handle_file_drops = false;
 		const char* window_title = "Lumix App";
 		UniquePtr<struct FileSystem> file_system; 
+		// used only if file_system is not set, 0 == based on CPU count
+		u32 io_threads_count = 0;
 	};
 
 	using LuaResourceHandle = u32;
@@ -33,6 +35,8 @@ struct LUMIX_ENGINE_API Engine {
 	virtual struct PluginManager& getPluginManager() = 0;
 	virtual struct ResourceManagerHub& getResourceManager() = 0;
 	virtual struct PageAllocator& getPageAllocator() = 0;
+	// memory valid until the end of the next frame, see FrameAllocator
+	virtual struct FrameAllocator& getFrameAllocator() = 0;
 	virtual IAllocator& getAllocator() = 0;
 	virtual bool instantiatePrefab(Universe& universe,
 		const struct PrefabResource& prefab,
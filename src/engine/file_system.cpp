@@ -2,12 +2,14 @@
 
 #include "engine/allocator.h"
 #include "engine/array.h"
+#include "engine/atomic.h"
 #include "engine/crc32.h"
 #include "engine/delegate_list.h"
 #include "engine/flag_set.h"
-#include "engine/hash_map.h"
+#include "engine/job_system.h"
 #include "engine/metaprogramming.h"
 #include "engine/log.h"
+#include "engine/math.h"
 #include "engine/sync.h"
 #include "engine/thread.h"
 #include "engine/os.h"
@@ -30,7 +32,10 @@ struct AsyncItem {
 	bool isCanceled() const { return flags.isSet(Flags::CANCELED); }
 
 	FileSystem::ContentCallback callback;
+	FileSystem::ProcessCallback process;
 	OutputMemoryStream data;
+	// if set, used instead of data, e.g. uncompressed entries in memory mapped pack files
+	Span<const u8> mapped;
 	StaticString<LUMIX_MAX_PATH> path;
 	u32 id = 0;
 	FlagSet<Flags, u32> flags;
@@ -48,34 +53,96 @@ struct FSTask final : Thread {
 
 	~FSTask() = default;
 
-	void stop();
 	int task() override;
 
 private:
 	FileSystemImpl& m_fs;
-	bool m_finish = false;
 };
 
 
 struct FileSystemImpl : FileSystem {
-	explicit FileSystemImpl(const char* base_path, IAllocator& allocator)
+	// in-flight reads check for cancellation after each chunk
+	static constexpr u64 READ_CHUNK_SIZE = 1024 * 1024;
+
+	explicit FileSystemImpl(const char* base_path, IAllocator& allocator, u32 io_threads_count)
 		: m_allocator(allocator)
-		, m_queue(allocator)	
-		, m_finished(allocator)	
+		, m_queues{Array<AsyncItem>(allocator), Array<AsyncItem>(allocator), Array<AsyncItem>(allocator)}
+		, m_in_flight(allocator)
+		, m_finished(allocator)
+		, m_tasks(allocator)
 		, m_last_id(0)
 		, m_semaphore(0, 0xffFF)
 	{
 		setBasePath(base_path);
-		m_task.create(*this, m_allocator);
-		m_task->create("Filesystem", true);
+		if (io_threads_count == 0) io_threads_count = clamp(os::getCPUsCount() / 2, 1u, 4u);
+		for (u32 i = 0; i < io_threads_count; ++i) {
+			FSTask* task = LUMIX_NEW(m_allocator, FSTask)(*this, m_allocator);
+			task->create("Filesystem", true);
+			m_tasks.push(task);
+		}
 	}
 
 	~FileSystemImpl() override {
-		m_task->stop();
-		m_task->destroy();
-		m_task.destroy();
+		stopTasks();
+	}
+
+	// item read by FSTask, waiting for ProcessCallback on a job worker
+	struct ProcessJob {
+		ProcessJob(FileSystemImpl& fs, AsyncItem&& item) : fs(fs), item(static_cast<AsyncItem&&>(item)) {}
+
+		FileSystemImpl& fs;
+		AsyncItem item;
+	};
+
+	static void processItem(void* data) {
+		ProcessJob* job = (ProcessJob*)data;
+		FileSystemImpl& fs = job->fs;
+		AsyncItem& item = job->item;
+
+		OutputMemoryStream result(fs.m_allocator);
+		bool success = true;
+		if (!fs.isCanceled(item)) {
+			PROFILE_BLOCK("process file");
+			profiler::pushString(item.path);
+			const Span<const u8> content = item.mapped.begin() ? item.mapped : Span((const u8*)item.data.data(), (u32)item.data.size());
+			success = item.process.invoke(content, result);
+		}
+
+		{
+			MutexGuard lock(fs.m_mutex);
+			fs.m_in_flight.eraseItem(&item);
+			if (item.isCanceled()) {
+				ASSERT(fs.m_work_counter > 0);
+				--fs.m_work_counter;
+			}
+			else {
+				if (!success) item.flags.set(AsyncItem::Flags::FAILED);
+				if (result.size() > 0) {
+					item.data = static_cast<OutputMemoryStream&&>(result);
+					item.mapped = Span<const u8>();
+				}
+				fs.m_finished.emplace(static_cast<AsyncItem&&>(item));
+			}
+		}
+		LUMIX_DELETE(fs.m_allocator, job);
+	}
+
+protected:
+	// tasks call virtual readAsync, so derived classes must stop them before releasing what it reads
+	void stopTasks() {
+		m_finish = true;
+		for (i32 i = 0; i < m_tasks.size(); ++i) m_semaphore.signal();
+		for (FSTask* task : m_tasks) {
+			task->destroy();
+			LUMIX_DELETE(m_allocator, task);
+		}
+		m_tasks.clear();
+		// tasks do not start new process jobs anymore, jobs can still read mapped content
+		jobs::wait(m_processing);
 	}
 
+public:
+
 
 	bool hasWork() override
 	{
@@ -108,18 +175,53 @@ struct FileSystemImpl : FileSystem {
 		return true;
 	}
 
-	AsyncHandle getContent(const Path& file, const ContentCallback& callback) override
+	bool isCanceled(const AsyncItem& item) {
+		MutexGuard lock(m_mutex);
+		return item.isCanceled();
+	}
+
+	// called from FSTask, returns false if the read failed or was canceled
+	virtual bool readAsync(AsyncItem& item, OutputMemoryStream& content) {
+		os::InputFile file;
+		StaticString<LUMIX_MAX_PATH> full_path(m_base_path, item.path);
+
+		if (!file.open(full_path)) return false;
+
+		content.resize(file.size());
+		for (u64 offset = 0; offset < content.size(); offset += READ_CHUNK_SIZE) {
+			if (isCanceled(item)) {
+				file.close();
+				return false;
+			}
+			const u64 size = minimum(READ_CHUNK_SIZE, content.size() - offset);
+			if (!file.read(content.getMutableData() + offset, size)) {
+				logError("Could not read ", item.path);
+				file.close();
+				return false;
+			}
+		}
+		file.close();
+		return true;
+	}
+
+	AsyncHandle getContent(const Path& file, const ContentCallback& callback, Priority priority) override
+	{
+		return getContent(file, callback, ProcessCallback(), priority);
+	}
+
+	AsyncHandle getContent(const Path& file, const ContentCallback& callback, const ProcessCallback& process, Priority priority) override
 	{
 		if (file.isEmpty()) return AsyncHandle::invalid();
 
 		MutexGuard lock(m_mutex);
 		++m_work_counter;
-		AsyncItem& item = m_queue.emplace(m_allocator);
+		AsyncItem& item = m_queues[(u32)priority].emplace(m_allocator);
 		++m_last_id;
 		if (m_last_id == 0) ++m_last_id;
 		item.id = m_last_id;
 		item.path = file.c_str();
 		item.callback = callback;
+		item.process = process;
 		m_semaphore.signal();
 		return AsyncHandle(item.id);
 	}
@@ -128,10 +230,19 @@ struct FileSystemImpl : FileSystem {
 	void cancel(AsyncHandle async) override
 	{
 		MutexGuard lock(m_mutex);
-		for (AsyncItem& item : m_queue) {
-			if (item.id == async.value) {
-				item.flags.set(AsyncItem::Flags::CANCELED);
-				--m_work_counter;
+		for (Array<AsyncItem>& queue : m_queues) {
+			for (i32 i = 0, c = queue.size(); i < c; ++i) {
+				if (queue[i].id == async.value) {
+					queue.erase(i);
+					--m_work_counter;
+					return;
+				}
+			}
+		}
+		// FSTask aborts the read and drops the item
+		for (AsyncItem* item : m_in_flight) {
+			if (item->id == async.value) {
+				item->flags.set(AsyncItem::Flags::CANCELED);
 				return;
 			}
 		}
@@ -244,7 +355,12 @@ struct FileSystemImpl : FileSystem {
 			m_mutex.exit();
 
 			if(!item.isCanceled()) {
-				item.callback.invoke(item.data.size(), (const u8*)item.data.data(), !item.isFailed());
+				if (item.mapped.begin()) {
+					item.callback.invoke(item.mapped.length(), item.mapped.begin(), !item.isFailed());
+				}
+				else {
+					item.callback.invoke(item.data.size(), (const u8*)item.data.data(), !item.isFailed());
+				}
 			}
 
 			if (timer.getTimeSinceStart() > 0.1f) {
@@ -254,13 +370,18 @@ struct FileSystemImpl : FileSystem {
 	}
 
 	IAllocator& m_allocator;
-	Local<FSTask> m_task;
 	StaticString<LUMIX_MAX_PATH> m_base_path;
-	Array<AsyncItem> m_queue;
+	Array<AsyncItem> m_queues[(u32)Priority::COUNT];
+	// items being read by FSTasks, owned by the tasks
+	Array<AsyncItem*> m_in_flight;
 	u32 m_work_counter = 0;
 	Array<AsyncItem> m_finished;
+	Array<FSTask*> m_tasks;
 	Mutex m_mutex;
 	Semaphore m_semaphore;
+	volatile bool m_finish = false;
+	// finished when there are no process jobs running
+	jobs::SignalHandle m_processing = jobs::INVALID_HANDLE;
 
 	u32 m_last_id;
 };
@@ -268,114 +389,212 @@ struct FileSystemImpl : FileSystem {
 
 int FSTask::task()
 {
-	while (!m_finish) {
+	for (;;) {
 		m_fs.m_semaphore.wait();
-		if (m_finish) break;
+		if (m_fs.m_finish) break;
 
-		StaticString<LUMIX_MAX_PATH> path;
+		AsyncItem item(m_fs.m_allocator);
 		{
 			MutexGuard lock(m_fs.m_mutex);
-			ASSERT(!m_fs.m_queue.empty());
-			path = m_fs.m_queue[0].path;
-			if (m_fs.m_queue[0].isCanceled()) {
-				m_fs.m_queue.erase(0);
-				continue;
+			Array<AsyncItem>* queue = nullptr;
+			for (Array<AsyncItem>& q : m_fs.m_queues) {
+				if (!q.empty()) {
+					queue = &q;
+					break;
+				}
 			}
+			// canceled items are removed from queues, but the semaphore is still signaled for them
+			if (!queue) continue;
+
+			item = static_cast<AsyncItem&&>((*queue)[0]);
+			queue->erase(0);
+			m_fs.m_in_flight.push(&item);
 		}
 
-		OutputMemoryStream data(m_fs.m_allocator);
-		bool success = m_fs.getContentSync(Path(path), data);
+		PROFILE_BLOCK("read file");
+		profiler::pushString(item.path);
+		const bool success = m_fs.readAsync(item, item.data);
 
-		{
-			MutexGuard lock(m_fs.m_mutex);
-			if (!m_fs.m_queue[0].isCanceled()) {
-				m_fs.m_finished.emplace(static_cast<AsyncItem&&>(m_fs.m_queue[0]));
-				m_fs.m_finished.back().data = static_cast<OutputMemoryStream&&>(data);
-				if(!success) {
-					m_fs.m_finished.back().flags.set(AsyncItem::Flags::FAILED);
-				}
-			}
-			m_fs.m_queue.erase(0);
+		MutexGuard lock(m_fs.m_mutex);
+		m_fs.m_in_flight.eraseItem(&item);
+		if (item.isCanceled()) {
+			ASSERT(m_fs.m_work_counter > 0);
+			--m_fs.m_work_counter;
+			continue;
+		}
+		if (!success) item.flags.set(AsyncItem::Flags::FAILED);
+		else if (item.process.isValid()) {
+			// stays in flight, so it can be canceled while it's processed
+			FileSystemImpl::ProcessJob* job = LUMIX_NEW(m_fs.m_allocator, FileSystemImpl::ProcessJob)(m_fs, static_cast<AsyncItem&&>(item));
+			m_fs.m_in_flight.push(&job->item);
+			jobs::run(job, &FileSystemImpl::processItem, &m_fs.m_processing);
+			continue;
 		}
+		m_fs.m_finished.emplace(static_cast<AsyncItem&&>(item));
 	}
 	return 0;
 }
 
+namespace pak {
 
-void FSTask::stop()
-{
-	m_finish = true;
-	m_fs.m_semaphore.signal();
+bool compress(Span<const u8> src, OutputMemoryStream& dst, chunked_lz4::Level level, IAllocator& allocator) {
+	const u64 offset = dst.size();
+	if (!chunked_lz4::compress(src, dst, level, allocator)) return false;
+	return dst.size() - offset < src.length() / 4 * 3;
 }
 
+} // namespace pak
+
 struct PackFileSystem : FileSystemImpl {
-	PackFileSystem(const char* pak_path, IAllocator& allocator) 
-		: FileSystemImpl("pack://", allocator) 
-		, m_map(allocator)
-		, m_allocator(allocator)
+	PackFileSystem(const char* pak_path, IAllocator& allocator, u32 io_threads_count) 
+		: FileSystemImpl("pack://", allocator, io_threads_count) 
 	{
-		if (!m_file.open(pak_path)) {
-			logError("Failed to open game.pak");
+		m_data = (const u8*)os::mapFile(pak_path, m_size);
+		if (!m_data) {
+			logError("Failed to open ", pak_path);
+			return;
+		}
+
+		pak::Footer footer;
+		if (m_size >= sizeof(footer)) memcpy(&footer, m_data + m_size - sizeof(footer), sizeof(footer));
+		if (m_size < sizeof(footer) 
+			|| footer.magic != pak::Footer::MAGIC 
+			|| footer.version != pak::Footer::VERSION 
+			|| footer.chunk_size == 0
+			|| footer.toc_offset > m_size - sizeof(footer)
+			|| footer.count > (m_size - sizeof(footer) - footer.toc_offset) / sizeof(pak::Entry)
+			|| !areEntriesValid((const pak::Entry*)(m_data + footer.toc_offset), footer.count, footer.toc_offset)) 
+		{
+			logError(pak_path, " is not a valid pack file, export the game again.");
+			os::unmapFile(m_data, m_size);
+			m_data = nullptr;
 			return;
 		}
-		const u32 count = m_file.read<u32>();
+		m_entries = (const pak::Entry*)(m_data + footer.toc_offset);
+		m_count = footer.count;
+		m_chunk_size = footer.chunk_size;
+	}
+
+	// entries must be in the data before the table, contents are passed around as u32 sized spans
+	static bool areEntriesValid(const pak::Entry* entries, u32 count, u64 data_size) {
 		for (u32 i = 0; i < count; ++i) {
-			const u32 hash = m_file.read<u32>();
-			PackFile& f = m_map.insert(hash);
-			f.offset = m_file.read<u64>();
-			f.size = m_file.read<u64>();
+			const pak::Entry& entry = entries[i];
+			if (entry.offset > data_size || entry.size > data_size - entry.offset) return false;
+			if (entry.size > 0xffFFffFF || entry.decompressed_size > 0xffFFffFF) return false;
 		}
+		return true;
 	}
 
 	~PackFileSystem() {
-		m_file.close();
+		stopTasks();
+		if (m_data) os::unmapFile(m_data, m_size);
 	}
 
-	bool getContentSync(const Path& path, OutputMemoryStream& content) override {
-		ASSERT(content.size() == 0);
+	const pak::Entry* find(const Path& path) const {
 		Span<const char> basename = Path::getBasename(path.c_str());
 		u32 hash;
 		fromCString(basename, hash);
 		if (basename[0] < '0' || basename[0] > '9' || hash == 0) {
 			hash = path.getHash();
 		}
-		auto iter = m_map.find(hash);
-		if (!iter.isValid()) {
-			iter = m_map.find(path.getHash());
-			if (!iter.isValid()) return false;
+		const pak::Entry* entry = find(hash);
+		if (!entry) entry = find(path.getHash());
+		return entry;
+	}
+
+	// entries are sorted by hash
+	const pak::Entry* find(u32 hash) const {
+		u32 first = 0;
+		u32 count = m_count;
+		while (count > 0) {
+			const u32 step = count / 2;
+			if (m_entries[first + step].hash < hash) {
+				first += step + 1;
+				count -= step + 1;
+			}
+			else {
+				count = step;
+			}
+		}
+		return first < m_count && m_entries[first].hash == hash ? &m_entries[first] : nullptr;
+	}
+
+	// decompresses chunks [from, to) of compressed entry
+	bool decompress(const pak::Entry& entry, u32 from, u32 to, OutputMemoryStream& content) const {
+		const Span<const u8> src(m_data + entry.offset, (u32)entry.size);
+		const Span<u8> dst(content.getMutableData(), (u32)content.size());
+		return chunked_lz4::decompress(src, dst, from, to, m_chunk_size);
+	}
+
+	bool getContentSync(const Path& path, OutputMemoryStream& content) override {
+		ASSERT(content.size() == 0);
+		const pak::Entry* entry = m_data ? find(path) : nullptr;
+		if (!entry) return false;
+
+		if (!(entry->flags & pak::Entry::COMPRESSED)) {
+			content.write(m_data + entry->offset, entry->size);
+			return true;
 		}
 
-		content.resize(iter.value().size);
-		MutexGuard lock(m_mutex);
-		const u32 header_size = sizeof(u32) + m_map.size() * (2 * sizeof(u64) + sizeof(u32));
-		if (!m_file.seek(iter.value().offset + header_size) || !m_file.read(content.getMutableData(), content.size())) {
-			logError("Could not read ", path);
+		content.resize(entry->decompressed_size);
+		const u32 chunks_count = chunked_lz4::getChunksCount(entry->decompressed_size, m_chunk_size);
+		if (!decompress(*entry, 0, chunks_count, content)) {
+			logError("Could not decompress ", path);
 			return false;
 		}
+		return true;
+	}
+
+	bool readAsync(AsyncItem& item, OutputMemoryStream& content) override {
+		const Path path(item.path);
+		const pak::Entry* entry = m_data ? find(path) : nullptr;
+		if (!entry) return false;
+
+		if (!(entry->flags & pak::Entry::COMPRESSED)) {
+			// no copy, but touch the pages here so the callback does not wait for the disk
+			const u8* data = m_data + entry->offset;
+			u8 sum = 0;
+			for (u64 offset = 0; offset < entry->size; offset += READ_CHUNK_SIZE) {
+				if (isCanceled(item)) return false;
+				const u64 to = minimum(offset + READ_CHUNK_SIZE, entry->size);
+				for (u64 i = offset; i < to; i += 4096) sum += ((const volatile u8*)data)[i];
+			}
+			m_touched += sum;
+			item.mapped = Span(data, (u32)entry->size);
+			return true;
+		}
 
+		content.resize(entry->decompressed_size);
+		const u32 chunks_count = chunked_lz4::getChunksCount(entry->decompressed_size, m_chunk_size);
+		// chunk at a time, so canceled reads stop early
+		for (u32 i = 0; i < chunks_count; ++i) {
+			if (isCanceled(item)) return false;
+			if (!decompress(*entry, i, i + 1, content)) {
+				logError("Could not decompress ", path);
+				return false;
+			}
+		}
 		return true;
 	}
-	
-	struct PackFile {
-		u64 offset;
-		u64 size;
-	};
 
-	IAllocator& m_allocator;
-	HashMap<u32, PackFile> m_map;
-	Mutex m_mutex;
-	os::InputFile m_file;
+	const u8* m_data = nullptr;
+	u64 m_size = 0;
+	const pak::Entry* m_entries = nullptr;
+	u32 m_count = 0;
+	u32 m_chunk_size = chunked_lz4::DEFAULT_CHUNK_SIZE;
+	// keeps the page touching loop from being optimized away
+	volatile u8 m_touched = 0;
 };
 
 
-UniquePtr<FileSystem> FileSystem::create(const char* base_path, IAllocator& allocator)
+UniquePtr<FileSystem> FileSystem::create(const char* base_path, IAllocator& allocator, u32 io_threads_count)
 {
-	return UniquePtr<FileSystemImpl>::create(allocator, base_path, allocator);
+	return UniquePtr<FileSystemImpl>::create(allocator, base_path, allocator, io_threads_count);
 }
 
-UniquePtr<FileSystem> FileSystem::createPacked(const char* pak_path, IAllocator& allocator)
+UniquePtr<FileSystem> FileSystem::createPacked(const char* pak_path, IAllocator& allocator, u32 io_threads_count)
 {
-	return UniquePtr<PackFileSystem>::create(allocator, pak_path, allocator);
+	return UniquePtr<PackFileSystem>::create(allocator, pak_path, allocator, io_threads_count);
 }
 
 
@@ -1,9 +1,10 @@
 #pragma once
 
-#include "engine/lumix.h"
+#include "engine/compression.h"
 
 namespace Lumix {
 
+struct OutputMemoryStream;
 template <typename T> struct Delegate;
 template <typename T> struct UniquePtr;
 
@@ -15,6 +16,18 @@ namespace os {
 
 struct LUMIX_ENGINE_API FileSystem {
 	using ContentCallback = Delegate<void(u64, const u8*, bool)>;
+	// called on a job worker with the content of the file, before ContentCallback is called on the main thread,
+	// e.g. to decompress it; ContentCallback gets the output instead of the content, unless the output is empty
+	using ProcessCallback = Delegate<bool(Span<const u8>, OutputMemoryStream&)>;
+
+	// async requests with higher priority are read first, requests with the same priority in FIFO order
+	enum class Priority : u8 {
+		HIGH, // needed right now, e.g. visible
+		NORMAL,
+		LOW, // prefetch
+
+		COUNT
+	};
 
 	struct LUMIX_ENGINE_API AsyncHandle {
 		static AsyncHandle invalid() { return AsyncHandle(0xffFFffFF); }
@@ -23,8 +36,9 @@ struct LUMIX_ENGINE_API FileSystem {
 		bool isValid() const { return value != 0xffFFffFF; }
 	};
 
-	static UniquePtr<FileSystem> create(const char* base_path, struct IAllocator& allocator);
-	static UniquePtr<FileSystem> createPacked(const char* pak_path, struct IAllocator& allocator);
+	// io_threads_count == 0 picks the number of I/O threads based on CPU count
+	static UniquePtr<FileSystem> create(const char* base_path, struct IAllocator& allocator, u32 io_threads_count = 0);
+	static UniquePtr<FileSystem> createPacked(const char* pak_path, struct IAllocator& allocator, u32 io_threads_count = 0);
 
 	virtual ~FileSystem() {}
 
@@ -45,8 +59,46 @@ struct LUMIX_ENGINE_API FileSystem {
 	virtual void makeAbsolute(Span<char> absolute, const char* relative) const = 0;
 
 	[[nodiscard]] virtual bool getContentSync(const struct Path& file, struct OutputMemoryStream& content) =  0;
-	virtual AsyncHandle getContent(const Path& file, const ContentCallback& callback) = 0;
+	virtual AsyncHandle getContent(const Path& file, const ContentCallback& callback, Priority priority = Priority::NORMAL) = 0;
+	// the request is in progress, i.e. hasWork() and cancel() work, until `process` is done and `callback` is called
+	virtual AsyncHandle getContent(const Path& file, const ContentCallback& callback, const ProcessCallback& process, Priority priority = Priority::NORMAL) = 0;
+	// callback of canceled request is not called, in-flight read is aborted
 	virtual void cancel(AsyncHandle handle) = 0;
 };
 
+namespace pak {
+
+// Pack file is the data of all entries, each aligned to ALIGNMENT, followed by the table of entries
+// sorted by hash and the footer. Compressed entries use chunked_lz4 format with Footer::chunk_size chunks.
+static constexpr u32 ALIGNMENT = 16;
+
+#pragma pack(1)
+struct Entry {
+	enum Flags : u32 {
+		COMPRESSED = 1 << 0
+	};
+	u32 hash;
+	u32 flags;
+	u64 offset;
+	u64 size;
+	u64 decompressed_size;
+};
+
+struct Footer {
+	static constexpr u32 MAGIC = 'LPAK';
+	// version 1 was the unaligned (hash, offset, size) table at the beginning of the file
+	static constexpr u32 VERSION = 2;
+	u64 toc_offset;
+	u32 count;
+	u32 chunk_size = chunked_lz4::DEFAULT_CHUNK_SIZE;
+	u32 version = VERSION;
+	u32 magic = MAGIC;
+};
+#pragma pack()
+
+// compresses src to dst, returns false if it's not worth it
+LUMIX_ENGINE_API bool compress(Span<const u8> src, OutputMemoryStream& dst, chunked_lz4::Level level, IAllocator& allocator);
+
+} // namespace pak
+
 } // namespace Lumix
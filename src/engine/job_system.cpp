@@ -28,6 +28,7 @@ struct Job
 	SignalHandle dec_on_finish;
 	SignalHandle precondition;
 	u8 worker_index;
+	FiberPoolHandle fiber_pool;
 };
 
 
@@ -36,6 +37,169 @@ struct Signal {
 	u32 generation;
 	Job next_job;
 	SignalHandle sibling;
+	u32 next_free;
+};
+
+
+// Items are allocated in chunks and never move, so references stay valid while the pool grows.
+// Free items are in a lock-free stack, T must have `u32 next_free` member.
+template <typename T, u32 CHUNK_SIZE, u32 MAX_CHUNKS>
+struct GrowablePool
+{
+	static constexpr u32 NONE = 0xffFFffFF;
+
+	~GrowablePool()
+	{
+		for (u32 i = 0; i < m_chunks_count; ++i) {
+			for (u32 j = 0; j < CHUNK_SIZE; ++j) {
+				m_chunks[i][j].~T();
+			}
+			m_allocator->deallocate_aligned(m_chunks[i]);
+		}
+	}
+
+	T& operator[](u32 idx) { return m_chunks[idx / CHUNK_SIZE][idx % CHUNK_SIZE]; }
+	u32 capacity() const { return m_chunks_count * CHUNK_SIZE; }
+
+	// returns NONE if the pool is full and can not grow anymore
+	u32 alloc()
+	{
+		for (;;) {
+			const i64 head = m_free_head;
+			const u32 idx = u32(head);
+			if (idx == NONE) {
+				if (!grow()) return NONE;
+				continue;
+			}
+
+			const u32 next = (*this)[idx].next_free;
+			if (compareAndExchange64(&m_free_head, makeHead(head, next), head)) {
+				const i32 used = atomicIncrement(&m_used);
+				for (;;) {
+					const i32 high = m_high_water_mark;
+					if (used <= high || compareAndExchange(&m_high_water_mark, used, high)) break;
+				}
+				return idx;
+			}
+		}
+	}
+
+	void free(u32 idx)
+	{
+		pushRange(idx, idx);
+		atomicDecrement(&m_used);
+	}
+
+	bool grow()
+	{
+		MutexGuard lock(m_grow_mutex);
+		if (u32(m_free_head) != NONE) return true;
+		if (m_chunks_count == MAX_CHUNKS) return false;
+
+		T* chunk = (T*)m_allocator->allocate_aligned(sizeof(T) * CHUNK_SIZE, alignof(T));
+		const u32 first = m_chunks_count * CHUNK_SIZE;
+		for (u32 i = 0; i < CHUNK_SIZE; ++i) {
+			new (NewPlaceholder(), chunk + i) T();
+			chunk[i].next_free = first + i + 1;
+		}
+		m_chunks[m_chunks_count] = chunk;
+		memoryBarrier();
+		++m_chunks_count;
+		pushRange(first, first + CHUNK_SIZE - 1);
+		return true;
+	}
+
+	// pushes linked list of items, from first to last, to the free stack
+	void pushRange(u32 first, u32 last)
+	{
+		for (;;) {
+			const i64 head = m_free_head;
+			(*this)[last].next_free = u32(head);
+			if (compareAndExchange64(&m_free_head, makeHead(head, first), head)) return;
+		}
+	}
+
+	// upper 32 bits are incremented on every change to avoid ABA
+	static i64 makeHead(i64 prev_head, u32 idx)
+	{
+		const u64 tag = (u64(prev_head) >> 32) + 1;
+		return i64((tag << 32) | idx);
+	}
+
+	IAllocator* m_allocator = nullptr;
+	Mutex m_grow_mutex;
+	T* m_chunks[MAX_CHUNKS] = {};
+	volatile u32 m_chunks_count = 0;
+	volatile i64 m_free_head = NONE;
+	volatile i32 m_used = 0;
+	volatile i32 m_high_water_mark = 0;
+};
+
+
+// Chase-Lev work-stealing deque
+// push and pop are called only by the owning worker, steal by any thread
+struct WorkQueue
+{
+	enum { CAPACITY = 4096, MASK = CAPACITY - 1 };
+
+	bool push(const Job& job)
+	{
+		const i64 b = m_bottom;
+		const i64 t = m_top;
+		if (b - t >= CAPACITY) return false;
+
+		m_jobs[b & MASK] = job;
+		memoryBarrier();
+		m_bottom = b + 1;
+		return true;
+	}
+
+
+	bool pop(Job* job)
+	{
+		const i64 b = m_bottom - 1;
+		m_bottom = b;
+		memoryBarrier();
+		const i64 t = m_top;
+		if (t > b) {
+			m_bottom = b + 1;
+			return false;
+		}
+
+		const Job tmp = m_jobs[b & MASK];
+		if (t == b) {
+			// last job, race with thieves
+			const bool won = compareAndExchange64(&m_top, t + 1, t);
+			m_bottom = b + 1;
+			if (!won) return false;
+		}
+		*job = tmp;
+		return true;
+	}
+
+
+	bool steal(Job* job)
+	{
+		for (;;) {
+			const i64 t = m_top;
+			memoryBarrier();
+			const i64 b = m_bottom;
+			if (t >= b) return false;
+
+			const Job tmp = m_jobs[t & MASK];
+			if (compareAndExchange64(&m_top, t + 1, t)) {
+				*job = tmp;
+				return true;
+			}
+		}
+	}
+
+
+	bool isEmpty() const { return m_bottom <= m_top; }
+
+	alignas(64) volatile i64 m_top = 0;
+	alignas(64) volatile i64 m_bottom = 0;
+	Job m_jobs[CAPACITY];
 };
 
 
@@ -44,11 +208,20 @@ struct WorkerTask;
 
 struct FiberDecl
 {
-	int idx;
+	u32 idx;
+	u32 next_free;
+	FiberPoolHandle pool;
 	Fiber::Handle fiber = Fiber::INVALID_FIBER;
 	Job current_job;
 };
 
+
+struct FiberPool
+{
+	u32 stack_size;
+	GrowablePool<FiberDecl, 64, 64> fibers;
+};
+
 #ifdef _WIN32
 	static void __stdcall manage(void* data);
 #else
@@ -62,17 +235,13 @@ struct System
 		, m_workers(allocator)
 		, m_job_queue(allocator)
 		, m_ready_fibers(allocator)
-		, m_signals_pool(allocator)
-		, m_free_queue(allocator)
-		, m_free_fibers(allocator)
 		, m_backup_workers(allocator)
+		, m_sleeping_workers(allocator)
 	{
-		m_signals_pool.resize(4096);
-		m_free_queue.resize(4096);
-		for(int i = 0; i < 4096; ++i) {
-			m_free_queue[i] = i;
-			m_signals_pool[i].sibling = jobs::INVALID_HANDLE;
-			m_signals_pool[i].generation = 0;
+		m_signals.m_allocator = &allocator;
+		m_signals.grow();
+		for (FiberPool& pool : m_fiber_pools) {
+			pool.fibers.m_allocator = &allocator;
 		}
 	}
 
@@ -81,13 +250,20 @@ struct System
 	Mutex m_job_queue_sync;
 	Array<WorkerTask*> m_workers;
 	Array<WorkerTask*> m_backup_workers;
+	Array<WorkerTask*> m_sleeping_workers;
+	volatile i32 m_sleeping_count = 0;
+	// workers which are awake, have no work of their own and try to steal
+	volatile i32 m_searching_count = 0;
+	// jobs pushed from non-worker threads or when worker's queue is full
 	Array<Job> m_job_queue;
-	Array<Signal> m_signals_pool;
-	FiberDecl m_fiber_pool[512];
-	Array<FiberDecl*> m_free_fibers;
+	// hint for lock-free check, modified only with m_job_queue_sync
+	volatile i32 m_locked_work_count = 0;
+	// handle's id has 16 bits, so there can be at most 16 * 4096 signals
+	GrowablePool<Signal, 4096, 16> m_signals;
+	FiberPool m_fiber_pools[MAX_FIBER_POOLS];
+	u32 m_fiber_pools_count = 0;
 	Array<FiberDecl*> m_ready_fibers;
 	IAllocator& m_allocator;
-	Array<u32> m_free_queue;
 };
 
 
@@ -103,6 +279,27 @@ WorkerTask* getWorker()
 
 static bool isValid(SignalHandle waitable) { return waitable != INVALID_HANDLE; }
 
+
+static FiberDecl* allocFiber(FiberPoolHandle pool_handle)
+{
+	FiberPool& pool = g_system->m_fiber_pools[pool_handle];
+	const u32 idx = pool.fibers.alloc();
+	LUMIX_FATAL(idx != pool.fibers.NONE);
+	FiberDecl* fiber = &pool.fibers[idx];
+	if (!Fiber::isValid(fiber->fiber)) {
+		fiber->idx = idx;
+		fiber->pool = pool_handle;
+		fiber->fiber = Fiber::create(pool.stack_size, manage, fiber);
+	}
+	return fiber;
+}
+
+
+static void freeFiber(FiberDecl* fiber)
+{
+	g_system->m_fiber_pools[fiber->pool].fibers.free(fiber->idx);
+}
+
 struct WorkerTask : Thread
 {
 	WorkerTask(System& system, u8 worker_index) 
@@ -131,11 +328,7 @@ struct WorkerTask : Thread
 	#endif
 	{
 		g_system->m_sync.enter();
-		FiberDecl* fiber = g_system->m_free_fibers.back();
-		g_system->m_free_fibers.pop();
-		if (!Fiber::isValid(fiber->fiber)) {
-			fiber->fiber = Fiber::create(64 * 1024, manage, fiber);
-		}
+		FiberDecl* fiber = allocFiber(DEFAULT_FIBER_POOL);
 		getWorker()->m_current_fiber = fiber;
 		Fiber::switchTo(&getWorker()->m_primary_fiber, fiber->fiber);
 	}
@@ -145,68 +338,113 @@ struct WorkerTask : Thread
 	FiberDecl* m_current_fiber = nullptr;
 	Fiber::Handle m_primary_fiber;
 	System& m_system;
+	// job which needs a fiber from another pool, picked by the next fiber on this worker
+	Job m_pending_job;
+	WorkQueue m_work_queue;
+	// jobs pinned to this worker
 	Array<Job> m_job_queue;
 	Array<FiberDecl*> m_ready_fibers;
+	// hint for lock-free check, modified only with m_job_queue_sync
+	volatile i32 m_locked_work_count = 0;
 	u8 m_worker_index;
+	u32 m_steal_offset = 0;
 	bool m_is_enabled = false;
 	bool m_is_backup = false;
+	bool m_is_sleeping = false;
+	bool m_is_searching = false;
 };
 
 
 static LUMIX_FORCE_INLINE SignalHandle allocateSignal()
 {
-	LUMIX_FATAL(!g_system->m_free_queue.empty());
+	const u32 id = g_system->m_signals.alloc();
+	LUMIX_FATAL(id != g_system->m_signals.NONE);
 
-	const u32 handle = g_system->m_free_queue.back();
-	Signal& w = g_system->m_signals_pool[handle & HANDLE_ID_MASK];
+	Signal& w = g_system->m_signals[id];
 	w.value = 1;
 	w.sibling = jobs::INVALID_HANDLE;
 	w.next_job.task = nullptr;
-	g_system->m_free_queue.pop();
 
-	return (handle & HANDLE_ID_MASK) | w.generation;
+	return id | w.generation;
+}
+
+
+// call with m_job_queue_sync locked
+static void wakeupWorker(WorkerTask* worker)
+{
+	if (worker->m_is_sleeping) {
+		worker->m_is_sleeping = false;
+		g_system->m_sleeping_workers.swapAndPopItem(worker);
+		atomicDecrement(&g_system->m_sleeping_count);
+		if (!worker->m_is_searching) {
+			worker->m_is_searching = true;
+			atomicIncrement(&g_system->m_searching_count);
+		}
+	}
+	worker->wakeup();
+}
+
+
+// call with m_job_queue_sync locked
+// if some worker is already searching for work, it's going to find the new job, so we do not wake anyone
+static void wakeupOneWorker()
+{
+	if (g_system->m_searching_count > 0) return;
+	if (g_system->m_sleeping_workers.empty()) return;
+	wakeupWorker(g_system->m_sleeping_workers.back());
 }
 
 
 static void pushJob(const Job& job)
 {
 	if (job.worker_index != ANY_WORKER) {
+		MutexGuard lock(g_system->m_job_queue_sync);
 		WorkerTask* worker = g_system->m_workers[job.worker_index % g_system->m_workers.size()];
 		worker->m_job_queue.push(job);
-		worker->wakeup();
+		++worker->m_locked_work_count;
+		wakeupWorker(worker);
 		return;
 	}
-	g_system->m_job_queue.push(job);
-	for (WorkerTask* worker : g_system->m_workers) {
-		worker->wakeup();
-	}
-	for (WorkerTask* worker : g_system->m_backup_workers) {
-		if (worker->m_is_enabled) worker->wakeup();
+
+	WorkerTask* worker = getWorker();
+	if (!worker || worker->m_is_backup || !worker->m_work_queue.push(job)) {
+		MutexGuard lock(g_system->m_job_queue_sync);
+		g_system->m_job_queue.push(job);
+		++g_system->m_locked_work_count;
+		wakeupOneWorker();
+		return;
 	}
+
+	// pairs with the barrier in manage, between registering as sleeping and checking queues
+	memoryBarrier();
+	if (g_system->m_searching_count > 0 || g_system->m_sleeping_count == 0) return;
+	
+	MutexGuard lock(g_system->m_job_queue_sync);
+	wakeupOneWorker();
 }
 
 
 void trigger(SignalHandle handle)
 {
-	LUMIX_FATAL((handle & HANDLE_ID_MASK) < 4096);
+	LUMIX_FATAL((handle & HANDLE_ID_MASK) < g_system->m_signals.capacity());
 
 	MutexGuard lock(g_system->m_sync);
 	
-	Signal& counter = g_system->m_signals_pool[handle & HANDLE_ID_MASK];
+	Signal& counter = g_system->m_signals[handle & HANDLE_ID_MASK];
 	--counter.value;
 	if (counter.value > 0) return;
 
 	SignalHandle iter = handle;
 	while (isValid(iter)) {
-		Signal& signal = g_system->m_signals_pool[iter & HANDLE_ID_MASK];
+		Signal& signal = g_system->m_signals[iter & HANDLE_ID_MASK];
 		if(signal.next_job.task) {
-			MutexGuard queue_lock(g_system->m_job_queue_sync);
 			pushJob(signal.next_job);
 		}
 		signal.generation = (((signal.generation >> 16) + 1) & 0xffFF) << 16;
-		g_system->m_free_queue.push((iter & HANDLE_ID_MASK) | signal.generation);
 		signal.next_job.task = nullptr;
-		iter = signal.sibling;
+		const SignalHandle sibling = signal.sibling;
+		g_system->m_signals.free(iter & HANDLE_ID_MASK);
+		iter = sibling;
 	}
 }
 
@@ -219,7 +457,7 @@ static LUMIX_FORCE_INLINE bool isSignalZero(SignalHandle handle, bool lock)
 	const u32 id = handle & HANDLE_ID_MASK;
 	
 	if (lock) g_system->m_sync.enter();
-	Signal& counter = g_system->m_signals_pool[id];
+	Signal& counter = g_system->m_signals[id];
 	bool is_zero = counter.generation != gen || counter.value == 0;
 	if (lock) g_system->m_sync.exit();
 	return is_zero;
@@ -231,19 +469,22 @@ static LUMIX_FORCE_INLINE void runInternal(void* data
 	, SignalHandle precondition
 	, bool do_lock
 	, SignalHandle* on_finish
-	, u8 worker_index)
+	, u8 worker_index
+	, FiberPoolHandle fiber_pool)
 {
+	ASSERT(fiber_pool < g_system->m_fiber_pools_count);
 	Job j;
 	j.data = data;
 	j.task = task;
 	j.worker_index = worker_index != ANY_WORKER ? worker_index % getWorkersCount() : worker_index;
 	j.precondition = precondition;
+	j.fiber_pool = fiber_pool;
 
 	if (do_lock) g_system->m_sync.enter();
 	j.dec_on_finish = [&]() -> SignalHandle {
 		if (!on_finish) return INVALID_HANDLE;
 		if (isValid(*on_finish) && !isSignalZero(*on_finish, false)) {
-			++g_system->m_signals_pool[*on_finish & HANDLE_ID_MASK].value;
+			++g_system->m_signals[*on_finish & HANDLE_ID_MASK].value;
 			return *on_finish;
 		}
 		return allocateSignal();
@@ -251,14 +492,13 @@ static LUMIX_FORCE_INLINE void runInternal(void* data
 	if (on_finish) *on_finish = j.dec_on_finish;
 
 	if (!isValid(precondition) || isSignalZero(precondition, false)) {
-		MutexGuard lock(g_system->m_job_queue_sync);
 		pushJob(j);
 	}
 	else {
-		Signal& counter = g_system->m_signals_pool[precondition & HANDLE_ID_MASK];
+		Signal& counter = g_system->m_signals[precondition & HANDLE_ID_MASK];
 		if(counter.next_job.task) {
 			const SignalHandle ch = allocateSignal();
-			Signal& c = g_system->m_signals_pool[ch & HANDLE_ID_MASK];
+			Signal& c = g_system->m_signals[ch & HANDLE_ID_MASK];
 			c.next_job = j;
 			c.sibling = counter.sibling;
 			counter.sibling = ch;
@@ -279,6 +519,7 @@ void enableBackupWorker(bool enable)
 	for (WorkerTask* task : g_system->m_backup_workers) {
 		if (task->m_is_enabled != enable) {
 			task->m_is_enabled = enable;
+			if (enable) task->wakeup();
 			return;
 		}
 	}
@@ -304,7 +545,7 @@ void incSignal(SignalHandle* signal)
 	MutexGuard lock(g_system->m_sync);
 	
 	if (isValid(*signal) && !isSignalZero(*signal, false)) {
-		++g_system->m_signals_pool[*signal & HANDLE_ID_MASK].value;
+		++g_system->m_signals[*signal & HANDLE_ID_MASK].value;
 	}
 	else {
 		*signal = allocateSignal();
@@ -320,13 +561,81 @@ void decSignal(SignalHandle signal)
 
 void run(void* data, void(*task)(void*), SignalHandle* on_finished)
 {
-	runInternal(data, task, INVALID_HANDLE, true, on_finished, ANY_WORKER);
+	runInternal(data, task, INVALID_HANDLE, true, on_finished, ANY_WORKER, DEFAULT_FIBER_POOL);
+}
+
+
+void runEx(void* data, void(*task)(void*), SignalHandle* on_finished, SignalHandle precondition, u8 worker_index, FiberPoolHandle fiber_pool)
+{
+	runInternal(data, task, precondition, true, on_finished, worker_index, fiber_pool);
+}
+
+
+// call with m_job_queue_sync locked
+static bool popLockedWork(WorkerTask* worker, FiberDecl** fiber, Job* job)
+{
+	if (!worker->m_ready_fibers.empty()) {
+		*fiber = worker->m_ready_fibers.back();
+		worker->m_ready_fibers.pop();
+		--worker->m_locked_work_count;
+		return true;
+	}
+	if (!worker->m_job_queue.empty()) {
+		*job = worker->m_job_queue.back();
+		worker->m_job_queue.pop();
+		--worker->m_locked_work_count;
+		return true;
+	}
+	if (!g_system->m_ready_fibers.empty()) {
+		*fiber = g_system->m_ready_fibers.back();
+		g_system->m_ready_fibers.pop();
+		--g_system->m_locked_work_count;
+		return true;
+	}
+	if (!g_system->m_job_queue.empty()) {
+		*job = g_system->m_job_queue.back();
+		g_system->m_job_queue.pop();
+		--g_system->m_locked_work_count;
+		return true;
+	}
+	return false;
 }
 
 
-void runEx(void* data, void(*task)(void*), SignalHandle* on_finished, SignalHandle precondition, u8 worker_index)
+static bool steal(WorkerTask* thief, Job* job)
 {
-	runInternal(data, task, precondition, true, on_finished, worker_index);
+	const u32 count = g_system->m_workers.size();
+	const u32 offset = thief->m_steal_offset++;
+	for (u32 i = 0; i < count; ++i) {
+		WorkerTask* victim = g_system->m_workers[(offset + i) % count];
+		if (victim == thief) continue;
+		if (victim->m_work_queue.steal(job)) return true;
+	}
+	return false;
+}
+
+
+static bool hasStealableWork()
+{
+	for (WorkerTask* worker : g_system->m_workers) {
+		if (!worker->m_work_queue.isEmpty()) return true;
+	}
+	return false;
+}
+
+
+static void stopSearching(WorkerTask* worker)
+{
+	if (!worker->m_is_searching) return;
+
+	worker->m_is_searching = false;
+	// the last searching worker found some work, there might be more, so wake somebody to look for it
+	if (atomicDecrement(&g_system->m_searching_count) > 0) return;
+	if (g_system->m_sleeping_count == 0) return;
+	if (!hasStealableWork() && g_system->m_locked_work_count == 0) return;
+
+	MutexGuard lock(g_system->m_job_queue_sync);
+	wakeupOneWorker();
 }
 
 
@@ -352,35 +661,45 @@ void runEx(void* data, void(*task)(void*), SignalHandle* on_finished, SignalHand
 		}
 
 		FiberDecl* fiber = nullptr;
-		Job job;
-		while (!worker->m_finished) {
-			MutexGuard lock(g_system->m_job_queue_sync);
-
-			if (!worker->m_ready_fibers.empty()) {
-				fiber = worker->m_ready_fibers.back();
-				worker->m_ready_fibers.pop();
-				break;
+		Job job = worker->m_pending_job;
+		worker->m_pending_job.task = nullptr;
+		while (!job.task && !worker->m_finished) {
+			if (worker->m_locked_work_count > 0 || g_system->m_locked_work_count > 0) {
+				MutexGuard lock(g_system->m_job_queue_sync);
+				if (popLockedWork(worker, &fiber, &job)) break;
 			}
-			if (!worker->m_job_queue.empty()) {
-				job = worker->m_job_queue.back();
-				worker->m_job_queue.pop();
-				break;
+			if (!worker->m_is_backup && worker->m_work_queue.pop(&job)) break;
+			if (!worker->m_is_searching) {
+				worker->m_is_searching = true;
+				atomicIncrement(&g_system->m_searching_count);
 			}
-			if (!g_system->m_ready_fibers.empty()) {
-				fiber = g_system->m_ready_fibers.back();
-				g_system->m_ready_fibers.pop();
-				break;
+			if (steal(worker, &job)) break;
+
+			MutexGuard lock(g_system->m_job_queue_sync);
+			if (popLockedWork(worker, &fiber, &job)) break;
+			
+			if (!worker->m_is_sleeping) {
+				worker->m_is_sleeping = true;
+				g_system->m_sleeping_workers.push(worker);
+				atomicIncrement(&g_system->m_sleeping_count);
 			}
-			if(!g_system->m_job_queue.empty()) {
-				job = g_system->m_job_queue.back();
-				g_system->m_job_queue.pop();
-				break;
+			if (worker->m_is_searching) {
+				worker->m_is_searching = false;
+				atomicDecrement(&g_system->m_searching_count);
+			}
+			// pairs with the barrier in pushJob, so either we see the job or the pusher sees us sleeping
+			memoryBarrier();
+			if (hasStealableWork() || worker->m_finished) {
+				wakeupWorker(worker);
+				continue;
 			}
 
 			PROFILE_BLOCK("sleeping");
 			profiler::blockColor(0xff, 0, 0xff);
 			worker->sleep(g_system->m_job_queue_sync);
+			if (worker->m_is_sleeping) wakeupWorker(worker);
 		}
+		stopSearching(worker);
 		if (worker->m_finished) break;
 
 		if (fiber) {
@@ -389,13 +708,28 @@ void runEx(void* data, void(*task)(void*), SignalHandle* on_finished, SignalHand
 
 			g_system->m_sync.enter();
             LUMIX_FATAL(!this_fiber->current_job.task);
-			g_system->m_free_fibers.push(this_fiber);
+			freeFiber(this_fiber);
 			Fiber::switchTo(&this_fiber->fiber, fiber->fiber);
 			g_system->m_sync.exit();
 
 			worker = getWorker();
 			worker->m_current_fiber = this_fiber;
 		}
+		else if (job.fiber_pool != DEFAULT_FIBER_POOL && job.fiber_pool != this_fiber->pool) {
+			// job needs a fiber from another pool, e.g. with bigger stack
+			// the new fiber picks the job from m_pending_job
+			worker->m_pending_job = job;
+
+			g_system->m_sync.enter();
+			FiberDecl* new_fiber = allocFiber(job.fiber_pool);
+			freeFiber(this_fiber);
+			worker->m_current_fiber = new_fiber;
+			Fiber::switchTo(&this_fiber->fiber, new_fiber->fiber);
+			g_system->m_sync.exit();
+
+			worker = getWorker();
+			worker->m_current_fiber = this_fiber;
+		}
 		else {
 			profiler::endBlock();
 			profiler::beginBlock("job");
@@ -420,21 +754,14 @@ void runEx(void* data, void(*task)(void*), SignalHandle* on_finished, SignalHand
 bool init(u8 workers_count, IAllocator& allocator)
 {
 	g_system.create(allocator);
+	createFiberPool(64 * 1024);
 
-	g_system->m_free_fibers.reserve(lengthOf(g_system->m_fiber_pool));
-	for (FiberDecl& fiber : g_system->m_fiber_pool) {
-		g_system->m_free_fibers.push(&fiber);
-	}
-
-	const int fiber_num = lengthOf(g_system->m_fiber_pool);
-	for(int i = 0; i < fiber_num; ++i) { 
-		FiberDecl& decl = g_system->m_fiber_pool[i];
-		decl.idx = i;
-	}
-
+	// workers wait in WorkerTask::start until all of them are created, so m_workers does not change while they steal
+	MutexGuard lock(g_system->m_sync);
 	int count = maximum(1, int(workers_count));
+	g_system->m_workers.reserve(count);
 	for (int i = 0; i < count; ++i) {
-		WorkerTask* task = LUMIX_NEW(allocator, WorkerTask)(*g_system, i < 64 ? u64(1) << i : 0);
+		WorkerTask* task = LUMIX_NEW(allocator, WorkerTask)(*g_system, i);
 		if (task->create("Worker", false)) {
 			task->m_is_enabled = true;
 			g_system->m_workers.push(task);
@@ -450,6 +777,40 @@ bool init(u8 workers_count, IAllocator& allocator)
 }
 
 
+FiberPoolHandle createFiberPool(u32 stack_size)
+{
+	MutexGuard lock(g_system->m_sync);
+	LUMIX_FATAL(g_system->m_fiber_pools_count < MAX_FIBER_POOLS);
+	FiberPool& pool = g_system->m_fiber_pools[g_system->m_fiber_pools_count];
+	pool.stack_size = stack_size;
+	pool.fibers.grow();
+	const FiberPoolHandle handle = (FiberPoolHandle)g_system->m_fiber_pools_count;
+	memoryBarrier();
+	++g_system->m_fiber_pools_count;
+	return handle;
+}
+
+
+static void getPoolStats(PoolStats& stats, u32 used, u32 capacity, u32 high_water_mark)
+{
+	stats.used = used;
+	stats.capacity = capacity;
+	stats.high_water_mark = high_water_mark;
+}
+
+
+void getStats(Stats& stats)
+{
+	auto& signals = g_system->m_signals;
+	getPoolStats(stats.signals, signals.m_used, signals.capacity(), signals.m_high_water_mark);
+	stats.fiber_pools_count = g_system->m_fiber_pools_count;
+	for (u32 i = 0; i < stats.fiber_pools_count; ++i) {
+		auto& fibers = g_system->m_fiber_pools[i].fibers;
+		getPoolStats(stats.fibers[i], fibers.m_used, fibers.capacity(), fibers.m_high_water_mark);
+	}
+}
+
+
 u8 getWorkersCount()
 {
 	const int c = g_system->m_workers.size();
@@ -483,13 +844,20 @@ void shutdown()
 	{
 		while (!task->isFinished()) task->wakeup();
 		task->destroy();
-		LUMIX_DELETE(allocator, task);
 	}
 
-	for (FiberDecl& fiber : g_system->m_fiber_pool)
+	// other workers could still be stealing from a worker until all of them are finished
+	for (WorkerTask* task : g_system->m_workers)
 	{
-		if(Fiber::isValid(fiber.fiber)) {
-			Fiber::destroy(fiber.fiber);
+		LUMIX_DELETE(allocator, task);
+	}
+
+	for (u32 i = 0; i < g_system->m_fiber_pools_count; ++i) {
+		auto& fibers = g_system->m_fiber_pools[i].fibers;
+		for (u32 j = 0, c = fibers.capacity(); j < c; ++j) {
+			if (Fiber::isValid(fibers[j].fiber)) {
+				Fiber::destroy(fibers[j].fiber);
+			}
 		}
 	}
 
@@ -523,23 +891,19 @@ void wait(SignalHandle handle)
 		FiberDecl* fiber = (FiberDecl*)data;
 		if (fiber->current_job.worker_index == ANY_WORKER) {
 			g_system->m_ready_fibers.push(fiber);
-			for (WorkerTask* worker : g_system->m_workers) {
-				worker->wakeup();
-			}
+			++g_system->m_locked_work_count;
+			wakeupOneWorker();
 		}
 		else {
 			WorkerTask* worker = g_system->m_workers[fiber->current_job.worker_index % g_system->m_workers.size()];
 			worker->m_ready_fibers.push(fiber);
-			worker->wakeup();
+			++worker->m_locked_work_count;
+			wakeupWorker(worker);
 		}
-	}, handle, false, nullptr, 0);
+	}, handle, false, nullptr, 0, DEFAULT_FIBER_POOL);
 	
 	const profiler::FiberSwitchData& switch_data = profiler::beginFiberWait(handle);
-	FiberDecl* new_fiber = g_system->m_free_fibers.back();
-	g_system->m_free_fibers.pop();
-	if (!Fiber::isValid(new_fiber->fiber)) {
-		new_fiber->fiber = Fiber::create(64 * 1024, manage, new_fiber);
-	}
+	FiberDecl* new_fiber = allocFiber(DEFAULT_FIBER_POOL);
 	getWorker()->m_current_fiber = new_fiber;
 	Fiber::switchTo(&this_fiber->fiber, new_fiber->fiber);
 	getWorker()->m_current_fiber = this_fiber;
@@ -553,4 +917,4 @@ void wait(SignalHandle handle)
 	#endif
 }
 
-} // namespace Lumix::jobs
\ No newline at end of file
+} // namespace Lumix::jobs
@@ -8,12 +8,30 @@ struct IAllocator;
 namespace jobs {
 
 using SignalHandle = u32;
+using FiberPoolHandle = u8;
 constexpr u8 ANY_WORKER = 0xff;
 constexpr u32 INVALID_HANDLE = 0xffFFffFF;
+constexpr FiberPoolHandle DEFAULT_FIBER_POOL = 0;
+constexpr u32 MAX_FIBER_POOLS = 4;
+
+struct PoolStats {
+	u32 used;
+	u32 capacity;
+	u32 high_water_mark;
+};
+
+struct Stats {
+	PoolStats signals;
+	PoolStats fibers[MAX_FIBER_POOLS];
+	u32 fiber_pools_count;
+};
 
 LUMIX_ENGINE_API bool init(u8 workers_count, IAllocator& allocator);
 LUMIX_ENGINE_API void shutdown();
 LUMIX_ENGINE_API u8 getWorkersCount();
+// jobs run with this pool's handle get fibers with `stack_size` stack, e.g. for deep recursion
+LUMIX_ENGINE_API FiberPoolHandle createFiberPool(u32 stack_size);
+LUMIX_ENGINE_API void getStats(Stats& stats);
 
 LUMIX_ENGINE_API void enableBackupWorker(bool enable);
 
@@ -21,7 +39,7 @@ LUMIX_ENGINE_API void incSignal(SignalHandle* signal);
 LUMIX_ENGINE_API void decSignal(SignalHandle signal);
 
 LUMIX_ENGINE_API void run(void* data, void(*task)(void*), SignalHandle* on_finish);
-LUMIX_ENGINE_API void runEx(void* data, void (*task)(void*), SignalHandle* on_finish, SignalHandle precondition, u8 worker_index);
+LUMIX_ENGINE_API void runEx(void* data, void (*task)(void*), SignalHandle* on_finish, SignalHandle precondition, u8 worker_index, FiberPoolHandle fiber_pool = DEFAULT_FIBER_POOL);
 LUMIX_ENGINE_API void wait(SignalHandle waitable);
 
 
@@ -61,6 +79,64 @@ void forEach(i32 count, i32 step, const F& f)
 	});
 }
 
+template <typename F>
+struct ParallelForRange
+{
+	static void execute(void* data)
+	{
+		const ParallelForRange* range = (const ParallelForRange*)data;
+		split(*range->f, range->from, range->to, range->step, range->depth);
+	}
+
+	// keeps the left halves on this thread and pushes the right halves as jobs, so idle workers can steal them
+	static void split(const F& f, i32 from, i32 to, i32 step, u32 depth)
+	{
+		ParallelForRange halves[32];
+		u32 halves_count = 0;
+		SignalHandle signal = INVALID_HANDLE;
+		while (depth > 0 && to - from > step) {
+			const i32 mid = from + ((to - from) / 2 + step - 1) / step * step;
+			--depth;
+			ParallelForRange& half = halves[halves_count];
+			++halves_count;
+			half.f = &f;
+			half.from = mid;
+			half.to = to;
+			half.step = step;
+			half.depth = depth;
+			jobs::run(&half, &execute, &signal);
+			to = mid;
+		}
+		f(from, to);
+		wait(signal);
+	}
+
+	const F* f;
+	i32 from;
+	i32 to;
+	i32 step;
+	u32 depth;
+};
+
+
+// Calls f(from, to) on disjoint ranges covering [0, count). Ranges start at multiples of `step` and are at least `step` long,
+// except the last one. Range is split recursively, into at most ~4 ranges per worker, so small loops run inline
+// and uneven loops are balanced by stealing.
+template <typename F>
+void parallelFor(i32 count, i32 step, const F& f)
+{
+	if (count <= 0) return;
+	const u32 workers_count = getWorkersCount();
+	if (count <= step || workers_count == 1) {
+		f(0, count);
+		return;
+	}
+
+	u32 depth = 2;
+	for (u32 i = workers_count - 1; i > 0; i >>= 1) ++depth;
+	ParallelForRange<F>::split(f, 0, count, step, depth);
+}
+
 } // namespace jobs
 
 } // namespace Lumix
\ No newline at end of file
@@ -16,24 +16,31 @@ namespace Fiber
 thread_local Handle g_finisher;
 
 
+// makecontext reads uc_link when it's called, so it must be set before
+// with null uc_link, the whole process exits when proc returns
+static Handle create(int stack_size, FiberProc proc, void* parameter, ucontext_t* link)
+{
+	ucontext_t fib;
+	getcontext(&fib);
+    fib.uc_stack.ss_sp = (::malloc)(stack_size);
+    fib.uc_stack.ss_size = stack_size;
+    fib.uc_link = link;
+    makecontext(&fib, (void(*)())proc, 1, parameter); 
+	return fib;
+}
+
+
 void initThread(FiberProc proc, Handle* out)
 {
-	*out = create(64*1024, proc, nullptr);
-	getcontext(&g_finisher);
-	out->uc_link = &g_finisher;
+	// thread continues here when proc returns
+	*out = create(64*1024, proc, nullptr, &g_finisher);
 	switchTo(&g_finisher, *out);
 }
 
 
 Handle create(int stack_size, FiberProc proc, void* parameter)
 {
-	ucontext_t fib;
-	getcontext(&fib);
-    fib.uc_stack.ss_sp = (::malloc)(stack_size);
-    fib.uc_stack.ss_size = stack_size;
-    fib.uc_link = 0;
-    makecontext(&fib, (void(*)())proc, 1, parameter); 
-	return fib;
+	return create(stack_size, proc, parameter, nullptr);
 }
 
 bool isValid(Handle handle)
@@ -43,7 +50,7 @@ bool isValid(Handle handle)
 
 void destroy(Handle fiber)
 {
-	ASSERT(false);
+	(::free)(fiber.uc_stack.ss_sp);
 }
 
 
@@ -916,6 +916,25 @@ void memRelease(void* ptr, size_t size) {
 	munmap(ptr, size);
 }
 
+const void* mapFile(const char* path, u64& size) {
+	const int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return nullptr;
+	}
+	size = st.st_size;
+	void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	return ptr == MAP_FAILED ? nullptr : ptr;
+}
+
+void unmapFile(const void* ptr, u64 size) {
+	munmap((void*)ptr, size);
+}
+
 struct FileIterator {};
 
 FileIterator* createFileIterator(const char* path, IAllocator& allocator) {
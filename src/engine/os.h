@@ -167,6 +167,9 @@ LUMIX_ENGINE_API void memCommit(void* ptr, size_t size);
 LUMIX_ENGINE_API void memRelease(void* ptr, size_t size); // size must be full size used in reserve
 LUMIX_ENGINE_API u32 getMemPageSize();
 LUMIX_ENGINE_API u32 getMemPageAlignment();
+// maps whole file to memory as copy-on-write, returns nullptr on failure
+LUMIX_ENGINE_API const void* mapFile(const char* path, u64& size);
+LUMIX_ENGINE_API void unmapFile(const void* ptr, u64 size);
 
 LUMIX_ENGINE_API FileIterator* createFileIterator(const char* path, IAllocator& allocator);
 LUMIX_ENGINE_API void destroyFileIterator(FileIterator* iterator);
@@ -45,6 +45,9 @@ struct LUMIX_ENGINE_API IScene
 	virtual void stopGame() {}
 	virtual i32 getVersion() const { return -1; }
 	virtual void clear() = 0;
+	// deserialize can run on a job worker, in parallel with other scenes' deserialize; 
+	// only thread-safe engine services (file system, allocators, Universe::onComponentCreated) may be used
+	virtual bool isDeserializeThreadSafe() const { return false; }
 };
 
 
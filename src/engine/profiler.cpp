@@ -4,11 +4,18 @@
 	#define WIN32_LEAN_AND_MEAN
 	#include <Windows.h>
 	#include <evntcons.h>
+#else
+	#include <linux/perf_event.h>
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <time.h>
+	#include <unistd.h>
 #endif
 
 #include "engine/array.h"
 #include "engine/crt.h"
 #include "engine/hash_map.h"
+#include "engine/log.h"
 #include "engine/allocators.h"
 #include "engine/atomic.h"
 #include "engine/math.h"
@@ -26,21 +33,28 @@ namespace profiler
 {
 
 
+// power of two, so positions can wrap around u32
+static constexpr u32 THREAD_BUFFER_SIZE = 1024 * 512;
+static_assert((THREAD_BUFFER_SIZE & (THREAD_BUFFER_SIZE - 1)) == 0);
+
 struct ThreadContext
 {
 	ThreadContext(IAllocator& allocator) 
 		: buffer(allocator)
 		, open_blocks(allocator)
 	{
-		buffer.resize(1024 * 512);
+		buffer.resize(THREAD_BUFFER_SIZE);
 		open_blocks.reserve(64);
 	}
 
 	Array<const char*> open_blocks;
 	OutputMemoryStream buffer;
-	u32 begin = 0;
-	u32 end = 0;
+	// written only by the owning thread, see writeEvent
+	volatile u32 begin = 0;
+	volatile u32 end = 0;
+	// guards name and, if the context is shared by multiple threads, writes
 	Mutex mutex;
+	bool is_shared = false;
 	StaticString<64> name;
 	bool show_in_profiler = false;
 	u32 thread_id;
@@ -85,29 +99,66 @@ struct ThreadContext
 		TRACEHANDLE open_handle;
 	};
 #else
-	struct TraceTask {
-		TraceTask(IAllocator&) {}
-		void destroy() {}
-		int open_handle;
+	#ifndef PERF_RECORD_MISC_SWITCH_OUT_PREEMPT
+		#define PERF_RECORD_MISC_SWITCH_OUT_PREEMPT (1 << 14)
+	#endif
+
+	// same values as KWAIT_REASON on windows, so profiler UI shows the same strings
+	static constexpr i8 WAIT_REASON_USER_REQUEST = 13;
+	static constexpr i8 WAIT_REASON_PREEMPTED = 32;
+
+	// Each profiled thread opens a perf event recording its own context switches. This does not
+	// need root, unlike system-wide sched_switch tracepoints, and works with perf_event_paranoid <= 2.
+	// If perf events are not available, context switches are not recorded.
+	struct TraceTask : Thread {
+		TraceTask(IAllocator& allocator);
+		~TraceTask();
+
+		// called from ctx's thread
+		void addThread(const ThreadContext& ctx);
+		void stop();
+		int task() override;
+
+		struct Event {
+			int fd;
+			perf_event_mmap_page* meta;
+			u32 thread_id;
+		};
+
+		static constexpr u32 RING_PAGES = 16;
+
+		Mutex mutex;
+		Array<Event> events;
+		u32 page_size;
+		bool failed = false;
+		volatile bool finished = false;
 	};
-	void CloseTrace(int) {}
 #endif
 
+struct Capture;
+
 static struct Instance
 {
 	Instance()
 		: contexts(allocator)
 		, trace_task(allocator)
 		, global_context(allocator)
+		, reported_memory_tags(allocator)
 	{
+		global_context.is_shared = true;
 		startTrace();
 	}
 
 
 	~Instance()
 	{
-		CloseTrace(trace_task.open_handle);
-		trace_task.destroy();
+		stopCapture();
+		#ifdef _WIN32
+			CloseTrace(trace_task.open_handle);
+			trace_task.destroy();
+		#else
+			trace_task.stop();
+		#endif
 	}
 
 
@@ -155,8 +206,13 @@ static struct Instance
 		thread_local ThreadContext* ctx = [&](){
 			ThreadContext* new_ctx = LUMIX_NEW(allocator, ThreadContext)(allocator);
 			new_ctx->thread_id = os::getCurrentThreadID();
-			MutexGuard lock(mutex);
-			contexts.push(new_ctx);
+			{
+				MutexGuard lock(mutex);
+				contexts.push(new_ctx);
+			}
+			#ifndef _WIN32
+				trace_task.addThread(*new_ctx);
+			#endif
 			return new_ctx;
 		}();
 
@@ -176,14 +232,62 @@ static struct Instance
 	volatile i32 fiber_wait_id = 0;
 	TraceTask trace_task;
 	ThreadContext global_context;
+	// tag id -> live bytes last written to the profiler
+	HashMap<u32, u64> reported_memory_tags;
+	Capture* capture = nullptr;
 } g_instance;
 
 
-template <typename T>
-void write(ThreadContext& ctx, u64 timestamp, EventType type, const T& value)
+static LUMIX_FORCE_INLINE void copyToBuffer(ThreadContext& ctx, u32 pos, const void* data, u32 size)
 {
-	if (g_instance.paused && timestamp > g_instance.paused_time) return;
+	u8* buf = ctx.buffer.getMutableData();
+	const u32 l = pos & (THREAD_BUFFER_SIZE - 1);
+	if (THREAD_BUFFER_SIZE - l >= size) {
+		memcpy(buf + l, data, size);
+	}
+	else {
+		memcpy(buf + l, data, THREAD_BUFFER_SIZE - l);
+		memcpy(buf, (const u8*)data + THREAD_BUFFER_SIZE - l, size - (THREAD_BUFFER_SIZE - l));
+	}
+}
+
 
+static u16 readEventSize(const ThreadContext& ctx, u32 pos)
+{
+	const u8* buf = ctx.buffer.data();
+	return buf[pos & (THREAD_BUFFER_SIZE - 1)] | (buf[(pos + 1) & (THREAD_BUFFER_SIZE - 1)] << 8);
+}
+
+
+// Thread contexts have a single writer, so writing needs no lock. Old events are dropped
+// by publishing new `begin` before they are overwritten, and new events are published by
+// moving `end` after they are written, so serialize() can read the buffer concurrently.
+// Returns position where `size` bytes can be written.
+static LUMIX_FORCE_INLINE u32 beginWrite(ThreadContext& ctx, u32 size)
+{
+	const u32 end = ctx.end;
+	u32 begin = ctx.begin;
+	if (size + end - begin > THREAD_BUFFER_SIZE) {
+		while (size + end - begin > THREAD_BUFFER_SIZE) {
+			begin += readEventSize(ctx, begin);
+		}
+		ctx.begin = begin;
+		releaseFence();
+	}
+	return end;
+}
+
+
+static LUMIX_FORCE_INLINE void endWrite(ThreadContext& ctx, u32 end)
+{
+	releaseFence();
+	ctx.end = end;
+}
+
+
+template <typename T>
+static LUMIX_FORCE_INLINE void writeEvent(ThreadContext& ctx, u64 timestamp, EventType type, const T& value)
+{
 	#pragma pack(1)
 		struct {
 			EventHeader header;
@@ -195,63 +299,33 @@ void write(ThreadContext& ctx, u64 timestamp, EventType type, const T& value)
 	v.header.time = timestamp;
 	v.value = value;
 
-	MutexGuard lock(ctx.mutex);
-	u8* buf = ctx.buffer.getMutableData();
-	const u32 buf_size = (u32)ctx.buffer.size();
+	const u32 pos = beginWrite(ctx, sizeof(v));
+	copyToBuffer(ctx, pos, &v, sizeof(v));
+	endWrite(ctx, pos + sizeof(v));
+}
 
-	while (sizeof(v) + ctx.end - ctx.begin > buf_size) {
-		const u8 size = buf[ctx.begin % buf_size];
-		ctx.begin += size;
-	}
 
-	const u32 lend = ctx.end % buf_size;
-	if (buf_size - lend >= sizeof(v)) {
-		memcpy(buf + lend, &v, sizeof(v));
+template <typename T>
+void write(ThreadContext& ctx, u64 timestamp, EventType type, const T& value)
+{
+	if (g_instance.paused && timestamp > g_instance.paused_time) return;
+
+	if (ctx.is_shared) {
+		MutexGuard lock(ctx.mutex);
+		writeEvent(ctx, timestamp, type, value);
 	}
 	else {
-		memcpy(buf + lend, &v, buf_size - lend);
-		memcpy(buf, ((u8*)&v) + buf_size - lend, sizeof(v) - (buf_size - lend));
+		writeEvent(ctx, timestamp, type, value);
 	}
+}
 
-	ctx.end += sizeof(v);
-};
 
 template <typename T>
 void write(ThreadContext& ctx, EventType type, const T& value)
 {
 	if (g_instance.paused) return;
-
-#pragma pack(1)
-	struct {
-		EventHeader header;
-		T value;
-	} v;
-#pragma pack()
-	v.header.type = type;
-	v.header.size = sizeof(v);
-	v.header.time = os::Timer::getRawTimestamp();
-	v.value = value;
-
-	MutexGuard lock(ctx.mutex);
-	u8* buf = ctx.buffer.getMutableData();
-	const u32 buf_size = (u32)ctx.buffer.size();
-
-	while (sizeof(v) + ctx.end - ctx.begin > buf_size) {
-		const u8 size = buf[ctx.begin % buf_size];
-		ctx.begin += size;
-	}
-
-	const u32 lend = ctx.end % buf_size;
-	if (buf_size - lend >= sizeof(v)) {
-		memcpy(buf + lend, &v, sizeof(v));
-	}
-	else {
-		memcpy(buf + lend, &v, buf_size - lend);
-		memcpy(buf, ((u8*)&v) + buf_size - lend, sizeof(v) - (buf_size - lend));
-	}
-
-	ctx.end += sizeof(v);
-};
+	write(ctx, os::Timer::getRawTimestamp(), type, value);
+}
 
 
 void write(ThreadContext& ctx, EventType type, const u8* data, int size)
@@ -264,31 +338,12 @@ void write(ThreadContext& ctx, EventType type, const u8* data, int size)
 	header.size = u16(sizeof(header) + size);
 	header.time = os::Timer::getRawTimestamp();
 
-	MutexGuard lock(ctx.mutex);
-	u8* buf = ctx.buffer.getMutableData();
-	const u32 buf_size = (u32)ctx.buffer.size();
-
-	while (header.size + ctx.end - ctx.begin > buf_size) {
-		const u8 size = buf[ctx.begin % buf_size];
-		ctx.begin += size;
-	}
-
-	auto cpy = [&](const u8* ptr, u32 size) {
-		const u32 lend = ctx.end % buf_size;
-		if (buf_size - lend >= size) {
-			memcpy(buf + lend, ptr, size);
-		}
-		else {
-			memcpy(buf + lend, ptr, buf_size - lend);
-			memcpy(buf, ((u8*)ptr) + buf_size - lend, size - (buf_size - lend));
-		}
-
-		ctx.end += size;
-	};
-
-	cpy((u8*)&header, sizeof(header));
-	cpy(data, size);
-};
+	ASSERT(!ctx.is_shared);
+	const u32 pos = beginWrite(ctx, header.size);
+	copyToBuffer(ctx, pos, &header, sizeof(header));
+	copyToBuffer(ctx, pos + sizeof(header), data, size);
+	endWrite(ctx, pos + header.size);
+}
 
 #ifdef _WIN32
 	TraceTask::TraceTask(IAllocator& allocator)
@@ -314,6 +369,123 @@ void write(ThreadContext& ctx, EventType type, const u8* data, int size)
 		rec.reason = cs->OldThreadWaitReason;
 		write(g_instance.global_context, rec.timestamp, profiler::EventType::CONTEXT_SWITCH, rec);
 	};
+#else
+	TraceTask::TraceTask(IAllocator& allocator)
+		: Thread(allocator)
+		, events(allocator)
+	{
+		page_size = (u32)sysconf(_SC_PAGESIZE);
+	}
+
+
+	TraceTask::~TraceTask()
+	{
+		for (const Event& e : events) {
+			munmap(e.meta, (RING_PAGES + 1) * page_size);
+			close(e.fd);
+		}
+	}
+
+
+	void TraceTask::addThread(const ThreadContext& ctx)
+	{
+		MutexGuard lock(mutex);
+		if (failed || finished) return;
+
+		perf_event_attr attr = {};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_SOFTWARE;
+		attr.config = PERF_COUNT_SW_DUMMY;
+		attr.context_switch = 1;
+		attr.sample_id_all = 1;
+		attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// same clock as os::Timer::getRawTimestamp
+		attr.use_clockid = 1;
+		attr.clockid = CLOCK_REALTIME;
+
+		const int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+		if (fd < 0) {
+			failed = true;
+			return;
+		}
+		void* mem = mmap(nullptr, (RING_PAGES + 1) * page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mem == MAP_FAILED) {
+			close(fd);
+			failed = true;
+			return;
+		}
+
+		Event& e = events.emplace();
+		e.fd = fd;
+		e.meta = (perf_event_mmap_page*)mem;
+		e.thread_id = ctx.thread_id;
+		
+		if (!g_instance.context_switches_enabled) {
+			g_instance.context_switches_enabled = true;
+			create("profiler trace", true);
+		}
+	}
+
+
+	void TraceTask::stop()
+	{
+		bool running;
+		{
+			MutexGuard lock(mutex);
+			finished = true;
+			running = !events.empty();
+		}
+		if (running) destroy();
+	}
+
+
+	int TraceTask::task()
+	{
+		while (!finished) {
+			{
+				MutexGuard lock(mutex);
+				for (const Event& e : events) {
+					const u8* data = (const u8*)e.meta + page_size;
+					const u64 data_size = RING_PAGES * page_size;
+					const u64 head = *(volatile u64*)&e.meta->data_head;
+					acquireFence();
+					u64 tail = e.meta->data_tail;
+					while (tail < head) {
+						// records are 8-byte aligned, so header does not wrap
+						perf_event_header header;
+						memcpy(&header, data + tail % data_size, sizeof(header));
+						if (header.type == PERF_RECORD_SWITCH) {
+							// sample_id: u32 pid, u32 tid, u64 time
+							u64 time;
+							const u64 time_offset = (tail + sizeof(header) + 2 * sizeof(u32)) % data_size;
+							memcpy(&time, data + time_offset, sizeof(time));
+
+							ContextSwitchRecord rec;
+							rec.timestamp = time;
+							if (header.misc & PERF_RECORD_MISC_SWITCH_OUT) {
+								rec.old_thread_id = e.thread_id;
+								rec.new_thread_id = 0;
+								rec.reason = (header.misc & PERF_RECORD_MISC_SWITCH_OUT_PREEMPT) ? WAIT_REASON_PREEMPTED : WAIT_REASON_USER_REQUEST;
+							}
+							else {
+								rec.old_thread_id = 0;
+								rec.new_thread_id = e.thread_id;
+								rec.reason = -1;
+							}
+							write(g_instance.global_context, rec.timestamp, profiler::EventType::CONTEXT_SWITCH, rec);
+						}
+						tail += header.size;
+					}
+					releaseFence();
+					*(volatile u64*)&e.meta->data_tail = tail;
+				}
+			}
+			os::sleep(10);
+		}
+		return 0;
+	}
 #endif
 
 void pushInt(const char* key, int value)
@@ -478,6 +650,31 @@ bool contextSwitchesEnabled()
 }
 
 
+static void writeMemoryTags()
+{
+	TagAllocator::forEachTag([](TagAllocator& tag){
+		const TagAllocator::Stats stats = tag.getStats();
+		auto iter = g_instance.reported_memory_tags.find(tag.getID());
+		if (iter.isValid()) {
+			if (iter.value() == stats.live_bytes) return;
+			iter.value() = stats.live_bytes;
+		}
+		else {
+			g_instance.reported_memory_tags.insert(tag.getID(), stats.live_bytes);
+		}
+
+		MemoryTagRecord r;
+		copyString(r.name, tag.getName());
+		r.id = tag.getID();
+		r.parent_id = tag.getParent() ? tag.getParent()->getID() : 0;
+		r.live_bytes = stats.live_bytes;
+		r.peak_bytes = stats.peak_bytes;
+		r.live_count = stats.live_count;
+		write(g_instance.global_context, EventType::MEMORY_TAG, r);
+	});
+}
+
+
 void frame()
 {
 	const u64 n = os::Timer::getRawTimestamp();
@@ -486,6 +683,7 @@ void frame()
 	}
 	g_instance.last_frame_time = n;
 	write(g_instance.global_context, EventType::FRAME, 0);
+	writeMemoryTags();
 }
 
 
@@ -506,11 +704,18 @@ void setThreadName(const char* name)
 	ctx->name = name;
 }
 
+// context's events copied into serialized blob
+struct Snapshot
+{
+	u32 begin;
+	u32 end;
+	u32 buffer_size;
+	u64 buffer_offset;
+};
+
 template <typename T>
-static void read(const ThreadContext& ctx, u32 p, T& value)
+static void read(const u8* buf, u32 buf_size, u32 p, T& value)
 {
-	const u8* buf = ctx.buffer.data();
-	const u32 buf_size = (u32)ctx.buffer.size();
 	const u32 l = p % buf_size;
 	if (l + sizeof(value) <= buf_size) {
 		memcpy(&value, buf + l, sizeof(value));
@@ -521,19 +726,20 @@ static void read(const ThreadContext& ctx, u32 p, T& value)
 	memcpy((u8*)&value + (buf_size - l), buf, sizeof(value) - (buf_size - l));
 }
 
-static void saveStrings(OutputMemoryStream& blob) {
+static void saveStrings(OutputMemoryStream& blob, Span<const Snapshot> snapshots) {
 	HashMap<const char*, const char*> map(g_instance.allocator);
 	map.reserve(512);
-	auto gather = [&](const ThreadContext& ctx){
-		u32 p = ctx.begin;
-		const u32 end = ctx.end;
-		while (p != end) {
+	for (const Snapshot& snapshot : snapshots) {
+		const u8* buf = blob.data() + snapshot.buffer_offset;
+		const u32 buf_size = snapshot.buffer_size;
+		u32 p = snapshot.begin;
+		while (p != snapshot.end) {
 			profiler::EventHeader header;
-			read(ctx, p, header);
+			read(buf, buf_size, p, header);
 			switch (header.type) {
 				case profiler::EventType::BEGIN_BLOCK: {
 					const char* name;
-					read(ctx, p + sizeof(profiler::EventHeader), name);
+					read(buf, buf_size, p + sizeof(profiler::EventHeader), name);
 					if (!map.find(name).isValid()) {
 						map.insert(name, name);
 					}
@@ -541,7 +747,7 @@ static void saveStrings(OutputMemoryStream& blob) {
 				}
 				case profiler::EventType::INT: {
 					IntRecord r;
-					read(ctx, p + sizeof(profiler::EventHeader), r);
+					read(buf, buf_size, p + sizeof(profiler::EventHeader), r);
 					if (!map.find(r.key).isValid()) {
 						map.insert(r.key, r.key);
 					}
@@ -551,11 +757,6 @@ static void saveStrings(OutputMemoryStream& blob) {
 			}
 			p += header.size;
 		}
-	};
-
-	gather(g_instance.global_context);
-	for (const ThreadContext* ctx : g_instance.contexts) {
-		gather(*ctx);
 	}
 
 	blob.write(map.size());
@@ -565,28 +766,464 @@ static void saveStrings(OutputMemoryStream& blob) {
 	}
 }
 
-void serialize(OutputMemoryStream& blob, ThreadContext& ctx) {
-	MutexGuard lock(ctx.mutex);
-	blob.writeString(ctx.name);
+// does not block the writer, see writeEvent
+static Snapshot serialize(OutputMemoryStream& blob, ThreadContext& ctx) {
+	{
+		MutexGuard lock(ctx.mutex);
+		blob.writeString(ctx.name);
+	}
 	blob.write(ctx.thread_id);
-	blob.write(ctx.begin);
-	blob.write(ctx.end);
+	const u64 range_offset = blob.size();
+	blob.write<u32>(0); // begin and end, written below
+	blob.write<u32>(0);
 	blob.write((u8)ctx.show_in_profiler);
 	blob.write((u32)ctx.buffer.size());
+
+	Snapshot snapshot;
+	snapshot.buffer_size = (u32)ctx.buffer.size();
+	snapshot.buffer_offset = blob.size();
+	// events before `end` are completely written; those overwritten during the copy
+	// are before `begin`, because the writer moves `begin` before overwriting them
+	snapshot.end = ctx.end;
+	acquireFence();
 	blob.write(ctx.buffer.data(), ctx.buffer.size());
+	acquireFence();
+	snapshot.begin = ctx.begin;
+	if (i32(snapshot.end - snapshot.begin) < 0) snapshot.begin = snapshot.end;
+
+	memcpy(blob.getMutableData() + range_offset, &snapshot.begin, sizeof(snapshot.begin));
+	memcpy(blob.getMutableData() + range_offset + sizeof(snapshot.begin), &snapshot.end, sizeof(snapshot.end));
+	return snapshot;
 }
 
 void serialize(OutputMemoryStream& blob) {
 	MutexGuard lock(g_instance.mutex);
+	Array<Snapshot> snapshots(g_instance.allocator);
 	blob.write<u32>(0); // version
 	blob.write((u32)g_instance.contexts.size());
-	serialize(blob, g_instance.global_context);
+	snapshots.push(serialize(blob, g_instance.global_context));
 	for (ThreadContext* ctx : g_instance.contexts) {
-		serialize(blob, *ctx);
+		snapshots.push(serialize(blob, *ctx));
 	}	
-	saveStrings(blob);
+	saveStrings(blob, snapshots);
 }
 
+// escapes `src` so it can be used in a json string
+static void escapeJSON(const char* src, Span<char> dst)
+{
+	char* out = dst.begin();
+	char* const out_end = dst.end() - 1;
+	for (const char* c = src; *c && out < out_end; ++c) {
+		if (*c == '"' || *c == '\\') {
+			if (out + 2 > out_end) break;
+			*out++ = '\\';
+			*out++ = *c;
+		}
+		else {
+			*out++ = u8(*c) < 0x20 ? ' ' : *c;
+		}
+	}
+	*out = '\0';
+}
+
+
+// Streams events to a json file in chrome's trace event format. Events are read from
+// the thread buffers the same way serialize() does, so writers are never blocked.
+struct Capture : Thread
+{
+	static constexpr u32 MAX_DEPTH = 32;
+
+	struct ThreadState
+	{
+		ThreadContext* ctx;
+		u32 tid;
+		u32 read_pos;
+		// number of open blocks
+		u32 depth = 0;
+		// open blocks with `B` event in another file or lost, their `E` is not written
+		u32 unwritten = 0;
+		u64 last_time = 0;
+		StaticString<64> name;
+		StaticString<256> args[MAX_DEPTH];
+	};
+
+	Capture(IAllocator& allocator)
+		: Thread(allocator)
+		, threads(allocator)
+		, scratch(allocator)
+		, out(allocator)
+	{
+		scratch.resize(THREAD_BUFFER_SIZE);
+		out.reserve(256 * 1024);
+	}
+
+	~Capture()
+	{
+		for (ThreadState* state : threads) LUMIX_DELETE(getAllocator(), state);
+	}
+
+	bool openFile()
+	{
+		if (!file.open(path)) return false;
+		file_size = 0;
+		first_event = true;
+		writeRaw("[\n");
+		return true;
+	}
+
+	void closeFile()
+	{
+		if (!file_ok) return;
+		writeRaw("\n]\n");
+		file.close();
+	}
+
+	void writeRaw(const char* str)
+	{
+		const u64 len = stringLength(str);
+		if (!file.write(str, len)) logError("Failed to write ", path);
+		file_size += len;
+	}
+
+	void flush()
+	{
+		if (out.empty() || !file_ok) return;
+		if (!file.write(out.data(), out.size())) logError("Failed to write ", path);
+		file_size += out.size();
+		out.clear();
+		
+		if (max_file_size == 0 || file_size < max_file_size) return;
+
+		// keep only the last two files, so disk usage is bounded
+		closeFile();
+		const StaticString<LUMIX_MAX_PATH> prev_path(path, ".prev");
+		if (os::fileExists(prev_path)) os::deleteFile(prev_path);
+		if (!os::moveFile(path, prev_path)) logError("Failed to move ", path, " to ", prev_path);
+		if (!openFile()) {
+			logError("Failed to open ", path);
+			file_ok = false;
+			return;
+		}
+		for (ThreadState* state : threads) {
+			state->unwritten = state->depth;
+			state->name = "";
+		}
+	}
+
+	void writeTimestamp(u64 time)
+	{
+		if (time < start_time) time = start_time;
+		const u64 ns = u64((time - start_time) * 1'000'000'000.0 / frequency);
+		out << ns / 1000 << ".";
+		const u32 frac = u32(ns % 1000);
+		if (frac < 100) out << "0";
+		if (frac < 10) out << "0";
+		out << frac;
+	}
+
+	void beginEvent(const char* ph, const ThreadState& state, u64 time)
+	{
+		out << (first_event ? "" : ",\n") << "{\"ph\":\"" << ph << "\",\"pid\":0,\"tid\":" << state.tid << ",\"ts\":";
+		writeTimestamp(time);
+		first_event = false;
+	}
+
+	void writeString(const char* str)
+	{
+		char tmp[256];
+		escapeJSON(str, Span(tmp));
+		out << "\"" << tmp << "\"";
+	}
+
+	void writeName(const char* name)
+	{
+		out << ",\"name\":";
+		writeString(name);
+	}
+
+	void addArg(ThreadState& state, const char* key, const char* value, bool quote)
+	{
+		if (state.depth == 0 || state.depth > MAX_DEPTH) return;
+		StaticString<256>& args = state.args[state.depth - 1];
+		char tmp[128];
+		escapeJSON(value, Span(tmp));
+		// drop what does not fit, truncated args would not be valid json
+		if (stringLength(args) + stringLength(key) + stringLength(tmp) + 6 >= (int)sizeof(args.data)) return;
+		if (args.data[0]) args << ",";
+		args << "\"" << key << "\":";
+		if (quote) args << "\"" << tmp << "\"";
+		else args << tmp;
+	}
+
+	void addArg(ThreadState& state, const char* key, i64 value)
+	{
+		char tmp[32];
+		toCString(value, Span(tmp));
+		addArg(state, key, tmp, false);
+	}
+
+	void beginBlock(ThreadState& state, const char* name, u64 time)
+	{
+		beginEvent("B", state, time);
+		writeName(name);
+		out << "}";
+		if (state.depth < MAX_DEPTH) state.args[state.depth] = "";
+		++state.depth;
+	}
+
+	void endBlock(ThreadState& state, u64 time)
+	{
+		if (state.depth == 0) return; // began before the capture
+		--state.depth;
+		if (state.depth < state.unwritten) {
+			state.unwritten = state.depth;
+			return;
+		}
+		beginEvent("E", state, time);
+		if (state.depth < MAX_DEPTH && state.args[state.depth].data[0]) {
+			out << ",\"args\":{" << state.args[state.depth].data << "}";
+		}
+		out << "}";
+	}
+
+	void flowEvent(const char* ph, const char* cat, const ThreadState& state, u64 time, i64 id)
+	{
+		beginEvent(ph, state, time);
+		out << ",\"cat\":\"" << cat << "\",\"name\":\"" << cat << "\",\"id\":" << id;
+		if (ph[0] == 'f') out << ",\"bp\":\"e\"";
+		out << "}";
+	}
+
+	void writeThreadName(ThreadState& state)
+	{
+		StaticString<64> name;
+		if (state.ctx == &g_instance.global_context) {
+			name = "GPU";
+		}
+		else {
+			MutexGuard lock(state.ctx->mutex);
+			name = state.ctx->name;
+		}
+		if (equalStrings(name, state.name)) return;
+
+		state.name = name;
+		out << (first_event ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":0,\"tid\":" << state.tid << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+		writeString(name);
+		out << "}}";
+		first_event = false;
+	}
+
+	void processEvent(ThreadState& state, const EventHeader& header, const u8* data)
+	{
+		state.last_time = header.time;
+		switch (header.type) {
+			case EventType::BEGIN_BLOCK: {
+				const char* name;
+				memcpy(&name, data, sizeof(name));
+				beginBlock(state, name, header.time);
+				break;
+			}
+			case EventType::END_BLOCK: endBlock(state, header.time); break;
+			case EventType::FRAME:
+				beginEvent("i", state, header.time);
+				out << ",\"name\":\"frame\",\"s\":\"g\"}";
+				break;
+			case EventType::STRING: addArg(state, "string", (const char*)data, true); break;
+			case EventType::INT: {
+				IntRecord r;
+				memcpy(&r, data, sizeof(r));
+				addArg(state, r.key, r.value);
+				break;
+			}
+			case EventType::JOB_INFO: {
+				JobRecord r;
+				memcpy(&r, data, sizeof(r));
+				addArg(state, "signal_on_finish", r.signal_on_finish);
+				addArg(state, "precondition", r.precondition);
+				break;
+			}
+			case EventType::LINK: {
+				i64 link;
+				memcpy(&link, data, sizeof(link));
+				addArg(state, "link", link);
+				flowEvent("s", "link", state, header.time, link);
+				break;
+			}
+			case EventType::BEGIN_FIBER_WAIT:
+			case EventType::END_FIBER_WAIT: {
+				FiberWaitRecord r;
+				memcpy(&r, data, sizeof(r));
+				const bool begin = header.type == EventType::BEGIN_FIBER_WAIT;
+				flowEvent(begin ? "s" : "f", "fiber", state, header.time, r.id);
+				break;
+			}
+			case EventType::BEGIN_GPU_BLOCK: {
+				GPUBlock r;
+				memcpy(&r, data, sizeof(r));
+				r.name[lengthOf(r.name) - 1] = '\0';
+				beginBlock(state, r.name, r.timestamp);
+				if (r.profiler_link) flowEvent("f", "link", state, r.timestamp, r.profiler_link);
+				break;
+			}
+			case EventType::END_GPU_BLOCK: {
+				u64 timestamp;
+				memcpy(&timestamp, data, sizeof(timestamp));
+				endBlock(state, timestamp);
+				break;
+			}
+			case EventType::GPU_MEM_STATS: {
+				GPUMemStatsBlock r;
+				memcpy(&r, data, sizeof(r));
+				beginEvent("C", state, header.time);
+				out << ",\"name\":\"gpu memory\",\"args\":{\"total\":" << r.total << ",\"current\":" << r.current << ",\"dedicated\":" << r.dedicated << "}}";
+				break;
+			}
+			case EventType::MEMORY_TAG: {
+				MemoryTagRecord r;
+				memcpy(&r, data, sizeof(r));
+				r.name[lengthOf(r.name) - 1] = '\0';
+				beginEvent("C", state, header.time);
+				const StaticString<64> name("memory ", r.name);
+				writeName(name);
+				out << ",\"args\":{\"live\":" << r.live_bytes << "}}";
+				break;
+			}
+			case EventType::BLOCK_COLOR:
+			case EventType::CONTEXT_SWITCH:
+			case EventType::GPU_FRAME:
+				break;
+		}
+	}
+
+	void drain(ThreadState& state)
+	{
+		ThreadContext& ctx = *state.ctx;
+		writeThreadName(state);
+
+		// copy new events, see serialize()
+		const u32 end = ctx.end;
+		acquireFence();
+		u32 from = state.read_pos;
+		if (end - from > THREAD_BUFFER_SIZE) from = end - THREAD_BUFFER_SIZE;
+		const u32 size = end - from;
+		const u8* buf = ctx.buffer.data();
+		u8* dst = scratch.getMutableData();
+		const u32 l = from & (THREAD_BUFFER_SIZE - 1);
+		if (THREAD_BUFFER_SIZE - l >= size) {
+			memcpy(dst, buf + l, size);
+		}
+		else {
+			memcpy(dst, buf + l, THREAD_BUFFER_SIZE - l);
+			memcpy(dst + THREAD_BUFFER_SIZE - l, buf, size - (THREAD_BUFFER_SIZE - l));
+		}
+		acquireFence();
+		const u32 begin = ctx.begin;
+
+		u32 pos = state.read_pos;
+		if (i32(begin - pos) > 0) {
+			// writer overwrote events we did not read yet
+			while (state.depth > 0) endBlock(state, state.last_time);
+			beginEvent("i", state, state.last_time);
+			out << ",\"name\":\"events lost\",\"s\":\"t\"}";
+			// writer lapped the whole copied range while we were copying it
+			pos = i32(begin - end) >= 0 ? end : begin;
+		}
+
+		while (i32(end - pos) > 0) {
+			EventHeader header;
+			const u8* event = dst + (pos - from);
+			memcpy(&header, event, sizeof(header));
+			processEvent(state, header, event + sizeof(header));
+			pos += header.size;
+		}
+		state.read_pos = end;
+		flush();
+	}
+
+	void drain()
+	{
+		{
+			MutexGuard lock(g_instance.mutex);
+			if (threads.empty()) addThread(g_instance.global_context, 0);
+			for (u32 i = threads.size() - 1; i < (u32)g_instance.contexts.size(); ++i) {
+				ThreadContext* ctx = g_instance.contexts[i];
+				addThread(*ctx, ctx->thread_id);
+			}
+		}
+		for (ThreadState* state : threads) drain(*state);
+	}
+
+	void addThread(ThreadContext& ctx, u32 tid)
+	{
+		ThreadState* state = LUMIX_NEW(getAllocator(), ThreadState);
+		state->ctx = &ctx;
+		state->tid = tid;
+		state->read_pos = ctx.end;
+		threads.push(state);
+	}
+
+	int task() override
+	{
+		while (!finished) {
+			drain();
+			os::sleep(10);
+		}
+		drain();
+		closeFile();
+		return 0;
+	}
+
+	StaticString<LUMIX_MAX_PATH> path;
+	u64 max_file_size = 0;
+	u64 file_size = 0;
+	u64 start_time;
+	double frequency;
+	bool first_event = true;
+	bool file_ok = true;
+	volatile bool finished = false;
+	os::OutputFile file;
+	Array<ThreadState*> threads;
+	OutputMemoryStream scratch;
+	OutputMemoryStream out;
+};
+
+
+bool startCapture(const char* path, u64 max_file_size)
+{
+	stopCapture();
+
+	Capture* capture = LUMIX_NEW(g_instance.allocator, Capture)(g_instance.allocator);
+	capture->path = path;
+	capture->max_file_size = max_file_size;
+	capture->start_time = os::Timer::getRawTimestamp();
+	capture->frequency = (double)frequency();
+	if (!capture->openFile()) {
+		logError("Failed to open ", path);
+		LUMIX_DELETE(g_instance.allocator, capture);
+		return false;
+	}
+	if (!capture->create("profiler capture", true)) {
+		capture->closeFile();
+		LUMIX_DELETE(g_instance.allocator, capture);
+		return false;
+	}
+	g_instance.capture = capture;
+	return true;
+}
+
+
+void stopCapture()
+{
+	Capture* capture = g_instance.capture;
+	if (!capture) return;
+
+	capture->finished = true;
+	capture->destroy();
+	LUMIX_DELETE(g_instance.allocator, capture);
+	g_instance.capture = nullptr;
+}
+
+
 void pause(bool paused)
 {
 	g_instance.paused = paused;
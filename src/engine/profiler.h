@@ -29,6 +29,11 @@ LUMIX_ENGINE_API void gpuFrame();
 LUMIX_ENGINE_API void link(i64 link);
 LUMIX_ENGINE_API i64 createNewLinkID();
 LUMIX_ENGINE_API void serialize(OutputMemoryStream& blob);
+// streams events to `path` in chrome's trace event format (chrome://tracing, ui.perfetto.dev)
+// until stopCapture(); if max_file_size is not 0, the file is moved to `path`.prev when it
+// reaches that size and a new one is started, so only the last two files are kept
+LUMIX_ENGINE_API bool startCapture(const char* path, u64 max_file_size = 0);
+LUMIX_ENGINE_API void stopCapture();
 
 struct FiberSwitchData {
 	i32 id;
@@ -98,6 +103,17 @@ struct GPUMemStatsBlock
 	u64 dedicated;
 };
 
+// snapshot of TagAllocator stats, written by frame() when they change
+struct MemoryTagRecord
+{
+	char name[32];
+	u32 id;
+	u32 parent_id;
+	u64 live_bytes;
+	u64 peak_bytes;
+	u64 live_count;
+};
+
 
 enum class EventType : u8
 {
@@ -115,7 +131,8 @@ enum class EventType : u8
 	END_GPU_BLOCK,
 	GPU_FRAME,
 	GPU_MEM_STATS,
-	LINK
+	LINK,
+	MEMORY_TAG
 };
 
 #pragma pack(1)
@@ -1,7 +1,9 @@
 #include "engine/resource.h"
+#include "engine/atomic.h"
 #include "engine/crc32.h"
 #include "engine/log.h"
 #include "engine/lumix.h"
+#include "engine/compression.h"
 #include "engine/lz4.h"
 #include "engine/path.h"
 #include "engine/resource_manager.h"
@@ -20,6 +22,9 @@ ResourceType::ResourceType(const char* type_name)
 }
 
 
+static i32 volatile g_generation = 0;
+
+
 Resource::Resource(const Path& path, ResourceManager& resource_manager, IAllocator& allocator)
 	: m_ref_count()
 	, m_empty_dep_count(1)
@@ -31,6 +36,7 @@ Resource::Resource(const Path& path, ResourceManager& resource_manager, IAllocat
 	, m_cb(allocator)
 	, m_resource_manager(resource_manager)
 	, m_async_op(FileSystem::AsyncHandle::invalid())
+	, m_generation((u32)atomicIncrement(&g_generation))
 {
 }
 
@@ -107,6 +113,30 @@ void Resource::checkState()
 }
 
 
+// called on a job worker before fileLoaded, see FileSystem::ProcessCallback
+// decompressed content has the same header, without the COMPRESSED flag
+static bool decompressResource(Span<const u8> content, OutputMemoryStream& result) {
+	CompiledResourceHeader header;
+	// invalid headers are reported by fileLoaded
+	if (content.length() < sizeof(header)) return true;
+	memcpy(&header, content.begin(), sizeof(header));
+	if (header.magic != CompiledResourceHeader::MAGIC) return true;
+	if (header.version > CompiledResourceHeader::VERSION) return true;
+	if (!(header.flags & CompiledResourceHeader::COMPRESSED)) return true;
+
+	const Span<const u8> src = content.fromLeft(sizeof(header));
+	header.flags &= ~CompiledResourceHeader::COMPRESSED;
+	result.resize(sizeof(header) + header.decompressed_size);
+	memcpy(result.getMutableData(), &header, sizeof(header));
+	const Span<u8> dst(result.getMutableData() + sizeof(header), (u32)header.decompressed_size);
+	if (header.version == 0) {
+		const i32 res = LZ4_decompress_safe((const char*)src.begin(), (char*)dst.begin(), (i32)src.length(), (i32)dst.length());
+		return res == (i32)header.decompressed_size;
+	}
+	return chunked_lz4::decompressParallel(src, dst);
+}
+
+
 void Resource::fileLoaded(u64 size, const u8* mem, bool success) {
 	ASSERT(m_async_op.isValid());
 	m_async_op = FileSystem::AsyncHandle::invalid();
@@ -125,6 +155,9 @@ void Resource::fileLoaded(u64 size, const u8* mem, bool success) {
 		return;
 	}
 
+	// dependencies are added while loading, so we start with an empty list
+	m_resource_manager.getOwner().clearRecordedDependencies(*this);
+
 	const CompiledResourceHeader* header = (const CompiledResourceHeader*)mem;
 	if (startsWith(getPath().c_str(), ".lumix/asset_tiles/")) {
 		if (!load(size, mem)) {
@@ -140,26 +173,21 @@ void Resource::fileLoaded(u64 size, const u8* mem, bool success) {
 		logError("Invalid resource file, please delete .lumix directory");
 		++m_failed_dep_count;
 	}
-	else if (header->version != 0) {
+	else if (header->version > CompiledResourceHeader::VERSION) {
 		logError("Unsupported resource file version, please delete .lumix directory");
 		++m_failed_dep_count;
 	}
-	else if (header->flags & CompiledResourceHeader::COMPRESSED) {
-		OutputMemoryStream tmp(m_resource_manager.m_allocator);
-		tmp.resize(header->decompressed_size);
-		const i32 res = LZ4_decompress_safe((const char*)mem + sizeof(*header), (char*)tmp.getMutableData(), i32(size - sizeof(*header)), (i32)tmp.size());
-		if (res != header->decompressed_size || !load(header->decompressed_size, tmp.data())) {
-			++m_failed_dep_count;
-		}
-		m_size = header->decompressed_size;
-	}
 	else {
+		// compressed data was already decompressed by decompressResource
+		ASSERT(!(header->flags & CompiledResourceHeader::COMPRESSED));
 		if (!load(size - sizeof(*header), mem + sizeof(*header))) {
 			++m_failed_dep_count;
 		}
 		m_size = header->decompressed_size;
 	} 
 
+	m_resource_manager.m_cache_stats.resident_size += m_size;
+
 	ASSERT(m_empty_dep_count > 0);
 	--m_empty_dep_count;
 	checkState();
@@ -176,11 +204,15 @@ void Resource::doUnload()
 		m_async_op = FileSystem::AsyncHandle::invalid();
 	}
 
+	if (m_cached) m_resource_manager.removeFromCache(*this);
+
 	m_hooked = false;
 	m_desired_state = State::EMPTY;
 	unload();
+	m_generation = (u32)atomicIncrement(&g_generation);
 	ASSERT(m_empty_dep_count <= 1);
 
+	m_resource_manager.m_cache_stats.resident_size -= m_size;
 	m_size = 0;
 	m_empty_dep_count = 1;
 	m_failed_dep_count = 0;
@@ -200,7 +232,7 @@ void Resource::onCreated(State state)
 }
 
 
-void Resource::doLoad()
+void Resource::doLoad(FileSystem::Priority priority)
 {
 	if (m_desired_state == State::READY) return;
 	m_desired_state = State::READY;
@@ -214,11 +246,13 @@ void Resource::doLoad()
 
 	const u32 hash = m_path.getHash();
 	if (startsWith(m_path.c_str(), ".lumix/asset_tiles/")) {
-		m_async_op = fs.getContent(m_path, cb);
+		m_async_op = fs.getContent(m_path, cb, priority);
 	}
 	else {	
 		const StaticString<LUMIX_MAX_PATH> res_path(".lumix/assets/", hash, ".res");
-		m_async_op = fs.getContent(Path(res_path), cb);
+		FileSystem::ProcessCallback process;
+		process.bind<&decompressResource>();
+		m_async_op = fs.getContent(Path(res_path), cb, process, priority);
 	}
 }
 
@@ -228,6 +262,7 @@ void Resource::addDependency(Resource& dependent_resource)
 	ASSERT(m_desired_state != State::EMPTY);
 
 	dependent_resource.m_cb.bind<&Resource::onStateChanged>(this);
+	m_resource_manager.getOwner().recordDependency(*this, dependent_resource);
 	if (dependent_resource.isEmpty()) ++m_empty_dep_count;
 	if (dependent_resource.isFailure()) {
 		++m_failed_dep_count;
@@ -261,7 +296,7 @@ u32 Resource::decRefCount() {
 	ASSERT(m_ref_count > 0);
 	--m_ref_count;
 	if (m_ref_count == 0 && m_resource_manager.m_is_unload_enabled) {
-		doUnload();
+		m_resource_manager.onUnreferenced(*this);
 	}
 	return m_ref_count;
 }
@@ -23,11 +23,14 @@ const ResourceType INVALID_RESOURCE_TYPE("");
 #pragma pack(1)
 struct CompiledResourceHeader {
 	static constexpr u32 MAGIC = 'LRES';
+	// 0 - compressed data is a single LZ4 block
+	// 1 - compressed data is chunked_lz4
+	static constexpr u32 VERSION = 1;
 	enum Flags {
 		COMPRESSED = 1 << 0
 	};
 	u32 magic = MAGIC;
-	u32 version = 0;
+	u32 version = VERSION;
 	u32 flags = 0;
 	u32 padding = 0;
 	u64 decompressed_size = 0;
@@ -62,6 +65,10 @@ struct LUMIX_ENGINE_API Resource {
 	u32 incRefCount() { return ++m_ref_count; }
 	bool wantReady() const { return m_desired_state == State::READY; }
 	bool isHooked() const { return m_hooked; }
+	bool isCached() const { return m_cached; }
+	// changes whenever the resource is unloaded, unique among all resources, so anything derived
+	// from the resource's data can be cached together with the generation and rebuilt once it differs
+	u32 getGeneration() const { return m_generation; }
 
 	template <auto Function, typename C> void onLoaded(C* instance)
 	{
@@ -91,7 +98,7 @@ protected:
 	ResourceManager& m_resource_manager;
 
 private:
-	void doLoad();
+	void doLoad(FileSystem::Priority priority = FileSystem::Priority::NORMAL);
 	void fileLoaded(u64 size, const u8* mem, bool success);
 	void onStateChanged(State old_state, State new_state, Resource&);
 
@@ -106,6 +113,11 @@ private:
 	State m_current_state;
 	FileSystem::AsyncHandle m_async_op;
 	bool m_hooked = false;
+	u32 m_generation;
+	// LRU list of unreferenced resources in ResourceManager
+	bool m_cached = false;
+	Resource* m_cache_prev = nullptr;
+	Resource* m_cache_next = nullptr;
 	#ifdef LUMIX_DEBUG
 		bool m_invoking = false;
 	#endif
@@ -1,7 +1,10 @@
 #include "engine/log.h"
 #include "engine/lumix.h"
+#include "engine/os.h"
+#include "engine/profiler.h"
 #include "engine/resource.h"
 #include "engine/resource_manager.h"
+#include "engine/stream.h"
 
 
 namespace Lumix
@@ -16,6 +19,7 @@ void ResourceManager::create(ResourceType type, ResourceManagerHub& owner)
 
 void ResourceManager::destroy()
 {
+	setMemoryBudget(0);
 	for (auto iter = m_resources.begin(), end = m_resources.end(); iter != end; ++iter)
 	{
 		Resource* resource = iter.value();
@@ -40,7 +44,7 @@ Resource* ResourceManager::get(const Path& path)
 	return nullptr;
 }
 
-Resource* ResourceManager::load(const Path& path)
+Resource* ResourceManager::load(const Path& path, FileSystem::Priority priority)
 {
 	if (path.isEmpty()) return nullptr;
 	Resource* resource = get(path);
@@ -51,8 +55,14 @@ Resource* ResourceManager::load(const Path& path)
 		m_resources.insert(path.getHash(), resource);
 	}
 
+	if (resource->m_cached) {
+		removeFromCache(*resource);
+		++m_cache_stats.hits;
+	}
+
 	if(resource->isEmpty() && resource->m_desired_state == Resource::State::EMPTY)
 	{
+		++m_cache_stats.misses;
 		if (m_owner->onBeforeLoad(*resource) == ResourceManagerHub::LoadHook::Action::DEFERRED)
 		{
 			ASSERT(!resource->m_hooked);
@@ -60,9 +70,11 @@ Resource* ResourceManager::load(const Path& path)
 			resource->m_desired_state = Resource::State::READY;
 			resource->incRefCount(); // for hook
 			resource->incRefCount(); // for return value
+			m_owner->prefetch(*resource, priority);
 			return resource;
 		}
-		resource->doLoad();
+		resource->doLoad(priority);
+		m_owner->prefetch(*resource, priority);
 	}
 
 	resource->incRefCount();
@@ -76,16 +88,77 @@ void ResourceManager::removeUnreferenced()
 	Array<Resource*> to_remove(m_allocator);
 	for (auto* i : m_resources)
 	{
-		if (i->getRefCount() == 0) to_remove.push(i);
+		if (i->getRefCount() == 0 && !i->m_cached) to_remove.push(i);
 	}
 
 	for (auto* i : to_remove)
 	{
-		auto iter = m_resources.find(i->getPath().getHash());
-		if (iter.value()->isReady()) iter.value()->doUnload();
+		// could be unloaded or cached by previous iterations
+		if (i->isReady() && !i->m_cached && i->getRefCount() == 0) onUnreferenced(*i);
+	}
+}
+
+void ResourceManager::onUnreferenced(Resource& resource)
+{
+	if (m_memory_budget == 0 || !resource.isReady()) {
+		resource.doUnload();
+		return;
+	}
+
+	addToCache(resource);
+	evict();
+}
+
+void ResourceManager::addToCache(Resource& resource)
+{
+	ASSERT(!resource.m_cached);
+	resource.m_cached = true;
+	resource.m_cache_prev = m_cache_last;
+	resource.m_cache_next = nullptr;
+	if (m_cache_last) m_cache_last->m_cache_next = &resource;
+	else m_cache_first = &resource;
+	m_cache_last = &resource;
+
+	m_cache_stats.cached_size += resource.size();
+	++m_cache_stats.cached_count;
+}
+
+void ResourceManager::removeFromCache(Resource& resource)
+{
+	ASSERT(resource.m_cached);
+	if (resource.m_cache_prev) resource.m_cache_prev->m_cache_next = resource.m_cache_next;
+	else m_cache_first = resource.m_cache_next;
+	if (resource.m_cache_next) resource.m_cache_next->m_cache_prev = resource.m_cache_prev;
+	else m_cache_last = resource.m_cache_prev;
+	resource.m_cached = false;
+	resource.m_cache_prev = nullptr;
+	resource.m_cache_next = nullptr;
+
+	m_cache_stats.cached_size -= resource.size();
+	--m_cache_stats.cached_count;
+}
+
+void ResourceManager::evict()
+{
+	// unloading can release dependencies, which can end up in the cache, so we check the list every time
+	while (m_cache_first && m_cache_stats.resident_size > m_memory_budget) {
+		++m_cache_stats.evictions;
+		m_cache_first->doUnload();
 	}
 }
 
+void ResourceManager::clearCache()
+{
+	while (m_cache_first) m_cache_first->doUnload();
+}
+
+void ResourceManager::setMemoryBudget(u64 bytes)
+{
+	m_memory_budget = bytes;
+	if (bytes == 0) clearCache();
+	else evict();
+}
+
 void ResourceManager::reload(const Path& path)
 {
 	Resource* resource = get(path);
@@ -94,6 +167,12 @@ void ResourceManager::reload(const Path& path)
 
 void ResourceManager::reload(Resource& resource)
 {
+	if (resource.m_cached) {
+		// nobody references it, so just drop the stale data, next load() reads the new file
+		resource.doUnload();
+		return;
+	}
+
 	if (resource.m_current_state != Resource::State::EMPTY) {
 		resource.doUnload();
 	}
@@ -119,9 +198,9 @@ void ResourceManager::enableUnload(bool enable)
 
 	for (auto* resource : m_resources)
 	{
-		if (resource->getRefCount() == 0)
+		if (resource->getRefCount() == 0 && !resource->m_cached)
 		{
-			resource->doUnload();
+			onUnreferenced(*resource);
 		}
 	}
 }
@@ -140,6 +219,11 @@ ResourceManager::~ResourceManager()
 
 ResourceManagerHub::ResourceManagerHub(IAllocator& allocator) 
 	: m_resource_managers(allocator)
+	, m_caches(allocator)
+	, m_manifest(allocator)
+	, m_manifest_path_offsets(allocator)
+	, m_manifest_paths(allocator)
+	, m_prefetched(allocator)
 	, m_allocator(allocator)
 	, m_load_hook(nullptr)
 	, m_file_system(nullptr)
@@ -152,18 +236,200 @@ ResourceManagerHub::~ResourceManagerHub() = default;
 void ResourceManagerHub::init(FileSystem& fs)
 {
 	m_file_system = &fs;
+	loadDependencyManifest();
 }
 
-Resource* ResourceManagerHub::load(ResourceType type, const Path& path)
+Resource* ResourceManagerHub::load(ResourceType type, const Path& path, FileSystem::Priority priority)
 {
 	ResourceManager* manager = get(type);
 	if(!manager) return nullptr;
-	return load(*manager, path);
+	return load(*manager, path, priority);
 }
 	
-Resource* ResourceManagerHub::load(ResourceManager& manager, const Path& path)
+Resource* ResourceManagerHub::load(ResourceManager& manager, const Path& path, FileSystem::Priority priority)
+{
+	return manager.load(path, priority);
+}
+
+static constexpr u32 MANIFEST_MAGIC = 'LDEP';
+static constexpr u32 MANIFEST_VERSION = 0;
+static const char* MANIFEST_PATH = ".lumix/assets/_deps.bin";
+
+void ResourceManagerHub::prefetch(Resource& resource, FileSystem::Priority priority)
+{
+	auto iter = m_manifest.find(resource.getPath().getHash());
+	if (!iter.isValid() || iter.value().empty()) return;
+
+	PROFILE_FUNCTION();
+	// loading a dependency prefetches its own dependencies, so the whole closure is requested at once;
+	// that can change m_manifest, so we copy the list first
+	Array<ManifestDependency> dependencies(m_allocator);
+	for (const ManifestDependency& dep : iter.value()) dependencies.push(dep);
+
+	for (const ManifestDependency& dep : dependencies) {
+		auto manager_iter = m_resource_managers.find(dep.type);
+		if (!manager_iter.isValid()) continue;
+
+		const Path path(&m_manifest_paths[dep.path]);
+		Resource* dependency = manager_iter.value()->load(path, priority);
+		if (dependency) m_prefetched.push({&resource, dependency});
+	}
+}
+
+u32 ResourceManagerHub::addManifestPath(const char* path, u32 hash)
+{
+	auto iter = m_manifest_path_offsets.find(hash);
+	if (iter.isValid()) return iter.value();
+
+	const u32 offset = m_manifest_paths.size();
+	const i32 len = stringLength(path);
+	m_manifest_paths.resize(offset + len + 1);
+	memcpy(&m_manifest_paths[offset], path, len + 1);
+	m_manifest_path_offsets.insert(hash, offset);
+	return offset;
+}
+
+void ResourceManagerHub::recordDependency(Resource& resource, Resource& dependency)
+{
+	if (!m_record_dependencies) return;
+
+	const u32 hash = resource.getPath().getHash();
+	auto iter = m_manifest.find(hash);
+	if (!iter.isValid()) {
+		m_manifest.insert(hash, Array<ManifestDependency>(m_allocator));
+		iter = m_manifest.find(hash);
+	}
+
+	const Path& path = dependency.getPath();
+	for (const ManifestDependency& dep : iter.value()) {
+		if (dep.path_hash == path.getHash()) return;
+	}
+
+	ManifestDependency& dep = iter.value().emplace();
+	dep.type = dependency.getType().type;
+	dep.path_hash = path.getHash();
+	dep.path = addManifestPath(path.c_str(), path.getHash());
+}
+
+void ResourceManagerHub::clearRecordedDependencies(Resource& resource)
+{
+	if (!m_record_dependencies) return;
+
+	auto iter = m_manifest.find(resource.getPath().getHash());
+	if (iter.isValid()) iter.value().clear();
+}
+
+// returns nullptr if the string is not terminated inside the blob
+static const char* readManifestString(InputMemoryStream& blob)
+{
+	const char* data = (const char*)blob.getData();
+	for (u64 i = blob.getPosition(), c = blob.size(); i < c; ++i) {
+		if (data[i] == 0) return blob.readString();
+	}
+	return nullptr;
+}
+
+bool ResourceManagerHub::loadDependencyManifest()
 {
-	return manager.load(path);
+	m_manifest.clear();
+	m_manifest_path_offsets.clear();
+	m_manifest_paths.clear();
+
+	OutputMemoryStream content(m_allocator);
+	if (!m_file_system->getContentSync(Path(MANIFEST_PATH), content)) return false;
+
+	InputMemoryStream blob(content);
+	auto remaining = [&](){ return blob.size() - blob.getPosition(); };
+	if (remaining() < sizeof(u32) * 3) {
+		logError("Corrupted ", MANIFEST_PATH);
+		return false;
+	}
+	u32 magic, version, count;
+	blob.read(magic);
+	blob.read(version);
+	blob.read(count);
+	if (magic != MANIFEST_MAGIC || version != MANIFEST_VERSION) {
+		logError("Unsupported ", MANIFEST_PATH);
+		return false;
+	}
+
+	// type, path hash and at least the terminating zero of the path
+	constexpr u64 MIN_DEP_SIZE = sizeof(u32) * 2 + 1;
+	bool ok = true;
+	for (u32 i = 0; ok && i < count; ++i) {
+		if (remaining() < sizeof(u32) * 2) {
+			ok = false;
+			break;
+		}
+		u32 hash, deps_count;
+		blob.read(hash);
+		blob.read(deps_count);
+		if (deps_count > remaining() / MIN_DEP_SIZE) {
+			ok = false;
+			break;
+		}
+
+		Array<ManifestDependency> deps(m_allocator);
+		deps.reserve(deps_count);
+		for (u32 j = 0; j < deps_count; ++j) {
+			ManifestDependency& dep = deps.emplace();
+			if (remaining() < sizeof(dep.type) + sizeof(dep.path_hash)) {
+				ok = false;
+				break;
+			}
+			blob.read(dep.type);
+			blob.read(dep.path_hash);
+			const char* path = readManifestString(blob);
+			if (!path) {
+				ok = false;
+				break;
+			}
+			dep.path = addManifestPath(path, dep.path_hash);
+		}
+		if (ok) m_manifest.insert(hash, static_cast<Array<ManifestDependency>&&>(deps));
+	}
+
+	if (!ok) {
+		logError("Corrupted ", MANIFEST_PATH);
+		m_manifest.clear();
+		m_manifest_path_offsets.clear();
+		m_manifest_paths.clear();
+		return false;
+	}
+	return true;
+}
+
+bool ResourceManagerHub::saveDependencyManifest()
+{
+	OutputMemoryStream blob(m_allocator);
+	u32 count = 0;
+	for (const Array<ManifestDependency>& deps : m_manifest) {
+		if (!deps.empty()) ++count;
+	}
+	blob.write(MANIFEST_MAGIC);
+	blob.write(MANIFEST_VERSION);
+	blob.write(count);
+	for (auto iter = m_manifest.begin(), end = m_manifest.end(); iter != end; ++iter) {
+		const Array<ManifestDependency>& deps = iter.value();
+		if (deps.empty()) continue;
+
+		blob.write(iter.key());
+		blob.write(deps.size());
+		for (const ManifestDependency& dep : deps) {
+			blob.write(dep.type);
+			blob.write(dep.path_hash);
+			blob.writeString(&m_manifest_paths[dep.path]);
+		}
+	}
+
+	os::OutputFile file;
+	if (!m_file_system->open(MANIFEST_PATH, file)) {
+		logError("Could not save ", MANIFEST_PATH);
+		return false;
+	}
+	const bool success = file.write(blob.data(), blob.size());
+	file.close();
+	return success;
 }
 
 ResourceManager* ResourceManagerHub::get(ResourceType type)
@@ -200,7 +466,65 @@ void ResourceManagerHub::add(ResourceType type, ResourceManager* rm)
 
 void ResourceManagerHub::remove(ResourceType type)
 { 
-	m_resource_managers.erase(type.type);
+	auto iter = m_resource_managers.find(type.type);
+	if (!iter.isValid()) return;
+
+	m_caches.eraseItems([&](const Cache& cache){ return cache.manager == iter.value(); });
+	m_resource_managers.erase(iter);
+}
+
+void ResourceManagerHub::cancelPrefetch()
+{
+	while (!m_prefetched.empty()) {
+		Resource* dependency = m_prefetched.back().dependency;
+		m_prefetched.pop();
+		dependency->decRefCount();
+	}
+}
+
+bool ResourceManagerHub::setMemoryBudget(const char* type_name, u64 bytes)
+{
+	ResourceManager* manager = get(ResourceType(type_name));
+	if (!manager) {
+		logError("Unknown resource type ", type_name);
+		return false;
+	}
+
+	manager->setMemoryBudget(bytes);
+	m_caches.eraseItems([&](const Cache& cache){ return cache.manager == manager; });
+	if (bytes > 0) {
+		Cache& cache = m_caches.emplace();
+		cache.manager = manager;
+		cache.name = type_name;
+	}
+	return true;
+}
+
+void ResourceManagerHub::update()
+{
+	PROFILE_FUNCTION();
+	// dependencies are referenced by their parents once the parents are loaded
+	for (i32 i = m_prefetched.size() - 1; i >= 0; --i) {
+		const Prefetch prefetch = m_prefetched[i];
+		if (prefetch.parent->isEmpty() && prefetch.parent->wantReady()) continue;
+
+		m_prefetched.swapAndPop(i);
+		prefetch.dependency->decRefCount();
+	}
+
+	for (const Cache& cache : m_caches) {
+		// budget can be exceeded by resources loaded since the last update
+		cache.manager->evict();
+
+		const ResourceManager::CacheStats& stats = cache.manager->getCacheStats();
+		const u64 requests = stats.hits + stats.misses;
+		PROFILE_BLOCK("resource cache");
+		profiler::pushString(cache.name);
+		profiler::pushInt("hit rate %", requests ? int(stats.hits * 100 / requests) : 0);
+		profiler::pushInt("resident KB", int(stats.resident_size / 1024));
+		profiler::pushInt("cached KB", int(stats.cached_size / 1024));
+		profiler::pushInt("evictions", int(stats.evictions));
+	}
 }
 
 void ResourceManagerHub::removeUnreferenced()
@@ -226,7 +550,11 @@ void ResourceManagerHub::reloadAll() {
 	for (auto* manager : m_resource_managers) {
 		ResourceManager::ResourceTable& resources = manager->getResourceTable();
 		for (Resource* res : resources) {
-			if (res->isReady()) {
+			if (res->m_cached) {
+				// unreferenced, see ResourceManager::reload
+				res->doUnload();
+			}
+			else if (res->isReady()) {
 				res->doUnload();
 				to_reload.push(res);
 			}
@@ -1,7 +1,10 @@
 #pragma once
 
 
+#include "engine/array.h"
+#include "engine/file_system.h"
 #include "engine/hash_map.h"
+#include "engine/string.h"
 
 
 namespace Lumix
@@ -13,12 +16,28 @@ struct LUMIX_ENGINE_API ResourceManager {
 	friend struct ResourceManagerHub;
 	using ResourceTable = HashMap<u32, struct Resource*, HashFuncDirect<u32>>;
 
+	struct CacheStats {
+		u64 hits = 0;
+		u64 misses = 0;
+		u64 evictions = 0;
+		// size of all loaded resources, including cached
+		u64 resident_size = 0;
+		u64 cached_size = 0;
+		u32 cached_count = 0;
+	};
+
 	void create(struct ResourceType type, struct ResourceManagerHub& owner);
 	void destroy();
 
 	void enableUnload(bool enable);
 
 	void removeUnreferenced();
+	// unreferenced ready resources are kept loaded until resident size of all resources 
+	// goes over the budget, then the least recently used are unloaded; 0 disables the cache
+	void setMemoryBudget(u64 bytes);
+	u64 getMemoryBudget() const { return m_memory_budget; }
+	const CacheStats& getCacheStats() const { return m_cache_stats; }
+	void clearCache();
 
 	void reload(const Path& path);
 	void reload(Resource& resource);
@@ -29,20 +48,35 @@ struct LUMIX_ENGINE_API ResourceManager {
 	ResourceManagerHub& getOwner() const { return *m_owner; }
 
 protected:
-	Resource* load(const Path& path);
+	Resource* load(const Path& path, FileSystem::Priority priority = FileSystem::Priority::NORMAL);
 	virtual Resource* createResource(const Path& path) = 0;
 	virtual void destroyResource(Resource& resource) = 0;
 	Resource* get(const Path& path);
 
+private:
+	void onUnreferenced(Resource& resource);
+	void addToCache(Resource& resource);
+	void removeFromCache(Resource& resource);
+	void evict();
+
 protected:
 	IAllocator& m_allocator;
 	ResourceTable m_resources;
 	ResourceManagerHub* m_owner;
 	bool m_is_unload_enabled;
+
+private:
+	u64 m_memory_budget = 0;
+	CacheStats m_cache_stats;
+	// cached resources, from the least recently used
+	Resource* m_cache_first = nullptr;
+	Resource* m_cache_last = nullptr;
 };
 
 
 struct LUMIX_ENGINE_API ResourceManagerHub {
+	friend struct Resource;
+	friend struct ResourceManager;
 	using ResourceManagerTable = HashMap<u32, ResourceManager*>;
 
 	struct LUMIX_ENGINE_API LoadHook {
@@ -63,12 +97,14 @@ struct LUMIX_ENGINE_API ResourceManagerHub {
 	const ResourceManagerTable& getAll() const { return m_resource_managers; }
 
 	template <typename R> 
-	R* load(const Path& path)
+	R* load(const Path& path, FileSystem::Priority priority = FileSystem::Priority::NORMAL)
 	{
-		return static_cast<R*>(load(R::TYPE, path));
+		return static_cast<R*>(load(R::TYPE, path, priority));
 	}
 
-	Resource* load(ResourceType type, const Path& path);
+	// if the resource is not loaded yet, dependencies from the manifest are loaded with it, 
+	// so they do not wait until the resource is parsed
+	Resource* load(ResourceType type, const Path& path, FileSystem::Priority priority = FileSystem::Priority::NORMAL);
 
 	void setLoadHook(LoadHook* hook);
 	LoadHook::Action onBeforeLoad(Resource& resource) const;
@@ -78,13 +114,52 @@ struct LUMIX_ENGINE_API ResourceManagerHub {
 	void reloadAll();
 	void removeUnreferenced();
 	void enableUnload(bool enable);
+	// see ResourceManager::setMemoryBudget, cache stats are reported to profiler as `type_name`
+	bool setMemoryBudget(const char* type_name, u64 bytes);
+	// evicts cached resources over budget and releases finished prefetches, called once per frame
+	void update();
+	// releases all dependencies held by prefetch, even if their parent is not loaded yet
+	void cancelPrefetch();
+
+	// dependency manifest is .lumix/assets/_deps.bin, dependencies are recorded when resources load
+	bool loadDependencyManifest();
+	bool saveDependencyManifest();
+	void enableDependencyRecording(bool enable) { m_record_dependencies = enable; }
 
 	FileSystem& getFileSystem() { return *m_file_system; }
 
 private:
-	Resource* load(ResourceManager& manager, const Path& path);
+	struct Cache {
+		ResourceManager* manager;
+		StaticString<32> name;
+	};
+
+	struct ManifestDependency {
+		u32 type;
+		u32 path_hash;
+		// offset in m_manifest_paths
+		u32 path;
+	};
+
+	struct Prefetch {
+		Resource* parent;
+		Resource* dependency;
+	};
+
+	Resource* load(ResourceManager& manager, const Path& path, FileSystem::Priority priority);
+	void prefetch(Resource& resource, FileSystem::Priority priority);
+	void recordDependency(Resource& resource, Resource& dependency);
+	void clearRecordedDependencies(Resource& resource);
+	u32 addManifestPath(const char* path, u32 hash);
+
 	IAllocator& m_allocator;
 	ResourceManagerTable m_resource_managers;
+	Array<Cache> m_caches;
+	HashMap<u32, Array<ManifestDependency>, HashFuncDirect<u32>> m_manifest;
+	HashMap<u32, u32, HashFuncDirect<u32>> m_manifest_path_offsets;
+	Array<char> m_manifest_paths;
+	Array<Prefetch> m_prefetched;
+	bool m_record_dependencies = false;
 	FileSystem* m_file_system;
 	LoadHook* m_load_hook;
 };
@@ -1,10 +1,13 @@
 #include "universe.h"
 #include "engine/crc32.h"
 #include "engine/engine.h"
+#include "engine/atomic.h"
+#include "engine/job_system.h"
 #include "engine/log.h"
 #include "engine/math.h"
 #include "engine/plugin.h"
 #include "engine/prefab.h"
+#include "engine/profiler.h"
 #include "engine/reflection.h"
 #include "engine/string.h"
 
@@ -49,14 +52,17 @@ Universe::Universe(Engine& engine, IAllocator& allocator)
 	, m_names(m_allocator)
 	, m_entities(m_allocator)
 	, m_component_added(m_allocator)
+	, m_deferred_components_added(m_allocator)
 	, m_component_destroyed(m_allocator)
 	, m_entity_destroyed(m_allocator)
 	, m_entity_moved(m_allocator)
+	, m_entities_moved(m_allocator)
 	, m_entity_created(m_allocator)
 	, m_first_free_slot(-1)
 	, m_scenes(m_allocator)
 	, m_hierarchy(m_allocator)
 	, m_transforms(m_allocator)
+	, m_dirty_transforms(m_allocator)
 	, m_name("")
 {
 	m_entities.reserve(RESERVED_ENTITIES_COUNT);
@@ -106,20 +112,152 @@ void Universe::addScene(UniquePtr<IScene>&& scene)
 
 const DVec3& Universe::getPosition(EntityRef entity) const
 {
+	resolveTransform(entity);
 	return m_transforms[entity.index].pos;
 }
 
 
 const Quat& Universe::getRotation(EntityRef entity) const
 {
+	resolveTransform(entity);
 	return m_transforms[entity.index].rot;
 }
 
 
+void Universe::setTransformsDeferred(bool deferred)
+{
+	if (!deferred) flushTransforms();
+	m_transforms_deferred = deferred;
+}
+
+
+// if an ancestor was moved in deferred mode, updates transforms from that ancestor down to `entity`,
+// the rest of the subtree is updated in flushTransforms
+void Universe::resolveTransform(EntityRef entity) const
+{
+	if (m_dirty_transforms.empty()) return;
+	const int hierarchy_idx = m_entities[entity.index].hierarchy;
+	if (hierarchy_idx < 0) return;
+
+	EntityPtr top = INVALID_ENTITY;
+	for (EntityPtr e = m_hierarchy[hierarchy_idx].parent; e.isValid(); e = m_hierarchy[m_entities[e.index].hierarchy].parent) {
+		if (m_entities[e.index].transform_dirty) top = e;
+	}
+	if (!top.isValid()) return;
+
+	struct Chain {
+		static void update(Universe& universe, EntityRef e, EntityPtr top) {
+			const Hierarchy& h = universe.m_hierarchy[universe.m_entities[e.index].hierarchy];
+			if (h.parent != top) update(universe, (EntityRef)h.parent, top);
+			universe.m_transforms[e.index] = universe.m_transforms[h.parent.index] * h.local_transform;
+		}
+	};
+	// global transforms are just a cache of local transforms here
+	Chain::update(const_cast<Universe&>(*this), entity, top);
+}
+
+
+// pre-order, so parents are before their children
+void Universe::collectSubtree(EntityRef root, Array<EntityRef>& out) const
+{
+	out.push(root);
+	EntityPtr e = getFirstChild(root);
+	while (e.isValid()) {
+		out.push((EntityRef)e);
+		EntityPtr next = getFirstChild((EntityRef)e);
+		while (!next.isValid() && e != root) {
+			next = getNextSibling((EntityRef)e);
+			if (!next.isValid()) e = getParent((EntityRef)e);
+		}
+		e = next;
+	}
+}
+
+
+void Universe::propagateTransforms(Span<const EntityRef> subtree)
+{
+	for (u32 i = 1, c = subtree.length(); i < c; ++i) {
+		const EntityRef e = subtree[i];
+		const Hierarchy& h = m_hierarchy[m_entities[e.index].hierarchy];
+		m_transforms[e.index] = m_transforms[h.parent.index] * h.local_transform;
+	}
+}
+
+
+void Universe::flushTransforms()
+{
+	if (m_dirty_transforms.empty()) return;
+
+	PROFILE_FUNCTION();
+	Array<EntityRef> dirty(m_allocator);
+	Array<EntityRef> moved(m_allocator);
+	Array<u32> subtrees(m_allocator);
+	// moved handlers can move other entities
+	while (!m_dirty_transforms.empty()) {
+		dirty.clear();
+		moved.clear();
+		subtrees.clear();
+		dirty.swap(m_dirty_transforms);
+
+		// subtrees of dirty entities without dirty ancestors are independent
+		for (EntityRef e : dirty) {
+			if (!m_entities[e.index].transform_dirty) continue;
+			bool is_root = true;
+			for (EntityPtr p = getParent(e); p.isValid() && is_root; p = getParent((EntityRef)p)) {
+				is_root = !m_entities[p.index].transform_dirty;
+			}
+			if (!is_root) continue;
+
+			subtrees.push(moved.size());
+			collectSubtree(e, moved);
+		}
+		subtrees.push(moved.size());
+		for (EntityRef e : dirty) m_entities[e.index].transform_dirty = false;
+
+		const i32 subtrees_count = subtrees.size() - 1;
+		auto propagate = [&](i32 from, i32 to){
+			for (i32 i = from; i < to; ++i) {
+				propagateTransforms(Span<const EntityRef>(moved.begin() + subtrees[i], moved.begin() + subtrees[i + 1]));
+			}
+		};
+		if (moved.size() - subtrees_count < 4096) {
+			propagate(0, subtrees_count);
+		}
+		else {
+			jobs::parallelFor(subtrees_count, 16, [&](i32 from, i32 to){
+				PROFILE_BLOCK("propagate transforms");
+				propagate(from, to);
+			});
+		}
+
+		for (EntityRef e : moved) m_entity_moved.invoke(e);
+		m_entities_moved.invoke(moved);
+	}
+}
+
+
 void Universe::transformEntity(EntityRef entity, bool update_local)
 {
 	const int hierarchy_idx = m_entities[entity.index].hierarchy;
+	if (m_transforms_deferred) {
+		// local transform is updated now, since the parent can move before flush
+		if (update_local && hierarchy_idx >= 0) {
+			Hierarchy& h = m_hierarchy[hierarchy_idx];
+			if (h.parent.isValid()) {
+				const Transform& parent_tr = getTransform((EntityRef)h.parent);
+				h.local_transform = parent_tr.inverted() * m_transforms[entity.index];
+			}
+		}
+		EntityData& data = m_entities[entity.index];
+		if (!data.transform_dirty) {
+			data.transform_dirty = true;
+			m_dirty_transforms.push(entity);
+		}
+		return;
+	}
+
 	m_entity_moved.invoke(entity);
+	m_entities_moved.invoke(Span<const EntityRef>(&entity, 1));
 	if (hierarchy_idx >= 0) {
 		Hierarchy& h = m_hierarchy[hierarchy_idx];
 		const Transform my_transform = getTransform(entity);
@@ -145,6 +283,7 @@ void Universe::transformEntity(EntityRef entity, bool update_local)
 
 void Universe::setRotation(EntityRef entity, const Quat& rot)
 {
+	resolveTransform(entity);
 	m_transforms[entity.index].rot = rot;
 	transformEntity(entity, true);
 }
@@ -152,6 +291,7 @@ void Universe::setRotation(EntityRef entity, const Quat& rot)
 
 void Universe::setRotation(EntityRef entity, float x, float y, float z, float w)
 {
+	resolveTransform(entity);
 	m_transforms[entity.index].rot.set(x, y, z, w);
 	transformEntity(entity, true);
 }
@@ -165,11 +305,14 @@ bool Universe::hasEntity(EntityRef entity) const
 
 void Universe::setTransformKeepChildren(EntityRef entity, const Transform& transform)
 {
+	// children's global transforms must be up-to-date before we change their local transforms
+	flushTransforms();
 	Transform& tmp = m_transforms[entity.index];
 	tmp = transform;
 	
 	int hierarchy_idx = m_entities[entity.index].hierarchy;
-	entityTransformed().invoke(entity);
+	m_entity_moved.invoke(entity);
+	m_entities_moved.invoke(Span<const EntityRef>(&entity, 1));
 	if (hierarchy_idx >= 0)
 	{
 		Hierarchy& h = m_hierarchy[hierarchy_idx];
@@ -202,6 +345,7 @@ void Universe::setTransform(EntityRef entity, const Transform& transform)
 
 void Universe::setTransform(EntityRef entity, const RigidTransform& transform)
 {
+	resolveTransform(entity);
 	auto& tmp = m_transforms[entity.index];
 	tmp.pos = transform.pos;
 	tmp.rot = transform.rot;
@@ -221,12 +365,14 @@ void Universe::setTransform(EntityRef entity, const DVec3& pos, const Quat& rot,
 
 const Transform& Universe::getTransform(EntityRef entity) const
 {
+	resolveTransform(entity);
 	return m_transforms[entity.index];
 }
 
 
 Matrix Universe::getRelativeMatrix(EntityRef entity, const DVec3& base_pos) const
 {
+	resolveTransform(entity);
 	const Transform& transform = m_transforms[entity.index];
 	Matrix mtx = transform.rot.toMatrix();
 	mtx.setTranslation(Vec3(transform.pos - base_pos));
@@ -237,6 +383,7 @@ Matrix Universe::getRelativeMatrix(EntityRef entity, const DVec3& base_pos) cons
 
 void Universe::setPosition(EntityRef entity, const DVec3& pos)
 {
+	resolveTransform(entity);
 	m_transforms[entity.index].pos = pos;
 	transformEntity(entity, true);
 }
@@ -306,6 +453,7 @@ void Universe::emplaceEntity(EntityRef entity)
 		EntityData& data = m_entities.emplace();
 		Transform& tr = m_transforms.emplace();
 		data.valid = false;
+		data.transform_dirty = false;
 		data.prev = -1;
 		data.name = -1;
 		data.hierarchy = -1;
@@ -338,11 +486,49 @@ void Universe::emplaceEntity(EntityRef entity)
 	data.hierarchy = -1;
 	data.components = 0;
 	data.valid = true;
+	data.transform_dirty = false;
 
 	m_entity_created.invoke(entity);
 }
 
 
+void Universe::emplaceEntities(Span<const EntityRef> entities, Span<const Transform> transforms)
+{
+	ASSERT(m_entities.empty());
+	ASSERT(entities.length() == transforms.length());
+	const i32 size = entities.length() > 0 ? entities[entities.length() - 1].index + 1 : 0;
+	m_entities.reserve(size);
+	m_transforms.reserve(size);
+
+	// each slot is written only once, free slots are linked the same way emplaceEntity would link them
+	u32 k = 0;
+	for (i32 i = 0; i < size; ++i) {
+		EntityData& data = m_entities.emplace();
+		Transform& tr = m_transforms.emplace();
+		data.name = -1;
+		data.hierarchy = -1;
+		data.transform_dirty = false;
+		if (entities[k].index == i) {
+			// transforms come straight from a stream, so they do not have to be aligned
+			memcpy(&tr, &transforms[k], sizeof(tr));
+			data.components = 0;
+			data.valid = true;
+			++k;
+			continue;
+		}
+		tr.scale = -1;
+		data.valid = false;
+		data.prev = -1;
+		data.next = m_first_free_slot;
+		if (m_first_free_slot >= 0) m_entities[m_first_free_slot].prev = i;
+		m_first_free_slot = i;
+	}
+	ASSERT(k == entities.length());
+
+	for (EntityRef e : entities) m_entity_created.invoke(e);
+}
+
+
 EntityRef Universe::createEntity(const DVec3& position, const Quat& rotation)
 {
 	EntityData* data;
@@ -369,6 +555,7 @@ EntityRef Universe::createEntity(const DVec3& position, const Quat& rotation)
 	data->hierarchy = -1;
 	data->components = 0;
 	data->valid = true;
+	data->transform_dirty = false;
 	m_entity_created.invoke(entity);
 
 	return entity;
@@ -405,6 +592,7 @@ void Universe::destroyEntity(EntityRef entity)
 	entity_data.hierarchy = -1;
 	
 	entity_data.valid = false;
+	entity_data.transform_dirty = false;
 	if (m_first_free_slot >= 0)
 	{
 		m_entities[m_first_free_slot].prev = entity.index;
@@ -480,6 +668,9 @@ bool Universe::isDescendant(EntityRef ancestor, EntityRef descendant) const
 
 void Universe::setParent(EntityPtr new_parent, EntityRef child)
 {
+	// changes in hierarchy would break propagation of deferred transforms
+	flushTransforms();
+
 	bool would_create_cycle = new_parent.isValid() && isDescendant(child, (EntityRef)new_parent);
 	if (would_create_cycle)
 	{
@@ -649,15 +840,20 @@ float Universe::getLocalScale(EntityRef entity) const
 
 void Universe::serialize(OutputMemoryStream& serializer)
 {
+	flushTransforms();
 	serializer.write((u32)m_entities.size());
 
+	u32 count = 0;
+	for (const EntityData& data : m_entities) {
+		if (data.valid) ++count;
+	}
+	serializer.write(count);
+	for (u32 i = 0, c = m_entities.size(); i < c; ++i) {
+		if (m_entities[i].valid) serializer.write(EntityRef{(i32)i});
+	}
 	for (u32 i = 0, c = m_entities.size(); i < c; ++i) {
-		if (!m_entities[i].valid) continue;
-		const EntityRef e = {(i32)i};
-		serializer.write(e);
-		serializer.write(m_transforms[i]);
+		if (m_entities[i].valid) serializer.write(m_transforms[i]);
 	}
-	serializer.write(INVALID_ENTITY);
 
 	serializer.write((u32)m_names.size());
 	for (const EntityName& name : m_names) {
@@ -673,17 +869,38 @@ void Universe::setName(const char* name) {
 	copyString(m_name, name);
 }
 
-void Universe::deserialize(InputMemoryStream& serializer, EntityMap& entity_map)
+void Universe::deserialize(InputMemoryStream& serializer, EntityMap& entity_map, UniverseVersion version)
 {
 	u32 to_reserve;
 	serializer.read(to_reserve);
 	entity_map.reserve(to_reserve);
 
-	for (EntityPtr e = serializer.read<EntityPtr>(); e.isValid(); e = serializer.read<EntityPtr>()) {
-		EntityRef orig = (EntityRef)e;
-		const EntityRef new_e = createEntity({0, 0, 0}, {0, 0, 0, 1});
-		entity_map.set(orig, new_e);
-		serializer.read(m_transforms[new_e.index]);
+	if (version > UniverseVersion::BASE) {
+		const u32 entities_count = serializer.read<u32>();
+		const Span<const EntityRef> entities((const EntityRef*)serializer.skip(entities_count * sizeof(EntityRef)), entities_count);
+		const Span<const Transform> transforms((const Transform*)serializer.skip(entities_count * sizeof(Transform)), entities_count);
+		if (m_entities.empty()) {
+			// nothing to collide with, so entities keep their indices
+			emplaceEntities(entities, transforms);
+			entity_map.m_map.resize(m_entities.size());
+			for (EntityPtr& e : entity_map.m_map) e = INVALID_ENTITY;
+			for (EntityRef e : entities) entity_map.m_map[e.index] = e;
+		}
+		else {
+			for (u32 i = 0; i < entities_count; ++i) {
+				const EntityRef e = createEntity({0, 0, 0}, {0, 0, 0, 1});
+				entity_map.set(entities[i], e);
+				memcpy(&m_transforms[e.index], &transforms[i], sizeof(Transform));
+			}
+		}
+	}
+	else {
+		for (EntityPtr e = serializer.read<EntityPtr>(); e.isValid(); e = serializer.read<EntityPtr>()) {
+			EntityRef orig = (EntityRef)e;
+			const EntityRef new_e = createEntity({0, 0, 0}, {0, 0, 0, 1});
+			entity_map.set(orig, new_e);
+			serializer.read(m_transforms[new_e.index]);
+		}
 	}
 
 	u32 count;
@@ -702,19 +919,23 @@ void Universe::deserialize(InputMemoryStream& serializer, EntityMap& entity_map)
 	if (count > 0) {
 		serializer.read(&m_hierarchy[old_count], sizeof(m_hierarchy[0]) * count);
 
-		for (u32 i = old_count; i < count + old_count; ++i) {
-			m_hierarchy[i].entity = entity_map.get(m_hierarchy[i].entity);
-			m_hierarchy[i].first_child = entity_map.get(m_hierarchy[i].first_child);
-			m_hierarchy[i].next_sibling = entity_map.get(m_hierarchy[i].next_sibling);
-			m_hierarchy[i].parent = entity_map.get(m_hierarchy[i].parent);
-			m_entities[m_hierarchy[i].entity.index].hierarchy = i;
-		}
+		// each entry touches only its own entity
+		jobs::parallelFor(count, 4096, [&](i32 from, i32 to){
+			for (u32 i = old_count + from; i < old_count + to; ++i) {
+				m_hierarchy[i].entity = entity_map.get(m_hierarchy[i].entity);
+				m_hierarchy[i].first_child = entity_map.get(m_hierarchy[i].first_child);
+				m_hierarchy[i].next_sibling = entity_map.get(m_hierarchy[i].next_sibling);
+				m_hierarchy[i].parent = entity_map.get(m_hierarchy[i].parent);
+				m_entities[m_hierarchy[i].entity.index].hierarchy = i;
+			}
+		});
 	}
 }
 
 
 void Universe::setScale(EntityRef entity, float scale)
 {
+	resolveTransform(entity);
 	m_transforms[entity.index].scale = scale;
 	transformEntity(entity, true);
 }
@@ -722,6 +943,7 @@ void Universe::setScale(EntityRef entity, float scale)
 
 float Universe::getScale(EntityRef entity) const
 {
+	resolveTransform(entity);
 	return m_transforms[entity.index].scale;
 }
 
@@ -805,9 +1027,25 @@ void Universe::destroyComponent(EntityRef entity, ComponentType type)
 }
 
 
+void Universe::setComponentsAddedDeferred(bool deferred)
+{
+	m_components_added_deferred = deferred;
+	if (deferred) return;
+
+	for (const ComponentUID& cmp : m_deferred_components_added) m_component_added.invoke(cmp);
+	m_deferred_components_added.clear();
+}
+
+
 void Universe::onComponentCreated(EntityRef entity, ComponentType component_type, IScene* scene)
 {
 	ComponentUID cmp(entity, component_type, scene);
+	if (m_components_added_deferred) {
+		MutexGuard lock(m_components_added_mutex);
+		m_entities[entity.index].components |= (u64)1 << component_type.index;
+		m_deferred_components_added.push(cmp);
+		return;
+	}
 	m_entities[entity.index].components |= (u64)1 << component_type.index;
 	m_component_added.invoke(cmp);
 }
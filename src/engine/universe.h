@@ -5,6 +5,7 @@
 #include "engine/delegate_list.h"
 #include "engine/lumix.h"
 #include "engine/math.h"
+#include "engine/sync.h"
 
 
 namespace Lumix {
@@ -12,6 +13,13 @@ namespace Lumix {
 struct ComponentUID;
 struct IScene;
 
+enum class UniverseVersion : i32 {
+	BASE,
+	BULK_ENTITIES, // entity indices and transforms are stored in separate contiguous blocks
+
+	LATEST
+};
+
 struct LUMIX_ENGINE_API EntityMap {
 	EntityMap(IAllocator& allocator);
 	void reserve(u32 count);
@@ -40,14 +48,19 @@ struct LUMIX_ENGINE_API Universe {
 			};
 		};
 		bool valid;
+		// moved in deferred mode, children are updated in flushTransforms
+		bool transform_dirty;
 	};
 
 	explicit Universe(struct Engine& engine, IAllocator& allocator);
 	~Universe();
 
 	IAllocator& getAllocator() { return m_allocator; }
+	// call flushTransforms first if transforms are deferred
 	const Transform* getTransforms() const { return m_transforms.begin(); }
 	void emplaceEntity(EntityRef entity);
+	// emplaceEntity and setTransform for each entity in a single pass, universe must be empty and `entities` sorted
+	void emplaceEntities(Span<const EntityRef> entities, Span<const Transform> transforms);
 	EntityRef createEntity(const DVec3& position, const Quat& rotation);
 	void destroyEntity(EntityRef entity);
 	void createComponent(ComponentType type, EntityRef entity);
@@ -96,14 +109,26 @@ struct LUMIX_ENGINE_API Universe {
 	const char* getName() const { return m_name; }
 	void setName(const char* name);
 
+	// in deferred mode setters only mark moved entities, children are updated 
+	// and moved notifications sent in flushTransforms; getters still return up-to-date values
+	void setTransformsDeferred(bool deferred);
+	bool areTransformsDeferred() const { return m_transforms_deferred; }
+	void flushTransforms();
+
 	DelegateList<void(EntityRef)>& entityCreated() { return m_entity_created; }
 	DelegateList<void(EntityRef)>& entityTransformed() { return m_entity_moved; }
+	// moved entities in batches, in deferred mode one batch per flushTransforms
+	DelegateList<void(Span<const EntityRef>)>& entitiesTransformed() { return m_entities_moved; }
 	DelegateList<void(EntityRef)>& entityDestroyed() { return m_entity_destroyed; }
 	DelegateList<void(const ComponentUID&)>& componentDestroyed() { return m_component_destroyed; }
 	DelegateList<void(const ComponentUID&)>& componentAdded() { return m_component_added; }
 
+	// while deferred, onComponentCreated can be called from multiple threads, 
+	// componentAdded is invoked for all created components when deferring ends
+	void setComponentsAddedDeferred(bool deferred);
+
 	void serialize(struct OutputMemoryStream& serializer);
-	void deserialize(struct InputMemoryStream& serializer, EntityMap& entity_map);
+	void deserialize(struct InputMemoryStream& serializer, EntityMap& entity_map, UniverseVersion version);
 
 	IScene* getScene(ComponentType type) const;
 	IScene* getScene(const char* name) const;
@@ -113,6 +138,9 @@ struct LUMIX_ENGINE_API Universe {
 private:
 	void transformEntity(EntityRef entity, bool update_local);
 	void updateGlobalTransform(EntityRef entity);
+	void resolveTransform(EntityRef entity) const;
+	void collectSubtree(EntityRef root, Array<EntityRef>& out) const;
+	void propagateTransforms(Span<const EntityRef> subtree);
 
 	struct Hierarchy {
 		EntityRef entity;
@@ -144,11 +172,17 @@ private:
 	Array<EntityName> m_names;
 	DelegateList<void(EntityRef)> m_entity_created;
 	DelegateList<void(EntityRef)> m_entity_moved;
+	DelegateList<void(Span<const EntityRef>)> m_entities_moved;
 	DelegateList<void(EntityRef)> m_entity_destroyed;
 	DelegateList<void(const ComponentUID&)> m_component_destroyed;
 	DelegateList<void(const ComponentUID&)> m_component_added;
+	Mutex m_components_added_mutex;
+	Array<ComponentUID> m_deferred_components_added;
+	bool m_components_added_deferred = false;
 	int m_first_free_slot;
 	char m_name[64];
+	bool m_transforms_deferred = false;
+	Array<EntityRef> m_dirty_transforms;
 };
 
 struct LUMIX_ENGINE_API ComponentUID final {
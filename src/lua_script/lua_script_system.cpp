@@ -1,5 +1,6 @@
 #include "lua_script_system.h"
 #include "animation/animation_scene.h"
+#include "engine/allocators.h"
 #include "engine/array.h"
 #include "engine/associative_array.h"
 #include "engine/crc32.h"
@@ -283,7 +284,7 @@ namespace Lumix
 		bool deserialize(u32 version, InputMemoryStream& stream) override { return version == 0; }
 
 		Engine& m_engine;
-		IAllocator& m_allocator;
+		TagAllocator m_allocator;
 		LuaScriptManager m_script_manager;
 	};
 
@@ -2319,7 +2320,7 @@ namespace Lumix
 
 	LuaScriptSystemImpl::LuaScriptSystemImpl(Engine& engine)
 		: m_engine(engine)
-		, m_allocator(engine.getAllocator())
+		, m_allocator(engine.getAllocator(), "lua script")
 		, m_script_manager(m_allocator)
 	{
 		m_script_manager.create(LuaScript::TYPE, engine.getResourceManager());
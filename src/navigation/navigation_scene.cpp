@@ -93,13 +93,13 @@ struct NavigationSceneImpl final : NavigationScene
 		, m_script_scene(nullptr)
 		, m_on_update(m_allocator)
 	{
-		m_universe.entityTransformed().bind<&NavigationSceneImpl::onEntityMoved>(this);
+		m_universe.entitiesTransformed().bind<&NavigationSceneImpl::onEntitiesMoved>(this);
 	}
 
 
 	~NavigationSceneImpl()
 	{
-		m_universe.entityTransformed().unbind<&NavigationSceneImpl::onEntityMoved>(this);
+		m_universe.entitiesTransformed().unbind<&NavigationSceneImpl::onEntitiesMoved>(this);
 	}
 
 
@@ -113,6 +113,12 @@ struct NavigationSceneImpl final : NavigationScene
 	}
 
 
+	void onEntitiesMoved(Span<const EntityRef> entities)
+	{
+		if (m_agents.empty()) return;
+		for (EntityRef e : entities) onEntityMoved(e);
+	}
+
 	void onEntityMoved(EntityRef entity)
 	{
 		auto iter = m_agents.find(entity);
@@ -1458,6 +1464,8 @@ struct NavigationSceneImpl final : NavigationScene
 	}
 
 	i32 getVersion() const override { return (i32)NavigationSceneVersion::LATEST; }
+	// navmeshes are loaded through the file system, nothing else outside this scene is touched
+	bool isDeserializeThreadSafe() const override { return true; }
 
 
 	void serialize(OutputMemoryStream& serializer) override
@@ -1675,6 +1675,9 @@ struct PhysicsSceneImpl final : PhysicsScene
 	void updateDynamicActors()
 	{
 		PROFILE_FUNCTION();
+		// with deferred transforms, we get notified in flushTransforms, so we flush other moves first
+		// and then flush ours while ignoring dynamic actors
+		m_universe.flushTransforms();
 		for (EntityRef e : m_dynamic_actors)
 		{
 			RigidActor& actor = m_actors[e];
@@ -1683,6 +1686,9 @@ struct PhysicsSceneImpl final : PhysicsScene
 			m_universe.setTransform(actor.entity, fromPhysx(trans));
 		}
 		m_update_in_progress = nullptr;
+		m_is_updating_dynamic_actors = true;
+		m_universe.flushTransforms();
+		m_is_updating_dynamic_actors = false;
 
 		for (auto iter = m_vehicles.begin(), end = m_vehicles.end(); iter != end; ++iter) {
 			Vehicle* veh = iter.value().get();
@@ -1809,6 +1815,8 @@ struct PhysicsSceneImpl final : PhysicsScene
 		if (!m_is_game_running || paused) return;
 
 		time_delta = minimum(1 / 20.0f, time_delta);
+		// apply kinematic targets and teleports from this frame before the simulation, not after it
+		m_universe.flushTransforms();
 		updateVehicles(time_delta);
 		simulateScene(time_delta);
 		fetchResults();
@@ -2329,6 +2337,12 @@ struct PhysicsSceneImpl final : PhysicsScene
 		}
 	}
 
+	void onEntitiesMoved(Span<const EntityRef> entities)
+	{
+		for (EntityRef e : entities) onEntityMoved(e);
+	}
+
+
 	void onEntityMoved(EntityRef entity)
 	{
 		const u64 cmp_mask = m_universe.getComponentsMask(entity);
@@ -2349,7 +2363,9 @@ struct PhysicsSceneImpl final : PhysicsScene
 			auto iter = m_actors.find(entity);
 			if (iter.isValid()) {
 				RigidActor& actor = iter.value();
-				if (actor.physx_actor && m_update_in_progress != &actor)
+				const bool is_update_in_progress = m_update_in_progress == &actor 
+					|| (m_is_updating_dynamic_actors && actor.dynamic_type == DynamicType::DYNAMIC);
+				if (actor.physx_actor && !is_update_in_progress)
 				{
 					Transform trans = m_universe.getTransform(entity);
 					if (actor.dynamic_type == DynamicType::KINEMATIC)
@@ -3526,6 +3542,7 @@ struct PhysicsSceneImpl final : PhysicsScene
 
 	Array<EntityRef> m_dynamic_actors;
 	RigidActor* m_update_in_progress;
+	bool m_is_updating_dynamic_actors = false;
 	DelegateList<void(const ContactData&)> m_contact_callbacks;
 	bool m_is_game_running;
 	u32 m_debug_visualization_flags;
@@ -3572,7 +3589,7 @@ PhysicsSceneImpl::PhysicsSceneImpl(Engine& engine, Universe& context, PhysicsSys
 UniquePtr<PhysicsScene> PhysicsScene::create(PhysicsSystem& system, Universe& context, Engine& engine, IAllocator& allocator)
 {
 	PhysicsSceneImpl* impl = LUMIX_NEW(allocator, PhysicsSceneImpl)(engine, context, system, allocator);
-	impl->m_universe.entityTransformed().bind<&PhysicsSceneImpl::onEntityMoved>(impl);
+	impl->m_universe.entitiesTransformed().bind<&PhysicsSceneImpl::onEntitiesMoved>(impl);
 	impl->m_universe.entityDestroyed().bind<&PhysicsSceneImpl::onEntityDestroyed>(impl);
 	PxSceneDesc sceneDesc(system.getPhysics()->getTolerancesScale());
 	sceneDesc.gravity = PxVec3(0.0f, -9.8f, 0.0f);
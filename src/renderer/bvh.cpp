@@ -0,0 +1,489 @@
+#include "bvh.h"
+#include "engine/allocator.h"
+#include "engine/profiler.h"
+
+
+namespace Lumix
+{
+
+
+// deeper nodes are made leaves, so traversal's stack can not overflow
+static constexpr u32 MAX_TRIANGLE_BVH_DEPTH = 60;
+static constexpr u32 SAH_BINS_COUNT = 12;
+// bounds in EntityBVH are enlarged by this, so small movements do not change the tree
+static constexpr double ENTITY_BVH_MARGIN = 0.1;
+
+
+namespace
+{
+
+struct Bounds {
+	void reset() {
+		min[0] = min[1] = min[2] = FLT_MAX;
+		max[0] = max[1] = max[2] = -FLT_MAX;
+	}
+
+	void add(const float* p) {
+		for (u32 i = 0; i < 3; ++i) {
+			min[i] = minimum(min[i], p[i]);
+			max[i] = maximum(max[i], p[i]);
+		}
+	}
+
+	void add(const Bounds& rhs) {
+		for (u32 i = 0; i < 3; ++i) {
+			min[i] = minimum(min[i], rhs.min[i]);
+			max[i] = maximum(max[i], rhs.max[i]);
+		}
+	}
+
+	// half of the surface area
+	float area() const {
+		if (min[0] > max[0]) return 0;
+		const float dx = max[0] - min[0];
+		const float dy = max[1] - min[1];
+		const float dz = max[2] - min[2];
+		return dx * dy + dy * dz + dz * dx;
+	}
+
+	float min[3];
+	float max[3];
+};
+
+struct BuildItem {
+	u32 node;
+	u32 depth;
+};
+
+struct BuildTriangle {
+	Bounds bounds;
+	float centroid[3];
+	u32 index;
+};
+
+} // anonymous namespace
+
+
+TriangleBVH::TriangleBVH(IAllocator& allocator)
+	: m_allocator(allocator)
+	, m_nodes(allocator)
+	, m_triangles(allocator)
+{}
+
+
+void TriangleBVH::clear() {
+	m_nodes.clear();
+	m_triangles.clear();
+}
+
+
+void TriangleBVH::addTriangles(const Vec3* vertices, const void* indices, u32 indices_count, bool indices_16bit, u32 tag) {
+	m_triangles.reserve(m_triangles.size() + indices_count / 3);
+	const u16* indices16 = (const u16*)indices;
+	const u32* indices32 = (const u32*)indices;
+	for (u32 i = 0; i + 2 < indices_count; i += 3) {
+		const Vec3& p0 = vertices[indices_16bit ? indices16[i] : indices32[i]];
+		const Vec3& p1 = vertices[indices_16bit ? indices16[i + 1] : indices32[i + 1]];
+		const Vec3& p2 = vertices[indices_16bit ? indices16[i + 2] : indices32[i + 2]];
+		Triangle& tri = m_triangles.emplace();
+		tri.p0 = p0;
+		tri.e1 = Vec3(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
+		tri.e2 = Vec3(p2.x - p0.x, p2.y - p0.y, p2.z - p0.z);
+		tri.tag = tag;
+	}
+}
+
+
+void TriangleBVH::build() {
+	PROFILE_FUNCTION();
+	m_nodes.clear();
+	const u32 triangles_count = m_triangles.size();
+	if (triangles_count == 0) return;
+
+	// partitioning moves these around, so the build reads memory sequentially
+	Array<BuildTriangle> build_tris(m_allocator);
+	build_tris.resize(triangles_count);
+	for (u32 i = 0; i < triangles_count; ++i) {
+		const Triangle& tri = m_triangles[i];
+		const float p0[] = { tri.p0.x, tri.p0.y, tri.p0.z };
+		const float p1[] = { tri.p0.x + tri.e1.x, tri.p0.y + tri.e1.y, tri.p0.z + tri.e1.z };
+		const float p2[] = { tri.p0.x + tri.e2.x, tri.p0.y + tri.e2.y, tri.p0.z + tri.e2.z };
+		BuildTriangle& bt = build_tris[i];
+		bt.bounds.reset();
+		bt.bounds.add(p0);
+		bt.bounds.add(p1);
+		bt.bounds.add(p2);
+		for (u32 j = 0; j < 3; ++j) bt.centroid[j] = (bt.bounds.min[j] + bt.bounds.max[j]) * 0.5f;
+		bt.index = i;
+	}
+
+	m_nodes.reserve(triangles_count * 2);
+	Node& root = m_nodes.emplace();
+	root.first = 0;
+	root.count = triangles_count;
+
+	Array<BuildItem> stack(m_allocator);
+	stack.push({0, 0});
+	while (!stack.empty()) {
+		const BuildItem item = stack.back();
+		stack.pop();
+
+		const u32 first = m_nodes[item.node].first;
+		const u32 count = m_nodes[item.node].count;
+		BuildTriangle* tris = build_tris.begin() + first;
+		Bounds node_bounds;
+		Bounds centroid_bounds;
+		node_bounds.reset();
+		centroid_bounds.reset();
+		for (u32 i = 0; i < count; ++i) {
+			node_bounds.add(tris[i].bounds);
+			centroid_bounds.add(tris[i].centroid);
+		}
+		m_nodes[item.node].min = Vec3(node_bounds.min[0], node_bounds.min[1], node_bounds.min[2]);
+		m_nodes[item.node].max = Vec3(node_bounds.max[0], node_bounds.max[1], node_bounds.max[2]);
+
+		if (count <= MAX_LEAF_SIZE || item.depth >= MAX_TRIANGLE_BVH_DEPTH) continue;
+
+		// binned SAH, all axes in one pass, cost of a node is area * triangles count
+		Bounds bins[3][SAH_BINS_COUNT];
+		u32 bin_counts[3][SAH_BINS_COUNT] = {};
+		float bin_scales[3];
+		for (u32 axis = 0; axis < 3; ++axis) {
+			for (Bounds& b : bins[axis]) b.reset();
+			const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+			bin_scales[axis] = extent > 0 ? SAH_BINS_COUNT / extent : 0;
+		}
+		for (u32 i = 0; i < count; ++i) {
+			for (u32 axis = 0; axis < 3; ++axis) {
+				const u32 bin = minimum(u32((tris[i].centroid[axis] - centroid_bounds.min[axis]) * bin_scales[axis]), SAH_BINS_COUNT - 1);
+				++bin_counts[axis][bin];
+				bins[axis][bin].add(tris[i].bounds);
+			}
+		}
+
+		float best_cost = FLT_MAX;
+		u32 best_axis = 0;
+		u32 best_split = 0;
+		for (u32 axis = 0; axis < 3; ++axis) {
+			if (bin_scales[axis] == 0) continue;
+
+			float right_costs[SAH_BINS_COUNT];
+			Bounds acc;
+			acc.reset();
+			u32 acc_count = 0;
+			for (u32 i = SAH_BINS_COUNT - 1; i > 0; --i) {
+				acc.add(bins[axis][i]);
+				acc_count += bin_counts[axis][i];
+				right_costs[i] = acc_count == 0 ? -1 : acc.area() * acc_count;
+			}
+
+			acc.reset();
+			acc_count = 0;
+			for (u32 i = 0; i < SAH_BINS_COUNT - 1; ++i) {
+				acc.add(bins[axis][i]);
+				acc_count += bin_counts[axis][i];
+				if (acc_count == 0 || right_costs[i + 1] < 0) continue;
+				const float cost = acc.area() * acc_count + right_costs[i + 1];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = i + 1;
+				}
+			}
+		}
+
+		u32 mid;
+		if (best_cost == FLT_MAX) {
+			// all centroids are in the same point
+			mid = count / 2;
+		}
+		else {
+			u32 i = 0;
+			u32 j = count;
+			while (i < j) {
+				const float c = tris[i].centroid[best_axis];
+				const u32 bin = minimum(u32((c - centroid_bounds.min[best_axis]) * bin_scales[best_axis]), SAH_BINS_COUNT - 1);
+				if (bin < best_split) {
+					++i;
+				}
+				else {
+					--j;
+					swap(tris[i], tris[j]);
+				}
+			}
+			mid = i;
+			ASSERT(mid > 0 && mid < count);
+		}
+
+		const u32 left = m_nodes.size();
+		Node& left_node = m_nodes.emplace();
+		left_node.first = first;
+		left_node.count = mid;
+		Node& right_node = m_nodes.emplace();
+		right_node.first = first + mid;
+		right_node.count = count - mid;
+		m_nodes[item.node].first = left;
+		m_nodes[item.node].count = 0;
+		stack.push({left, item.depth + 1});
+		stack.push({left + 1, item.depth + 1});
+	}
+
+	Array<Triangle> sorted(m_allocator);
+	sorted.reserve(triangles_count);
+	for (const BuildTriangle& bt : build_tris) sorted.push(m_triangles[bt.index]);
+	m_triangles.swap(sorted);
+}
+
+
+static void merge(DVec3& min, DVec3& max, const DVec3& a_min, const DVec3& a_max, const DVec3& b_min, const DVec3& b_max) {
+	min = DVec3(minimum(a_min.x, b_min.x), minimum(a_min.y, b_min.y), minimum(a_min.z, b_min.z));
+	max = DVec3(maximum(a_max.x, b_max.x), maximum(a_max.y, b_max.y), maximum(a_max.z, b_max.z));
+}
+
+
+// half of the surface area
+static double area(const DVec3& min, const DVec3& max) {
+	const double dx = max.x - min.x;
+	const double dy = max.y - min.y;
+	const double dz = max.z - min.z;
+	return dx * dy + dy * dz + dz * dx;
+}
+
+
+EntityBVH::EntityBVH(IAllocator& allocator)
+	: m_nodes(allocator)
+	, m_leaves(allocator)
+{}
+
+
+void EntityBVH::clear() {
+	m_nodes.clear();
+	m_leaves.clear();
+	m_root = -1;
+	m_free_list = -1;
+}
+
+
+bool EntityBVH::isAdded(EntityRef entity) const {
+	return entity.index < m_leaves.size() && m_leaves[entity.index] >= 0;
+}
+
+
+i32 EntityBVH::allocNode() {
+	i32 idx;
+	if (m_free_list >= 0) {
+		idx = m_free_list;
+		m_free_list = m_nodes[idx].entity.index;
+	}
+	else {
+		idx = m_nodes.size();
+		m_nodes.emplace();
+	}
+	Node& node = m_nodes[idx];
+	node.parent = -1;
+	node.children[0] = node.children[1] = -1;
+	node.height = 0;
+	node.entity = INVALID_ENTITY;
+	return idx;
+}
+
+
+void EntityBVH::freeNode(i32 node) {
+	m_nodes[node].height = -1;
+	m_nodes[node].entity = EntityPtr{m_free_list};
+	m_free_list = node;
+}
+
+
+void EntityBVH::add(EntityRef entity, const DVec3& min, const DVec3& max) {
+	ASSERT(!isAdded(entity));
+	while (m_leaves.size() <= entity.index) m_leaves.push(-1);
+
+	const i32 leaf = allocNode();
+	Node& node = m_nodes[leaf];
+	node.entity = entity;
+	node.min = DVec3(min.x - ENTITY_BVH_MARGIN, min.y - ENTITY_BVH_MARGIN, min.z - ENTITY_BVH_MARGIN);
+	node.max = DVec3(max.x + ENTITY_BVH_MARGIN, max.y + ENTITY_BVH_MARGIN, max.z + ENTITY_BVH_MARGIN);
+	m_leaves[entity.index] = leaf;
+	insertLeaf(leaf);
+}
+
+
+void EntityBVH::remove(EntityRef entity) {
+	if (!isAdded(entity)) return;
+
+	const i32 leaf = m_leaves[entity.index];
+	removeLeaf(leaf);
+	freeNode(leaf);
+	m_leaves[entity.index] = -1;
+}
+
+
+bool EntityBVH::set(EntityRef entity, const DVec3& min, const DVec3& max) {
+	ASSERT(isAdded(entity));
+	const i32 leaf = m_leaves[entity.index];
+	Node& node = m_nodes[leaf];
+	if (node.min.x <= min.x && node.min.y <= min.y && node.min.z <= min.z
+		&& node.max.x >= max.x && node.max.y >= max.y && node.max.z >= max.z)
+	{
+		return false;
+	}
+
+	removeLeaf(leaf);
+	node.min = DVec3(min.x - ENTITY_BVH_MARGIN, min.y - ENTITY_BVH_MARGIN, min.z - ENTITY_BVH_MARGIN);
+	node.max = DVec3(max.x + ENTITY_BVH_MARGIN, max.y + ENTITY_BVH_MARGIN, max.z + ENTITY_BVH_MARGIN);
+	insertLeaf(leaf);
+	return true;
+}
+
+
+void EntityBVH::insertLeaf(i32 leaf) {
+	if (m_root < 0) {
+		m_root = leaf;
+		m_nodes[leaf].parent = -1;
+		return;
+	}
+
+	// find the sibling with the lowest cost, cost is the area of the new parent plus the enlargement of ancestors
+	const DVec3 leaf_min = m_nodes[leaf].min;
+	const DVec3 leaf_max = m_nodes[leaf].max;
+	i32 idx = m_root;
+	while (m_nodes[idx].height > 0) {
+		const Node& node = m_nodes[idx];
+		DVec3 merged_min, merged_max;
+		merge(merged_min, merged_max, node.min, node.max, leaf_min, leaf_max);
+		const double merged_area = area(merged_min, merged_max);
+		const double cost = 2 * merged_area;
+		const double inheritance_cost = 2 * (merged_area - area(node.min, node.max));
+
+		double children_costs[2];
+		for (u32 i = 0; i < 2; ++i) {
+			const Node& child = m_nodes[node.children[i]];
+			merge(merged_min, merged_max, child.min, child.max, leaf_min, leaf_max);
+			children_costs[i] = area(merged_min, merged_max) + inheritance_cost;
+			if (child.height > 0) children_costs[i] -= area(child.min, child.max);
+		}
+
+		if (cost < children_costs[0] && cost < children_costs[1]) break;
+		idx = children_costs[0] < children_costs[1] ? node.children[0] : node.children[1];
+	}
+
+	const i32 sibling = idx;
+	const i32 old_parent = m_nodes[sibling].parent;
+	const i32 new_parent = allocNode();
+	Node& parent = m_nodes[new_parent];
+	parent.parent = old_parent;
+	merge(parent.min, parent.max, m_nodes[sibling].min, m_nodes[sibling].max, leaf_min, leaf_max);
+	parent.height = m_nodes[sibling].height + 1;
+	parent.children[0] = sibling;
+	parent.children[1] = leaf;
+	m_nodes[sibling].parent = new_parent;
+	m_nodes[leaf].parent = new_parent;
+
+	if (old_parent >= 0) {
+		Node& p = m_nodes[old_parent];
+		p.children[p.children[0] == sibling ? 0 : 1] = new_parent;
+	}
+	else {
+		m_root = new_parent;
+	}
+
+	refit(old_parent);
+}
+
+
+void EntityBVH::removeLeaf(i32 leaf) {
+	if (leaf == m_root) {
+		m_root = -1;
+		return;
+	}
+
+	const i32 parent = m_nodes[leaf].parent;
+	const i32 grand_parent = m_nodes[parent].parent;
+	const i32 sibling = m_nodes[parent].children[m_nodes[parent].children[0] == leaf ? 1 : 0];
+
+	m_nodes[sibling].parent = grand_parent;
+	freeNode(parent);
+	if (grand_parent >= 0) {
+		Node& gp = m_nodes[grand_parent];
+		gp.children[gp.children[0] == parent ? 0 : 1] = sibling;
+		refit(grand_parent);
+	}
+	else {
+		m_root = sibling;
+	}
+}
+
+
+// walks from `idx` to the root, rebalancing and updating bounds and heights
+void EntityBVH::refit(i32 idx) {
+	while (idx >= 0) {
+		idx = balance(idx);
+		Node& node = m_nodes[idx];
+		const Node& a = m_nodes[node.children[0]];
+		const Node& b = m_nodes[node.children[1]];
+		node.height = 1 + maximum(a.height, b.height);
+		merge(node.min, node.max, a.min, a.max, b.min, b.max);
+		idx = node.parent;
+	}
+}
+
+
+// if one subtree of `idx` is more than one level deeper than the other, its child is rotated up;
+// returns the node which is at `idx`'s place in the tree afterwards
+i32 EntityBVH::balance(i32 idx_a) {
+	Node& a = m_nodes[idx_a];
+	if (a.height < 2) return idx_a;
+
+	const i32 idx_b = a.children[0];
+	const i32 idx_c = a.children[1];
+	Node& b = m_nodes[idx_b];
+	Node& c = m_nodes[idx_c];
+	const i32 diff = c.height - b.height;
+
+	auto rotate_up = [&](i32 idx_up, Node& up, i32 up_slot) {
+		// `up` takes `a`'s place, `a` takes place of `up`'s lower child
+		const i32 idx_f = up.children[0];
+		const i32 idx_g = up.children[1];
+		Node& f = m_nodes[idx_f];
+		Node& g = m_nodes[idx_g];
+		const Node& other = m_nodes[a.children[1 - up_slot]];
+
+		up.children[0] = idx_a;
+		up.parent = a.parent;
+		a.parent = idx_up;
+		if (up.parent >= 0) {
+			Node& p = m_nodes[up.parent];
+			p.children[p.children[0] == idx_a ? 0 : 1] = idx_up;
+		}
+		else {
+			m_root = idx_up;
+		}
+
+		const bool keep_f = f.height > g.height;
+		const i32 idx_keep = keep_f ? idx_f : idx_g;
+		const i32 idx_move = keep_f ? idx_g : idx_f;
+		Node& keep = m_nodes[idx_keep];
+		Node& move = m_nodes[idx_move];
+		up.children[1] = idx_keep;
+		a.children[up_slot] = idx_move;
+		move.parent = idx_a;
+		merge(a.min, a.max, other.min, other.max, move.min, move.max);
+		a.height = 1 + maximum(other.height, move.height);
+		merge(up.min, up.max, a.min, a.max, keep.min, keep.max);
+		up.height = 1 + maximum(a.height, keep.height);
+	};
+
+	if (diff > 1) {
+		rotate_up(idx_c, c, 1);
+		return idx_c;
+	}
+	if (diff < -1) {
+		rotate_up(idx_b, b, 0);
+		return idx_b;
+	}
+	return idx_a;
+}
+
+
+} // namespace Lumix
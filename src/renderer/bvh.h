@@ -0,0 +1,261 @@
+#pragma once
+
+
+#include "engine/array.h"
+#include "engine/crt.h"
+#include "engine/lumix.h"
+#include "engine/math.h"
+
+
+namespace Lumix
+{
+
+
+struct IAllocator;
+
+
+// Static bounding volume hierarchy over triangles, built once with binned SAH and read only afterwards,
+// so any number of threads can cast rays against it. Used by Model::castRay.
+struct TriangleBVH
+{
+public:
+	struct Node {
+		Vec3 min;
+		// leaf: first triangle, inner node: left child, right child is `first + 1`
+		u32 first;
+		Vec3 max;
+		// 0 for inner nodes
+		u32 count;
+	};
+
+	struct Triangle {
+		Vec3 p0;
+		Vec3 e1;
+		Vec3 e2;
+		// any user data, e.g. mesh index
+		u32 tag;
+	};
+
+	static constexpr u32 MAX_LEAF_SIZE = 4;
+
+	explicit TriangleBVH(IAllocator& allocator);
+
+	void clear();
+	// triangles are collected until `build` is called
+	void addTriangles(const Vec3* vertices, const void* indices, u32 indices_count, bool indices_16bit, u32 tag);
+	void build();
+	bool isEmpty() const { return m_nodes.empty(); }
+	u32 getTrianglesCount() const { return m_triangles.size(); }
+
+	// `f(const Triangle&, float t)` is called for every triangle hit in [0, max_t), nodes are visited front to back;
+	// if `f` returns true, the hit is accepted and only closer triangles are reported afterwards
+	// returns the closest accepted t or max_t if nothing is accepted
+	template <typename F>
+	float castRay(const Vec3& origin, const Vec3& dir, float max_t, F&& f) const;
+
+private:
+	IAllocator& m_allocator;
+	Array<Node> m_nodes;
+	Array<Triangle> m_triangles;
+};
+
+
+// Dynamic bounding volume hierarchy over world space bounds of entities. Leaves are enlarged by a margin,
+// so small movements do not change the tree, otherwise the leaf is reinserted and its ancestors
+// are refitted and rebalanced by rotations.
+struct EntityBVH
+{
+public:
+	explicit EntityBVH(IAllocator& allocator);
+
+	void clear();
+	bool isAdded(EntityRef entity) const;
+	void add(EntityRef entity, const DVec3& min, const DVec3& max);
+	void remove(EntityRef entity);
+	// returns false if the enlarged bounds still contain the new bounds and the tree did not change
+	bool set(EntityRef entity, const DVec3& min, const DVec3& max);
+	u32 getHeight() const { return m_root < 0 ? 0 : m_nodes[m_root].height + 1; }
+
+	// `f(EntityRef, double& max_t)` is called for every entity whose bounds are hit in [0, max_t),
+	// nodes are visited front to back, `f` can lower max_t to skip farther entities
+	template <typename F>
+	void castRay(const DVec3& origin, const Vec3& dir, double max_t, F&& f) const;
+
+private:
+	struct Node {
+		DVec3 min;
+		DVec3 max;
+		i32 parent;
+		// -1 in leaves
+		i32 children[2];
+		// 0 in leaves
+		i32 height;
+		// next free node if the node is not used
+		EntityPtr entity;
+	};
+
+	i32 allocNode();
+	void freeNode(i32 node);
+	void insertLeaf(i32 leaf);
+	void removeLeaf(i32 leaf);
+	void refit(i32 node);
+	i32 balance(i32 node);
+
+	Array<Node> m_nodes;
+	// entity.index -> leaf node or -1
+	Array<i32> m_leaves;
+	i32 m_root = -1;
+	i32 m_free_list = -1;
+};
+
+
+template <typename F>
+float TriangleBVH::castRay(const Vec3& origin, const Vec3& dir, float max_t, F&& f) const
+{
+	if (m_nodes.empty()) return max_t;
+
+	const float inv_dir[] = {
+		1 / (dir.x == 0 ? 1e-20f : dir.x),
+		1 / (dir.y == 0 ? 1e-20f : dir.y),
+		1 / (dir.z == 0 ? 1e-20f : dir.z)
+	};
+
+	auto intersect = [&](const Node& n) {
+		const float tx0 = (n.min.x - origin.x) * inv_dir[0];
+		const float tx1 = (n.max.x - origin.x) * inv_dir[0];
+		const float ty0 = (n.min.y - origin.y) * inv_dir[1];
+		const float ty1 = (n.max.y - origin.y) * inv_dir[1];
+		const float tz0 = (n.min.z - origin.z) * inv_dir[2];
+		const float tz1 = (n.max.z - origin.z) * inv_dir[2];
+		const float tmin = maximum(maximum(minimum(tx0, tx1), minimum(ty0, ty1)), maximum(minimum(tz0, tz1), 0.f));
+		const float tmax = minimum(minimum(maximum(tx0, tx1), maximum(ty0, ty1)), minimum(maximum(tz0, tz1), max_t));
+		return tmin <= tmax ? tmin : FLT_MAX;
+	};
+
+	u32 stack[64];
+	u32 stack_size = 0;
+	u32 node_idx = 0;
+	if (intersect(m_nodes[0]) == FLT_MAX) return max_t;
+
+	for (;;) {
+		const Node& node = m_nodes[node_idx];
+		if (node.count > 0) {
+			for (u32 i = node.first, end = node.first + node.count; i < end; ++i) {
+				// Moller-Trumbore, both sides
+				const Triangle& tri = m_triangles[i];
+				const float px = dir.y * tri.e2.z - dir.z * tri.e2.y;
+				const float py = dir.z * tri.e2.x - dir.x * tri.e2.z;
+				const float pz = dir.x * tri.e2.y - dir.y * tri.e2.x;
+				const float det = tri.e1.x * px + tri.e1.y * py + tri.e1.z * pz;
+				if (det == 0) continue;
+
+				const float inv_det = 1 / det;
+				const float sx = origin.x - tri.p0.x;
+				const float sy = origin.y - tri.p0.y;
+				const float sz = origin.z - tri.p0.z;
+				const float u = (sx * px + sy * py + sz * pz) * inv_det;
+				if (u < 0 || u > 1) continue;
+
+				const float qx = sy * tri.e1.z - sz * tri.e1.y;
+				const float qy = sz * tri.e1.x - sx * tri.e1.z;
+				const float qz = sx * tri.e1.y - sy * tri.e1.x;
+				const float v = (dir.x * qx + dir.y * qy + dir.z * qz) * inv_det;
+				if (v < 0 || u + v > 1) continue;
+
+				const float t = (tri.e2.x * qx + tri.e2.y * qy + tri.e2.z * qz) * inv_det;
+				if (t < 0 || t >= max_t) continue;
+				if (f(tri, t)) max_t = t;
+			}
+		}
+		else {
+			u32 near_idx = node.first;
+			u32 far_idx = node.first + 1;
+			float near_t = intersect(m_nodes[near_idx]);
+			float far_t = intersect(m_nodes[far_idx]);
+			if (far_t < near_t) {
+				swap(near_idx, far_idx);
+				swap(near_t, far_t);
+			}
+			if (near_t != FLT_MAX) {
+				if (far_t != FLT_MAX) {
+					ASSERT(stack_size < lengthOf(stack));
+					stack[stack_size++] = far_idx;
+				}
+				node_idx = near_idx;
+				continue;
+			}
+		}
+
+		// popped nodes are tested again, max_t could be lower now
+		for (;;) {
+			if (stack_size == 0) return max_t;
+			node_idx = stack[--stack_size];
+			if (intersect(m_nodes[node_idx]) != FLT_MAX) break;
+		}
+	}
+}
+
+
+template <typename F>
+void EntityBVH::castRay(const DVec3& origin, const Vec3& dir, double max_t, F&& f) const
+{
+	if (m_root < 0) return;
+
+	const double inv_dir[] = {
+		1 / (dir.x == 0 ? 1e-20 : (double)dir.x),
+		1 / (dir.y == 0 ? 1e-20 : (double)dir.y),
+		1 / (dir.z == 0 ? 1e-20 : (double)dir.z)
+	};
+
+	auto intersect = [&](const Node& n) {
+		const double tx0 = (n.min.x - origin.x) * inv_dir[0];
+		const double tx1 = (n.max.x - origin.x) * inv_dir[0];
+		const double ty0 = (n.min.y - origin.y) * inv_dir[1];
+		const double ty1 = (n.max.y - origin.y) * inv_dir[1];
+		const double tz0 = (n.min.z - origin.z) * inv_dir[2];
+		const double tz1 = (n.max.z - origin.z) * inv_dir[2];
+		const double tmin = maximum(maximum(minimum(tx0, tx1), minimum(ty0, ty1)), maximum(minimum(tz0, tz1), 0.0));
+		const double tmax = minimum(minimum(maximum(tx0, tx1), maximum(ty0, ty1)), minimum(maximum(tz0, tz1), max_t));
+		return tmin <= tmax ? tmin : DBL_MAX;
+	};
+
+	// the tree is balanced, 64 levels are more than any entity count can need
+	i32 stack[64];
+	u32 stack_size = 0;
+	i32 node_idx = m_root;
+	if (intersect(m_nodes[node_idx]) == DBL_MAX) return;
+
+	for (;;) {
+		const Node& node = m_nodes[node_idx];
+		if (node.height == 0) {
+			f((EntityRef)node.entity, max_t);
+		}
+		else {
+			i32 near_idx = node.children[0];
+			i32 far_idx = node.children[1];
+			double near_t = intersect(m_nodes[near_idx]);
+			double far_t = intersect(m_nodes[far_idx]);
+			if (far_t < near_t) {
+				swap(near_idx, far_idx);
+				swap(near_t, far_t);
+			}
+			if (near_t != DBL_MAX) {
+				if (far_t != DBL_MAX) {
+					ASSERT(stack_size < lengthOf(stack));
+					stack[stack_size++] = far_idx;
+				}
+				node_idx = near_idx;
+				continue;
+			}
+		}
+
+		for (;;) {
+			if (stack_size == 0) return;
+			node_idx = stack[--stack_size];
+			if (intersect(m_nodes[node_idx]) != DBL_MAX) break;
+		}
+	}
+}
+
+
+} // namespace Lumix
@@ -11,46 +11,28 @@
 #include "engine/page_allocator.h"
 #include "engine/profiler.h"
 #include "engine/simd.h"
+#include "engine/sync.h"
 
 
 namespace Lumix
 {
 
 
-struct CellIndices
-{
-	CellIndices() {}
-	CellIndices(const DVec3& pos, float cell_size, u8 type, bool is_big)
-		: pos(pos * (1 / cell_size))
-		, is_big(is_big)
-		, type(type)
-	{}
-
-	bool operator==(const CellIndices& rhs) const { return pos == rhs.pos && type == rhs.type && is_big == rhs.is_big; }
-
-	IVec3 pos;
-	u8 type;
-	bool is_big;
-};
-
-
-struct CellIndicesHasher
-{
-	// http://www.beosil.com/download/CollisionDetectionHashing_VMV03.pdf
-	static u32 get(const CellIndices& indices) {
-		// TODO indices.is_big, indices.type
-		return (u32)indices.pos.x * 73856093 + (u32)indices.pos.y * 19349663 + (u32)indices.pos.z * 83492791; 
-	}
-};
+struct CullingNode;
 
 
 struct alignas(4096) CellPage {
 	struct {
 		CellPage* next = nullptr;
 		CellPage* prev = nullptr;
+		CullingNode* node = nullptr;
 		DVec3 origin;
-		CellIndices indices;
+		// bounds of all spheres relative to origin, recomputed only after the page changes
+		Vec3 bounds_min;
+		Vec3 bounds_max;
 		int count = 0;
+		u8 type;
+		bool bounds_dirty = true;
 	} header;
 
 	enum { MAX_COUNT = (PageAllocator::PAGE_SIZE - sizeof(header)) / (sizeof(Sphere) + sizeof(EntityPtr)) };
@@ -60,55 +42,277 @@ struct alignas(4096) CellPage {
 };
 
 static_assert(sizeof(CellPage) == PageAllocator::PAGE_SIZE);
+static_assert(sizeof(CullResult) <= PageAllocator::PAGE_SIZE);
+
+
+// Node of an adaptive loose octree. Objects are in a node which contains their center 
+// and whose size is at least 4x their radius, so they never stick out more than size / 4 of the node's cube.
+// Culling uses node bounds enlarged by size / 4 on each side, which are conservative for the whole subtree.
+// Nodes are split only once they fill a page, so sparse areas do not end up with a page per object.
+struct CullingNode {
+	static constexpr u8 HUGE_LEVEL = 0xff;
+
+	DVec3 origin; // min corner
+	float size;
+	u8 level;
+	u8 child_index;
+	u8 children_count = 0;
+	bool is_split = false;
+	IVec3 top_indices;
+	CullingNode* parent = nullptr;
+	CullingNode* children[8] = {};
+	CellPage* pages = nullptr;
+};
+
+
+struct TopIndicesHasher
+{
+	// http://www.beosil.com/download/CollisionDetectionHashing_VMV03.pdf
+	static u32 get(const IVec3& indices) {
+		return (u32)indices.x * 73856093 + (u32)indices.y * 19349663 + (u32)indices.z * 83492791; 
+	}
+};
 
 
 struct CullingSystemImpl final : CullingSystem
 {
+	static constexpr u32 MAX_VIEWS = 32;
+
+	// bit i of a mask is set if the page is visible in i-th view
+	struct VisiblePage {
+		const CellPage* page;
+		u32 inside;
+		u32 partial;
+	};
+
+	struct ResultList {
+		CullResult* first = nullptr;
+		CullResult* last = nullptr;
+	};
+
 	CullingSystemImpl(IAllocator& allocator, PageAllocator& page_allocator) 
 		: m_allocator(allocator)
-		, m_cell_map(allocator)
+		, m_top_map(allocator)
+		, m_top_nodes(allocator)
 		, m_entity_to_cell(allocator)
-		, m_cells(allocator)
-		, m_cell_size(300.0f)
 		, m_page_allocator(page_allocator)
 	{
+		m_huge.origin = DVec3(0, 0, 0);
+		m_huge.size = 0;
+		m_huge.level = CullingNode::HUGE_LEVEL;
+		setCellSizes(32.f, 8);
 	}
 	
 	~CullingSystemImpl()
 	{
 		clear();
 	}
-	
-	Sphere* addToCell(CellPage& cell, EntityPtr entity, const DVec3& pos, float radius)
+
+
+	void setCellSizes(float min_cell_size, u32 levels_count) override
 	{
-		const Vec3 rel_pos = Vec3(pos - cell.header.origin);
-		const int count = cell.header.count;
+		ASSERT(levels_count > 0 && levels_count < CullingNode::HUGE_LEVEL);
+		struct Entry {
+			EntityRef entity;
+			u8 type;
+			DVec3 pos;
+			float radius;
+		};
+		Array<Entry> entries(m_allocator);
+		forEachPage([&](const CellPage& page){
+			for (int i = 0; i < page.header.count; ++i) {
+				entries.push({(EntityRef)page.entities[i], page.header.type, page.header.origin + page.spheres[i].position, page.spheres[i].radius});
+			}
+		});
+		clear();
+
+		m_levels_count = levels_count;
+		m_top_size = min_cell_size * float(1 << (levels_count - 1));
+		for (const Entry& e : entries) add(e.entity, e.type, e.pos, e.radius);
+	}
+
 
-		if(count < CellPage::MAX_COUNT - 1) {
-			cell.spheres[count] = {rel_pos, radius};
-			cell.entities[count] = entity;
-			++cell.header.count;
-			return &cell.spheres[count];
+	template <typename F>
+	void forEachPage(F&& f) const
+	{
+		for (const CellPage* page = m_huge.pages; page; page = page->header.next) f(*page);
+		for (const CullingNode* node : m_top_nodes) forEachPage(*node, f);
+	}
+
+
+	template <typename F>
+	static void forEachPage(const CullingNode& node, F& f)
+	{
+		for (const CellPage* page = node.pages; page; page = page->header.next) f(*page);
+		for (const CullingNode* child : node.children) {
+			if (child) forEachPage(*child, f);
 		}
+	}
 
-		void* mem = m_page_allocator.allocate(true);
-		CellPage* new_cell = new (Lumix::NewPlaceholder(), mem) CellPage;
-		new_cell->header.origin = cell.header.origin;
-		new_cell->header.indices = cell.header.indices;
-		new_cell->header.next = &cell;
-		new_cell->header.prev = cell.header.prev;
-		
-		new_cell->header.next->header.prev = new_cell;
-		if (new_cell->header.prev) new_cell->header.prev->header.next = new_cell;
 
-		m_cells.push(new_cell);
-		if(!new_cell->header.prev) m_cell_map[new_cell->header.indices] = new_cell;
+	// deepest level an object with `radius` can be in
+	u8 getLevel(float radius) const
+	{
+		float size = m_top_size;
+		if (radius > size * 0.25f) return CullingNode::HUGE_LEVEL;
+		u8 level = 0;
+		while (level + 1u < m_levels_count && radius <= size * 0.125f) {
+			size *= 0.5f;
+			++level;
+		}
+		return level;
+	}
+
 
-		new_cell->spheres[0] = {rel_pos, radius};
-		new_cell->entities[0] = entity;
-		new_cell->header.count = 1;
+	static bool contains(const CullingNode& node, const DVec3& pos)
+	{
+		return pos.x >= node.origin.x && pos.y >= node.origin.y && pos.z >= node.origin.z
+			&& pos.x < node.origin.x + node.size && pos.y < node.origin.y + node.size && pos.z < node.origin.z + node.size;
+	}
 
-		return &new_cell->spheres[0];
+
+	static u8 getChildIndex(const CullingNode& node, const DVec3& pos)
+	{
+		const double half = node.size * 0.5;
+		return (pos.x >= node.origin.x + half ? 1 : 0)
+			| (pos.y >= node.origin.y + half ? 2 : 0)
+			| (pos.z >= node.origin.z + half ? 4 : 0);
+	}
+
+
+	CullingNode& getChild(CullingNode& node, u8 child_index)
+	{
+		CullingNode* child = node.children[child_index];
+		if (child) return *child;
+
+		const double half = node.size * 0.5;
+		child = LUMIX_NEW(m_allocator, CullingNode);
+		child->origin = node.origin + DVec3(child_index & 1 ? half : 0, child_index & 2 ? half : 0, child_index & 4 ? half : 0);
+		child->size = node.size * 0.5f;
+		child->level = node.level + 1;
+		child->child_index = child_index;
+		child->parent = &node;
+		node.children[child_index] = child;
+		++node.children_count;
+		return *child;
+	}
+
+
+	CullingNode& getTopNode(const DVec3& pos)
+	{
+		const double top_size = m_top_size;
+		const IVec3 top_indices((i32)floor(pos.x / top_size), (i32)floor(pos.y / top_size), (i32)floor(pos.z / top_size));
+		auto iter = m_top_map.find(top_indices);
+		if (iter.isValid()) return *iter.value();
+
+		CullingNode* node = LUMIX_NEW(m_allocator, CullingNode);
+		node->origin = DVec3(top_indices.x * top_size, top_indices.y * top_size, top_indices.z * top_size);
+		node->size = m_top_size;
+		node->level = 0;
+		node->child_index = 0;
+		node->top_indices = top_indices;
+		m_top_map.insert(top_indices, node);
+		m_top_nodes.push(node);
+		return *node;
+	}
+
+
+	// nodes are split only after their page of `type` is full
+	static bool isFull(const CullingNode& node, u8 type)
+	{
+		bool any = false;
+		for (const CellPage* page = node.pages; page; page = page->header.next) {
+			if (page->header.type != type) continue;
+			if (page->header.count < CellPage::MAX_COUNT) return false;
+			any = true;
+		}
+		return any;
+	}
+
+
+	// moves objects, which are small enough, to children
+	void split(CullingNode& node)
+	{
+		node.is_split = true;
+		CellPage* page = node.pages;
+		while (page) {
+			CellPage* next = page->header.next;
+			for (int i = page->header.count - 1; i >= 0; --i) {
+				const float radius = page->spheres[i].radius;
+				if (getLevel(radius) <= node.level) continue;
+
+				const DVec3 pos = page->header.origin + page->spheres[i].position;
+				const EntityRef entity = (EntityRef)page->entities[i];
+				CullingNode& child = getChild(node, getChildIndex(node, pos));
+				m_entity_to_cell[entity.index] = addToNode(child, entity, page->header.type, pos, radius);
+				removeFromPage(*page, i);
+			}
+			if (page->header.count == 0) freePage(*page);
+			page = next;
+		}
+	}
+
+
+	CullingNode& getNode(const DVec3& pos, float radius, u8 type)
+	{
+		const u8 max_level = getLevel(radius);
+		if (max_level == CullingNode::HUGE_LEVEL) return m_huge;
+
+		CullingNode* node = &getTopNode(pos);
+		while (node->level < max_level) {
+			if (!node->is_split) {
+				if (!isFull(*node, type)) break;
+				split(*node);
+			}
+			node = &getChild(*node, getChildIndex(*node, pos));
+		}
+		return *node;
+	}
+
+
+	// frees empty nodes from `node` up
+	void releaseNode(CullingNode* node)
+	{
+		while (node && node != &m_huge && !node->pages && node->children_count == 0) {
+			CullingNode* parent = node->parent;
+			if (parent) {
+				parent->children[node->child_index] = nullptr;
+				--parent->children_count;
+			}
+			else {
+				m_top_map.erase(node->top_indices);
+				m_top_nodes.swapAndPopItem(node);
+			}
+			LUMIX_DELETE(m_allocator, node);
+			node = parent;
+		}
+	}
+
+
+	Sphere* addToNode(CullingNode& node, EntityRef entity, u8 type, const DVec3& pos, float radius)
+	{
+		CellPage* page = node.pages;
+		while (page && (page->header.type != type || page->header.count == CellPage::MAX_COUNT)) {
+			page = page->header.next;
+		}
+
+		if (!page) {
+			void* mem = m_page_allocator.allocate(true);
+			page = new (Lumix::NewPlaceholder(), mem) CellPage;
+			page->header.origin = node.origin;
+			page->header.node = &node;
+			page->header.type = type;
+			page->header.next = node.pages;
+			if (node.pages) node.pages->header.prev = page;
+			node.pages = page;
+		}
+
+		const int idx = page->header.count;
+		page->spheres[idx] = {Vec3(pos - page->header.origin), radius};
+		page->entities[idx] = entity;
+		page->header.bounds_dirty = true;
+		++page->header.count;
+		return &page->spheres[idx];
 	}
 
 
@@ -121,23 +325,8 @@ struct CullingSystemImpl final : CullingSystem
 			}
 		}
 		
-		const CellIndices i(pos, m_cell_size, type, radius > m_cell_size);
-
-		auto iter = m_cell_map.find(i);
-		if (!iter.isValid()) {
-			void* mem = m_page_allocator.allocate(true);
-			CellPage* new_cell = new (Lumix::NewPlaceholder(), mem) CellPage;
-			new_cell->header.origin = i.pos * double(m_cell_size);
-			new_cell->header.indices = i;
-			m_cell_map.insert(i, new_cell);
-			m_cells.push(new_cell);
-			iter = m_cell_map.find(i);
-		}
-
-		CellPage& cell = *iter.value();
-		Sphere* sphere = addToCell(cell, entity, pos, radius);
-		m_entity_to_cell[entity.index] = sphere;
-		return;
+		CullingNode& node = getNode(pos, radius, type);
+		m_entity_to_cell[entity.index] = addToNode(node, entity, type, pos, radius);
 	}
 
 
@@ -145,34 +334,45 @@ struct CullingSystemImpl final : CullingSystem
 	{
 		if (m_entity_to_cell.size() <= entity.index) return;
 		
-		const Sphere* sphere = m_entity_to_cell[entity.index];
+		Sphere* sphere = m_entity_to_cell[entity.index];
 		if (!sphere) return;
 
-		CellPage& cell = getCell(*sphere);
-		if (cell.header.count == 1) {
-			if (!cell.header.prev) {
-				if (!cell.header.next) m_cell_map.erase(cell.header.indices);
-				else m_cell_map[cell.header.indices] = cell.header.next;
-			}
-			if (cell.header.prev) cell.header.prev->header.next = cell.header.next;
-			if (cell.header.next) cell.header.next->header.prev = cell.header.prev;
-			m_cells.swapAndPopItem(&cell);
-			cell.~CellPage();
-			m_page_allocator.deallocate(&cell, true);
+		CellPage& page = getPage(*sphere);
+		m_entity_to_cell[entity.index] = nullptr;
+		removeFromPage(page, int(sphere - page.spheres));
+
+		if (page.header.count == 0) {
+			CullingNode* node = page.header.node;
+			freePage(page);
+			releaseNode(node);
 		}
-		else {
-			const int idx = int(sphere - cell.spheres);
-			EntityPtr last = cell.entities[cell.header.count - 1];
-			cell.entities[idx] = cell.entities[cell.header.count - 1];
-			cell.spheres[idx] = cell.spheres[cell.header.count - 1];
-			m_entity_to_cell[last.index] = &cell.spheres[idx];
-			--cell.header.count;
+	}
+
+
+	void removeFromPage(CellPage& page, int idx)
+	{
+		const int last = page.header.count - 1;
+		if (idx != last) {
+			page.entities[idx] = page.entities[last];
+			page.spheres[idx] = page.spheres[last];
+			m_entity_to_cell[page.entities[idx].index] = &page.spheres[idx];
 		}
-		m_entity_to_cell[entity.index] = nullptr;
+		--page.header.count;
+	}
+
+
+	void freePage(CellPage& page)
+	{
+		CullingNode* node = page.header.node;
+		if (page.header.prev) page.header.prev->header.next = page.header.next;
+		else node->pages = page.header.next;
+		if (page.header.next) page.header.next->header.prev = page.header.prev;
+		page.~CellPage();
+		m_page_allocator.deallocate(&page, true);
 	}
 
 
-	CellPage& getCell(const Sphere& sphere) const
+	CellPage& getPage(const Sphere& sphere) const
 	{
 		const intptr_t ptr = (intptr_t)&sphere;
 		const intptr_t page_ptr = ptr - (ptr % PageAllocator::PAGE_SIZE);
@@ -180,20 +380,28 @@ struct CullingSystemImpl final : CullingSystem
 	}
 
 
+	// objects moving inside their node are updated in place, otherwise they are moved to another node
+	bool canStay(const CullingNode& node, const DVec3& pos, float radius) const
+	{
+		const u8 max_level = getLevel(radius);
+		if (node.level == CullingNode::HUGE_LEVEL) return max_level == CullingNode::HUGE_LEVEL;
+		return max_level != CullingNode::HUGE_LEVEL && max_level >= node.level && contains(node, pos);
+	}
+
+
 	void setPosition(EntityRef entity, const DVec3& pos) override
 	{
 		Sphere* sphere = m_entity_to_cell[entity.index];
-		CellPage& cell = getCell(*sphere);
-
-		const IVec3 new_indices(pos * (1 / m_cell_size));
+		CellPage& page = getPage(*sphere);
 
-		if(new_indices == cell.header.indices.pos) {
-			sphere->position = Vec3(pos - cell.header.origin);
+		if (canStay(*page.header.node, pos, sphere->radius)) {
+			sphere->position = Vec3(pos - page.header.origin);
+			page.header.bounds_dirty = true;
 			return;
 		}
 
 		const float radius = sphere->radius;
-		const u8 type = cell.header.indices.type;
+		const u8 type = page.header.type;
 		remove(entity);
 		add(entity, type, pos, radius);
 	}
@@ -206,19 +414,16 @@ struct CullingSystemImpl final : CullingSystem
 
 	void set(EntityRef entity, const DVec3& pos, float radius) override {
 		Sphere* sphere = m_entity_to_cell[entity.index];
-		CellPage& cell = getCell(*sphere);
-		const IVec3 new_indices(pos * (1 / m_cell_size));
-		
-		const bool was_big = cell.header.indices.is_big;
-		const bool is_big = radius > m_cell_size;
+		CellPage& page = getPage(*sphere);
 
-		if (was_big == is_big && new_indices == cell.header.indices.pos) {
+		if (canStay(*page.header.node, pos, radius)) {
 			sphere->radius = radius;
-			sphere->position = Vec3(pos - cell.header.origin);
+			sphere->position = Vec3(pos - page.header.origin);
+			page.header.bounds_dirty = true;
 			return;
 		}
 
-		const u8 type = cell.header.indices.type;
+		const u8 type = page.header.type;
 		remove(entity);
 		add(entity, type, pos, radius);
 	}
@@ -226,58 +431,89 @@ struct CullingSystemImpl final : CullingSystem
 	void setRadius(EntityRef entity, float radius) override
 	{
 		Sphere* sphere = m_entity_to_cell[entity.index];
-		CellPage& cell = getCell(*sphere);
-		
-		const bool was_big = cell.header.indices.is_big;
-		const bool is_big = radius > m_cell_size;
+		CellPage& page = getPage(*sphere);
+		const DVec3 pos = page.header.origin + sphere->position;
 
-		if (was_big == is_big) {
+		if (canStay(*page.header.node, pos, radius)) {
 			sphere->radius = radius;
+			page.header.bounds_dirty = true;
 			return;
 		}
-		const u8 type = cell.header.indices.type;
-		const DVec3 pos = cell.header.origin + sphere->position;
+
+		const u8 type = page.header.type;
 		remove(entity);
 		add(entity, type, pos, radius);
 	}
 
 
-	void clear() override
+	void freePages(CellPage* page)
 	{
-		for(CellPage* page : m_cell_map) {
-			ASSERT(!page->header.prev);
-			CellPage* iter = page;
-			while(iter) {
-				CellPage* tmp = iter;
-				iter = tmp->header.next;
-				tmp->~CellPage();
-				m_page_allocator.deallocate(tmp, true);
-			}
+		while (page) {
+			CellPage* tmp = page;
+			page = tmp->header.next;
+			tmp->~CellPage();
+			m_page_allocator.deallocate(tmp, true);
 		}
-	   
-		m_cells.clear();
-		m_cell_map.clear();
+	}
+
+
+	void freeNode(CullingNode* node)
+	{
+		freePages(node->pages);
+		for (CullingNode* child : node->children) {
+			if (child) freeNode(child);
+		}
+		LUMIX_DELETE(m_allocator, node);
+	}
+
+
+	void clear() override
+	{
+		for (CullingNode* node : m_top_nodes) freeNode(node);
+		freePages(m_huge.pages);
+		m_huge.pages = nullptr;
+
+		m_top_nodes.clear();
+		m_top_map.clear();
 		m_entity_to_cell.clear();
 	}
 
-	LUMIX_FORCE_INLINE void doCulling(const CellPage& cell
+	CullResult* push(ResultList& list, u8 type)
+	{
+		void* mem = m_page_allocator.allocate(true);
+		CullResult* result = new (NewPlaceholder(), mem) CullResult;
+		result->header.type = type;
+		if (list.last) list.last->header.next = result;
+		else list.first = result;
+		list.last = result;
+		return result;
+	}
+
+	// `frustum` is relative to its own origin, `offset` moves it to be relative to the page's origin, 
+	// which is much cheaper than ShiftedFrustum::getRelative for each page
+	// returns the result page which should be used for following entities
+	LUMIX_FORCE_INLINE CullResult* doCulling(const CellPage& cell
 		, const Frustum& frustum
+		, const Vec3& offset
 		, CullResult* LUMIX_RESTRICT results
-		, PagedList<CullResult>& list
+		, ResultList& list
 		, u8 type)
 	{
 		const Sphere* LUMIX_RESTRICT start = cell.spheres;
 		const Sphere* LUMIX_RESTRICT end = cell.spheres + cell.header.count;
 		const EntityPtr* LUMIX_RESTRICT sphere_to_entity_map = cell.entities;
 
+		const float4 ox = f4Splat(offset.x);
+		const float4 oy = f4Splat(offset.y);
+		const float4 oz = f4Splat(offset.z);
 		const float4 px = f4Load(frustum.xs);
 		const float4 py = f4Load(frustum.ys);
 		const float4 pz = f4Load(frustum.zs);
-		const float4 pd = f4Load(frustum.ds);
+		const float4 pd = f4Load(frustum.ds) - (px * ox + py * oy + pz * oz);
 		const float4 px2 = f4Load(&frustum.xs[4]);
 		const float4 py2 = f4Load(&frustum.ys[4]);
 		const float4 pz2 = f4Load(&frustum.zs[4]);
-		const float4 pd2 = f4Load(&frustum.ds[4]);
+		const float4 pd2 = f4Load(&frustum.ds[4]) - (px2 * ox + py2 * oy + pz2 * oz);
 		int cursor = results->header.count;
 
 		int i = 0;
@@ -298,8 +534,7 @@ struct CullingSystemImpl final : CullingSystem
 
 			if(cursor == lengthOf(results->entities)) {
 				results->header.count = cursor;
-				results = list.push();
-				results->header.type = type;
+				results = push(list, type);
 				cursor = 0;
 			}
 
@@ -307,72 +542,189 @@ struct CullingSystemImpl final : CullingSystem
 			++cursor;
 		}
 		results->header.count = cursor;
+		return results;
+	}
+
+	CullResult* copyAll(const CellPage& cell, CullResult* result, ResultList& list)
+	{
+		int to_cpy = cell.header.count;
+		int src_offset = 0;
+		while (to_cpy > 0) {
+			if(result->header.count == lengthOf(result->entities)) {
+				result = push(list, cell.header.type);
+			}
+			const int rem_space = lengthOf(result->entities) - result->header.count;
+			const int step = minimum(to_cpy, rem_space);
+			memcpy(result->entities + result->header.count, cell.entities + src_offset, step * sizeof(cell.entities[0]));
+			src_offset += step;
+			result->header.count += step;
+			to_cpy -= step;
+		}
+		return result;
 	}
 
 	CullResult* cull(const ShiftedFrustum& frustum, u8 type) override
 	{
 		ASSERT(type != 0xff); // 0xff type is reserved for `all types`
-		return cullInternal(frustum, type);
+		CullResult* result;
+		cullInternal(Span(&frustum, 1), type, Span(&result, 1));
+		return result;
 	}
 
 	CullResult* cull(const ShiftedFrustum& frustum) override
 	{
-		return cullInternal(frustum, 0xff);
+		CullResult* result;
+		cullInternal(Span(&frustum, 1), 0xff, Span(&result, 1));
+		return result;
+	}
+
+	void cull(Span<const ShiftedFrustum> frusta, u8 type, Span<CullResult*> results) override
+	{
+		cullInternal(frusta, type, results);
+	}
+
+
+	static void updateBounds(CellPage& page)
+	{
+		page.header.bounds_dirty = false;
+		if (page.header.count == 0) return;
+
+		Vec3 min = page.spheres[0].position - Vec3(page.spheres[0].radius);
+		Vec3 max = page.spheres[0].position + Vec3(page.spheres[0].radius);
+		for (int i = 1; i < page.header.count; ++i) {
+			const Sphere& sphere = page.spheres[i];
+			min.x = minimum(min.x, sphere.position.x - sphere.radius);
+			min.y = minimum(min.y, sphere.position.y - sphere.radius);
+			min.z = minimum(min.z, sphere.position.z - sphere.radius);
+			max.x = maximum(max.x, sphere.position.x + sphere.radius);
+			max.y = maximum(max.y, sphere.position.y + sphere.radius);
+			max.z = maximum(max.z, sphere.position.z + sphere.radius);
+		}
+		page.header.bounds_min = min;
+		page.header.bounds_max = max;
+	}
+
+
+	// pages, which did not change, reuse their bounds, so most of pages on the edge 
+	// of a frustum are resolved without testing each sphere
+	static void collectPages(CullingNode& node, Span<const ShiftedFrustum> frusta, u8 type, u32 inside, u32 partial, Array<VisiblePage>& out)
+	{
+		for (CellPage* page = node.pages; page; page = page->header.next) {
+			if (type != 0xff && page->header.type != type) continue;
+
+			u32 page_inside = inside;
+			u32 page_partial = partial;
+			if (partial) {
+				if (page->header.bounds_dirty) updateBounds(*page);
+				const DVec3 pos = page->header.origin + page->header.bounds_min;
+				const Vec3 size = page->header.bounds_max - page->header.bounds_min;
+				for (u32 i = 0, c = frusta.length(); i < c; ++i) {
+					const u32 bit = 1u << i;
+					if ((partial & bit) == 0) continue;
+					if (!frusta[i].intersectsAABB(pos, size)) {
+						page_partial &= ~bit;
+					}
+					else if (frusta[i].containsAABB(pos, size)) {
+						page_partial &= ~bit;
+						page_inside |= bit;
+					}
+				}
+			}
+			if (page_inside | page_partial) out.push({page, page_inside, page_partial});
+		}
+	}
+
+
+	// whole subtrees outside of or inside a frustum are resolved at the coarsest level possible
+	static void visit(CullingNode& node, Span<const ShiftedFrustum> frusta, u8 type, u32 inside, u32 partial, Array<VisiblePage>& out)
+	{
+		if (partial) {
+			const float margin = node.size * 0.25f;
+			const DVec3 loose_min = node.origin - DVec3(margin, margin, margin);
+			const Vec3 loose_size(node.size * 1.5f);
+			for (u32 i = 0, c = frusta.length(); i < c; ++i) {
+				const u32 bit = 1u << i;
+				if ((partial & bit) == 0) continue;
+				if (!frusta[i].intersectsAABB(loose_min, loose_size)) {
+					partial &= ~bit;
+				}
+				else if (frusta[i].containsAABB(loose_min, loose_size)) {
+					partial &= ~bit;
+					inside |= bit;
+				}
+			}
+			if (!(inside | partial)) return;
+		}
+
+		collectPages(node, frusta, type, inside, partial, out);
+		for (CullingNode* child : node.children) {
+			if (child) visit(*child, frusta, type, inside, partial, out);
+		}
 	}
 	
-	CullResult* cullInternal(const ShiftedFrustum& frustum, u8 type)
+	void cullInternal(Span<const ShiftedFrustum> frusta, u8 type, Span<CullResult*> results)
 	{
 		PROFILE_FUNCTION();
-		if (m_cells.empty()) return nullptr;
-
-		volatile i32 cell_idx = 0;
-		PagedList<CullResult> list(m_page_allocator);
+		const u32 views_count = frusta.length();
+		ASSERT(views_count <= MAX_VIEWS);
+		ASSERT(results.length() == views_count);
+		for (CullResult*& result : results) result = nullptr;
+		if (m_top_nodes.empty() && !m_huge.pages) return;
+
+		const u32 all_views = views_count == MAX_VIEWS ? 0xffFFffFF : (1u << views_count) - 1;
+		Array<VisiblePage> pages(m_allocator);
+		collectPages(m_huge, frusta, type, 0, all_views, pages);
+		for (CullingNode* node : m_top_nodes) visit(*node, frusta, type, 0, all_views, pages);
+		if (pages.empty()) return;
+
+		Frustum relative_frusta[MAX_VIEWS];
+		for (u32 view = 0; view < views_count; ++view) {
+			relative_frusta[view] = frusta[view].getRelative(frusta[view].origin);
+		}
 
-		jobs::runOnWorkers([&](){
+		ResultList lists[MAX_VIEWS];
+		Mutex mutex;
+		jobs::parallelFor(pages.size(), 4, [&](i32 from, i32 to){
 			PROFILE_BLOCK("cull_job");
-			const Vec3 v3_cell_size(m_cell_size);
-			const Vec3 v3_2_cell_size(2 * m_cell_size);
-			CullResult* result = nullptr;
+			ResultList job_lists[MAX_VIEWS];
+			CullResult* job_results[MAX_VIEWS] = {};
 			u32 total_count = 0;
-			for(;;) {
-				const i32 idx = atomicIncrement(&cell_idx) - 1;
-				if (idx >= m_cells.size()) return;
-
-				CellPage& cell = *m_cells[idx];
-				if (type != 0xff && cell.header.indices.type != type) continue;
-				if (!result || result->header.type != cell.header.indices.type) {
-					result = list.push();
-					result->header.type = cell.header.indices.type;
-				}
-
+			for (i32 idx = from; idx < to; ++idx) {
+				const VisiblePage& visible = pages[idx];
+				const CellPage& cell = *visible.page;
 				total_count += cell.header.count;
-				if (cell.header.indices.is_big) {
-					doCulling(cell, frustum.getRelative(cell.header.origin), result, list, cell.header.indices.type);
-				}
-				else if (frustum.containsAABB(cell.header.origin + v3_cell_size, v3_cell_size)) {
-					int to_cpy = cell.header.count;
-					int src_offset = 0;
-					while (to_cpy > 0) {
-						if(result->header.count == lengthOf(result->entities)) {
-							result = list.push();
-							result->header.type = cell.header.indices.type;
-						}
-						const int rem_space = lengthOf(result->entities) - result->header.count;
-						const int step = minimum(to_cpy, rem_space);
-						memcpy(result->entities + result->header.count, cell.entities + src_offset, step * sizeof(cell.entities[0]));
-						src_offset += step;
-						result->header.count += step;
-						to_cpy -= step;
+				// all views are handled while the page is in cache
+				for (u32 view = 0; view < views_count; ++view) {
+					const u32 bit = 1u << view;
+					if (((visible.inside | visible.partial) & bit) == 0) continue;
+
+					CullResult*& result = job_results[view];
+					if (!result || result->header.type != cell.header.type) {
+						result = push(job_lists[view], cell.header.type);
+					}
+
+					if (visible.inside & bit) {
+						result = copyAll(cell, result, job_lists[view]);
+					}
+					else {
+						const Vec3 offset(frusta[view].origin - cell.header.origin);
+						result = doCulling(cell, relative_frusta[view], offset, result, job_lists[view], cell.header.type);
 					}
-				}
-				else if (frustum.intersectsAABB(cell.header.origin - v3_cell_size, v3_2_cell_size)) {
-					doCulling(cell, frustum.getRelative(cell.header.origin), result, list, cell.header.indices.type);
 				}
 			}
 			profiler::pushInt("count", total_count);
+
+			MutexGuard guard(mutex);
+			for (u32 view = 0; view < views_count; ++view) {
+				ResultList& job_list = job_lists[view];
+				if (!job_list.first) continue;
+				if (lists[view].last) lists[view].last->header.next = job_list.first;
+				else lists[view].first = job_list.first;
+				lists[view].last = job_list.last;
+			}
 		});
 
-		return list.detach();
+		for (u32 view = 0; view < views_count; ++view) results[view] = lists[view].first;
 	}
 	
 
@@ -384,10 +736,13 @@ struct CullingSystemImpl final : CullingSystem
 
 	IAllocator& m_allocator;
 	PageAllocator& m_page_allocator;
-	HashMap<CellIndices, CellPage*, CellIndicesHasher> m_cell_map;
-	Array<CellPage*> m_cells;
+	HashMap<IVec3, CullingNode*, TopIndicesHasher> m_top_map;
+	Array<CullingNode*> m_top_nodes;
+	// objects too big for top level nodes, always tested
+	CullingNode m_huge;
 	Array<Sphere*> m_entity_to_cell;
-	float m_cell_size;
+	float m_top_size;
+	u32 m_levels_count;
 };
 
 
@@ -1,7 +1,9 @@
 #pragma once
 
 
+#include "engine/allocator.h"
 #include "engine/lumix.h"
+#include "engine/page_allocator.h"
 
 
 namespace Lumix
@@ -10,8 +12,6 @@ namespace Lumix
 template <typename T> struct Array;
 template <typename T> struct UniquePtr;
 struct DVec3;
-struct IAllocator;
-struct PageAllocator;
 struct ShiftedFrustum;
 struct Sphere;
 struct Vec3;
@@ -42,7 +42,7 @@ struct CullResult {
 		u32 count = 0;
 		u8 type;
 	} header;
-	EntityRef entities[(16384 - sizeof(header)) / sizeof(EntityRef)];
+	EntityRef entities[(PageAllocator::PAGE_SIZE - sizeof(header)) / sizeof(EntityRef)];
 };
 
 struct LUMIX_RENDERER_API CullingSystem
@@ -53,9 +53,15 @@ struct LUMIX_RENDERER_API CullingSystem
 	static UniquePtr<CullingSystem> create(IAllocator& allocator, PageAllocator& page_allocator);
 
 	virtual void clear() = 0;
+	// smallest cells are `min_cell_size` big, each of the other `levels_count - 1` levels doubles the size;
+	// already added objects are redistributed
+	virtual void setCellSizes(float min_cell_size, u32 levels_count) = 0;
 
 	virtual CullResult* cull(const ShiftedFrustum& frustum, u8 type) = 0;
 	virtual CullResult* cull(const ShiftedFrustum& frustum) = 0;
+	// culls all views in one pass over the pages, `results[i]` is what's visible in `frusta[i]`
+	// type 0xff means all types
+	virtual void cull(Span<const ShiftedFrustum> frusta, u8 type, Span<CullResult*> results) = 0;
 
 	virtual bool isAdded(EntityRef entity) = 0;
 	virtual void add(EntityRef entity, u8 type, const DVec3& pos, float radius) = 0;
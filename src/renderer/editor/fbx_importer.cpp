@@ -1285,31 +1285,6 @@ static void convert(const ofbx::Matrix& mtx, Vec3& pos, Quat& rot)
 	pos = m.getTranslation();
 }
 
-template <typename T>
-static void fillTimes(const ofbx::AnimationCurve* curve, Array<T>& out){
-	if(!curve) return;
-
-	const i64* times = curve->getKeyTime();
-	for (u32 i = 0, c = curve->getKeyCount(); i < c; ++i) {
-		if (out.empty()) {
-			out.emplace().time = times[i];
-		}
-		else if (times[i] > out.back().time) {
-			out.emplace().time = times[i];
-		}
-		else {
-			for (const T& k : out) {
-				if (k.time == times[i]) break;
-				if (times[i] < k.time) {
-					const u32 idx = u32(&k - out.begin());
-					out.emplaceAt(idx).time = times[i];
-					break;
-				}
-			}
-		}
-	}
-};
-
 static float evalCurve(i64 time, const ofbx::AnimationCurve& curve) {
 	const i64* times = curve.getKeyTime();
 	const float* values = curve.getKeyValue();
@@ -1332,53 +1307,6 @@ static float evalCurve(i64 time, const ofbx::AnimationCurve& curve) {
 	return 0.f;
 };
 
-// parent_scale - animated scale is not supported, but we can get rid of static scale if we ignore
-// it in writeSkeleton() and use `parent_scale` in this function
-static void compressPositions(float parent_scale, Array<FBXImporter::Key>& out)
-{
-	if (out.empty()) return;
-
-	const float ERROR = 0; 
-	Vec3 dir = out[1].pos - out[0].pos;
-	dir *= float(1 / ofbx::fbxTimeToSeconds(out[1].time - out[0].time));
-	u32 prev = 0;
-	for (u32 i = 2; i < (u32)out.size(); ++i) {
-		const Vec3 estimate = out[prev].pos + dir * (float)ofbx::fbxTimeToSeconds(out[i].time - out[prev].time);
-		const Vec3 diff = estimate - out[i].pos;
-		if (fabs(diff.x) > ERROR || fabs(diff.y) > ERROR || fabs(diff.z) > ERROR)  {
-			prev = i - 1;
-			dir = out[i].pos - out[i - 1].pos;
-			dir *= float(1 / ofbx::fbxTimeToSeconds(out[i].time - out[i - 1].time));
-		}
-		else {
-			out[i - 1].flags |= 1;
-		}
-	}
-	for (u32 i = 0; i < (u32)out.size(); ++i) {
-		out[i].pos *= parent_scale;
-	}
-}
-
-static void compressRotations(Array<FBXImporter::Key>& out)
-{
-	if (out.empty()) return;
-
-	const float ERROR = 0; 
-	u32 prev = 0;
-	for (u32 i = 2; i < (u32)out.size(); ++i) {
-		const float t = float(ofbx::fbxTimeToSeconds(out[prev + 1].time - out[prev].time) / ofbx::fbxTimeToSeconds(out[i].time - out[prev].time));
-		const Quat estimate = nlerp(out[prev].rot, out[i].rot, t);
-		if (fabs(estimate.x - out[prev + 1].rot.x) > ERROR || fabs(estimate.y - out[prev + 1].rot.y) > ERROR ||
-			fabs(estimate.z - out[prev + 1].rot.z) > ERROR) 
-		{
-			prev = i - 1;
-		}
-		else {
-			out[i - 1].flags |= 2;
-		}
-	}
-}
-
 static float getScaleX(const ofbx::Matrix& mtx)
 {
 	Vec3 v(float(mtx.m[0]), float(mtx.m[4]), float(mtx.m[8]));
@@ -1386,78 +1314,6 @@ static float getScaleX(const ofbx::Matrix& mtx)
 	return length(v);
 }
 
-static void fill(const ofbx::Object& bone, double anim_len, const ofbx::AnimationLayer& layer, Array<FBXImporter::Key>& keys) {
-	const ofbx::AnimationCurveNode* translation_node = layer.getCurveNode(bone, "Lcl Translation");
-	const ofbx::AnimationCurveNode* rotation_node = layer.getCurveNode(bone, "Lcl Rotation");
-	if (!translation_node && !rotation_node) return;
-
-	keys.emplace().time = 0;
-	keys.emplace().time = ofbx::secondsToFbxTime(anim_len);
-	if (translation_node) {
-		fillTimes(translation_node->getCurve(0), keys);
-		fillTimes(translation_node->getCurve(1), keys);
-		fillTimes(translation_node->getCurve(2), keys);
-	}
-
-	if (rotation_node) {
-		fillTimes(rotation_node->getCurve(0), keys);
-		fillTimes(rotation_node->getCurve(1), keys);
-		fillTimes(rotation_node->getCurve(2), keys);
-	}
-	
-	auto fill_rot = [&](u32 idx, const ofbx::AnimationCurve* curve) {
-		if (!curve) {
-			const ofbx::Vec3 lcl_rot = bone.getLocalRotation();
-			for (FBXImporter::Key& k : keys) {
-				(&k.rot.x)[idx] = float((&lcl_rot.x)[idx]);
-			}
-			return;
-		}
-
-		for (FBXImporter::Key& k : keys) {
-			(&k.rot.x)[idx] = evalCurve(k.time, *curve);
-		}
-	};
-	
-	auto fill_pos = [&](u32 idx, const ofbx::AnimationCurve* curve) {
-		if (!curve) {
-			const ofbx::Vec3 lcl_pos = bone.getLocalTranslation();
-			for (FBXImporter::Key& k : keys) {
-				(&k.pos.x)[idx] = float((&lcl_pos.x)[idx]);
-			}
-			return;
-		}
-
-		for (FBXImporter::Key& k : keys) {
-			(&k.pos.x)[idx] = evalCurve(k.time, *curve);
-		}
-	};
-	
-	fill_rot(0, rotation_node ? rotation_node->getCurve(0) : nullptr);
-	fill_rot(1, rotation_node ? rotation_node->getCurve(1) : nullptr);
-	fill_rot(2, rotation_node ? rotation_node->getCurve(2) : nullptr);
-
-	fill_pos(0, translation_node ? translation_node->getCurve(0) : nullptr);
-	fill_pos(1, translation_node ? translation_node->getCurve(1) : nullptr);
-	fill_pos(2, translation_node ? translation_node->getCurve(2) : nullptr);
-
-	for (FBXImporter::Key& key : keys) {
-		const ofbx::Matrix mtx = bone.evalLocal({key.pos.x, key.pos.y, key.pos.z}, {key.rot.x, key.rot.y, key.rot.z});
-		convert(mtx, key.pos, key.rot);
-	}
-
-}
-
-static bool shouldSample(u32 keyframe_count, float anim_len, float fps, u32 data_size) {
-	const u32 sampled_frame_count = u32(anim_len * fps);
-	const u32 sampled_size = sampled_frame_count * data_size;
-	const u32 time_size = sizeof(u16);
-	const u32 keyframed_size = keyframe_count * (data_size + time_size);
-
-	// * 4 / 3 -> prefer sampled even when a bit bigger, since sampled tracks are faster
-	return sampled_size < keyframed_size * 4 / 3; 
-}
-
 static LocalRigidTransform sample(const ofbx::Object& bone, const ofbx::AnimationLayer& layer, float t) {
 	const ofbx::AnimationCurveNode* translation_node = layer.getCurveNode(bone, "Lcl Translation");
 	const ofbx::AnimationCurveNode* rotation_node = layer.getCurveNode(bone, "Lcl Rotation");
@@ -1489,29 +1345,111 @@ static LocalRigidTransform sample(const ofbx::Object& bone, const ofbx::Animatio
 	return res;
 }
 
-static bool isBindPoseRotationTrack(u32 count, const Array<FBXImporter::Key>& keys, const Quat& bind_rot, float error) {
-	if (count != 2) return false;
-	for (const FBXImporter::Key& key : keys) {
-		if (key.flags & 1) continue;
-		if (fabs(key.rot.x - bind_rot.x) > error) return false;
-		if (fabs(key.rot.y - bind_rot.y) > error) return false;
-		if (fabs(key.rot.z - bind_rot.z) > error) return false;
-		if (fabs(key.rot.w - bind_rot.w) > error) return false;
+// translation tracks which do not move more than this are stored as a single value
+static constexpr float POSITION_ERROR = 1e-4f;
+// same for rotations, maximal difference of a quaternion's component
+static constexpr float ROTATION_ERROR = 1e-4f;
+
+static bool isConstant(const Array<Vec3>& frames) {
+	for (const Vec3& v : frames) {
+		if (fabsf(v.x - frames[0].x) > POSITION_ERROR) return false;
+		if (fabsf(v.y - frames[0].y) > POSITION_ERROR) return false;
+		if (fabsf(v.z - frames[0].z) > POSITION_ERROR) return false;
 	}
 	return true;
 }
 
-static bool isBindPosePositionTrack(u32 count, const Array<FBXImporter::Key>& keys, const Vec3& bind_pos) {
-	if (count != 2) return false;
-	const float ERROR = 0;
-	for (const FBXImporter::Key& key : keys) {
-		if (key.flags & 1) continue;
-		const Vec3 d = key.pos - bind_pos;
-		if (d.x > ERROR || d.y > ERROR || d.z > ERROR) return false;
+static bool isConstant(const Array<Quat>& frames) {
+	for (const Quat& q : frames) {
+		if (fabsf(q.x - frames[0].x) > ROTATION_ERROR) return false;
+		if (fabsf(q.y - frames[0].y) > ROTATION_ERROR) return false;
+		if (fabsf(q.z - frames[0].z) > ROTATION_ERROR) return false;
+		if (fabsf(q.w - frames[0].w) > ROTATION_ERROR) return false;
 	}
 	return true;
 }
 
+// writes ranges of translation tracks in a segment, followed by the segment's frames quantized to 16 bits per component
+static void compressPositions(const Array<Array<Vec3>>& tracks, u32 first_frame, u32 frames_count, Array<Animation::TranslationRange>& ranges, OutputMemoryStream& out)
+{
+	const u32 padded_count = (tracks.size() + 3) & ~3;
+	ranges.clear();
+	for (u32 group = 0; group < padded_count; group += 4) {
+		Animation::TranslationRange& range = ranges.emplace();
+		memset(&range, 0, sizeof(range));
+		for (u32 track = group, c = minimum(group + 4, (u32)tracks.size()); track < c; ++track) {
+			const Vec3* frames = tracks[track].begin() + first_frame;
+			Vec3 min = frames[0];
+			Vec3 max = frames[0];
+			for (u32 i = 1; i < frames_count; ++i) {
+				min = Vec3(minimum(min.x, frames[i].x), minimum(min.y, frames[i].y), minimum(min.z, frames[i].z));
+				max = Vec3(maximum(max.x, frames[i].x), maximum(max.y, frames[i].y), maximum(max.z, frames[i].z));
+			}
+			for (u32 i = 0; i < 3; ++i) {
+				range.min[i][track - group] = (&min.x)[i];
+				range.scale[i][track - group] = ((&max.x)[i] - (&min.x)[i]) / 0xffFF;
+			}
+		}
+	}
+	out.write(ranges.begin(), ranges.byte_size());
+
+	for (u32 i = 0; i < frames_count; ++i) {
+		for (u32 group = 0; group < padded_count; group += 4) {
+			// [xyz][track]
+			u16 packed[3][4] = {};
+			for (u32 track = group, c = minimum(group + 4, (u32)tracks.size()); track < c; ++track) {
+				const Vec3& v = tracks[track][first_frame + i];
+				const Animation::TranslationRange& range = ranges[group / 4];
+				for (u32 j = 0; j < 3; ++j) {
+					const float scale = range.scale[j][track - group];
+					if (scale == 0) continue;
+					const float q = ((&v.x)[j] - range.min[j][track - group]) / scale + 0.5f;
+					packed[j][track - group] = (u16)clamp(q, 0.f, float(0xffFF));
+				}
+			}
+			out.write(packed);
+		}
+	}
+}
+
+// writes rotations in a segment as smallest three, see Animation
+static void compressRotations(const Array<Array<Quat>>& tracks, u32 first_frame, u32 frames_count, OutputMemoryStream& out)
+{
+	const u32 padded_count = (tracks.size() + 3) & ~3;
+	for (u32 i = 0; i < frames_count; ++i) {
+		for (u32 group = 0; group < padded_count; group += 4) {
+			// [component][track]
+			u16 packed[3][4];
+			for (u32 track = group; track < group + 4; ++track) {
+				const Quat q = track < (u32)tracks.size() ? tracks[track][first_frame + i] : Quat::IDENTITY;
+				const float c[] = { q.x, q.y, q.z, q.w };
+				u32 dropped = 0;
+				for (u32 j = 1; j < 4; ++j) {
+					if (fabsf(c[j]) > fabsf(c[dropped])) dropped = j;
+				}
+
+				u32 k = 0;
+				for (u32 j = 0; j < 4; ++j) {
+					if (j == dropped) continue;
+					const float v = clamp(c[j], -Animation::ROTATION_RANGE, Animation::ROTATION_RANGE);
+					const float s = (v + Animation::ROTATION_RANGE) / (2 * Animation::ROTATION_RANGE) * Animation::ROTATION_STEPS + 0.5f;
+					packed[k][track - group] = u16(u32(s) << 1);
+					++k;
+				}
+				packed[0][track - group] |= dropped & 1;
+				packed[1][track - group] |= dropped >> 1;
+				packed[2][track - group] |= c[dropped] < 0 ? 1 : 0;
+			}
+			out.write(packed);
+		}
+	}
+}
+
+static bool isBindPosePosition(const Vec3& pos, const Vec3& bind_pos) {
+	const Vec3 d = pos - bind_pos;
+	return fabsf(d.x) <= POSITION_ERROR && fabsf(d.y) <= POSITION_ERROR && fabsf(d.z) <= POSITION_ERROR;
+}
+
 void FBXImporter::writeAnimations(const char* src, const ImportConfig& cfg)
 {
 	PROFILE_FUNCTION();
@@ -1541,154 +1479,119 @@ void FBXImporter::writeAnimations(const char* src, const ImportConfig& cfg)
 
 		out_file.clear();
 
+		// all tracks are sampled in each frame, there are always at least two frames to interpolate
+		const u32 frame_count = maximum(u32(anim_len * fps + 0.5f), 2u);
+
 		Animation::Header header;
 		header.magic = Animation::HEADER_MAGIC;
-		header.version = 3;
+		header.version = (u32)Animation::Version::LAST;
 		header.length = Time::fromSeconds((float)anim_len);
-		header.frame_count = u32(anim_len * fps + 0.5f);
+		header.frame_count = frame_count;
 		write(header);
 
-		Array<Array<Key>> all_keys(m_allocator);
-		auto fbx_to_anim_time = [anim_len](i64 fbx_time){
-			const double t = clamp(ofbx::fbxTimeToSeconds(fbx_time) / anim_len, 0.0, 1.0);
-			return u16(t * 0xffFF);
-		};
-
-		all_keys.reserve(m_bones.size());
-		for (const ofbx::Object* bone : m_bones) {
-			Array<Key>& keys = all_keys.emplace(m_allocator);
-			fill(*bone, anim_len, *layer, keys);
-		}
+		Array<u32> const_translation_names(m_allocator);
+		Array<u32> translation_names(m_allocator);
+		Array<u32> const_rotation_names(m_allocator);
+		Array<u32> rotation_names(m_allocator);
+		Array<Vec3> const_translations(m_allocator);
+		Array<Quat> const_rotations(m_allocator);
+		Array<Array<Vec3>> translations(m_allocator);
+		Array<Array<Quat>> rotations(m_allocator);
+		Array<Vec3> positions(m_allocator);
+		Array<Quat> rots(m_allocator);
+		positions.reserve(frame_count);
+		rots.reserve(frame_count);
 
 		for (const ofbx::Object*& bone : m_bones) {
-			Array<Key>& keys = all_keys[u32(&bone - m_bones.begin())];
+			if (!layer->getCurveNode(*bone, "Lcl Translation") && !layer->getCurveNode(*bone, "Lcl Rotation")) continue;
+
+			const u32 bone_idx = u32(&bone - m_bones.begin());
 			ofbx::Object* parent = bone->getParent();
+			// animated scale is not supported, but we can get rid of static scale if we ignore
+			// it in writeSkeleton() and use `parent_scale` here
 			const float parent_scale = parent ? (float)getScaleX(parent->getGlobalTransform()) : 1;
-			// TODO skip curves which do not change anything
-			compressRotations(keys);
-			compressPositions(parent_scale, keys);
-		}
-
-		const u64 stream_translations_count_pos = out_file.size();
-		u32 translation_curves_count = 0;
-		write(translation_curves_count);
-		for (const ofbx::Object*& bone : m_bones) {
-			Array<Key>& keys = all_keys[u32(&bone - m_bones.begin())];
-			u32 count = 0;
-			for (Key& key : keys) {
-				if ((key.flags & 1) == 0) ++count;
+			positions.clear();
+			rots.clear();
+			for (u32 i = 0; i < frame_count; ++i) {
+				const float t = float(anim_len * ((float)i / (frame_count - 1)));
+				const LocalRigidTransform tr = sample(*bone, *layer, t);
+				positions.push(tr.pos * parent_scale);
+				Quat rot = fixOrientation(tr.rot);
+				// runtime interpolates neighbouring frames without checking the sign
+				if (i > 0 && rot.x * rots.back().x + rot.y * rots.back().y + rot.z * rots.back().z + rot.w * rots.back().w < 0) {
+					rot = -rot;
+				}
+				rots.push(rot);
 			}
-			if (count == 0) continue;
-			const u32 idx = u32(&bone - m_bones.begin());
 
-			ofbx::Object* parent = bone->getParent();
 			Vec3 bind_pos;
 			if (!parent)
 			{
-				bind_pos = m_bind_pose[idx].getTranslation();
+				bind_pos = m_bind_pose[bone_idx].getTranslation();
 			}
 			else
 			{
 				const int parent_idx = m_bones.indexOf(parent);
 				if (m_bind_pose.empty()) {
-					// TODO should not we evalLocal here like in rotation ~50lines below?
 					bind_pos = toLumixVec3(bone->getLocalTranslation());
 				}
 				else {
-					bind_pos = (m_bind_pose[parent_idx].inverted() * m_bind_pose[idx]).getTranslation();
+					bind_pos = (m_bind_pose[parent_idx].inverted() * m_bind_pose[bone_idx]).getTranslation();
 				}
 			}
 
-			if (isBindPosePositionTrack(count, keys, bind_pos)) continue;
-			
 			const u32 name_hash = crc32(bone->name);
-			write(name_hash);
-			write(Animation::CurveType::KEYFRAMED);
-			write(count);
-
-			for (Key& key : keys) {
-				if ((key.flags & 1) == 0) {
-					write(fbx_to_anim_time(key.time));
-				}
-			}
-			for (Key& key : keys) {
-				if ((key.flags & 1) == 0) {
-					write(fixOrientation(key.pos * cfg.mesh_scale * m_fbx_scale));
+			if (!isConstant(positions)) {
+				translation_names.push(name_hash);
+				Array<Vec3>& track = translations.emplace(m_allocator);
+				track.reserve(frame_count);
+				for (const Vec3& pos : positions) {
+					track.push(fixOrientation(pos * cfg.mesh_scale * m_fbx_scale));
 				}
 			}
-			++translation_curves_count;
-		}
-		memcpy(out_file.getMutableData() + stream_translations_count_pos, &translation_curves_count, sizeof(translation_curves_count));
-
-		const u64 stream_rotations_count_pos = out_file.size();
-		u32 rotation_curves_count = 0;
-		write(rotation_curves_count);
-		u32 sampled_count = 0;
-
-		for (const ofbx::Object*& bone : m_bones) {
-			Array<Key>& keys = all_keys[u32(&bone - m_bones.begin())];
-			u32 count = 0;
-			for (Key& key : keys) {
-				if ((key.flags & 2) == 0) ++count;
-			}
-			if (count == 0) continue;
-			
-			Quat bind_rot;
-			const u32 bone_idx = u32(&bone - m_bones.begin());
-			ofbx::Object* parent = bone->getParent();
-			if (!parent)
-			{
-				bind_rot = m_bind_pose[bone_idx].getRotation();
-			}
-			else
-			{
-				const i32 parent_idx = m_bones.indexOf(parent);
-				if (m_bind_pose.empty()) {
-					const Matrix mtx = toLumix(bone->evalLocal(bone->getLocalTranslation(), bone->getLocalRotation()));
-					bind_rot = mtx.getRotation();
-				}
-				else {
-					bind_rot = (m_bind_pose[parent_idx].inverted() * m_bind_pose[bone_idx]).getRotation();
-				}
+			else if (!isBindPosePosition(positions[0], bind_pos)) {
+				const_translation_names.push(name_hash);
+				const_translations.push(fixOrientation(positions[0] * cfg.mesh_scale * m_fbx_scale));
 			}
-			//if (isBindPoseRotationTrack(count, keys, bind_rot, cfg.rotation_error)) continue;
 
-			const u32 name_hash = crc32(bone->name);
-			write(name_hash);
-			if (shouldSample(count, float(anim_len), fps, sizeof(Quat))) {
-				++sampled_count;
-				write(Animation::CurveType::SAMPLED);
-				count = u32(anim_len * fps + 0.5f);
-				write(count);
-				for (u32 i = 0; i < count; ++i) {
-					const float t = float(anim_len * ((float)i / (count - 1)));
-					write(fixOrientation(sample(*bone, *layer, t).rot));
-				}
+			if (!isConstant(rots)) {
+				rotation_names.push(name_hash);
+				Array<Quat>& track = rotations.emplace(m_allocator);
+				track.reserve(frame_count);
+				for (const Quat& rot : rots) track.push(rot);
 			}
 			else {
-				write(Animation::CurveType::KEYFRAMED);
-				write(count);
-				for (Key& key : keys) {
-					if ((key.flags & 2) == 0) {
-						write(fbx_to_anim_time(key.time));
-					}
-				}
-				for (Key& key : keys) {
-					if ((key.flags & 2) == 0) {
-						write(fixOrientation(key.rot));
-					}
-				}
+				const_rotation_names.push(name_hash);
+				const_rotations.push(rots[0]);
 			}
-			++rotation_curves_count;
 		}
 
-		memcpy(out_file.getMutableData() + stream_rotations_count_pos, &rotation_curves_count, sizeof(rotation_curves_count));
+		write((u32)const_translation_names.size());
+		write(u32(const_translation_names.size() + translation_names.size()));
+		write((u32)const_rotation_names.size());
+		write(u32(const_rotation_names.size() + rotation_names.size()));
+		write(const_translation_names.begin(), const_translation_names.byte_size());
+		write(translation_names.begin(), translation_names.byte_size());
+		write(const_rotation_names.begin(), const_rotation_names.byte_size());
+		write(rotation_names.begin(), rotation_names.byte_size());
+		write(const_translations.begin(), const_translations.byte_size());
+		write(const_rotations.begin(), const_rotations.byte_size());
+
+		if (!translations.empty() || !rotations.empty()) {
+			Array<Animation::TranslationRange> ranges(m_allocator);
+			for (u32 first_frame = 0; first_frame < frame_count - 1; first_frame += Animation::SEGMENT_FRAMES) {
+				const u32 frames = minimum(Animation::SEGMENT_FRAMES, frame_count - 1 - first_frame) + 1;
+				compressPositions(translations, first_frame, frames, ranges, out_file);
+				compressRotations(rotations, first_frame, frames, out_file);
+			}
+		}
 
 		const StaticString<LUMIX_MAX_PATH> anim_path(anim.name, ".ani:", src);
 		m_compiler.writeCompiledResource(anim_path, Span(out_file.data(), (i32)out_file.size()));
 	}
 }
 
+
 int FBXImporter::getVertexSize(const ofbx::Geometry& geom, bool is_skinned, const ImportConfig& cfg) const
 {
 	static const int POSITION_SIZE = sizeof(float) * 3;
@@ -50,14 +50,6 @@ struct FBXImporter
 		X_UP
 	};
 
-	struct Key
-	{
-		Vec3 pos;
-		Quat rot;
-		i64 time;
-		u8 flags = 0;
-	};
-
 	struct Skin
 	{
 		float weights[4];
@@ -482,6 +482,9 @@ private:
 
 		if (m_action_type != TerrainEditor::LAYER && m_action_type != TerrainEditor::REMOVE_GRASS)
 		{
+			RenderScene* render_scene = (RenderScene*)m_world_editor.getUniverse()->getScene(TERRAIN_TYPE);
+			render_scene->getTerrain(m_terrain)->updateHeightBounds(m_x, m_y, m_width, m_height);
+
 			IScene* scene = m_world_editor.getUniverse()->getScene("physics");
 			if (!scene) return;
 
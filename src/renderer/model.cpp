@@ -113,6 +113,7 @@ Model::Model(const Path& path, ResourceManager& resource_manager, Renderer& rend
 	, m_bones(m_allocator)
 	, m_first_nonroot_bone_index(0)
 	, m_renderer(renderer)
+	, m_ray_cast_bvh(m_allocator)
 {
 	for (LODMeshIndices& i : m_lod_indices) i = {0, -1};
 	for (float & i : m_lod_distances) i = FLT_MAX;
@@ -125,7 +126,7 @@ Model::~Model()
 }
 
 
-static Vec3 evaluateSkin(Vec3& p, Mesh::Skin s, const Matrix* matrices)
+static Vec3 evaluateSkin(const Vec3& p, Mesh::Skin s, const Matrix* matrices)
 {
 	Matrix m = matrices[s.indices[0]] * s.weights.x + matrices[s.indices[1]] * s.weights.y +
 			   matrices[s.indices[2]] * s.weights.z + matrices[s.indices[3]] * s.weights.w;
@@ -163,18 +164,33 @@ RayCastModelHit Model::castRay(const Vec3& origin, const Vec3& dir, const Pose*
 
 	Matrix matrices[256];
 	ASSERT(!pose || pose->count <= lengthOf(matrices));
-	bool is_skinned = false;
-	for (int mesh_index = m_lod_indices[0].from; mesh_index <= m_lod_indices[0].to; ++mesh_index) {
-		Mesh& mesh = m_meshes[mesh_index];
-		is_skinned = pose && !mesh.skin.empty() && pose->count <= lengthOf(matrices);
-	}
+	// skinned meshes are in the bvh in bind pose, if there's a pose they are skinned and tested one triangle after another
+	const bool is_skinned = pose && pose->count <= lengthOf(matrices) && isSkinned();
+	
+	m_ray_cast_bvh.castRay(origin, dir, FLT_MAX, [&](const TriangleBVH::Triangle& tri, float t){
+		Mesh& mesh = m_meshes[tri.tag];
+		if (is_skinned && mesh.type == Mesh::SKINNED) return false;
+		
+		RayCastModelHit prev = hit;
+		hit.is_hit = true;
+		hit.t = t;
+		hit.entity = entity;
+		hit.mesh = &mesh;
+		if (filter && !filter->invoke(hit)) {
+			hit = prev;
+			return false;
+		}
+		return true;
+	});
+
 	if (is_skinned) {
 		computeSkinMatrices(*pose, *this, matrices);
 	}
 
-	for (int mesh_index = m_lod_indices[0].from; mesh_index <= m_lod_indices[0].to; ++mesh_index) {
+	for (int mesh_index = m_lod_indices[0].from; is_skinned && mesh_index <= m_lod_indices[0].to; ++mesh_index) {
 		const Mesh& mesh = m_meshes[mesh_index];
-		const bool is_mesh_skinned = !mesh.skin.empty() && is_skinned;
+		if (mesh.type != Mesh::SKINNED) continue;
+
 		const u16* indices16 = (const u16*)mesh.indices.data();
 		const u32* indices32 = (const u32*)mesh.indices.data();
 		const bool is16 = mesh.flags.isSet(Mesh::Flags::INDICES_16_BIT);
@@ -184,23 +200,13 @@ RayCastModelHit Model::castRay(const Vec3& origin, const Vec3& dir, const Pose*
 		for (i32 i = 0, c = (i32)mesh.indices.size() / index_size; i < c; i += 3) {
 			Vec3 p0, p1, p2;
 			if (is16) {
-				p0 = vertices[indices16[i]];
-				p1 = vertices[indices16[i + 1]];
-				p2 = vertices[indices16[i + 2]];
-				if (is_mesh_skinned) {
-					p0 = evaluateSkin(p0, mesh.skin[indices16[i]], matrices);
-					p1 = evaluateSkin(p1, mesh.skin[indices16[i + 1]], matrices);
-					p2 = evaluateSkin(p2, mesh.skin[indices16[i + 2]], matrices);
-				}
+				p0 = evaluateSkin(vertices[indices16[i]], mesh.skin[indices16[i]], matrices);
+				p1 = evaluateSkin(vertices[indices16[i + 1]], mesh.skin[indices16[i + 1]], matrices);
+				p2 = evaluateSkin(vertices[indices16[i + 2]], mesh.skin[indices16[i + 2]], matrices);
 			} else {
-				p0 = vertices[indices32[i]];
-				p1 = vertices[indices32[i + 1]];
-				p2 = vertices[indices32[i + 2]];
-				if (is_mesh_skinned) {
-					p0 = evaluateSkin(p0, mesh.skin[indices32[i]], matrices);
-					p1 = evaluateSkin(p1, mesh.skin[indices32[i + 1]], matrices);
-					p2 = evaluateSkin(p2, mesh.skin[indices32[i + 2]], matrices);
-				}
+				p0 = evaluateSkin(vertices[indices32[i]], mesh.skin[indices32[i]], matrices);
+				p1 = evaluateSkin(vertices[indices32[i + 1]], mesh.skin[indices32[i + 1]], matrices);
+				p2 = evaluateSkin(vertices[indices32[i + 2]], mesh.skin[indices32[i + 2]], matrices);
 			}
 
 			Vec3 normal = cross(p1 - p0, p2 - p0);
@@ -354,6 +360,14 @@ void Model::onBeforeReady()
 			m_meshes[j].lod = float(i);
 		}
 	}
+
+	m_ray_cast_bvh.clear();
+	for (i32 i = m_lod_indices[0].from; i <= m_lod_indices[0].to; ++i) {
+		const Mesh& mesh = m_meshes[i];
+		const u32 indices_count = u32(mesh.indices.size() / (mesh.areIndices16() ? 2 : 4));
+		m_ray_cast_bvh.addTriangles(mesh.vertices.begin(), mesh.indices.data(), indices_count, mesh.areIndices16(), i);
+	}
+	m_ray_cast_bvh.build();
 }
 
 
@@ -612,6 +626,7 @@ void Model::unload()
 	}
 	m_meshes.clear();
 	m_bones.clear();
+	m_ray_cast_bvh.clear();
 }
 
 
@@ -10,6 +10,7 @@
 #include "engine/stream.h"
 #include "engine/string.h"
 #include "gpu/gpu.h"
+#include "renderer/bvh.h"
 
 
 struct lua_State;
@@ -219,6 +220,8 @@ private:
 	float m_center_bounding_radius = 0;
 	BoneMap m_bone_map;
 	AABB m_aabb;
+	// LOD0 triangles in bind pose
+	TriangleBVH m_ray_cast_bvh;
 	int m_first_nonroot_bone_index;
 };
 
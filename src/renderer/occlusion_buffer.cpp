@@ -1,399 +1,553 @@
-// clipping is inspired by urho 
-// https://github.com/urho3d/Urho3D/blob/9c666ae6b82e21e67bfb003d84e95e26f8a3d341/Source/Urho3D/Graphics/OcclusionBuffer.cpp#L681 
-
 #include "occlusion_buffer.h"
-#include "engine/array.h"
+#include "engine/allocator.h"
+#include "engine/atomic.h"
 #include "engine/geometry.h"
+#include "engine/job_system.h"
 #include "engine/math.h"
 #include "engine/profiler.h"
-#include "engine/universe.h"
-#include "renderer/model.h"
-#include "renderer/render_scene.h"
+#include "engine/simd.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
 
 
 namespace Lumix
 {
 
 
-static const int Z_SCALE = 1 << 30;
-static const int XY_SCALE = 1 << 16;
-static const int WIDTH = 384;
-static const int HEIGHT = 192;
+// pixel's value is min(1/w, min(edge functions) * EDGE_SCALE), it's negative outside of triangle and it's 1/w
+// everywhere except the thinnest slivers along edges, where it's smaller == farther == still conservative;
+// this way depth test and coverage are one max() without masks
+static constexpr float EDGE_SCALE = 1e6f;
+// triangles are clipped to |x| <= GUARD_BAND * w and |y| <= GUARD_BAND * w, so screen space coordinates stay
+// small enough for float precision
+static constexpr float GUARD_BAND = 4;
+// tested boxes are moved this much closer, so occluders are not hidden by themselves because of rounding errors
+static constexpr float DEPTH_BIAS = 1.001f;
+
+
+struct OcclusionBuffer::Triangle {
+	// a * (x - min_x) + b * (y - min_y) + c, for pixel (x, y), positive inside; not normalized, see EDGE_SCALE
+	float edges[3][3];
+	// 1/w == a * (x - min_x) + b * (y - min_y) + c
+	float depth[3];
+	// inclusive pixel bounds
+	i32 min_x, min_y, max_x, max_y;
+};
+
+
+struct ProjectedVertex {
+	float x, y, inv_w;
+};
+
+
+struct OcclusionBuffer::Vertex {
+	// clip space
+	float x, y, z, w;
+	// valid only if outside_mask == 0
+	ProjectedVertex projected;
+	// bit i is set if the vertex is behind i-th clip plane
+	u32 outside_mask;
+};
+
+
+// rasterized depth followed by all mips
+static u32 getDepthSize() {
+	u32 size = OcclusionBuffer::WIDTH * OcclusionBuffer::HEIGHT;
+	for (u32 i = 0; i < OcclusionBuffer::MIP_COUNT; ++i) {
+		size += (OcclusionBuffer::WIDTH >> i) * (OcclusionBuffer::HEIGHT >> i);
+	}
+	return size;
+}
 
 
 OcclusionBuffer::OcclusionBuffer(IAllocator& allocator)
-	: m_mips(allocator)
-	, m_allocator(allocator)
+	: m_allocator(allocator)
+	, m_occluders(allocator)
+	, m_ranges(allocator)
+	, m_vertices(allocator)
+	, m_triangles(allocator)
+	, m_tile_offsets(allocator)
+	, m_binned(allocator)
 {
+	u32 offset = WIDTH * HEIGHT;
+	for (u32 i = 0; i < MIP_COUNT; ++i) {
+		m_mip_offsets[i] = offset;
+		offset += (WIDTH >> i) * (HEIGHT >> i);
+	}
+	m_depth = (float*)m_allocator.allocate_aligned(getDepthSize() * sizeof(float), 16);
+	memset(m_bin_offsets, 0, sizeof(m_bin_offsets));
+	clear();
 }
 
 
-void OcclusionBuffer::setCamera(const DVec3& pos, const Quat& rot, const Matrix& projection)
+OcclusionBuffer::~OcclusionBuffer()
 {
-	m_view_projection_matrix = projection * rot.toMatrix();
+	m_allocator.deallocate_aligned(m_depth);
+}
+
+
+void OcclusionBuffer::setCamera(const DVec3& pos, const Matrix& view, const Matrix& projection)
+{
+	m_view_projection = projection * view;
 	m_camera_pos = pos;
 }
 
 
-static LUMIX_FORCE_INLINE Vec3 toViewport(const Vec4& v)
+void OcclusionBuffer::clear()
 {
-	float inv = 0.5f / v.w;
-	return { v.x * inv + 0.5f, v.y * inv + 0.5f, v.z * inv + 0.5f };
+	m_occluders.clear();
+	memset(m_depth, 0, getDepthSize() * sizeof(float));
 }
 
 
-Vec3 OcclusionBuffer::transform(const Transform& world_transform, float x, float y, float z)
+void OcclusionBuffer::addOccluder(const Occluder& occluder)
 {
-	Vec3 tmp = world_transform.scale * Vec3(x, y, z);
-	tmp = world_transform.rot.rotate(tmp);
-	tmp += Vec3(world_transform.pos - m_camera_pos);
-	return m_view_projection_matrix.transformPoint(tmp);
+	m_occluders.push(occluder);
 }
 
 
-bool OcclusionBuffer::isOccluded(const Transform& world_transform, const AABB& aabb)
+static Matrix getRelativeMatrix(const Transform& tr, const DVec3& origin)
 {
-	// TODO simd
-	const Vec3 vertices[] = {
-		transform(world_transform, aabb.min.x, aabb.min.y, aabb.min.z),
-		transform(world_transform, aabb.min.x, aabb.min.y, aabb.max.z),
-		transform(world_transform, aabb.min.x, aabb.max.y, aabb.min.z),
-		transform(world_transform, aabb.min.x, aabb.max.y, aabb.max.z),
-		transform(world_transform, aabb.max.x, aabb.min.y, aabb.min.z),
-		transform(world_transform, aabb.max.x, aabb.min.y, aabb.max.z),
-		transform(world_transform, aabb.max.x, aabb.max.y, aabb.min.z),
-		transform(world_transform, aabb.max.x, aabb.min.y, aabb.min.z)
+	Matrix mtx = tr.rot.toMatrix();
+	mtx.multiply3x3(tr.scale);
+	mtx.setTranslation(Vec3(tr.pos - origin));
+	return mtx;
+}
+
+
+static LUMIX_FORCE_INLINE OcclusionBuffer::Vertex transform(const Matrix& m, float x, float y, float z, float w)
+{
+	OcclusionBuffer::Vertex res;
+	res.x = m.columns[0].x * x + m.columns[1].x * y + m.columns[2].x * z + m.columns[3].x * w;
+	res.y = m.columns[0].y * x + m.columns[1].y * y + m.columns[2].y * z + m.columns[3].y * w;
+	res.z = m.columns[0].z * x + m.columns[1].z * y + m.columns[2].z * z + m.columns[3].z * w;
+	res.w = m.columns[0].w * x + m.columns[1].w * y + m.columns[2].w * z + m.columns[3].w * w;
+	return res;
+}
+
+
+static LUMIX_FORCE_INLINE ProjectedVertex project(float x, float y, float w)
+{
+	const float inv_w = 1 / w;
+	return {
+		(x * inv_w * 0.5f + 0.5f) * OcclusionBuffer::WIDTH,
+		(y * inv_w * 0.5f + 0.5f) * OcclusionBuffer::HEIGHT,
+		inv_w
 	};
-	
-	Vec3 min = vertices[0];
-	Vec3 max = vertices[0];
-
-	for (u32 i = 1; i < lengthOf(vertices); ++i)
-	{
-		min.x = minimum(vertices[i].x, min.x);
-		min.y = minimum(vertices[i].y, min.y);
-		min.z = minimum(vertices[i].z, min.z);
-
-		max.x = maximum(vertices[i].x, max.x);
-		max.y = maximum(vertices[i].y, max.y);
-	}
+}
 
-	if (max.x < 0) return false;
-	if (max.y < 0) return false;
-	if (min.x >= 1) return false;
-	if (min.y >= 1) return false;
-
-	const int min_x = maximum(0, int(min.x * (WIDTH - 1) + 0.5f));
-	const int max_x = minimum(WIDTH - 1, int(max.x * (WIDTH - 1) + 0.5f));
-	const int min_y = maximum(0, int(min.y * (HEIGHT - 1) + 0.5f));
-	const int max_y = minimum(HEIGHT - 1, int(max.y * (HEIGHT - 1) + 0.5f));
-
-	const int z = int(min.z * Z_SCALE);
-
-	// TODO check whole hierarchy
-	const int* LUMIX_RESTRICT depth = &m_mips[0][0];
-	for (int j = min_y; j <= max_y; ++j)
-	{
-		for (int i = min_x; i < max_x; ++i)
-		{
-			if (depth[i + j * WIDTH] > z) return false;
-		}
-	}
-	return true;
+
+// distance from near plane, w - z in reversed-Z, negative behind
+static LUMIX_FORCE_INLINE float getNearDistance(const OcclusionBuffer::Vertex& v)
+{
+	return v.w - v.z;
 }
 
 
-void OcclusionBuffer::init()
+// near plane and guard band planes, negative behind
+static LUMIX_FORCE_INLINE float getPlaneDistance(const OcclusionBuffer::Vertex& v, u32 plane)
 {
-	PROFILE_FUNCTION();
-	ASSERT(m_mips.empty());
+	switch (plane) {
+		case 0: return getNearDistance(v);
+		case 1: return GUARD_BAND * v.w - v.x;
+		case 2: return GUARD_BAND * v.w + v.x;
+		case 3: return GUARD_BAND * v.w - v.y;
+		default: return GUARD_BAND * v.w + v.y;
+	}
+}
+
+
+static constexpr u32 CLIP_PLANES_COUNT = 5;
+// space reserved for setup triangles, clipping can split a triangle into more
+static constexpr u32 TRIANGLES_PER_INPUT = 2;
 
-	int w = WIDTH;
-	int h = HEIGHT;
 
-	while (w % 2 != 1 && h % 2 != 1)
-	{
-		auto& mip = m_mips.emplace(m_allocator);
-		mip.resize(w * h);
-		w >>= 1;
-		h >>= 1;
+static LUMIX_FORCE_INLINE void computeOutsideMask(OcclusionBuffer::Vertex& v)
+{
+	v.outside_mask = 0;
+	for (u32 i = 0; i < CLIP_PLANES_COUNT; ++i) {
+		if (getPlaneDistance(v, i) < 0) v.outside_mask |= 1 << i;
 	}
 }
 
 
-void OcclusionBuffer::buildHierarchy()
+static bool setupProjected(const ProjectedVertex& p0, const ProjectedVertex& p1, const ProjectedVertex& p2, OcclusionBuffer::Triangle& tri)
 {
-	// TODO multithreading
-	PROFILE_FUNCTION();
-	for (int level = 1; level < m_mips.size(); ++level)
-	{
-		int prev_w = WIDTH >> (level - 1);
-		int w = WIDTH >> level;
-		int h = HEIGHT >> level;
-		for (int j = 0; j < h; ++j)
-		{
-			int prev_j = j << 1;
-			const int* LUMIX_RESTRICT prev_mip = &m_mips[level - 1][prev_j * prev_w];
-			int* LUMIX_RESTRICT mip = &m_mips[level][j * w];
-			int* end = mip + w;
-			while (mip != end)
-			{
-				*mip = maximum(prev_mip[0], prev_mip[1], prev_mip[prev_w], prev_mip[prev_w + 1]);
-				++mip;
-				prev_mip += 2;
-			}
-		}
+	// counter clockwise is front facing, `!(area > 0)` is also true for NaNs
+	const float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+	if (!(area > 0)) return false;
+
+	// pixel i is covered if its center i + 0.5 is inside
+	const float min_x = minimum(p0.x, p1.x, p2.x) - 0.5f;
+	const float min_y = minimum(p0.y, p1.y, p2.y) - 0.5f;
+	const float max_x = maximum(p0.x, p1.x, p2.x) - 0.5f;
+	const float max_y = maximum(p0.y, p1.y, p2.y) - 0.5f;
+	if (max_x < 0 || max_y < 0 || min_x > OcclusionBuffer::WIDTH - 1 || min_y > OcclusionBuffer::HEIGHT - 1) return false;
+	tri.min_x = (i32)ceilf(maximum(min_x, 0.f));
+	tri.min_y = (i32)ceilf(maximum(min_y, 0.f));
+	tri.max_x = (i32)minimum(max_x, float(OcclusionBuffer::WIDTH - 1));
+	tri.max_y = (i32)minimum(max_y, float(OcclusionBuffer::HEIGHT - 1));
+
+	// planes are relative to center of (min_x, min_y) pixel, so the values stay small and precise
+	const float ref_x = tri.min_x + 0.5f;
+	const float ref_y = tri.min_y + 0.5f;
+	const ProjectedVertex* p[] = { &p0, &p1, &p2 };
+	for (u32 i = 0; i < 3; ++i) {
+		const ProjectedVertex& a = *p[i];
+		const ProjectedVertex& b = *p[(i + 1) % 3];
+		tri.edges[i][0] = a.y - b.y;
+		tri.edges[i][1] = b.x - a.x;
+		tri.edges[i][2] = tri.edges[i][0] * (ref_x - a.x) + tri.edges[i][1] * (ref_y - a.y);
 	}
+
+	const float inv_area = 1 / area;
+	const float dz1 = p1.inv_w - p0.inv_w;
+	const float dz2 = p2.inv_w - p0.inv_w;
+	tri.depth[0] = (dz1 * (p2.y - p0.y) - dz2 * (p1.y - p0.y)) * inv_area;
+	tri.depth[1] = (dz2 * (p1.x - p0.x) - dz1 * (p2.x - p0.x)) * inv_area;
+	tri.depth[2] = p0.inv_w + tri.depth[0] * (ref_x - p0.x) + tri.depth[1] * (ref_y - p0.y);
+	return true;
 }
 
 
-LUMIX_FORCE_INLINE void rasterizeProjectedTriangle(Vec3(&v)[3], int* depth)
+// clips against near plane and guard band, result is a fan of triangles, returns number of triangles written to `out`;
+// writes at most `capacity` triangles, dropping the rest is conservative
+static u32 setupTriangle(const OcclusionBuffer::Vertex& v0, const OcclusionBuffer::Vertex& v1, const OcclusionBuffer::Vertex& v2, OcclusionBuffer::Triangle* out, u32 capacity)
 {
-	Vec3 n = cross(v[1] - v[0], v[2] - v[0]);
-	bool is_backface = n.z <= 0;
-	if (is_backface) return;
-
-	if (v[0].y > v[2].y) swap(v[0], v[2]);
-	if (v[0].y > v[1].y) swap(v[0], v[1]);
-	if (v[1].y > v[2].y) swap(v[1], v[2]);
-
-	int width = WIDTH;
-	int height = HEIGHT;
-
-	struct Point { int x, y; };
-	Point p0 = { int(v[0].x * (width - 1) + 0.5f), int(v[0].y * (height - 1) + 0.5f) };
-	Point p1 = { int(v[1].x * (width - 1) + 0.5f), int(v[1].y * (height - 1) + 0.5f) };
-	Point p2 = { int(v[2].x * (width - 1) + 0.5f), int(v[2].y * (height - 1) + 0.5f) };
-
-	if (p0.y == p2.y) return;
-
-	float xdz = -n.x / n.z;
-	int xdz_int = int(xdz * Z_SCALE / WIDTH);
-
-	if (p1.y != p0.y)
-	{
-		int dl = (p1.x - p0.x) * 2 * XY_SCALE / (2*p1.y - 2*p0.y + 1);
-		int dr = (p2.x - p0.x) * 2 * XY_SCALE / (2*p2.y - 2*p0.y + 1);
-		Vec3 left_p = dl > dr ? v[2] : v[1];
-		int dz_left = int((left_p.z - v[0].z) * Z_SCALE / (left_p.y - (v[0].y + 0.5f / HEIGHT)) / HEIGHT);
-		int z_left = int(v[0].z * Z_SCALE) + (dz_left >> 1);
-		if (dl > dr) swap(dl, dr);
-		int left = p0.x * XY_SCALE + (dl >> 1);
-		int right = p0.x * XY_SCALE + (dr >> 1);
-		for (int y = p0.y; y <= p1.y; ++y)
-		{
-			int base = y * width + left / XY_SCALE;
-			int z = z_left;
-			for (int x = 0, n = right / XY_SCALE - left / XY_SCALE; x <= n; ++x)
-			{
-				if (z < depth[base + x]) depth[base + x] = z;
-				z += xdz_int;
-			}
-			left += dl;
-			right += dr;
-			z_left += dz_left;
-		}
+	if (capacity == 0) return 0;
+	if ((v0.outside_mask | v1.outside_mask | v2.outside_mask) == 0) {
+		return setupProjected(v0.projected, v1.projected, v2.projected, out[0]) ? 1 : 0;
 	}
-	
-	if (p2.y == p1.y) return;
-
-	int dl = -(p1.x - p2.x) * 2 * XY_SCALE / (2 * p1.y - 2 * p2.y - 1);
-	int dr = -(p0.x - p2.x) * 2 * XY_SCALE / (2 * p0.y - 2 * p2.y - 1);
-	Vec3 left_p = dl > dr ? v[0] : v[1];
-	int dz_left = -int((left_p.z - v[2].z) * Z_SCALE / (left_p.y - (v[2].y - 0.5f / HEIGHT)) / HEIGHT);
-
-	if (dl > dr) swap(dl, dr);
-	int left = p2.x * XY_SCALE + (dl >> 1);
-	int right = p2.x * XY_SCALE + (dr >> 1);
-	int z_left = int(v[2].z * Z_SCALE) + (dz_left >> 1);
-	for (int y = p2.y; y >= p1.y; --y)
-	{
-		int base = y * width + left / XY_SCALE;
-		int z = z_left;
-		for (int x = 0, n = right / XY_SCALE - left / XY_SCALE; x <= n; ++x)
-		{
-			if (z < depth[base + x]) depth[base + x] = z;
-			z += xdz_int;
+	if ((v0.outside_mask & v1.outside_mask & v2.outside_mask) != 0) return 0;
+
+	OcclusionBuffer::Vertex polys[2][3 + CLIP_PLANES_COUNT];
+	OcclusionBuffer::Vertex* poly = polys[0];
+	OcclusionBuffer::Vertex* tmp = polys[1];
+	poly[0] = v0;
+	poly[1] = v1;
+	poly[2] = v2;
+	u32 count = 3;
+	const u32 mask = v0.outside_mask | v1.outside_mask | v2.outside_mask;
+	for (u32 plane = 0; plane < CLIP_PLANES_COUNT; ++plane) {
+		if ((mask & (1 << plane)) == 0) continue;
+		u32 tmp_count = 0;
+		for (u32 i = 0; i < count; ++i) {
+			const OcclusionBuffer::Vertex& a = poly[i];
+			const OcclusionBuffer::Vertex& b = poly[(i + 1) % count];
+			const float da = getPlaneDistance(a, plane);
+			const float db = getPlaneDistance(b, plane);
+			if (da >= 0) tmp[tmp_count++] = a;
+			if ((da >= 0) != (db >= 0)) {
+				const float t = da / (da - db);
+				OcclusionBuffer::Vertex& v = tmp[tmp_count++];
+				v.x = a.x + (b.x - a.x) * t;
+				v.y = a.y + (b.y - a.y) * t;
+				v.z = a.z + (b.z - a.z) * t;
+				v.w = a.w + (b.w - a.w) * t;
+			}
 		}
-		left += dl;
-		right += dr;
-		z_left += dz_left;
+		if (tmp_count < 3) return 0;
+		swap(poly, tmp);
+		count = tmp_count;
 	}
 
+	ProjectedVertex projected[3 + CLIP_PLANES_COUNT];
+	for (u32 i = 0; i < count; ++i) {
+		projected[i] = project(poly[i].x, poly[i].y, poly[i].w);
+	}
+	u32 res = 0;
+	for (u32 i = 2; i < count && res < capacity; ++i) {
+		if (setupProjected(projected[0], projected[i - 1], projected[i], out[res])) ++res;
+	}
+	return res;
 }
 
 
-static LUMIX_FORCE_INLINE Vec4 clip(const Vec4& v0, const Vec4& v1, float d0, float d1)
+template <typename T>
+static u32 setupTriangles(const T* LUMIX_RESTRICT indices, u32 triangles_count, const OcclusionBuffer::Vertex* LUMIX_RESTRICT vertices, OcclusionBuffer::Triangle* LUMIX_RESTRICT out, u32 capacity)
 {
-	float t = d0 / (d0 - d1);
-	return v0 + t * (v1 - v0);
+	u32 res = 0;
+	for (u32 i = 0; i < triangles_count; ++i) {
+		const T* idx = indices + i * 3;
+		res += setupTriangle(vertices[idx[0]], vertices[idx[1]], vertices[idx[2]], out + res, capacity - res);
+	}
+	return res;
 }
 
 
-static LUMIX_FORCE_INLINE bool tryClip2Vertices(Vec4* vertices, int index, float* d, int d0, int d1, int d2)
+template <typename F>
+static LUMIX_FORCE_INLINE void forEachTile(const OcclusionBuffer::Triangle& tri, F&& f)
 {
-	if (d[d0] < 0.0f && d[d1] < 0.0f)
-	{
-		vertices[index + d0] = clip(vertices[index + d0], vertices[index + d2], d[d0], d[d2]);
-		vertices[index + d1] = clip(vertices[index + d1], vertices[index + d2], d[d1], d[d2]);
-		return true;
+	using OB = OcclusionBuffer;
+	for (i32 ty = tri.min_y / (i32)OB::TILE_HEIGHT; ty <= tri.max_y / (i32)OB::TILE_HEIGHT; ++ty) {
+		for (i32 tx = tri.min_x / (i32)OB::TILE_WIDTH; tx <= tri.max_x / (i32)OB::TILE_WIDTH; ++tx) {
+			f(tx + ty * OB::TILES_X);
+		}
 	}
-	return false;
 }
 
 
-static LUMIX_FORCE_INLINE bool tryClip1Vertex(Vec4* vertices, int index, float* d, int d0, int d1, int d2, bool* triangles, int& tringles_count)
+void OcclusionBuffer::setupTriangles(u32 occluder_idx)
 {
-	bool is_behind_plane = d[d0] < 0;
-	if (!is_behind_plane) return false;
-
-	int new_index = tringles_count * 3;
-	triangles[tringles_count] = true;
-	++tringles_count;
+	const Occluder& occluder = m_occluders[occluder_idx];
+	OccluderRange& range = m_ranges[occluder_idx];
+	u32* LUMIX_RESTRICT tile_counts = &m_tile_offsets[occluder_idx * TILES_COUNT];
+	memset(tile_counts, 0, sizeof(tile_counts[0]) * TILES_COUNT);
+	range.triangles_count = 0;
+	if (occluder.vertices_count == 0 || occluder.indices_count < 3) return;
+
+	const Matrix mvp = m_view_projection * getRelativeMatrix(occluder.transform, m_camera_pos);
+	Vertex* LUMIX_RESTRICT vertices = &m_vertices[range.first_vertex];
+	for (u32 i = 0; i < occluder.vertices_count; ++i) {
+		const Vec3& v = occluder.vertices[i];
+		Vertex& out = vertices[i];
+		out = transform(mvp, v.x, v.y, v.z, 1);
+		computeOutsideMask(out);
+		if (out.outside_mask == 0) out.projected = project(out.x, out.y, out.w);
+	}
 
-	vertices[new_index + 0] = clip(vertices[index + d0], vertices[index + d2], d[d0], d[d2]);
-	vertices[new_index + 1] = clip(vertices[index + d0], vertices[index + d1], d[d0], d[d1]);
-	vertices[new_index + 2] = vertices[index + d2];
-	vertices[index + d0] = vertices[new_index + 1];
+	const u32 triangles_count = occluder.indices_count / 3;
+	Triangle* out = &m_triangles[range.first_triangle];
+	if (occluder.indices_16bit) {
+		range.triangles_count = Lumix::setupTriangles((const u16*)occluder.indices, triangles_count, vertices, out, triangles_count * TRIANGLES_PER_INPUT);
+	}
+	else {
+		range.triangles_count = Lumix::setupTriangles((const u32*)occluder.indices, triangles_count, vertices, out, triangles_count * TRIANGLES_PER_INPUT);
+	}
 
-	return true;
+	for (u32 i = 0; i < range.triangles_count; ++i) {
+		forEachTile(out[i], [&](u32 tile){ ++tile_counts[tile]; });
+	}
 }
 
 
-static void clipTriangles(const Vec4& plane, Vec4* vertices, bool* triangles, int& triangles_count)
+void OcclusionBuffer::binTriangles(u32 occluder_idx)
 {
-	int count = triangles_count;
-	for (int i = 0; i < count; ++i)
-	{
-		if (!triangles[i]) continue;
-		int index = i * 3;
-		float d[3] = { dot(plane, vertices[index])
-			, dot(plane, vertices[index + 1])
-			, dot(plane, vertices[index + 2])
-		};
-		
-		bool all_behind = d[0] < 0.0f && d[1] < 0.0f && d[2] < 0.0f;
-		if (all_behind)
-		{
-			triangles[i] = false;
-			continue;
-		}
-		if (tryClip2Vertices(vertices, index, d, 0, 1, 2)) continue;
-		if (tryClip2Vertices(vertices, index, d, 0, 2, 1)) continue;
-		if (tryClip2Vertices(vertices, index, d, 1, 2, 0)) continue;
-		if (tryClip1Vertex(vertices, index, d, 0, 1, 2, triangles, triangles_count)) continue;
-		if (tryClip1Vertex(vertices, index, d, 1, 2, 0, triangles, triangles_count)) continue;
-		if (tryClip1Vertex(vertices, index, d, 2, 0, 1, triangles, triangles_count)) continue;
+	const OccluderRange& range = m_ranges[occluder_idx];
+	u32* LUMIX_RESTRICT tile_offsets = &m_tile_offsets[occluder_idx * TILES_COUNT];
+	for (u32 i = range.first_triangle, end = range.first_triangle + range.triangles_count; i < end; ++i) {
+		forEachTile(m_triangles[i], [&](u32 tile){
+			m_binned[tile_offsets[tile]] = i;
+			++tile_offsets[tile];
+		});
 	}
 }
 
 
-LUMIX_FORCE_INLINE void rasterizeOccludingTriangle(Vec4 (&vertices)[64 * 3], int* depth)
+void OcclusionBuffer::rasterizeTile(u32 tile)
 {
-	enum ClipMask
-	{
-		NEGATIVE_X = 1 << 0,
-		POSITIVE_X = 1 << 1,
-		NEGATIVE_Y = 1 << 2,
-		POSITIVE_Y = 1 << 3,
-		NEGATIVE_Z = 1 << 4,
-		POSITIVE_Z = 1 << 5
-	};
-	u32 triangle_mask = 0;
-	u32 and_mask = 0;
-	for (int i = 0; i < 3; ++i)
-	{
-		Vec4 v = vertices[i];
-		u32 vertex_mask = 0;
-		if (v.x < -v.w) vertex_mask |= NEGATIVE_X;
-		if (v.y < -v.w) vertex_mask |= NEGATIVE_Y;
-		if (v.z < -v.w) vertex_mask |= NEGATIVE_Z;
-
-		if (v.x > v.w) vertex_mask |= POSITIVE_X;
-		if (v.y > v.w) vertex_mask |= POSITIVE_Y;
-		if (v.z > v.w) vertex_mask |= POSITIVE_Z;
-
-		triangle_mask |= vertex_mask;
-		if (i == 0) and_mask = vertex_mask;
-		else and_mask &= vertex_mask;
+	const i32 tile_x = (tile % TILES_X) * TILE_WIDTH;
+	const i32 tile_y = (tile / TILES_X) * TILE_HEIGHT;
+	alignas(16) static const float lane_offsets[] = { 0, 1, 2, 3 };
+	const float4 edge_scale = f4Splat(EDGE_SCALE);
+	const float4 step_x = f4Splat(4);
+
+	for (u32 i = m_bin_offsets[tile], end = m_bin_offsets[tile + 1]; i < end; ++i) {
+		const Triangle& tri = m_triangles[m_binned[i]];
+		// tile's width is a multiple of 4, so aligned 4 pixels never cross into another tile
+		const i32 x0 = maximum(tri.min_x, tile_x) & ~3;
+		const i32 x1 = minimum(tri.max_x, tile_x + (i32)TILE_WIDTH - 1);
+		const i32 y0 = maximum(tri.min_y, tile_y);
+		const i32 y1 = minimum(tri.max_y, tile_y + (i32)TILE_HEIGHT - 1);
+
+		// planes are evaluated directly, not incrementally, so errors do not accumulate
+		const float4 start_x = f4Add(f4Splat(float(x0 - tri.min_x)), f4Load(lane_offsets));
+		const float4 e0_dx = f4Splat(tri.edges[0][0]);
+		const float4 e1_dx = f4Splat(tri.edges[1][0]);
+		const float4 e2_dx = f4Splat(tri.edges[2][0]);
+		const float4 z_dx = f4Splat(tri.depth[0]);
+
+		for (i32 y = y0; y <= y1; ++y) {
+			const float dy = float(y - tri.min_y);
+			const float4 e0_row = f4Splat(tri.edges[0][1] * dy + tri.edges[0][2]);
+			const float4 e1_row = f4Splat(tri.edges[1][1] * dy + tri.edges[1][2]);
+			const float4 e2_row = f4Splat(tri.edges[2][1] * dy + tri.edges[2][2]);
+			const float4 z_row = f4Splat(tri.depth[1] * dy + tri.depth[2]);
+			float4 dx = start_x;
+			float* LUMIX_RESTRICT row = m_depth + y * WIDTH;
+			for (i32 x = x0; x <= x1; x += 4) {
+				const float4 e0 = f4Add(f4Mul(e0_dx, dx), e0_row);
+				const float4 e1 = f4Add(f4Mul(e1_dx, dx), e1_row);
+				const float4 e2 = f4Add(f4Mul(e2_dx, dx), e2_row);
+				const float4 z = f4Add(f4Mul(z_dx, dx), z_row);
+				const float4 value = f4Min(z, f4Mul(f4Min(e0, f4Min(e1, e2)), edge_scale));
+				f4Store(row + x, f4Max(f4Load(row + x), value));
+				dx = f4Add(dx, step_x);
+			}
+		}
 	}
+}
 
-	bool all_vertices_outside = and_mask != 0;
-	if (all_vertices_outside) return;
 
-	if (triangle_mask == 0)
-	{
-		Vec3 projected[] = { toViewport(vertices[0]), toViewport(vertices[1]), toViewport(vertices[2]) };
-		rasterizeProjectedTriangle(projected, depth);
+void OcclusionBuffer::buildHierarchy()
+{
+	PROFILE_FUNCTION();
+	// rasterizer covers a pixel if its center is covered, but the test uses every pixel a box touches, so the first
+	// mip is rasterized depth eroded by one pixel (3x3 min), i.e. a pixel is kept only if its neighbours are covered too
+	float* LUMIX_RESTRICT mip0 = m_depth + m_mip_offsets[0];
+	for (u32 j = 0; j < HEIGHT; ++j) {
+		const float* LUMIX_RESTRICT row = m_depth + j * WIDTH;
+		const float* LUMIX_RESTRICT prev_row = j > 0 ? row - WIDTH : row;
+		const float* LUMIX_RESTRICT next_row = j < HEIGHT - 1 ? row + WIDTH : row;
+		float* LUMIX_RESTRICT dst = mip0 + j * WIDTH;
+		for (u32 i = 0; i < WIDTH; i += 4) {
+			f4Store(dst + i, f4Min(f4Load(row + i), f4Min(f4Load(prev_row + i), f4Load(next_row + i))));
+		}
 	}
-	else
-	{
-		int triangles_count = 1;
-		bool triangles[64];
-		if (triangle_mask & POSITIVE_X) clipTriangles(Vec4(-1.0f, 0.0f, 0.0f, 1.0f), vertices, triangles, triangles_count);
-		if (triangle_mask & NEGATIVE_X) clipTriangles(Vec4(1.0f, 0.0f, 0.0f, 1.0f), vertices, triangles, triangles_count);
-		if (triangle_mask & POSITIVE_Y) clipTriangles(Vec4(0.0f, -1.0f, 0.0f, 1.0f), vertices, triangles, triangles_count);
-		if (triangle_mask & NEGATIVE_Y) clipTriangles(Vec4(0.0f, 1.0f, 0.0f, 1.0f), vertices, triangles, triangles_count);
-		if (triangle_mask & POSITIVE_Z) clipTriangles(Vec4(0.0f, 0.0f, -1.0f, 1.0f), vertices, triangles, triangles_count);
-		if (triangle_mask & NEGATIVE_Z) clipTriangles(Vec4(0.0f, 0.0f, 1.0f, 0.0f), vertices, triangles, triangles_count);
-
-		for (int i = 0; i < triangles_count; ++i)
-		{
-			if (!triangles[i]) continue;
-			int index = i * 3;
-			Vec3 projected[] = { toViewport(vertices[index]), toViewport(vertices[index + 1]), toViewport(vertices[index + 2]) };
-			rasterizeProjectedTriangle(projected, depth);
+	alignas(16) float padded_row[WIDTH + 4];
+	for (u32 j = 0; j < HEIGHT; ++j) {
+		float* LUMIX_RESTRICT row = mip0 + j * WIDTH;
+		memcpy(padded_row + 1, row, sizeof(float) * WIDTH);
+		padded_row[0] = row[0];
+		padded_row[WIDTH + 1] = row[WIDTH - 1];
+		for (u32 i = 0; i < WIDTH; i += 4) {
+			const float4 left = f4LoadUnaligned(padded_row + i);
+			const float4 center = f4LoadUnaligned(padded_row + i + 1);
+			const float4 right = f4LoadUnaligned(padded_row + i + 2);
+			f4Store(row + i, f4Min(center, f4Min(left, right)));
 		}
 	}
-}
 
-
-template <typename IndexType>
-static void rasterizeOccludingTriangles(const Mesh* mesh, const Matrix& mvp_mtx, int* depth)
-{
-	const Vec3* LUMIX_RESTRICT vertices = &mesh->vertices[0];
-	const IndexType* LUMIX_RESTRICT indices = (const IndexType*)mesh->indices.data();
-	for (i32 i = 0, n = (i32)mesh->indices.size() / sizeof(IndexType); i < n; i += 3)
-	{
-		Vec4 v[64*3] = {
-			mvp_mtx * Vec4(vertices[indices[i + 0]], 1),
-			mvp_mtx * Vec4(vertices[indices[i + 1]], 1),
-			mvp_mtx * Vec4(vertices[indices[i + 2]], 1)
-		};
-		rasterizeOccludingTriangle(v, depth);
+	// each texel is the farthest (min 1/w) of the four texels below it
+	for (u32 level = 1; level < MIP_COUNT; ++level) {
+		const u32 prev_w = WIDTH >> (level - 1);
+		const u32 w = WIDTH >> level;
+		const u32 h = HEIGHT >> level;
+		const float* LUMIX_RESTRICT prev = m_depth + m_mip_offsets[level - 1];
+		float* LUMIX_RESTRICT mip = m_depth + m_mip_offsets[level];
+		for (u32 j = 0; j < h; ++j) {
+			const float* src = prev + j * 2 * prev_w;
+			for (u32 i = 0; i < w; ++i) {
+				mip[i] = minimum(minimum(src[0], src[1]), minimum(src[prev_w], src[prev_w + 1]));
+				src += 2;
+			}
+			mip += w;
+		}
 	}
 }
 
 
-void OcclusionBuffer::rasterize(Universe* universe, const Array<MeshInstance>& meshes)
+void OcclusionBuffer::rasterize()
 {
 	PROFILE_FUNCTION();
-	if (m_mips.empty()) init();
-	int* depth = &m_mips[0][0];
-	for (const MeshInstance& mesh_instance : meshes) {
-		const Mesh* mesh = mesh_instance.mesh;
-		const Matrix mtx = m_view_projection_matrix * universe->getRelativeMatrix(mesh_instance.owner, m_camera_pos);
-		if (mesh->flags.isSet(Mesh::INDICES_16_BIT)) {
-			rasterizeOccludingTriangles<u16>(mesh, mtx, depth);
+	const u32 occluders_count = m_occluders.size();
+	m_ranges.resize(occluders_count);
+	u32 vertices_count = 0;
+	u32 triangles_count = 0;
+	for (u32 i = 0; i < occluders_count; ++i) {
+		m_ranges[i].first_vertex = vertices_count;
+		m_ranges[i].first_triangle = triangles_count * TRIANGLES_PER_INPUT;
+		vertices_count += m_occluders[i].vertices_count;
+		triangles_count += m_occluders[i].indices_count / 3;
+	}
+	profiler::pushInt("Occluder triangles", triangles_count);
+
+	m_vertices.resize(vertices_count);
+	m_triangles.resize(triangles_count * TRIANGLES_PER_INPUT);
+	m_tile_offsets.resize(occluders_count * TILES_COUNT);
+
+	jobs::parallelFor(occluders_count, 1, [&](i32 from, i32 to){
+		PROFILE_BLOCK("setup occluders");
+		for (i32 i = from; i < to; ++i) {
+			setupTriangles(i);
 		}
-		else {
-			rasterizeOccludingTriangles<u32>(mesh, mtx, depth);
+	});
+
+	// tile's triangles are sorted by occluder, so the result does not depend on how jobs were scheduled
+	u32 binned_count = 0;
+	for (u32 tile = 0; tile < TILES_COUNT; ++tile) {
+		m_bin_offsets[tile] = binned_count;
+		for (u32 i = 0; i < occluders_count; ++i) {
+			const u32 count = m_tile_offsets[i * TILES_COUNT + tile];
+			m_tile_offsets[i * TILES_COUNT + tile] = binned_count;
+			binned_count += count;
 		}
 	}
+	m_bin_offsets[TILES_COUNT] = binned_count;
+	m_binned.resize(binned_count);
+
+	jobs::parallelFor(occluders_count, 1, [&](i32 from, i32 to){
+		PROFILE_BLOCK("bin occluders");
+		for (i32 i = from; i < to; ++i) {
+			binTriangles(i);
+		}
+	});
+
+	jobs::parallelFor(TILES_COUNT, 1, [&](i32 from, i32 to){
+		PROFILE_BLOCK("rasterize tiles");
+		for (i32 i = from; i < to; ++i) {
+			rasterizeTile(i);
+		}
+	});
+
+	buildHierarchy();
 }
 
 
-void OcclusionBuffer::clear()
+bool OcclusionBuffer::isOccluded(const Transform& world_transform, const AABB& aabb) const
 {
-	PROFILE_FUNCTION();
-	for (auto& mip : m_mips)
-	{
-		for (int& i : mip)
-		{
-			i = Z_SCALE;
+	const Matrix mvp = m_view_projection * getRelativeMatrix(world_transform, m_camera_pos);
+	const Vertex origin = transform(mvp, aabb.min.x, aabb.min.y, aabb.min.z, 1);
+	const Vertex axes[] = {
+		transform(mvp, aabb.max.x - aabb.min.x, 0, 0, 0),
+		transform(mvp, 0, aabb.max.y - aabb.min.y, 0, 0),
+		transform(mvp, 0, 0, aabb.max.z - aabb.min.z, 0)
+	};
+
+	float min_x = FLT_MAX;
+	float min_y = FLT_MAX;
+	float max_x = -FLT_MAX;
+	float max_y = -FLT_MAX;
+	float max_inv_w = 0;
+	for (u32 i = 0; i < 8; ++i) {
+		Vertex v = origin;
+		for (u32 j = 0; j < 3; ++j) {
+			if ((i & (1 << j)) == 0) continue;
+			v.x += axes[j].x;
+			v.y += axes[j].y;
+			v.z += axes[j].z;
+			v.w += axes[j].w;
 		}
+		// crosses near plane
+		if (!(getNearDistance(v) > 0)) return false;
+
+		const ProjectedVertex p = project(v.x, v.y, v.w);
+		min_x = minimum(min_x, p.x);
+		min_y = minimum(min_y, p.y);
+		max_x = maximum(max_x, p.x);
+		max_y = maximum(max_y, p.y);
+		max_inv_w = maximum(max_inv_w, p.inv_w);
 	}
+
+	// outside of the buffer, frustum culling decides
+	if (max_x < 0 || max_y < 0 || min_x >= WIDTH || min_y >= HEIGHT) return false;
+
+	// every pixel the box touches, not just centers
+	i32 x0 = (i32)maximum(min_x, 0.f);
+	i32 y0 = (i32)maximum(min_y, 0.f);
+	i32 x1 = (i32)minimum(max_x, float(WIDTH - 1));
+	i32 y1 = (i32)minimum(max_y, float(HEIGHT - 1));
+
+	u32 level = 0;
+	while (level < MIP_COUNT - 1 && (x1 - x0 > 3 || y1 - y0 > 3)) {
+		x0 >>= 1;
+		y0 >>= 1;
+		x1 >>= 1;
+		y1 >>= 1;
+		++level;
+	}
+
+	max_inv_w *= DEPTH_BIAS;
+	const u32 w = WIDTH >> level;
+	const float* LUMIX_RESTRICT mip = getMip(level);
+	for (i32 y = y0; y <= y1; ++y) {
+		for (i32 x = x0; x <= x1; ++x) {
+			if (mip[x + y * w] <= max_inv_w) return false;
+		}
+	}
+	return true;
 }
 
 
-} // namespace Lumix
\ No newline at end of file
+} // namespace Lumix
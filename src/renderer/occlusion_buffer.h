@@ -9,35 +9,78 @@ namespace Lumix
 {
 
 
-template <typename T> struct Array;
-struct IAllocator;
-struct Mesh;
-struct MeshInstance;
 struct AABB;
-struct Universe;
+struct IAllocator;
 
 
+// Software depth buffer used to cull objects hidden behind big occluders. It does not need a GPU,
+// occluders are rasterized on job workers, the result does not depend on the number of workers.
+// Each pixel stores 1/w of the nearest occluder (0 == empty), 1/w is linear in screen space,
+// so it's interpolated exactly and larger value means closer.
 struct OcclusionBuffer
 {
 public:
-	OcclusionBuffer(IAllocator& allocator);
+	struct Occluder {
+		Transform transform;
+		const Vec3* vertices;
+		u32 vertices_count;
+		const void* indices;
+		u32 indices_count;
+		bool indices_16bit;
+	};
+
+	struct Triangle;
+	struct Vertex;
+
+	static constexpr u32 WIDTH = 384;
+	static constexpr u32 HEIGHT = 192;
+	static constexpr u32 MIP_COUNT = 7;
+	static constexpr u32 TILE_WIDTH = 64;
+	static constexpr u32 TILE_HEIGHT = 32;
+	static constexpr u32 TILES_X = WIDTH / TILE_WIDTH;
+	static constexpr u32 TILES_COUNT = TILES_X * (HEIGHT / TILE_HEIGHT);
 
-	bool isOccluded(const Transform& world_transform, const AABB& aabb);
+	explicit OcclusionBuffer(IAllocator& allocator);
+	~OcclusionBuffer();
+
+	// `view` is relative to `pos`, `projection` must be reversed-Z perspective, i.e. Viewport::getProjection
+	void setCamera(const DVec3& pos, const Matrix& view, const Matrix& projection);
+	// removes all occluders and clears depth
 	void clear();
-	void setCamera(const DVec3& pos, const Quat& rot, const Matrix& projection);
-	void rasterize(Universe* universe, const Array<MeshInstance>& meshes);
-	void buildHierarchy();
-	const int* getMip(int level) { return &m_mips[level][0]; }
+	// occluder's data must be alive until `rasterize` returns
+	void addOccluder(const Occluder& occluder);
+	u32 getOccludersCount() const { return m_occluders.size(); }
+	// rasterizes all occluders added since last `clear` and builds the hierarchy
+	void rasterize();
+	// conservative, true only if the whole box is behind rasterized occluders; thread safe
+	bool isOccluded(const Transform& world_transform, const AABB& aabb) const;
+	const float* getMip(u32 level) const { return m_depth + m_mip_offsets[level]; }
 
 private:
-	void init();
-	Vec3 transform(const Transform& world_transform, float x, float y, float z);
+	struct OccluderRange {
+		u32 first_vertex;
+		u32 first_triangle;
+		u32 triangles_count;
+	};
 
-	using Mip = Array<int>;
+	void setupTriangles(u32 occluder_idx);
+	void binTriangles(u32 occluder_idx);
+	void rasterizeTile(u32 tile);
+	void buildHierarchy();
 
 	IAllocator& m_allocator;
-	Array<Mip> m_mips;
-	Matrix m_view_projection_matrix;
+	Array<Occluder> m_occluders;
+	Array<OccluderRange> m_ranges;
+	Array<Vertex> m_vertices;
+	Array<Triangle> m_triangles;
+	// [occluder * TILES_COUNT + tile], where occluder's triangles go in m_binned
+	Array<u32> m_tile_offsets;
+	Array<u32> m_binned;
+	u32 m_bin_offsets[TILES_COUNT + 1];
+	// rasterized depth followed by the mips
+	float* m_depth;
+	u32 m_mip_offsets[MIP_COUNT];
+	Matrix m_view_projection;
 	DVec3 m_camera_pos;
 };
 
@@ -444,14 +444,11 @@ bool ParticleEmitter::update(float dt, PageAllocator& allocator)
 	u32* kill_list = (u32*)allocator.allocate(true);
 	volatile i32 kill_counter = 0;
 
-	volatile i32 counter = 0;
-	jobs::runOnWorkers([&](){
+	jobs::parallelFor(m_particles_count, 1024, [&](i32 range_from, i32 range_to){
 		PROFILE_FUNCTION();
 		Array<float4> reg_mem(m_allocator);
 		reg_mem.resize(m_resource->getRegistersCount() * 256);
-		for (;;) {
-			const i32 from = atomicAdd(&counter, 1024);
-			if (from >= (i32)m_particles_count) return;
+		for (i32 from = range_from; from < range_to; from += 1024) {
 
 			const i32 fromf4 = from / 4;
 			const i32 stepf4 = minimum(1024, m_particles_count - from + 3) / 4;
@@ -652,14 +649,11 @@ u32 ParticleEmitter::getParticlesDataSizeBytes() const
 void ParticleEmitter::fillInstanceData(float* data) const {
 	if (m_particles_count == 0) return;
 
-	volatile i32 counter = 0;
-	jobs::runOnWorkers([&](){
+	jobs::parallelFor(m_particles_count, 1024, [&](i32 range_from, i32 range_to){
 		PROFILE_FUNCTION();
 		Array<float4> reg_mem(m_allocator);
 		reg_mem.resize(m_resource->getRegistersCount() * 256);
-		for (;;) {
-			const u32 from = (u32)atomicAdd(&counter, 1024);
-			if (from >= m_particles_count) return;
+		for (u32 from = (u32)range_from; from < (u32)range_to; from += 1024) {
 			const u32 fromf4 = from / 4;
 			const u32 stepf4 = minimum(1024, m_particles_count - from + 3) / 4;
 
@@ -1,4 +1,5 @@
 #include "gpu/gpu.h"
+#include "engine/allocators.h"
 #include "engine/associative_array.h"
 #include "engine/crc32.h"
 #include "engine/crt.h"
@@ -22,6 +23,7 @@
 #include "font.h"
 #include "material.h"
 #include "model.h"
+#include "occlusion_buffer.h"
 #include "particle_system.h"
 #include "pipeline.h"
 #include "pose.h"
@@ -791,6 +793,7 @@ struct PipelineImpl final : Pipeline
 
 	PipelineImpl(Renderer& renderer, PipelineResource* resource, const char* define, IAllocator& allocator)
 		: m_allocator(allocator)
+		, m_frame_allocator(renderer.getEngine().getFrameAllocator())
 		, m_renderer(renderer)
 		, m_resource(resource)
 		, m_lua_state(nullptr)
@@ -806,6 +809,7 @@ struct PipelineImpl final : Pipeline
 		, m_buffers(allocator)
 		, m_views(allocator)
 		, m_buckets(allocator)
+		, m_occlusion_buffer(allocator)
 	{
 		m_viewport.w = m_viewport.h = 800;
 		ResourceManagerHub& rm = renderer.getEngine().getResourceManager();
@@ -3003,12 +3007,31 @@ struct PipelineImpl final : Pipeline
 		return float(light.radius / length(cam_pos - light_pos));
 	}
 
-	u32 cull(CameraParams cp) {
-		View& view = m_views.emplace(m_allocator, m_renderer.getEngine().getPageAllocator());
-		view.cp = cp;
-		view.renderables = m_scene->getRenderables(cp.frustum);
-		memset(view.layer_to_bucket, 0xff, sizeof(view.layer_to_bucket));
-		return m_views.size() - 1;
+	// culls all camera params passed as arguments in one pass and returns a view for each of them
+	static int cull(lua_State* L) {
+		PipelineImpl* pipeline = getClosureThis(L);
+		const int count = lua_gettop(L);
+		CameraParams cps[8];
+		if (count < 1 || count > (int)lengthOf(cps)) {
+			return luaL_error(L, "%s", "cull expects 1 to 8 camera params");
+		}
+
+		ShiftedFrustum frusta[lengthOf(cps)];
+		CullResult* renderables[lengthOf(cps)];
+		for (int i = 0; i < count; ++i) {
+			cps[i] = LuaWrapper::checkArg<CameraParams>(L, i + 1);
+			frusta[i] = cps[i].frustum;
+		}
+		pipeline->m_scene->getRenderables(Span<const ShiftedFrustum>(frusta, count), Span(renderables, count));
+
+		for (int i = 0; i < count; ++i) {
+			View& view = pipeline->m_views.emplace(pipeline->m_frame_allocator, pipeline->m_renderer.getEngine().getPageAllocator());
+			view.cp = cps[i];
+			view.renderables = renderables[i];
+			memset(view.layer_to_bucket, 0xff, sizeof(view.layer_to_bucket));
+			LuaWrapper::push(L, pipeline->m_views.size() - 1);
+		}
+		return count;
 	}
 
 	struct RenderBucketJob : Renderer::RenderJob {
@@ -3633,7 +3656,7 @@ struct PipelineImpl final : Pipeline
 		const i32 steps = (size + STEP - 1) / STEP;
 		PageAllocator& page_allocator = m_renderer.getEngine().getPageAllocator();
 
-		Array<CmdPage*> pages(m_allocator);
+		Array<CmdPage*> pages(m_frame_allocator);
 		pages.resize(steps);
 
 		volatile i32 iter = 0;
@@ -3674,6 +3697,7 @@ struct PipelineImpl final : Pipeline
 
 		for (View& view : m_views) {
 			if (!view.renderables) continue;
+			occlusionCull(view);
 			createSortKeys(view);
 			view.renderables->free(m_renderer.getEngine().getPageAllocator());
 		}
@@ -4106,7 +4130,7 @@ struct PipelineImpl final : Pipeline
 		void setup() override
 		{
 			PROFILE_FUNCTION();
-			Array<TerrainInfo> infos(m_allocator);
+			Array<TerrainInfo> infos(m_pipeline->m_frame_allocator);
 			m_pipeline->m_scene->getTerrainInfos(infos);
 			if(infos.empty()) return;
 
@@ -4235,6 +4259,118 @@ struct PipelineImpl final : Pipeline
 		u32 m_define_mask = 0;
 	};
 
+	// rasterizes the biggest opaque meshes in view to the occlusion buffer and removes meshes hidden behind them from the view
+	void occlusionCull(View& view) {
+		if (!m_occlusion_culling || view.cp.is_shadow) return;
+		// occlusion buffer needs perspective projection
+		if (view.cp.projection.columns[3].w != 0) return;
+		if (view.renderables->header.count == 0 && !view.renderables->header.next) return;
+
+		PROFILE_FUNCTION();
+		// bounding radius / distance
+		constexpr float MIN_OCCLUDER_SIZE = 0.1f;
+		constexpr u32 MAX_OCCLUDERS = 64;
+		constexpr u32 MAX_OCCLUDER_TRIANGLES = 32 * 1024;
+
+		struct Candidate {
+			EntityRef entity;
+			float size;
+		};
+
+		const ModelInstance* LUMIX_RESTRICT model_instances = m_scene->getModelInstances().begin();
+		const Transform* LUMIX_RESTRICT transforms = m_scene->getUniverse().getTransforms();
+		const DVec3 camera_pos = view.cp.pos;
+		const DVec3 lod_ref_point = m_viewport.pos;
+
+		Array<Candidate> candidates(m_frame_allocator);
+		for (const CullResult* page = view.renderables; page; page = page->header.next) {
+			const RenderableTypes type = (RenderableTypes)page->header.type;
+			if (type != RenderableTypes::MESH && type != RenderableTypes::MESH_MATERIAL_OVERRIDE) continue;
+
+			for (u32 i = 0, c = page->header.count; i < c; ++i) {
+				const EntityRef e = page->entities[i];
+				const Transform& tr = transforms[e.index];
+				const float radius = model_instances[e.index].model->getOriginBoundingRadius() * tr.scale;
+				const float distance = (float)length(tr.pos - camera_pos);
+				const float size = radius / maximum(distance, 0.001f);
+				if (size > MIN_OCCLUDER_SIZE) candidates.push({e, size});
+			}
+		}
+		if (candidates.empty()) return;
+
+		qsort(candidates.begin(), candidates.size(), sizeof(Candidate), [](const void* a, const void* b){
+			const float size_a = ((const Candidate*)a)->size;
+			const float size_b = ((const Candidate*)b)->size;
+			if (size_a > size_b) return -1;
+			return size_a < size_b ? 1 : 0;
+		});
+
+		m_occlusion_buffer.clear();
+		m_occlusion_buffer.setCamera(camera_pos, view.cp.view, view.cp.projection);
+		const u8 default_layer = m_renderer.getLayerIdx("default");
+		u32 triangles_count = 0;
+		for (const Candidate& candidate : candidates) {
+			if (m_occlusion_buffer.getOccludersCount() >= MAX_OCCLUDERS) break;
+
+			const ModelInstance& mi = model_instances[candidate.entity.index];
+			const Transform& tr = transforms[candidate.entity.index];
+			// the same LOD as the one rendered, any other could have different silhouette
+			const u32 lod_idx = mi.model->getLODMeshIndices(float(squaredLength(tr.pos - lod_ref_point)));
+			const LODMeshIndices& lod = mi.model->getLODIndices()[lod_idx];
+			for (int mesh_idx = lod.from; mesh_idx <= lod.to; ++mesh_idx) {
+				// only what's certainly opaque, alpha cutout or transparent mesh does not hide what's behind it
+				const Mesh& instance_mesh = mi.meshes[mesh_idx];
+				if (instance_mesh.layer != default_layer || instance_mesh.material->isAlphaCutout()) continue;
+
+				const Mesh& mesh = mi.model->getMesh(mesh_idx);
+				const bool indices_16bit = mesh.areIndices16();
+				const u32 indices_count = u32(mesh.indices.size() / (indices_16bit ? sizeof(u16) : sizeof(u32)));
+				if (triangles_count + indices_count / 3 > MAX_OCCLUDER_TRIANGLES) continue;
+				if (m_occlusion_buffer.getOccludersCount() >= MAX_OCCLUDERS) break;
+
+				triangles_count += indices_count / 3;
+				OcclusionBuffer::Occluder occluder;
+				occluder.transform = tr;
+				occluder.vertices = mesh.vertices.begin();
+				occluder.vertices_count = mesh.vertices.size();
+				occluder.indices = mesh.indices.data();
+				occluder.indices_count = indices_count;
+				occluder.indices_16bit = indices_16bit;
+				m_occlusion_buffer.addOccluder(occluder);
+			}
+		}
+		if (m_occlusion_buffer.getOccludersCount() == 0) return;
+
+		m_occlusion_buffer.rasterize();
+
+		PagedListIterator<CullResult> iterator(view.renderables);
+		volatile i32 occluded_count = 0;
+		jobs::runOnWorkers([&](){
+			PROFILE_BLOCK("occlusion test");
+			i32 occluded = 0;
+			for (;;) {
+				CullResult* page = iterator.next();
+				if (!page) break;
+				const RenderableTypes type = (RenderableTypes)page->header.type;
+				// skinned meshes are not tested, their bounding box does not include animation
+				if (type != RenderableTypes::MESH && type != RenderableTypes::MESH_MATERIAL_OVERRIDE) continue;
+
+				u32 visible_count = 0;
+				for (u32 i = 0, c = page->header.count; i < c; ++i) {
+					const EntityRef e = page->entities[i];
+					if (m_occlusion_buffer.isOccluded(transforms[e.index], model_instances[e.index].model->getAABB())) continue;
+					page->entities[visible_count] = e;
+					++visible_count;
+				}
+				occluded += page->header.count - visible_count;
+				page->header.count = visible_count;
+			}
+			atomicAdd(&occluded_count, occluded);
+		});
+		profiler::pushInt("occluders", m_occlusion_buffer.getOccludersCount());
+		profiler::pushInt("occluded", occluded_count);
+	}
+
 	void createSortKeys(PipelineImpl::View& view) {
 		if (view.renderables->header.count == 0 && !view.renderables->header.next) return;
 		PagedListIterator<const CullResult> iterator(view.renderables);
@@ -4318,6 +4454,7 @@ struct PipelineImpl final : Pipeline
 							const EntityRef e = renderables[i];
 							const DVec3 pos = entity_data[e.index].pos;
 							ModelInstance& mi = model_instances[e.index];
+							if (!mi.visible) compareAndExchange(&mi.visible, 1, 0);
 							const float squared_length = float(squaredLength(pos - lod_ref_point));
 								
 							const u32 lod_idx = mi.model->getLODMeshIndices(squared_length);
@@ -4538,7 +4675,7 @@ struct PipelineImpl final : Pipeline
 		profiler::pushInt("count", size);
 		if (size == 0) return;
 
-		Array<u64> tmp_mem(m_allocator);
+		Array<u64> tmp_mem(m_frame_allocator);
 
 		u64* keys = _keys;
 		u64* values = _values;
@@ -4663,6 +4800,10 @@ struct PipelineImpl final : Pipeline
 		m_profiler_link = 0;
 	}
 	
+	void setOcclusionCulling(bool enable) {
+		m_occlusion_culling = enable;
+	}
+
 	void setOutput(lua_State* L, PipelineTexture tex) {
 		if (tex.type != PipelineTexture::RENDERBUFFER) LuaWrapper::argError(L, 1, "renderbuffer");
 		
@@ -4790,7 +4931,6 @@ struct PipelineImpl final : Pipeline
 		REGISTER_FUNCTION(createTextureArray);
 		REGISTER_FUNCTION(createTexture2D);
 		REGISTER_FUNCTION(createTexture3D);
-		REGISTER_FUNCTION(cull);
 		REGISTER_FUNCTION(dispatch);
 		REGISTER_FUNCTION(drawArray);
 		REGISTER_FUNCTION(endBlock);
@@ -4814,6 +4954,7 @@ struct PipelineImpl final : Pipeline
 		REGISTER_FUNCTION(renderTransparent);
 		REGISTER_FUNCTION(renderUI);
 		REGISTER_FUNCTION(saveRenderbuffer);
+		REGISTER_FUNCTION(setOcclusionCulling);
 		REGISTER_FUNCTION(setOutput);
 		REGISTER_FUNCTION(viewport);
 
@@ -4831,6 +4972,7 @@ struct PipelineImpl final : Pipeline
 		registerConst("STENCIL_KEEP", (u32)gpu::StencilOps::KEEP);
 		registerConst("STENCIL_REPLACE", (u32)gpu::StencilOps::REPLACE);
 
+		registerCFunction("cull", PipelineImpl::cull);
 		registerCFunction("drawcallUniforms", PipelineImpl::drawcallUniforms);
 		registerCFunction("setRenderTargets", PipelineImpl::setRenderTargets);
 		registerCFunction("setRenderTargetsDS", PipelineImpl::setRenderTargetsDS);
@@ -4876,6 +5018,8 @@ struct PipelineImpl final : Pipeline
 	}
 
 	IAllocator& m_allocator;
+	// views, sort buffers and other temporaries which do not outlive render()
+	IAllocator& m_frame_allocator;
 	Renderer& m_renderer;
 	i64 m_profiler_link;
 	PipelineResource* m_resource;
@@ -4915,6 +5059,8 @@ struct PipelineImpl final : Pipeline
 	gpu::BufferHandle m_drawcall_ub = gpu::INVALID_BUFFER;
 	
 	ShadowAtlas m_shadow_atlas;
+	OcclusionBuffer m_occlusion_buffer;
+	bool m_occlusion_culling = true;
 
 	struct {
 		struct Buffer {
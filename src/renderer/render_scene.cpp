@@ -1,12 +1,15 @@
 #include "render_scene.h"
 
+#include "engine/allocators.h"
 #include "engine/array.h"
 #include "engine/associative_array.h"
+#include "engine/atomic.h"
 #include "engine/crc32.h"
 #include "engine/crt.h"
 #include "engine/engine.h"
 #include "engine/file_system.h"
 #include "engine/geometry.h"
+#include "engine/job_system.h"
 #include "engine/log.h"
 #include "engine/lua_wrapper.h"
 #include "engine/math.h"
@@ -18,6 +21,7 @@
 #include "engine/stream.h"
 #include "engine/universe.h"
 #include "imgui/IconsFontAwesome5.h"
+#include "renderer/bvh.h"
 #include "renderer/culling_system.h"
 #include "renderer/font.h"
 #include "renderer/material.h"
@@ -100,7 +104,7 @@ struct RenderSceneImpl final : RenderScene {
 	~RenderSceneImpl()
 	{
 		m_renderer.destroy(m_reflection_probes_texture);
-		m_universe.entityTransformed().unbind<&RenderSceneImpl::onEntityMoved>(this);
+		m_universe.entitiesTransformed().unbind<&RenderSceneImpl::onEntitiesMoved>(this);
 		m_universe.entityDestroyed().unbind<&RenderSceneImpl::onEntityDestroyed>(this);
 		m_culling_system.reset();
 	}
@@ -226,6 +230,7 @@ struct RenderSceneImpl final : RenderScene {
 		m_material_curve_decal_map.clear();
 
 		m_culling_system->clear();
+		m_ray_cast_bvh.clear();
 
 		for (const ReflectionProbe& probe : m_reflection_probes) {
 			LUMIX_DELETE(m_allocator, probe.load_job);
@@ -523,7 +528,7 @@ struct RenderSceneImpl final : RenderScene {
 		if (!m_is_game_running) return;
 		if (paused) return;
 
-		Array<EntityRef> to_delete(m_allocator);
+		Array<EntityRef> to_delete(m_engine.getFrameAllocator());
 		for (ParticleEmitter& emitter : m_particle_emitters) {
 			if (emitter.update(dt, m_engine.getPageAllocator())) {
 				to_delete.push(*emitter.m_entity);
@@ -1063,6 +1068,7 @@ struct RenderSceneImpl final : RenderScene {
 		model_instance.pose = nullptr;
 		model_instance.flags.clear();
 		model_instance.flags.set(ModelInstance::VALID, false);
+		model_instance.visible = 0;
 		if (model_instance.custom_material) model_instance.custom_material->decRefCount();
 		model_instance.custom_material = nullptr;
 		m_universe.onComponentDestroyed(entity, MODEL_INSTANCE_TYPE, this);
@@ -1231,6 +1237,12 @@ struct RenderSceneImpl final : RenderScene {
 	}
 
 
+	void onEntitiesMoved(Span<const EntityRef> entities)
+	{
+		for (EntityRef e : entities) onEntityMoved(e);
+	}
+
+
 	void onEntityMoved(EntityRef entity)
 	{
 		const u64 cmp_mask = m_universe.getComponentsMask(entity);
@@ -1238,6 +1250,10 @@ struct RenderSceneImpl final : RenderScene {
 			return;
 		}
 
+		if (m_ray_cast_bvh.isAdded(entity)) {
+			updateRayCastBounds(entity);
+		}
+
 		if (m_culling_system->isAdded(entity)) {
 			if (m_universe.hasComponent(entity, MODEL_INSTANCE_TYPE)) {
 				const Transform& tr = m_universe.getTransform(entity);
@@ -1338,6 +1354,12 @@ struct RenderSceneImpl final : RenderScene {
 	}
 
 
+	void getTerrainHeightsAt(EntityRef entity, Span<const Vec2> xz, Span<float> heights) override
+	{
+		m_terrains[entity]->getHeights(xz, heights);
+	}
+
+
 	AABB getTerrainAABB(EntityRef entity) override
 	{
 		return m_terrains[entity]->getAABB();
@@ -1806,6 +1828,12 @@ struct RenderSceneImpl final : RenderScene {
 	}
 
 
+	void getRenderables(Span<const ShiftedFrustum> frusta, Span<CullResult*> results) const override
+	{
+		m_culling_system->cull(frusta, 0xff, results);
+	}
+
+
 	float getCameraScreenWidth(EntityRef camera) override { return m_cameras[camera].screen_width; }
 	float getCameraScreenHeight(EntityRef camera) override { return m_cameras[camera].screen_height; }
 
@@ -2163,6 +2191,22 @@ struct RenderSceneImpl final : RenderScene {
 		return hit;
 	}
 
+	void castRaysTerrain(EntityRef entity, Span<RayCastModelHit> rays) override
+	{
+		auto iter = m_terrains.find(entity);
+		if (!iter.isValid()) {
+			for (RayCastModelHit& hit : rays) hit.is_hit = false;
+			return;
+		}
+
+		Terrain* terrain = iter.value();
+		terrain->castRays(rays);
+		for (RayCastModelHit& hit : rays) {
+			hit.component_type = TERRAIN_TYPE;
+			hit.entity = terrain->getEntity();
+		}
+	}
+
 	RayCastModelHit castRay(const DVec3& origin, const Vec3& dir, EntityPtr ignored_model_instance) override {
 		return castRay(origin, dir, [&](const RayCastModelHit& hit) -> bool {
 			return hit.entity != ignored_model_instance || !ignored_model_instance.isValid();
@@ -2173,41 +2217,25 @@ struct RenderSceneImpl final : RenderScene {
 		PROFILE_FUNCTION();
 		RayCastModelHit hit;
 		hit.is_hit = false;
-		double cur_dist = DBL_MAX;
 		const Universe& universe = getUniverse();
-		for (int i = 0; i < m_model_instances.size(); ++i) {
-			auto& r = m_model_instances[i];
-			if (!r.flags.isSet(ModelInstance::ENABLED)) continue;
-			if (!r.flags.isSet(ModelInstance::VALID)) continue;
-
-			const EntityRef entity{i};
-			const DVec3& pos = universe.getPosition(entity);
-			float scale = universe.getScale(entity);
-			float radius = r.model->getOriginBoundingRadius() * scale;
-			const double dist = length(pos - origin);
-			if (dist - radius > cur_dist) continue;
-			
-			float intersection_t;
-			Vec3 rel_pos = Vec3(origin - pos);
-			if (getRaySphereIntersection(rel_pos, dir, Vec3::ZERO, radius, intersection_t) && intersection_t >= 0) {
-				Vec3 aabb_hit;
-				const Quat rot = universe.getRotation(entity).conjugated();
-				const Vec3 rel_dir = rot.rotate(dir);
-				const AABB& aabb = r.model->getAABB();
-				rel_pos = rot.rotate(rel_pos / scale);
-				if (getRayAABBIntersection(rel_pos, rel_dir, aabb.min, aabb.max - aabb.min, aabb_hit)) {
-					RayCastModelHit new_hit = r.model->castRay(rel_pos, rel_dir, r.pose, entity, &filter);
-					if (new_hit.is_hit && (!hit.is_hit || new_hit.t * scale < hit.t)) {
-						new_hit.entity = entity;
-						new_hit.component_type = MODEL_INSTANCE_TYPE;
-						hit = new_hit;
-						hit.t *= scale;
-						hit.is_hit = true;
-						cur_dist = length(dir) * hit.t;
-					}
-				}
+		m_ray_cast_bvh.castRay(origin, dir, DBL_MAX, [&](EntityRef entity, double& max_t){
+			const ModelInstance& r = m_model_instances[entity.index];
+			if (!r.flags.isSet(ModelInstance::ENABLED)) return;
+
+			const Transform& tr = universe.getTransform(entity);
+			const Quat rot = tr.rot.conjugated();
+			const Vec3 rel_dir = rot.rotate(dir);
+			const Vec3 rel_pos = rot.rotate(Vec3(origin - tr.pos) / tr.scale);
+			RayCastModelHit new_hit = r.model->castRay(rel_pos, rel_dir, r.pose, entity, &filter);
+			if (new_hit.is_hit && (!hit.is_hit || new_hit.t * tr.scale < hit.t)) {
+				new_hit.entity = entity;
+				new_hit.component_type = MODEL_INSTANCE_TYPE;
+				hit = new_hit;
+				hit.t *= tr.scale;
+				hit.is_hit = true;
+				max_t = hit.t;
 			}
-		}
+		});
 
 		for (auto* terrain : m_terrains) {
 			RayCastModelHit terrain_hit = terrain->castRay(origin, dir);
@@ -2223,6 +2251,43 @@ struct RenderSceneImpl final : RenderScene {
 		hit.dir = dir;
 		return hit;
 	}
+
+	void castRays(Span<RayCastModelHit> rays, EntityPtr ignored_model_instance) override {
+		castRays(rays, [&](const RayCastModelHit& hit) -> bool {
+			return hit.entity != ignored_model_instance || !ignored_model_instance.isValid();
+		});
+	}
+
+	void castRays(Span<RayCastModelHit> rays, const Delegate<bool (const RayCastModelHit&)> filter) override {
+		PROFILE_FUNCTION();
+		// getTransform resolves deferred transforms and writes them, that's not safe on workers
+		if (m_universe.areTransformsDeferred()) m_universe.flushTransforms();
+		jobs::parallelFor(rays.length(), 64, [&](i32 from, i32 to){
+			PROFILE_BLOCK("cast rays");
+			for (i32 i = from; i < to; ++i) {
+				rays[i] = castRay(rays[i].origin, rays[i].dir, filter);
+			}
+		});
+	}
+
+	void updateRayCastBounds(EntityRef entity) {
+		const Model* model = m_model_instances[entity.index].model;
+		ASSERT(model && model->isReady());
+		DVec3 corners[8];
+		model->getAABB().getCorners(m_universe.getTransform(entity), corners);
+		DVec3 min = corners[0];
+		DVec3 max = corners[0];
+		for (const DVec3& p : corners) {
+			min = minimum(min, p);
+			max = maximum(max, p);
+		}
+		if (m_ray_cast_bvh.isAdded(entity)) {
+			m_ray_cast_bvh.set(entity, min, max);
+		}
+		else {
+			m_ray_cast_bvh.add(entity, min, max);
+		}
+	}
 	
 	Vec4 getShadowmapCascades(EntityRef entity) override
 	{
@@ -2349,6 +2414,7 @@ struct RenderSceneImpl final : RenderScene {
 		r.pose = nullptr;
 
 		m_culling_system->remove(entity);
+		m_ray_cast_bvh.remove(entity);
 	}
 
 
@@ -2364,6 +2430,7 @@ struct RenderSceneImpl final : RenderScene {
 			const RenderableTypes type = getRenderableType(*model, r.custom_material);
 			m_culling_system->add(entity, (u8)type, pos, radius);
 		}
+		updateRayCastBounds(entity);
 		ASSERT(!r.pose);
 		if (model->getBoneCount() > 0)
 		{
@@ -2547,6 +2614,7 @@ struct RenderSceneImpl final : RenderScene {
 			if (old_model->isReady())
 			{
 				m_culling_system->remove(entity);
+				m_ray_cast_bvh.remove(entity);
 			}
 			old_model->decRefCount();
 		}
@@ -2730,6 +2798,8 @@ struct RenderSceneImpl final : RenderScene {
 	Renderer& m_renderer;
 	Engine& m_engine;
 	UniquePtr<CullingSystem> m_culling_system;
+	// all model instances with ready model, used by castRay
+	EntityBVH m_ray_cast_bvh;
 	u64 m_render_cmps_mask;
 
 	EntityPtr m_active_global_light_entity;
@@ -2973,9 +3043,10 @@ RenderSceneImpl::RenderSceneImpl(Renderer& renderer,
 	, m_material_decal_map(m_allocator)
 	, m_material_curve_decal_map(m_allocator)
 	, m_furs(m_allocator)
+	, m_ray_cast_bvh(m_allocator)
 {
 
-	m_universe.entityTransformed().bind<&RenderSceneImpl::onEntityMoved>(this);
+	m_universe.entitiesTransformed().bind<&RenderSceneImpl::onEntitiesMoved>(this);
 	m_universe.entityDestroyed().bind<&RenderSceneImpl::onEntityDestroyed>(this);
 	m_culling_system = CullingSystem::create(m_allocator, engine.getPageAllocator());
 	m_model_instances.reserve(5000);
@@ -162,6 +162,9 @@ struct ModelInstance
 	float lod = 4;
 	FlagSet<Flags, u8> flags;
 	u16 mesh_count;
+	// set to 1 by pipeline's jobs when the instance is in a view, whoever needs it clears it, e.g. animation LOD
+	// not in `flags`, because several views set it concurrently, use compareAndExchange
+	i32 visible = 0;
 };
 
 
@@ -232,7 +235,12 @@ struct LUMIX_RENDERER_API RenderScene : IScene
 
 	virtual RayCastModelHit castRay(const DVec3& origin, const Vec3& dir, const Delegate<bool (const RayCastModelHit&)> filter) = 0;
 	virtual RayCastModelHit castRay(const DVec3& origin, const Vec3& dir, EntityPtr ignore) = 0;
+	// casts rays from `rays[i].origin` in `rays[i].dir` on job workers, results are written back to `rays`;
+	// `filter` is called from multiple threads at once
+	virtual void castRays(Span<RayCastModelHit> rays, const Delegate<bool (const RayCastModelHit&)> filter) = 0;
+	virtual void castRays(Span<RayCastModelHit> rays, EntityPtr ignore) = 0;
 	virtual RayCastModelHit castRayTerrain(EntityRef entity, const DVec3& origin, const Vec3& dir) = 0;
+	virtual void castRaysTerrain(EntityRef entity, Span<RayCastModelHit> rays) = 0;
 	virtual void getRay(EntityRef entity, const Vec2& screen_pos, DVec3& origin, Vec3& dir) = 0;
 
 	virtual void setActiveCamera(EntityRef camera) = 0;
@@ -306,6 +314,8 @@ struct LUMIX_RENDERER_API RenderScene : IScene
 	virtual Path getModelInstanceMaterialOverride(EntityRef entity) = 0;
 	virtual CullResult* getRenderables(const ShiftedFrustum& frustum, RenderableTypes type) const = 0;
 	virtual CullResult* getRenderables(const ShiftedFrustum& frustum) const = 0;
+	// one pass for all frusta, `results[i]` are renderables in `frusta[i]`
+	virtual void getRenderables(Span<const ShiftedFrustum> frusta, Span<CullResult*> results) const = 0;
 	virtual EntityPtr getFirstModelInstance() = 0;
 	virtual EntityPtr getNextModelInstance(EntityPtr entity) = 0;
 	virtual Model* getModelInstanceModel(EntityRef entity) = 0;
@@ -332,6 +342,8 @@ struct LUMIX_RENDERER_API RenderScene : IScene
 	virtual const HashMap<EntityRef, Terrain*>& getTerrains() = 0;
 	virtual void getTerrainInfos(Array<TerrainInfo>& infos) = 0;
 	virtual float getTerrainHeightAt(EntityRef entity, float x, float z) = 0;
+	// `xz` are in terrain's local space
+	virtual void getTerrainHeightsAt(EntityRef entity, Span<const Vec2> xz, Span<float> heights) = 0;
 	virtual Vec3 getTerrainNormalAt(EntityRef entity, float x, float z) = 0;
 	virtual void setTerrainMaterialPath(EntityRef entity, const Path& path) = 0;
 	virtual Path getTerrainMaterialPath(EntityRef entity) = 0;
@@ -1,5 +1,6 @@
 #include "renderer.h"
 
+#include "engine/allocators.h"
 #include "engine/array.h"
 #include "engine/command_line_parser.h"
 #include "engine/crc32.h"
@@ -344,13 +345,14 @@ struct RendererImpl final : Renderer
 {
 	explicit RendererImpl(Engine& engine)
 		: m_engine(engine)
-		, m_allocator(engine.getAllocator())
-		, m_texture_manager(*this, m_allocator)
-		, m_pipeline_manager(*this, m_allocator)
-		, m_model_manager(*this, m_allocator)
-		, m_particle_emitter_manager(*this, m_allocator)
-		, m_material_manager(*this, m_allocator)
-		, m_shader_manager(*this, m_allocator)
+		, m_allocator(engine.getAllocator(), "renderer")
+		, m_resource_allocator(m_allocator, "resources")
+		, m_texture_manager(*this, m_resource_allocator)
+		, m_pipeline_manager(*this, m_resource_allocator)
+		, m_model_manager(*this, m_resource_allocator)
+		, m_particle_emitter_manager(*this, m_resource_allocator)
+		, m_material_manager(*this, m_resource_allocator)
+		, m_shader_manager(*this, m_resource_allocator)
 		, m_font_manager(nullptr)
 		, m_shader_defines(m_allocator)
 		, m_profiler(m_allocator)
@@ -1223,7 +1225,8 @@ struct RendererImpl final : Renderer
 	}
 
 	Engine& m_engine;
-	IAllocator& m_allocator;
+	TagAllocator m_allocator;
+	TagAllocator m_resource_allocator;
 	Array<StaticString<32>> m_shader_defines;
 	Mutex m_shader_defines_mutex;
 	Array<StaticString<32>> m_layers;
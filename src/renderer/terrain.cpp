@@ -1,12 +1,15 @@
 #include "terrain.h"
+#include "engine/atomic.h"
 #include "engine/crc32.h"
 #include "engine/crt.h"
 #include "engine/engine.h"
 #include "engine/geometry.h"
+#include "engine/job_system.h"
 #include "engine/log.h"
 #include "engine/math.h"
 #include "engine/profiler.h"
 #include "engine/resource_manager.h"
+#include "engine/simd.h"
 #include "engine/stream.h"
 #include "renderer/material.h"
 #include "renderer/model.h"
@@ -30,6 +33,203 @@ struct Sample
 };
 
 
+// raw access to heightmap's data, heights are u16, RGBA8 is converted so both formats have the same range
+struct HeightmapView
+{
+	u16 get(i32 x, i32 z) const {
+		const i32 idx = clamp(x, 0, width - 1) + clamp(z, 0, height - 1) * width;
+		if (is_r16) return ((const u16*)data)[idx];
+		return u16((((const u32*)data)[idx] & 0xff) * 257);
+	}
+
+	const u8* data;
+	i32 width;
+	i32 height;
+	bool is_r16;
+};
+
+
+// ray in heightmap space, x and z are in texels, y is in raw height units;
+// it's an affine transform of terrain's local space, so t is the same in both
+struct HeightmapRay
+{
+	float origin[3];
+	float dir[3];
+	float inv_dir[3];
+};
+
+
+static bool getHeightmapView(const Texture* heightmap, i32 width, i32 height, HeightmapView& view)
+{
+	if (!heightmap || !heightmap->isReady() || !heightmap->getData()) return false;
+	if (width < 2 || height < 2) return false;
+	if (heightmap->format != gpu::TextureFormat::R16 && heightmap->format != gpu::TextureFormat::RGBA8) return false;
+
+	view.data = heightmap->getData();
+	view.width = width;
+	view.height = height;
+	view.is_r16 = heightmap->format == gpu::TextureFormat::R16;
+	return true;
+}
+
+
+// clips [t0, t1] to the part of the ray above rectangle [x0, x1] x [z0, z1]
+static bool clipRay(const HeightmapRay& ray, float x0, float z0, float x1, float z1, float& t0, float& t1)
+{
+	const float tx0 = (x0 - ray.origin[0]) * ray.inv_dir[0];
+	const float tx1 = (x1 - ray.origin[0]) * ray.inv_dir[0];
+	const float tz0 = (z0 - ray.origin[2]) * ray.inv_dir[2];
+	const float tz1 = (z1 - ray.origin[2]) * ray.inv_dir[2];
+	t0 = maximum(t0, minimum(tx0, tx1), minimum(tz0, tz1));
+	t1 = minimum(t1, maximum(tx0, tx1), maximum(tz0, tz1));
+	return t0 <= t1;
+}
+
+
+static bool overlapsHeights(const HeightmapRay& ray, float t0, float t1, u16 min, u16 max)
+{
+	const float y0 = ray.origin[1] + ray.dir[1] * t0;
+	const float y1 = ray.origin[1] + ray.dir[1] * t1;
+	// one unit of slack for rounding errors
+	return minimum(y0, y1) <= max + 1.f && maximum(y0, y1) >= min - 1.f;
+}
+
+
+// Moller-Trumbore, both sides
+static bool intersectTriangle(const HeightmapRay& ray, const float* p0, const float* p1, const float* p2, float& t)
+{
+	const float e1[] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	const float e2[] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	const float* d = ray.dir;
+	const float p[] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+	const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+	if (det == 0) return false;
+
+	const float inv_det = 1 / det;
+	const float s[] = { ray.origin[0] - p0[0], ray.origin[1] - p0[1], ray.origin[2] - p0[2] };
+	const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv_det;
+	if (u < 0 || u > 1) return false;
+
+	const float q[] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+	const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv_det;
+	if (v < 0 || u + v > 1) return false;
+
+	t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv_det;
+	return t >= 0;
+}
+
+
+// walks cells in [x0, x1) x [z0, z1) along the ray between t0 and t1, returns the first hit
+static bool castRayCells(const HeightmapView& view, const HeightmapRay& ray, i32 x0, i32 z0, i32 x1, i32 z1, float t0, float t1, float& out_t)
+{
+	i32 cx = clamp((i32)floorf(ray.origin[0] + ray.dir[0] * t0), x0, x1 - 1);
+	i32 cz = clamp((i32)floorf(ray.origin[2] + ray.dir[2] * t0), z0, z1 - 1);
+	const i32 step_x = ray.dir[0] > 0 ? 1 : (ray.dir[0] < 0 ? -1 : 0);
+	const i32 step_z = ray.dir[2] > 0 ? 1 : (ray.dir[2] < 0 ? -1 : 0);
+	float next_tx = step_x == 0 ? FLT_MAX : (cx + (step_x > 0 ? 1 : 0) - ray.origin[0]) * ray.inv_dir[0];
+	float next_tz = step_z == 0 ? FLT_MAX : (cz + (step_z > 0 ? 1 : 0) - ray.origin[2]) * ray.inv_dir[2];
+	const float delta_tx = step_x == 0 ? 0 : fabsf(ray.inv_dir[0]);
+	const float delta_tz = step_z == 0 ? 0 : fabsf(ray.inv_dir[2]);
+
+	float t = t0;
+	for (;;) {
+		const float t_exit = minimum(next_tx, next_tz, t1);
+		const u16 h00 = view.get(cx, cz);
+		const u16 h10 = view.get(cx + 1, cz);
+		const u16 h11 = view.get(cx + 1, cz + 1);
+		const u16 h01 = view.get(cx, cz + 1);
+		const u16 min = minimum(minimum(h00, h10), minimum(h11, h01));
+		const u16 max = maximum(maximum(h00, h10), maximum(h11, h01));
+		if (overlapsHeights(ray, t, t_exit, min, max)) {
+			const float x = (float)cx;
+			const float z = (float)cz;
+			const float p00[] = { x, (float)h00, z };
+			const float p10[] = { x + 1, (float)h10, z };
+			const float p11[] = { x + 1, (float)h11, z + 1 };
+			const float p01[] = { x, (float)h01, z + 1 };
+			float tri_t;
+			bool is_hit = false;
+			out_t = FLT_MAX;
+			if (intersectTriangle(ray, p00, p10, p11, tri_t)) {
+				out_t = tri_t;
+				is_hit = true;
+			}
+			if (intersectTriangle(ray, p00, p11, p01, tri_t)) {
+				out_t = minimum(out_t, tri_t);
+				is_hit = true;
+			}
+			if (is_hit) return true;
+		}
+
+		if (t_exit >= t1) return false;
+		if (next_tx < next_tz) {
+			cx += step_x;
+			t = next_tx;
+			next_tx += delta_tx;
+			if (cx < x0 || cx >= x1) return false;
+		}
+		else {
+			cz += step_z;
+			t = next_tz;
+			next_tz += delta_tz;
+			if (cz < z0 || cz >= z1) return false;
+		}
+	}
+}
+
+
+// skips blocks the ray passes above or below, children are visited front to back
+static bool castRayNode(const Terrain& terrain, const HeightmapView& view, const HeightmapRay& ray, u32 level, i32 bx, i32 bz, float t0, float t1, float& out_t)
+{
+	const i32 cells = Terrain::HEIGHT_BOUNDS_BLOCK_SIZE << level;
+	const i32 x0 = bx * cells;
+	const i32 z0 = bz * cells;
+	const i32 x1 = minimum(x0 + cells, view.width - 1);
+	const i32 z1 = minimum(z0 + cells, view.height - 1);
+	if (!clipRay(ray, (float)x0, (float)z0, (float)x1, (float)z1, t0, t1)) return false;
+
+	const IVec2 size = terrain.m_height_bounds_sizes[level];
+	const Terrain::HeightBounds& bounds = terrain.m_height_bounds[terrain.m_height_bounds_offsets[level] + bx + bz * size.x];
+	if (!overlapsHeights(ray, t0, t1, bounds.min, bounds.max)) return false;
+
+	if (level == 0) return castRayCells(view, ray, x0, z0, x1, z1, t0, t1, out_t);
+
+	struct Child {
+		i32 x, z;
+		float t;
+	} children[4];
+	u32 count = 0;
+	const IVec2 child_size = terrain.m_height_bounds_sizes[level - 1];
+	const i32 child_cells = cells >> 1;
+	for (i32 j = 0; j < 2; ++j) {
+		for (i32 i = 0; i < 2; ++i) {
+			const i32 cx = bx * 2 + i;
+			const i32 cz = bz * 2 + j;
+			if (cx >= child_size.x || cz >= child_size.y) continue;
+
+			float ct0 = t0;
+			float ct1 = t1;
+			const float fx = float(cx * child_cells);
+			const float fz = float(cz * child_cells);
+			if (!clipRay(ray, fx, fz, fx + child_cells, fz + child_cells, ct0, ct1)) continue;
+			
+			u32 k = count;
+			while (k > 0 && children[k - 1].t > ct0) {
+				children[k] = children[k - 1];
+				--k;
+			}
+			children[k] = {cx, cz, ct0};
+			++count;
+		}
+	}
+
+	for (u32 i = 0; i < count; ++i) {
+		if (castRayNode(terrain, view, ray, level - 1, children[i].x, children[i].z, t0, t1, out_t)) return true;
+	}
+	return false;
+}
+
+
 Terrain::Terrain(Renderer& renderer, EntityPtr entity, RenderScene& scene, IAllocator& allocator)
 	: m_material(nullptr)
 	, m_albedomap(nullptr)
@@ -44,6 +244,7 @@ Terrain::Terrain(Renderer& renderer, EntityPtr entity, RenderScene& scene, IAllo
 	, m_allocator(allocator)
 	, m_grass_types(m_allocator)
 	, m_renderer(renderer)
+	, m_height_bounds(m_allocator)
 {
 }
 
@@ -158,6 +359,12 @@ AABB Terrain::getAABB() const
 {
 	Vec3 min(0, 0, 0);
 	Vec3 max(m_width * m_scale.x, 0, m_height * m_scale.z);
+	if (m_height_bounds_levels > 0) {
+		const HeightBounds& root = m_height_bounds.back();
+		max.y = maximum(0.f, m_scale.y * root.max / 65535.f);
+		return AABB(min, max);
+	}
+
 	for (int j = 0; j < m_height; ++j)
 	{
 		for (int i = 0; i < m_width; ++i)
@@ -329,6 +536,63 @@ float Terrain::getHeight(float x, float z) const
 }
 	
 
+void Terrain::getHeights(Span<const Vec2> xz, Span<float> heights) const
+{
+	PROFILE_FUNCTION();
+	ASSERT(xz.length() == heights.length());
+	HeightmapView view;
+	if (!getHeightmapView(m_heightmap, m_width, m_height, view)) {
+		for (float& h : heights) h = 0;
+		return;
+	}
+
+	const float inv_scale = 1.0f / m_scale.x;
+	const float max_x = float(m_width - 1);
+	const float max_z = float(m_height - 1);
+	const float4 height_scale = f4Splat(m_scale.y / 65535.f);
+	const u32 count = xz.length();
+	for (u32 i = 0; i < count; i += 4) {
+		// corners are fetched one by one, interpolation is done for 4 points at once
+		// h = h00 + (ha - h00) * u + (h11 - ha) * v, where `ha` is the third corner of the triangle containing the point
+		alignas(16) float h00[4];
+		alignas(16) float ha[4];
+		alignas(16) float h11[4];
+		alignas(16) float u[4];
+		alignas(16) float v[4];
+		for (u32 j = 0; j < 4; ++j) {
+			const Vec2& p = xz[minimum(i + j, count - 1)];
+			const float fx = clamp(p.x * inv_scale, 0.f, max_x);
+			const float fz = clamp(p.y * inv_scale, 0.f, max_z);
+			const i32 ix = (i32)fx;
+			const i32 iz = (i32)fz;
+			const float dx = fx - ix;
+			const float dz = fz - iz;
+			h00[j] = view.get(ix, iz);
+			h11[j] = view.get(ix + 1, iz + 1);
+			if (dx > dz) {
+				ha[j] = view.get(ix + 1, iz);
+				u[j] = dx;
+				v[j] = dz;
+			}
+			else {
+				ha[j] = view.get(ix, iz + 1);
+				u[j] = dz;
+				v[j] = dx;
+			}
+		}
+
+		const float4 c0 = f4Load(h00);
+		const float4 ca = f4Load(ha);
+		const float4 c1 = f4Load(h11);
+		float4 h = f4Add(c0, f4Mul(f4Sub(ca, c0), f4Load(u)));
+		h = f4Add(h, f4Mul(f4Sub(c1, ca), f4Load(v)));
+		alignas(16) float res[4];
+		f4Store(res, f4Mul(h, height_scale));
+		for (u32 j = 0; j < 4 && i + j < count; ++j) heights[i + j] = res[j];
+	}
+}
+
+
 float Terrain::getHeight(int x, int z) const
 {
 	const float DIV64K = 1.0f / 65535.0f;
@@ -369,73 +633,175 @@ void Terrain::setHeight(int x, int z, float h)
 	ASSERT(t->format == gpu::TextureFormat::R16);
 	int idx = clamp(x, 0, m_width) + clamp(z, 0, m_height) * m_width;
 	((u16*)t->getData())[idx] = (u16)(h * (65535.0f / m_scale.y));
+	updateHeightBounds(x, z, 1, 1);
+}
+
+
+void Terrain::updateHeightBounds(int x, int z, int w, int h)
+{
+	HeightmapView view;
+	if (!getHeightmapView(m_heightmap, m_width, m_height, view)) {
+		m_height_bounds.clear();
+		m_height_bounds_levels = 0;
+		return;
+	}
+
+	const i32 cells_x = m_width - 1;
+	const i32 cells_z = m_height - 1;
+	const IVec2 leaves_size((cells_x + HEIGHT_BOUNDS_BLOCK_SIZE - 1) / HEIGHT_BOUNDS_BLOCK_SIZE
+		, (cells_z + HEIGHT_BOUNDS_BLOCK_SIZE - 1) / HEIGHT_BOUNDS_BLOCK_SIZE);
+	if (m_height_bounds_levels == 0 || m_height_bounds_sizes[0] != leaves_size) {
+		PROFILE_BLOCK("create height bounds");
+		IVec2 size = leaves_size;
+		u32 offset = 0;
+		m_height_bounds_levels = 0;
+		for (;;) {
+			ASSERT(m_height_bounds_levels < MAX_HEIGHT_BOUNDS_LEVELS);
+			m_height_bounds_sizes[m_height_bounds_levels] = size;
+			m_height_bounds_offsets[m_height_bounds_levels] = offset;
+			++m_height_bounds_levels;
+			offset += size.x * size.y;
+			if (size.x == 1 && size.y == 1) break;
+			size = IVec2((size.x + 1) / 2, (size.y + 1) / 2);
+		}
+		m_height_bounds.resize(offset);
+		x = 0;
+		z = 0;
+		w = m_width;
+		h = m_height;
+	}
+
+	// a texel is shared by up to 4 cells
+	i32 from_x = clamp(x - 1, 0, cells_x - 1) / HEIGHT_BOUNDS_BLOCK_SIZE;
+	i32 from_z = clamp(z - 1, 0, cells_z - 1) / HEIGHT_BOUNDS_BLOCK_SIZE;
+	i32 to_x = clamp(x + w - 1, 0, cells_x - 1) / HEIGHT_BOUNDS_BLOCK_SIZE;
+	i32 to_z = clamp(z + h - 1, 0, cells_z - 1) / HEIGHT_BOUNDS_BLOCK_SIZE;
+
+	for (i32 bz = from_z; bz <= to_z; ++bz) {
+		for (i32 bx = from_x; bx <= to_x; ++bx) {
+			HeightBounds bounds = {0xffFF, 0};
+			const i32 end_x = minimum((bx + 1) * HEIGHT_BOUNDS_BLOCK_SIZE, cells_x);
+			const i32 end_z = minimum((bz + 1) * HEIGHT_BOUNDS_BLOCK_SIZE, cells_z);
+			for (i32 j = bz * HEIGHT_BOUNDS_BLOCK_SIZE; j <= end_z; ++j) {
+				for (i32 i = bx * HEIGHT_BOUNDS_BLOCK_SIZE; i <= end_x; ++i) {
+					const u16 v = view.get(i, j);
+					bounds.min = minimum(bounds.min, v);
+					bounds.max = maximum(bounds.max, v);
+				}
+			}
+			m_height_bounds[bx + bz * leaves_size.x] = bounds;
+		}
+	}
+
+	for (u32 level = 1; level < m_height_bounds_levels; ++level) {
+		from_x >>= 1;
+		from_z >>= 1;
+		to_x >>= 1;
+		to_z >>= 1;
+		const IVec2 size = m_height_bounds_sizes[level];
+		const IVec2 child_size = m_height_bounds_sizes[level - 1];
+		const HeightBounds* children = &m_height_bounds[m_height_bounds_offsets[level - 1]];
+		HeightBounds* parents = &m_height_bounds[m_height_bounds_offsets[level]];
+		for (i32 bz = from_z; bz <= to_z; ++bz) {
+			for (i32 bx = from_x; bx <= to_x; ++bx) {
+				HeightBounds bounds = {0xffFF, 0};
+				for (i32 j = bz * 2; j < minimum(bz * 2 + 2, child_size.y); ++j) {
+					for (i32 i = bx * 2; i < minimum(bx * 2 + 2, child_size.x); ++i) {
+						const HeightBounds& child = children[i + j * child_size.x];
+						bounds.min = minimum(bounds.min, child.min);
+						bounds.max = maximum(bounds.max, child.max);
+					}
+				}
+				parents[bx + bz * size.x] = bounds;
+			}
+		}
+	}
 }
 
 
-RayCastModelHit Terrain::castRay(const DVec3& origin, const Vec3& dir)
+// `inv_rot` and `pos` are the terrain's transform, resolved by the caller, so this does not touch the universe
+static RayCastModelHit castRayTransformed(const Terrain& terrain, const HeightmapView& view, const Quat& inv_rot, const DVec3& pos, const DVec3& origin, const Vec3& dir)
 {
 	RayCastModelHit hit;
 	hit.is_hit = false;
 	hit.mesh = nullptr;
-	if (!m_heightmap || !m_heightmap->isReady()) return hit;
+	const Vec3 rel_dir = inv_rot.rotate(dir);
+	const Vec3 rel_origin = inv_rot.rotate(Vec3(origin - pos));
+
+	const float inv_xz_scale = 1 / terrain.m_scale.x;
+	const float y_to_raw = 65535.f / maximum(terrain.m_scale.y, 1e-6f);
+	HeightmapRay ray;
+	ray.origin[0] = rel_origin.x * inv_xz_scale;
+	ray.origin[1] = rel_origin.y * y_to_raw;
+	ray.origin[2] = rel_origin.z * inv_xz_scale;
+	ray.dir[0] = rel_dir.x * inv_xz_scale;
+	ray.dir[1] = rel_dir.y * y_to_raw;
+	ray.dir[2] = rel_dir.z * inv_xz_scale;
+	for (u32 i = 0; i < 3; ++i) {
+		ray.inv_dir[i] = 1 / (ray.dir[i] == 0 ? 1e-20f : ray.dir[i]);
+	}
 
-	const Universe& universe = m_scene.getUniverse();
-	const Quat rot = universe.getRotation(m_entity);
-	const DVec3 pos = universe.getPosition(m_entity);
-	const Vec3 rel_dir = rot.rotate(dir);
-	const Vec3 terrain_to_ray = Vec3(origin - pos);
-	const Vec3 rel_origin = rot.conjugated().rotate(terrain_to_ray);
+	float t;
+	bool is_hit;
+	if (terrain.m_height_bounds_levels > 0) {
+		is_hit = castRayNode(terrain, view, ray, terrain.m_height_bounds_levels - 1, 0, 0, 0, FLT_MAX, t);
+	}
+	else {
+		float t0 = 0;
+		float t1 = FLT_MAX;
+		is_hit = clipRay(ray, 0, 0, float(terrain.m_width - 1), float(terrain.m_height - 1), t0, t1)
+			&& castRayCells(view, ray, 0, 0, terrain.m_width - 1, terrain.m_height - 1, t0, t1, t);
+	}
 
-	Vec3 start;
-	const Vec3 size(m_width * m_scale.x, m_scale.y * 65535.0f, m_height * m_scale.x);
-	if (!getRayAABBIntersection(rel_origin, rel_dir, Vec3::ZERO, size, start)) return hit;
+	if (is_hit) {
+		hit.is_hit = true;
+		hit.origin = origin;
+		hit.dir = dir;
+		hit.t = t;
+	}
+	return hit;
+}
 
-	int hx = (int)(start.x / m_scale.x);
-	int hz = (int)(start.z / m_scale.x);
 
-	float next_x = fabs(rel_dir.x) < 0.01f ? hx : ((hx + (rel_dir.x < 0 ? 0 : 1)) * m_scale.x - rel_origin.x) / rel_dir.x;
-	float next_z = fabs(rel_dir.z) < 0.01f ? hz : ((hz + (rel_dir.z < 0 ? 0 : 1)) * m_scale.x - rel_origin.z) / rel_dir.z;
+RayCastModelHit Terrain::castRay(const DVec3& origin, const Vec3& dir) const
+{
+	HeightmapView view;
+	if (!getHeightmapView(m_heightmap, m_width, m_height, view)) {
+		RayCastModelHit hit;
+		hit.is_hit = false;
+		hit.mesh = nullptr;
+		return hit;
+	}
 
-	float delta_x = fabsf(rel_dir.x) < 0.01f ? 0 : m_scale.x / fabsf(rel_dir.x);
-	float delta_z = fabsf(rel_dir.z) < 0.01f ? 0 : m_scale.z / fabsf(rel_dir.z);
-	int step_x = (int)signum(rel_dir.x);
-	int step_z = (int)signum(rel_dir.z);
+	const Universe& universe = m_scene.getUniverse();
+	const Quat inv_rot = universe.getRotation(m_entity).conjugated();
+	const DVec3 pos = universe.getPosition(m_entity);
+	return castRayTransformed(*this, view, inv_rot, pos, origin, dir);
+}
 
-	while (hx >= 0 && hz >= 0 && hx + step_x < m_width && hz + step_z < m_height) {
-		float t;
-		float x = hx * m_scale.x;
-		float z = hz * m_scale.x;
-		Vec3 p0(x, getHeight(x, z), z);
-		Vec3 p1(x + m_scale.x, getHeight(x + m_scale.x, z), z);
-		Vec3 p2(x + m_scale.x, getHeight(x + m_scale.x, z + m_scale.x), z + m_scale.x);
-		Vec3 p3(x, getHeight(x, z + m_scale.x), z + m_scale.x);
-		if (getRayTriangleIntersection(rel_origin, rel_dir, p0, p1, p2, &t)) {
-			hit.is_hit = true;
-			hit.origin = origin;
-			hit.dir = dir;
-			hit.t = t;
-			return hit;
-		}
-		if (getRayTriangleIntersection(rel_origin, rel_dir, p0, p2, p3, &t)) {
-			hit.is_hit = true;
-			hit.origin = origin;
-			hit.dir = dir;
-			hit.t = t;
-			return hit;
-		}
-		if (next_x < next_z && step_x != 0) {
-			next_x += delta_x;
-			hx += step_x;
-		}
-		else {
-			next_z += delta_z;
-			hz += step_z;
-		}
-		if (delta_x == 0 && delta_z == 0) {
-			return hit;
+
+void Terrain::castRays(Span<RayCastModelHit> rays) const
+{
+	PROFILE_FUNCTION();
+	HeightmapView view;
+	if (!getHeightmapView(m_heightmap, m_width, m_height, view)) {
+		for (RayCastModelHit& hit : rays) {
+			hit.is_hit = false;
+			hit.mesh = nullptr;
 		}
+		return;
 	}
-	return hit;
+
+	// resolving the transform can write deferred transforms, so it must not be done on workers
+	const Universe& universe = m_scene.getUniverse();
+	const Quat inv_rot = universe.getRotation(m_entity).conjugated();
+	const DVec3 pos = universe.getPosition(m_entity);
+	jobs::parallelFor(rays.length(), 64, [&](i32 from, i32 to){
+		PROFILE_BLOCK("cast rays");
+		for (i32 i = from; i < to; ++i) {
+			rays[i] = castRayTransformed(*this, view, inv_rot, pos, rays[i].origin, rays[i].dir);
+		}
+	});
 }
 
 
@@ -464,6 +830,10 @@ void Terrain::onMaterialLoaded(Resource::State, Resource::State new_state, Resou
 			m_splatmap->addDataReference();
 			is_data_ready = false;
 		}
+
+		// forces full rebuild, does nothing but clear if heightmap's data are not loaded yet
+		m_height_bounds_levels = 0;
+		updateHeightBounds(0, 0, m_width, m_height);
 		/*
 		Texture* colormap = m_material->getTextureByUniform("u_colormap");
 		if (colormap && colormap->getData() == nullptr)
@@ -485,6 +855,8 @@ void Terrain::onMaterialLoaded(Resource::State, Resource::State new_state, Resou
 	}
 	else
 	{
+		m_height_bounds.clear();
+		m_height_bounds_levels = 0;
 		//LUMIX_DELETE(m_allocator, m_root);
 		//m_root = nullptr;
 	}
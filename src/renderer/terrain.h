@@ -32,6 +32,17 @@ struct Terrain
 {
 	public:
 		enum { TEXTURES_COUNT = 6 };
+		// heightmap is split into blocks of HEIGHT_BOUNDS_BLOCK_SIZE^2 cells, each level of m_height_bounds
+		// has min and max height of one block, the next level merges 2x2 blocks, the last level is one block
+		enum { HEIGHT_BOUNDS_BLOCK_SIZE = 8 };
+		enum { MAX_HEIGHT_BOUNDS_LEVELS = 20 };
+
+		// in raw heightmap units, i.e. height / y scale * 65535
+		struct HeightBounds
+		{
+			u16 min;
+			u16 max;
+		};
 
 		struct GrassType
 		{
@@ -69,6 +80,8 @@ struct Terrain
 		EntityRef getEntity() const { return m_entity; }
 		Vec3 getNormal(float x, float z);
 		float getHeight(float x, float z) const;
+		// `xz` are in terrain's local space, points outside of the terrain are clamped to its border
+		void getHeights(Span<const Vec2> xz, Span<float> heights) const;
 		float getXZScale() const { return m_scale.x; }
 		float getYScale() const { return m_scale.y; }
 		Path getGrassTypePath(int index);
@@ -84,6 +97,8 @@ struct Terrain
 
 		float getHeight(int x, int z) const;
 		void setHeight(int x, int z, float height);
+		// must be called after heightmap's texels in the rectangle are changed
+		void updateHeightBounds(int x, int z, int w, int h);
 		void setXZScale(float scale);
 		void setYScale(float scale);
 		void setGrassTypePath(int index, const Path& path);
@@ -94,7 +109,9 @@ struct Terrain
 
 		TerrainInfo getInfo();
 
-		RayCastModelHit castRay(const DVec3& origin, const Vec3& dir);
+		RayCastModelHit castRay(const DVec3& origin, const Vec3& dir) const;
+		// casts rays from `rays[i].origin` in `rays[i].dir` on job workers, results are written back to `rays`
+		void castRays(Span<RayCastModelHit> rays) const;
 		void serialize(OutputMemoryStream& serializer);
 		void deserialize(EntityRef entity, InputMemoryStream& serializer, Universe& universe, RenderScene& scene);
 
@@ -118,6 +135,11 @@ struct Terrain
 		RenderScene& m_scene;
 		Array<GrassType> m_grass_types;
 		Renderer& m_renderer;
+		// all levels, the finest first, empty if heightmap's data are not loaded
+		Array<HeightBounds> m_height_bounds;
+		u32 m_height_bounds_levels = 0;
+		u32 m_height_bounds_offsets[MAX_HEIGHT_BOUNDS_LEVELS];
+		IVec2 m_height_bounds_sizes[MAX_HEIGHT_BOUNDS_LEVELS];
 };
 
 
@@ -0,0 +1,108 @@
+#include "engine/allocator.h"
+#include "engine/atomic.h"
+#include "engine/job_system.h"
+#include "engine/math.h"
+#include "engine/os.h"
+#include "unit_tests/unit_tests.h"
+#include <string.h>
+
+
+using namespace Lumix;
+
+
+static constexpr u32 BLOCKS_COUNT = 256;
+
+
+// sizes cover all small bins and some allocations falling through to the system heap
+static u32 getBlockSize(u32 i)
+{
+	static const u32 sizes[] = { 8, 16, 24, 32, 48, 64, 96, 128, 200, 256, 500, 1024, 3000 };
+	return sizes[i % lengthOf(sizes)];
+}
+
+
+// typical small allocations made every frame, e.g. by containers and Lua
+static u32 getSmallBlockSize(u32 i)
+{
+	static const u32 sizes[] = { 8, 16, 16, 24, 32, 32, 48, 64, 64, 96, 128, 256 };
+	return sizes[i % lengthOf(sizes)];
+}
+
+
+LUMIX_TEST(defaultAllocatorCrossThreadFree)
+{
+	IAllocator& allocator = unit_tests::getAllocator();
+	u8* blocks[BLOCKS_COUNT];
+	for (u32 i = 0; i < BLOCKS_COUNT; ++i) {
+		blocks[i] = (u8*)allocator.allocate(getBlockSize(i));
+		memset(blocks[i], u8(i), getBlockSize(i));
+	}
+
+	// blocks allocated on this worker are checked and freed on any worker
+	volatile i32 errors_count = 0;
+	jobs::SignalHandle signal = jobs::INVALID_HANDLE;
+	for (u32 i = 0; i < BLOCKS_COUNT; ++i) {
+		struct Job {
+			u8* block;
+			u32 idx;
+			volatile i32* errors_count;
+		};
+		Job* job = LUMIX_NEW(allocator, Job){ blocks[i], i, &errors_count };
+		jobs::run(job, [](void* ptr) {
+			Job* job = (Job*)ptr;
+			IAllocator& allocator = unit_tests::getAllocator();
+			for (u32 j = 0, c = getBlockSize(job->idx); j < c; ++j) {
+				if (job->block[j] != u8(job->idx)) {
+					atomicIncrement(job->errors_count);
+					break;
+				}
+			}
+			allocator.deallocate(job->block);
+			LUMIX_DELETE(allocator, job);
+		}, &signal);
+	}
+	jobs::wait(signal);
+	LUMIX_EXPECT(errors_count == 0);
+
+	// reuse of freed blocks must not overlap
+	for (u32 i = 0; i < BLOCKS_COUNT; ++i) {
+		blocks[i] = (u8*)allocator.allocate(getBlockSize(i));
+		memset(blocks[i], u8(i), getBlockSize(i));
+	}
+	for (u32 i = 0; i < BLOCKS_COUNT; ++i) {
+		LUMIX_EXPECT(blocks[i][0] == u8(i) && blocks[i][getBlockSize(i) - 1] == u8(i));
+		allocator.deallocate(blocks[i]);
+	}
+}
+
+
+LUMIX_BENCHMARK(defaultAllocatorThroughput)
+{
+	const u32 max_threads = os::getCPUsCount();
+	for (u32 threads_count = 1;; threads_count = minimum(threads_count * 2, max_threads)) {
+		struct Context {
+			double ops_per_second;
+		} ctx = {};
+
+		unit_tests::runOnWorker(threads_count, [](void* ptr) {
+			Context& ctx = *(Context*)ptr;
+			const u32 iterations = 20'000;
+			volatile i32 ops_count = 0;
+			os::Timer timer;
+			// each worker allocates and frees its own blocks, the allocator is shared
+			jobs::runOnWorkers([&]() {
+				IAllocator& allocator = unit_tests::getAllocator();
+				void* blocks[BLOCKS_COUNT];
+				for (u32 i = 0; i < iterations / jobs::getWorkersCount(); ++i) {
+					for (u32 j = 0; j < BLOCKS_COUNT; ++j) blocks[j] = allocator.allocate(getSmallBlockSize(j));
+					for (u32 j = 0; j < BLOCKS_COUNT; ++j) allocator.deallocate(blocks[BLOCKS_COUNT - j - 1]);
+				}
+				atomicAdd(&ops_count, i32(iterations / jobs::getWorkersCount() * BLOCKS_COUNT));
+			});
+			ctx.ops_per_second = ops_count / timer.getTimeSinceStart();
+		}, &ctx);
+
+		unit_tests::reportBenchmark("defaultAllocatorThroughput", threads_count, ctx.ops_per_second / 1e6, "Mallocs/s");
+		if (threads_count >= max_threads) break;
+	}
+}
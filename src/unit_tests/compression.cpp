@@ -0,0 +1,69 @@
+#include "engine/compression.h"
+#include "engine/stream.h"
+#include "unit_tests/unit_tests.h"
+#include <string.h>
+
+
+using namespace Lumix;
+
+
+static u32 g_seed = 1;
+
+
+static u32 getRandom()
+{
+	g_seed ^= g_seed << 13;
+	g_seed ^= g_seed >> 17;
+	g_seed ^= g_seed << 5;
+	return g_seed;
+}
+
+
+// random, zeros, repeating text and data with matches further than LZ4's 64kB window
+static void generate(Span<u8> data, u32 kind)
+{
+	static const char text[] = "lorem ipsum dolor sit amet ";
+	for (u32 i = 0; i < data.length(); ++i) {
+		switch (kind) {
+			case 0: data[i] = u8(getRandom()); break;
+			case 1: data[i] = 0; break;
+			case 2: data[i] = text[i % (lengthOf(text) - 1)]; break;
+			case 3: data[i] = getRandom() % 4 == 0 || i < 70'000 ? u8('a' + getRandom() % 3) : data[i - 70'000 + getRandom() % 3]; break;
+		}
+	}
+}
+
+
+LUMIX_TEST(chunkedLZ4RoundTrip)
+{
+	IAllocator& allocator = unit_tests::getAllocator();
+	const u32 sizes[] = { 0, 1, 12, 13, 100, 65'536, 65'537, 256 * 1024, 256 * 1024 + 1, 1 << 20 };
+	const u32 chunk_sizes[] = { chunked_lz4::DEFAULT_CHUNK_SIZE, 4096 };
+	const chunked_lz4::Level levels[] = { chunked_lz4::Level::FAST, chunked_lz4::Level::HIGH };
+	OutputMemoryStream src(allocator);
+	OutputMemoryStream decompressed(allocator);
+	for (u32 kind = 0; kind < 4; ++kind) {
+		for (u32 size : sizes) {
+			src.resize(size);
+			generate(Span(src.getMutableData(), size), kind);
+			for (chunked_lz4::Level level : levels) {
+				for (u32 chunk_size : chunk_sizes) {
+					OutputMemoryStream compressed(allocator);
+					LUMIX_EXPECT(chunked_lz4::compress(src, compressed, level, allocator, chunk_size));
+
+					// one extra byte to check nothing is written past the end
+					decompressed.resize(size + 1);
+					decompressed.getMutableData()[size] = 0xcd;
+					const u32 chunks_count = chunked_lz4::getChunksCount(size, chunk_size);
+					LUMIX_EXPECT(chunked_lz4::decompress(compressed, Span(decompressed.getMutableData(), size), 0, chunks_count, chunk_size));
+					LUMIX_EXPECT(memcmp(decompressed.data(), src.data(), size) == 0);
+					LUMIX_EXPECT(decompressed.data()[size] == 0xcd);
+
+					memset(decompressed.getMutableData(), 0, size);
+					LUMIX_EXPECT(chunked_lz4::decompressParallel(compressed, Span(decompressed.getMutableData(), size), chunk_size));
+					LUMIX_EXPECT(memcmp(decompressed.data(), src.data(), size) == 0);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#include "engine/atomic.h"
+#include "engine/job_system.h"
+#include "engine/math.h"
+#include "engine/os.h"
+#include "unit_tests/unit_tests.h"
+
+
+using namespace Lumix;
+
+
+static constexpr u32 JOBS_PER_BATCH = 1000;
+
+
+// pushes `batches_count` batches of tiny jobs from the calling worker and waits for each batch, like a frame does
+static void runBatches(u32 batches_count, volatile i32* counter)
+{
+	for (u32 i = 0; i < batches_count; ++i) {
+		jobs::SignalHandle signal = jobs::INVALID_HANDLE;
+		for (u32 j = 0; j < JOBS_PER_BATCH; ++j) {
+			jobs::run((void*)counter, [](void* ptr) { atomicIncrement((volatile i32*)ptr); }, &signal);
+		}
+		jobs::wait(signal);
+	}
+}
+
+
+LUMIX_TEST(jobSystemRunsAllJobs)
+{
+	volatile i32 counter = 0;
+	runBatches(10, &counter);
+	LUMIX_EXPECT(counter == 10 * JOBS_PER_BATCH);
+
+	// nested jobs are pushed to the worker's own queue and stolen by others
+	counter = 0;
+	jobs::SignalHandle signal = jobs::INVALID_HANDLE;
+	for (u32 i = 0; i < 8; ++i) {
+		jobs::run((void*)&counter, [](void* ptr) { runBatches(2, (volatile i32*)ptr); }, &signal);
+	}
+	jobs::wait(signal);
+	LUMIX_EXPECT(counter == 8 * 2 * JOBS_PER_BATCH);
+
+	counter = 0;
+	jobs::parallelFor(100'000, 7, [&](i32 from, i32 to) { atomicAdd(&counter, to - from); });
+	LUMIX_EXPECT(counter == 100'000);
+}
+
+
+LUMIX_BENCHMARK(jobSystemThroughput)
+{
+	const u32 max_workers = os::getCPUsCount();
+	for (u32 workers_count = 1;; workers_count = minimum(workers_count * 2, max_workers)) {
+		struct Context {
+			volatile i32 counter;
+			double jobs_per_second;
+		} ctx = {};
+
+		unit_tests::runOnWorker(workers_count, [](void* ptr) {
+			Context& ctx = *(Context*)ptr;
+			// warm up fiber pool and queues
+			runBatches(10, &ctx.counter);
+
+			const u32 batches_count = 1000;
+			os::Timer timer;
+			runBatches(batches_count, &ctx.counter);
+			ctx.jobs_per_second = batches_count * JOBS_PER_BATCH / timer.getTimeSinceStart();
+		}, &ctx);
+
+		unit_tests::reportBenchmark("jobSystemThroughput", workers_count, ctx.jobs_per_second / 1e6, "Mjobs/s");
+		if (workers_count >= max_workers) break;
+	}
+}
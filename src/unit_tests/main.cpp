@@ -0,0 +1,104 @@
+#include "engine/allocators.h"
+#include "engine/atomic.h"
+#include "engine/job_system.h"
+#include "engine/os.h"
+#include "engine/string.h"
+#include "engine/sync.h"
+#include "unit_tests/unit_tests.h"
+#include <stdio.h>
+
+
+namespace Lumix::unit_tests {
+
+
+static TestRegistration* g_first_test = nullptr;
+static u32 g_failures_count = 0;
+static DefaultAllocator g_allocator;
+
+
+TestRegistration::TestRegistration(const char* name, TestFunction function, bool is_benchmark)
+	: name(name)
+	, function(function)
+	, is_benchmark(is_benchmark)
+	, next(g_first_test)
+{
+	g_first_test = this;
+}
+
+
+void expect(bool condition, const char* expression, const char* file, int line)
+{
+	if (condition) return;
+	++g_failures_count;
+	printf("%s(%d): %s failed\n", file, line, expression);
+}
+
+
+IAllocator& getAllocator() { return g_allocator; }
+
+
+void runOnWorker(u8 workers_count, void (*function)(void*), void* data)
+{
+	if (!jobs::init(workers_count, getAllocator())) {
+		printf("Failed to initialize job system.\n");
+		++g_failures_count;
+		return;
+	}
+
+	struct Context {
+		void (*function)(void*);
+		void* data;
+		Semaphore semaphore{0, 1};
+	} ctx = { function, data };
+
+	jobs::runEx(&ctx, [](void* ptr) {
+		Context* ctx = (Context*)ptr;
+		ctx->function(ctx->data);
+		ctx->semaphore.signal();
+	}, nullptr, jobs::INVALID_HANDLE, 0);
+	ctx.semaphore.wait();
+
+	jobs::shutdown();
+}
+
+
+void reportBenchmark(const char* name, u32 threads_count, double value, const char* unit)
+{
+	printf("%s %d threads: %.2f %s\n", name, threads_count, value, unit);
+}
+
+
+static void runTests(bool benchmarks)
+{
+	u32 tests_count = 0;
+	u32 failed_tests_count = 0;
+	for (TestRegistration* test = g_first_test; test; test = test->next) {
+		if (test->is_benchmark != benchmarks) continue;
+		const u32 failures_count = g_failures_count;
+		test->function();
+		++tests_count;
+		if (failures_count != g_failures_count) {
+			++failed_tests_count;
+			printf("%s failed\n", test->name);
+		}
+	}
+	printf("%d %s, %d failed\n", tests_count, benchmarks ? "benchmarks" : "tests", failed_tests_count);
+}
+
+
+} // namespace Lumix::unit_tests
+
+
+using namespace Lumix;
+
+
+int main(int argc, char* argv[])
+{
+	if (argc > 1 && equalStrings(argv[1], "-benchmarks")) {
+		unit_tests::runTests(true);
+	}
+	else {
+		unit_tests::runOnWorker(os::getCPUsCount(), [](void*) { unit_tests::runTests(false); }, nullptr);
+	}
+	return unit_tests::g_failures_count == 0 ? 0 : 1;
+}
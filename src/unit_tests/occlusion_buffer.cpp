@@ -0,0 +1,148 @@
+#include "engine/geometry.h"
+#include "engine/math.h"
+#include "renderer/occlusion_buffer.h"
+#include "unit_tests/unit_tests.h"
+
+
+using namespace Lumix;
+
+
+// camera is at the origin, looking down -Z, like Viewport with identity rotation
+static void setCamera(OcclusionBuffer& buffer)
+{
+	Matrix projection;
+	projection.setPerspective(degreesToRadians(60.f), float(OcclusionBuffer::WIDTH) / OcclusionBuffer::HEIGHT, 0.1f, 1000.f, true);
+	buffer.setCamera(DVec3(0), Matrix::IDENTITY, projection);
+}
+
+
+static bool isOccluded(const OcclusionBuffer& buffer, const Vec3& min, const Vec3& max)
+{
+	return buffer.isOccluded(Transform(DVec3(0), Quat::IDENTITY, 1), AABB(min, max));
+}
+
+
+static void rasterizeQuad(OcclusionBuffer& buffer, const Vec3 (&vertices)[4])
+{
+	static const u16 indices[] = { 0, 1, 2, 0, 2, 3 };
+	OcclusionBuffer::Occluder occluder;
+	occluder.transform = Transform(DVec3(0), Quat::IDENTITY, 1);
+	occluder.vertices = vertices;
+	occluder.vertices_count = lengthOf(vertices);
+	occluder.indices = indices;
+	occluder.indices_count = lengthOf(indices);
+	occluder.indices_16bit = true;
+
+	buffer.clear();
+	setCamera(buffer);
+	buffer.addOccluder(occluder);
+	buffer.rasterize();
+}
+
+
+static Vec3 getCorner(const Vec3& min, const Vec3& max, u32 i)
+{
+	return Vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+}
+
+
+// 10x10 quad facing the camera, 10 units in front of it
+static const Vec3 WALL[] = {
+	{-5, -5, -10},
+	{ 5, -5, -10},
+	{ 5,  5, -10},
+	{-5,  5, -10}
+};
+
+
+LUMIX_TEST(occlusionBufferWall)
+{
+	OcclusionBuffer buffer(unit_tests::getAllocator());
+	rasterizeQuad(buffer, WALL);
+
+	LUMIX_EXPECT(isOccluded(buffer, {-1, -1, -22}, {1, 1, -20}));
+	// in front of the wall
+	LUMIX_EXPECT(!isOccluded(buffer, {-1, -1, -6}, {1, 1, -4}));
+	// intersects the wall
+	LUMIX_EXPECT(!isOccluded(buffer, {-1, -1, -11}, {1, 1, -9}));
+	// beside the wall
+	LUMIX_EXPECT(!isOccluded(buffer, {14, -1, -22}, {16, 1, -20}));
+	LUMIX_EXPECT(!isOccluded(buffer, {-1, 14, -22}, {1, 16, -20}));
+	// partially behind the wall
+	LUMIX_EXPECT(!isOccluded(buffer, {8, -1, -22}, {12, 1, -20}));
+	// crosses near plane
+	LUMIX_EXPECT(!isOccluded(buffer, {-1, -1, -20}, {1, 1, 1}));
+	// behind the camera
+	LUMIX_EXPECT(!isOccluded(buffer, {-1, -1, 5}, {1, 1, 6}));
+}
+
+
+LUMIX_TEST(occlusionBufferWallConservative)
+{
+	OcclusionBuffer buffer(unit_tests::getAllocator());
+	rasterizeQuad(buffer, WALL);
+
+	// box is hidden only if it's behind the wall and all its corners project inside the wall
+	u32 occluded_count = 0;
+	for (float z = -4; z > -40; z -= 1.7f) {
+		for (float y = -12; y < 12; y += 0.9f) {
+			for (float x = -20; x < 20; x += 0.37f) {
+				const Vec3 min(x, y, z - 1);
+				const Vec3 max(x + 1, y + 1, z);
+				bool hidden = max.z < -10;
+				for (u32 i = 0; i < 8; ++i) {
+					const Vec3 c = getCorner(min, max, i);
+					hidden = hidden && fabsf(c.x / c.z) < 0.5f && fabsf(c.y / c.z) < 0.5f;
+				}
+				const bool occluded = isOccluded(buffer, min, max);
+				LUMIX_EXPECT(hidden || !occluded);
+				if (occluded) ++occluded_count;
+			}
+		}
+	}
+	// not conservative to the point of being useless
+	LUMIX_EXPECT(occluded_count > 0);
+}
+
+
+// floor below the camera, its near part is behind the camera, so it's clipped by the near plane and guard band
+static const Vec3 FLOOR[] = {
+	{-100, -2,   10},
+	{ 100, -2,   10},
+	{ 100, -2, -100},
+	{-100, -2, -100}
+};
+
+
+LUMIX_TEST(occlusionBufferClippedFloor)
+{
+	OcclusionBuffer buffer(unit_tests::getAllocator());
+	rasterizeQuad(buffer, FLOOR);
+
+	LUMIX_EXPECT(isOccluded(buffer, {-1, -6, -12}, {1, -4, -10}));
+	// above the floor
+	LUMIX_EXPECT(!isOccluded(buffer, {-1, -1.5f, -12}, {1, -0.5f, -10}));
+	// intersects the floor
+	LUMIX_EXPECT(!isOccluded(buffer, {-1, -3, -12}, {1, -1, -10}));
+
+	// box is hidden only if it's below the floor and rays from the camera to all its corners hit the floor
+	u32 occluded_count = 0;
+	for (float z = -3; z > -60; z -= 2.3f) {
+		for (float y = -4; y < -0.5f; y += 0.3f) {
+			for (float x = -30; x < 30; x += 1.1f) {
+				const Vec3 min(x, y - 1, z - 1);
+				const Vec3 max(x + 1, y, z);
+				bool hidden = max.y < -2;
+				for (u32 i = 0; i < 8; ++i) {
+					const Vec3 c = getCorner(min, max, i);
+					const Vec3 hit = c * (-2 / c.y);
+					hidden = hidden && fabsf(hit.x) < 100 && hit.z > -100 && hit.z < 10;
+				}
+				const bool occluded = isOccluded(buffer, min, max);
+				LUMIX_EXPECT(hidden || !occluded);
+				if (occluded) ++occluded_count;
+			}
+		}
+	}
+	LUMIX_EXPECT(occluded_count > 0);
+}
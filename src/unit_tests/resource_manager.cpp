@@ -0,0 +1,201 @@
+#include "engine/allocator.h"
+#include "engine/array.h"
+#include "engine/atomic.h"
+#include "engine/file_system.h"
+#include "engine/job_system.h"
+#include "engine/os.h"
+#include "engine/path.h"
+#include "engine/resource.h"
+#include "engine/resource_manager.h"
+#include "engine/stream.h"
+#include "engine/string.h"
+#include "unit_tests/unit_tests.h"
+#include <stdio.h>
+
+
+using namespace Lumix;
+
+
+namespace {
+
+
+// content is a list of dependencies followed by payload, dependencies are loaded only after the content is parsed,
+// like a model's materials or a material's textures
+struct TestResource final : Resource {
+	static const ResourceType TYPE;
+
+	TestResource(const Path& path, ResourceManager& manager, IAllocator& allocator)
+		: Resource(path, manager, allocator)
+		, m_dependencies(allocator)
+	{}
+
+	ResourceType getType() const override { return TYPE; }
+
+	bool load(u64 size, const u8* mem) override {
+		InputMemoryStream blob(mem, size);
+		const u32 count = blob.read<u32>();
+		for (u32 i = 0; i < count; ++i) {
+			const char* path = blob.readString();
+			TestResource* dependency = m_resource_manager.getOwner().load<TestResource>(Path(path));
+			addDependency(*dependency);
+			m_dependencies.push(dependency);
+		}
+		return true;
+	}
+
+	void unload() override {
+		for (TestResource* dependency : m_dependencies) {
+			removeDependency(*dependency);
+			dependency->decRefCount();
+		}
+		m_dependencies.clear();
+	}
+
+	Array<TestResource*> m_dependencies;
+};
+
+
+const ResourceType TestResource::TYPE("unit_test_resource");
+
+
+struct TestResourceManager final : ResourceManager {
+	explicit TestResourceManager(IAllocator& allocator) : ResourceManager(allocator) {}
+
+	Resource* createResource(const Path& path) override { return LUMIX_NEW(m_allocator, TestResource)(path, *this, m_allocator); }
+	void destroyResource(Resource& resource) override { LUMIX_DELETE(m_allocator, &resource); }
+};
+
+
+} // anonymous namespace
+
+
+static constexpr u32 MODELS_COUNT = 64;
+static constexpr u32 MATERIALS_COUNT = 128;
+static constexpr u32 TEXTURES_COUNT = 384;
+static constexpr u32 SHADERS_COUNT = 8;
+static const char* BASE_PATH = "unit_tests_data/";
+
+
+static void writeResource(FileSystem& fs, const Path& path, Span<const Path> dependencies, u32 payload_size)
+{
+	OutputMemoryStream blob(unit_tests::getAllocator());
+	CompiledResourceHeader header;
+	blob.write(header);
+	blob.write(dependencies.length());
+	for (const Path& dependency : dependencies) blob.writeString(dependency.c_str());
+	blob.resize(blob.size() + payload_size);
+	((CompiledResourceHeader*)blob.getMutableData())->decompressed_size = blob.size() - sizeof(header);
+
+	const StaticString<LUMIX_MAX_PATH> res_path(".lumix/assets/", path.getHash(), ".res");
+	os::OutputFile file;
+	LUMIX_EXPECT(fs.open(res_path, file));
+	LUMIX_EXPECT(file.write(blob.data(), blob.size()));
+	file.close();
+}
+
+
+static Path getModelPath(u32 i) { return Path(StaticString<64>("models/", i, ".test")); }
+static Path getMaterialPath(u32 i) { return Path(StaticString<64>("materials/", i, ".test")); }
+static Path getTexturePath(u32 i) { return Path(StaticString<64>("textures/", i, ".test")); }
+static Path getShaderPath(u32 i) { return Path(StaticString<64>("shaders/", i, ".test")); }
+
+
+// models -> materials -> textures and shaders, three levels of dependencies
+static void writeResources(FileSystem& fs, u32 texture_size)
+{
+	LUMIX_EXPECT(os::makePath(StaticString<LUMIX_MAX_PATH>(BASE_PATH, ".lumix/assets")));
+	for (u32 i = 0; i < MODELS_COUNT; ++i) {
+		const Path materials[] = { getMaterialPath(i * 2), getMaterialPath(i * 2 + 1), getMaterialPath((i * 7) % MATERIALS_COUNT) };
+		writeResource(fs, getModelPath(i), Span(materials), 64 * 1024);
+	}
+	for (u32 i = 0; i < MATERIALS_COUNT; ++i) {
+		const Path dependencies[] = { getTexturePath(i * 3), getTexturePath(i * 3 + 1), getTexturePath(i * 3 + 2), getShaderPath(i % SHADERS_COUNT) };
+		writeResource(fs, getMaterialPath(i), Span(dependencies), 256);
+	}
+	for (u32 i = 0; i < TEXTURES_COUNT; ++i) writeResource(fs, getTexturePath(i), Span<const Path>(), texture_size);
+	for (u32 i = 0; i < SHADERS_COUNT; ++i) writeResource(fs, getShaderPath(i), Span<const Path>(), 16 * 1024);
+}
+
+
+struct LoadStats {
+	float init_ms;
+	float load_ms;
+	u32 frames;
+};
+
+
+// loads all models like a universe does and updates until they are ready, once per `frame_ms` like the engine does
+static LoadStats loadModels(FileSystem& fs, bool record_dependencies, u32 frame_ms)
+{
+	IAllocator& allocator = unit_tests::getAllocator();
+	LoadStats stats = {};
+	ResourceManagerHub hub(allocator);
+	TestResourceManager manager(allocator);
+	os::Timer init_timer;
+	hub.init(fs);
+	stats.init_ms = init_timer.getTimeSinceStart() * 1000;
+	manager.create(TestResource::TYPE, hub);
+	hub.enableDependencyRecording(record_dependencies);
+
+	os::Timer timer;
+	TestResource* models[MODELS_COUNT];
+	for (u32 i = 0; i < MODELS_COUNT; ++i) models[i] = hub.load<TestResource>(getModelPath(i));
+
+	for (;;) {
+		fs.processCallbacks();
+		hub.update();
+		++stats.frames;
+		bool all_loaded = true;
+		for (TestResource* model : models) all_loaded = all_loaded && !model->isEmpty();
+		if (all_loaded) break;
+		os::sleep(frame_ms);
+	}
+	stats.load_ms = timer.getTimeSinceStart() * 1000;
+
+	for (TestResource* model : models) LUMIX_EXPECT(model->isReady());
+	if (record_dependencies) LUMIX_EXPECT(hub.saveDependencyManifest());
+
+	for (TestResource* model : models) model->decRefCount();
+	hub.cancelPrefetch();
+	hub.removeUnreferenced();
+	manager.destroy();
+	return stats;
+}
+
+
+LUMIX_BENCHMARK(resourceManagerColdLoad)
+{
+	IAllocator& allocator = unit_tests::getAllocator();
+	jobs::init(os::getCPUsCount(), allocator);
+	{
+		UniquePtr<FileSystem> fs = FileSystem::create(BASE_PATH, allocator);
+		// big textures make loading bound by reading, small ones by following dependencies
+		const u32 texture_sizes[] = { 256 * 1024, 4 * 1024 };
+		for (u32 texture_size : texture_sizes) {
+			writeResources(*fs, texture_size);
+			loadModels(*fs, true, 1);
+			OutputMemoryStream manifest(allocator);
+			LUMIX_EXPECT(fs->getContentSync(Path(".lumix/assets/_deps.bin"), manifest));
+			printf("resourceManagerColdLoad %d kB textures, manifest size: %d bytes\n", texture_size / 1024, (u32)manifest.size());
+
+			// files are in OS cache, so this does not include disk latency
+			const u32 frame_times[] = { 16, 1 };
+			for (u32 frame_ms : frame_times) {
+				for (u32 i = 0; i < 2; ++i) {
+					const bool use_manifest = i == 1;
+					if (!use_manifest) fs->moveFile(".lumix/assets/_deps.bin", ".lumix/assets/_deps.bin.bak");
+					const LoadStats stats = loadModels(*fs, false, frame_ms);
+					if (!use_manifest) fs->moveFile(".lumix/assets/_deps.bin.bak", ".lumix/assets/_deps.bin");
+					printf("resourceManagerColdLoad %d kB textures, %s manifest, %d ms frames: init %.2f ms, %d frames, %.2f ms\n"
+						, texture_size / 1024
+						, use_manifest ? "with" : "without"
+						, frame_ms
+						, stats.init_ms
+						, stats.frames
+						, stats.load_ms);
+				}
+			}
+		}
+	}
+	jobs::shutdown();
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "engine/lumix.h"
+
+namespace Lumix {
+
+struct IAllocator;
+
+namespace unit_tests {
+
+using TestFunction = void (*)();
+
+// tests register themselves in static constructors, use LUMIX_TEST or LUMIX_BENCHMARK
+struct TestRegistration {
+	TestRegistration(const char* name, TestFunction function, bool is_benchmark);
+
+	const char* name;
+	TestFunction function;
+	bool is_benchmark;
+	TestRegistration* next;
+};
+
+// reports failure and continues, so one run shows all failed expectations
+void expect(bool condition, const char* expression, const char* file, int line);
+IAllocator& getAllocator();
+// initializes job system with `workers_count` workers, runs `function` on worker 0 and shuts the job system down
+void runOnWorker(u8 workers_count, void (*function)(void*), void* data);
+// prints a result line, e.g. "jobSystem 4 workers: 1.23 Mjobs/s"
+void reportBenchmark(const char* name, u32 threads_count, double value, const char* unit);
+
+} // namespace unit_tests
+
+} // namespace Lumix
+
+// tests run on a job system worker, one at a time
+#define LUMIX_TEST(name) \
+	static void name(); \
+	static Lumix::unit_tests::TestRegistration name##_registration(#name, &name, false); \
+	static void name()
+
+// benchmarks run only with `-benchmarks`, on the main thread, without job system, so they can init it with any number of workers
+#define LUMIX_BENCHMARK(name) \
+	static void name(); \
+	static Lumix::unit_tests::TestRegistration name##_registration(#name, &name, true); \
+	static void name()
+
+#define LUMIX_EXPECT(condition) Lumix::unit_tests::expect((condition), #condition, __FILE__, __LINE__)